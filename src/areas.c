@@ -0,0 +1,967 @@
+/**
+ * \file areas.c
+ * \brief Areas of the multipolygon and boundary relations
+ *
+ * The rings of an area are assembled from the member ways with the
+ * locations of their nodes: ways with a common end node are joined until
+ * the ring is closed. Rings that cannot be closed and rings without area
+ * are dropped, the area is then marked as incomplete. The roles inner and
+ * outer are not used, the nesting of the rings decides: a ring inside an
+ * odd number of rings is an inner ring of the smallest ring around it.
+ * Outer rings are counterclockwise, inner rings clockwise.
+ *
+ * The relations are assembled by worker threads, each with its own
+ * read-only connection to the database. The areas are collected in a
+ * temporary database and then copied into the table areas and the R*Tree
+ * index rtree_area.
+ *
+ * Geometry blob, all numbers are varints (as in Protocol Buffers):
+ *
+ *   number of polygons
+ *   for each polygon: number of rings (outer ring, then the inner rings)
+ *     for each ring: number of points n (the first point is not repeated)
+ *       n times lon and lat in 1e-7 degrees, zigzag encoded difference
+ *       to the previous point of the blob
+ */
+
+#define AREAS_BLOCK_SIZE  16   /* Number of relations a worker takes at once */
+
+typedef struct {
+  int64_t node_id;     /* End node */
+  int way;             /* Index of the way */
+  int last;            /* 0: first node, 1: last node of the way */
+} AreaEnd;
+
+typedef struct {
+  size_t start, size;  /* Points w->ring_points.node[start] .. [start+size-1] */
+  double area;         /* Signed area in square degrees, > 0: counterclockwise */
+  bbox b;
+  int depth;           /* Number of rings around this ring */
+  int parent;          /* Inner ring: index of the outer ring */
+} AreaRing;
+
+typedef struct {
+  double size;         /* Absolute area */
+  int ring;
+} AreaOrder;
+
+typedef struct {
+  sqlite3 *db;
+  sqlite3_stmt *stmt_members;
+  sqlite3_stmt *stmt_nodes;
+  NodeList points;         /* Points of the member ways */
+  size_t *way_start;       /* Way i: points.node[way_start[i]] .. [way_start[i+1]-1] */
+  int num_ways, cap_ways;
+  AreaEnd *end;            /* Both ends of all ways, sorted by node_id */
+  unsigned char *used;     /* 1 if the way is part of a ring */
+  NodeList ring_points;    /* Points of the rings */
+  AreaRing *ring;
+  AreaOrder *order;        /* Rings sorted by size, largest first */
+  int num_rings, cap_rings;
+  ProtoBuf blob;
+} AreaWorker;
+
+static struct {
+  const char *filename;
+  int64_t *relation_id;        /* Relations with type multipolygon or boundary */
+  int num_relations;
+  int next_relation;
+  int num_areas, num_incomplete, num_failed;
+  sqlite3 *out;                /* Temporary database with the areas */
+  sqlite3_stmt *stmt_insert;
+  pthread_mutex_t lock;
+  pthread_mutex_t write_lock;
+} areas;
+
+static int area_end_cmp(const void *a, const void *b) {
+  const AreaEnd *ea = a, *eb = b;
+  if( ea->node_id!=eb->node_id ) return ea->node_id<eb->node_id ? -1 : 1;
+  return ea->way - eb->way;
+}
+
+/*
+** Signed area and boundingbox of a ring (coordinates relative
+** to the first point, so the products stay small)
+*/
+static void area_ring_measure(const AreaWorker *w, AreaRing *r) {
+  const Node *p = w->ring_points.node + r->start;
+  double sum = 0;
+  size_t i, j;
+  r->b.min_lon = r->b.max_lon = p[0].lon;
+  r->b.min_lat = r->b.max_lat = p[0].lat;
+  for(i=0; i<r->size; i++){
+    j = i+1<r->size ? i+1 : 0;
+    sum += (p[i].lon - p[0].lon) * (p[j].lat - p[0].lat) - (p[j].lon - p[0].lon) * (p[i].lat - p[0].lat);
+    if( p[i].lon<r->b.min_lon ) r->b.min_lon = p[i].lon;
+    if( p[i].lon>r->b.max_lon ) r->b.max_lon = p[i].lon;
+    if( p[i].lat<r->b.min_lat ) r->b.min_lat = p[i].lat;
+    if( p[i].lat>r->b.max_lat ) r->b.max_lat = p[i].lat;
+  }
+  r->area = sum / 2;
+}
+
+/*
+** 1 if the point is inside the ring (crossing number)
+*/
+static int area_ring_contains(const AreaWorker *w, const AreaRing *r, const double lon, const double lat) {
+  const Node *p = w->ring_points.node + r->start;
+  size_t i, j;
+  int inside = 0;
+  if( lon<r->b.min_lon || lon>r->b.max_lon || lat<r->b.min_lat || lat>r->b.max_lat ) return 0;
+  for(i=0, j=r->size-1; i<r->size; j=i++){
+    if( (p[i].lat>lat)!=(p[j].lat>lat) &&
+        lon<(p[j].lon - p[i].lon) * (lat - p[i].lat) / (p[j].lat - p[i].lat) + p[i].lon ) inside = !inside;
+  }
+  return inside;
+}
+
+/*
+** 1 if ring a lies inside ring b: a point of a that is not a point of b
+** (rings may touch) is inside b
+*/
+static int area_ring_inside(const AreaWorker *w, const AreaRing *a, const AreaRing *b) {
+  const Node *p = w->ring_points.node;
+  size_t i, j;
+  if( a->b.min_lon<b->b.min_lon || a->b.max_lon>b->b.max_lon ||
+      a->b.min_lat<b->b.min_lat || a->b.max_lat>b->b.max_lat ) return 0;
+  for(i=a->start; i<a->start+a->size; i++){
+    for(j=b->start; j<b->start+b->size && p[j].node_id!=p[i].node_id; j++);
+    if( j==b->start+b->size ) return area_ring_contains(w, b, p[i].lon, p[i].lat);
+  }
+  return 0;
+}
+
+/*
+** Loads the member ways of the relation with the locations of the
+** nodes, returns 0 if a way or a node is missing
+*/
+static int area_load_ways(AreaWorker *w, const int64_t relation_id) {
+  int complete = 1, result, missing;
+  size_t start;
+  nodelist_clear(&w->points);
+  w->num_ways = 0;
+  sqlite3_bind_int64(w->stmt_members, 1, relation_id);
+  while( (result = sqlite3_step(w->stmt_members))==SQLITE_ROW ){
+    start = w->points.size;
+    missing = 0;
+    sqlite3_bind_int64(w->stmt_nodes, 1, sqlite3_column_int64(w->stmt_members, 0));
+    while( (result = sqlite3_step(w->stmt_nodes))==SQLITE_ROW ){
+      if( sqlite3_column_type(w->stmt_nodes, 1)==SQLITE_NULL ) missing = 1;
+      nodelist_add(&w->points, sqlite3_column_double(w->stmt_nodes, 1), sqlite3_column_double(w->stmt_nodes, 2),
+                   sqlite3_column_int64(w->stmt_nodes, 0));
+    }
+    if( result!=SQLITE_DONE ) abort_db_error(w->db, result);
+    sqlite3_reset(w->stmt_nodes);
+    if( missing || w->points.size - start<2 ){
+      w->points.size = start;
+      complete = 0;
+      continue;
+    }
+    if( w->num_ways + 2>w->cap_ways ){
+      w->cap_ways = 2 * w->cap_ways + 64;
+      w->way_start = realloc(w->way_start, w->cap_ways * sizeof(size_t));
+      w->end = realloc(w->end, 2 * w->cap_ways * sizeof(AreaEnd));
+      w->used = realloc(w->used, w->cap_ways);
+      if( !w->way_start || !w->end || !w->used ) abort_msg("Out of memory");
+    }
+    w->way_start[w->num_ways++] = start;
+  }
+  if( result!=SQLITE_DONE ) abort_db_error(w->db, result);
+  sqlite3_reset(w->stmt_members);
+  w->way_start[w->num_ways] = w->points.size;
+  return complete;
+}
+
+/*
+** Appends the points of way i to the ring, without the first point
+** of the way if skip_first (the last point of the ring)
+*/
+static void area_append_way(AreaWorker *w, const int i, const int reverse, const int skip_first) {
+  size_t k, n = w->way_start[i+1] - w->way_start[i];
+  const Node *p = w->points.node + w->way_start[i];
+  for(k=skip_first; k<n; k++){
+    const Node *q = reverse ? &p[n-1-k] : &p[k];
+    nodelist_add(&w->ring_points, q->lon, q->lat, q->node_id);
+  }
+}
+
+/*
+** Joins the ways to closed rings, returns 0 if a ring is not closed
+** or has no area
+*/
+static int area_build_rings(AreaWorker *w) {
+  int complete = 1, i, lo, hi, mid;
+  size_t start;
+  AreaEnd *e;
+  AreaRing *r;
+  for(i=0; i<w->num_ways; i++){
+    w->end[2*i] = (AreaEnd){ w->points.node[w->way_start[i]].node_id, i, 0 };
+    w->end[2*i+1] = (AreaEnd){ w->points.node[w->way_start[i+1]-1].node_id, i, 1 };
+    w->used[i] = 0;
+  }
+  qsort(w->end, 2 * w->num_ways, sizeof(AreaEnd), area_end_cmp);
+  nodelist_clear(&w->ring_points);
+  w->num_rings = 0;
+  for(i=0; i<w->num_ways; i++){
+    if( w->used[i] ) continue;
+    start = w->ring_points.size;
+    w->used[i] = 1;
+    area_append_way(w, i, 0, 0);
+    while( w->ring_points.node[w->ring_points.size-1].node_id!=w->ring_points.node[start].node_id ){
+      /* Unused way with an end at the last point of the ring */
+      lo = 0;
+      hi = 2 * w->num_ways;
+      while( lo<hi ){
+        mid = (lo + hi) / 2;
+        if( w->end[mid].node_id<w->ring_points.node[w->ring_points.size-1].node_id ) lo = mid + 1;
+        else hi = mid;
+      }
+      for(e=w->end+lo; e<w->end+2*w->num_ways && e->node_id==w->ring_points.node[w->ring_points.size-1].node_id; e++){
+        if( !w->used[e->way] ) break;
+      }
+      if( e==w->end+2*w->num_ways || e->node_id!=w->ring_points.node[w->ring_points.size-1].node_id ) break;
+      w->used[e->way] = 1;
+      area_append_way(w, e->way, e->last, 1);
+    }
+    if( w->ring_points.node[w->ring_points.size-1].node_id!=w->ring_points.node[start].node_id ||
+        w->ring_points.size - start<4 ){
+      w->ring_points.size = start;    /* Not closed */
+      complete = 0;
+      continue;
+    }
+    if( w->num_rings==w->cap_rings ){
+      w->cap_rings = 2 * w->cap_rings + 16;
+      w->ring = realloc(w->ring, w->cap_rings * sizeof(AreaRing));
+      w->order = realloc(w->order, w->cap_rings * sizeof(AreaOrder));
+      if( !w->ring || !w->order ) abort_msg("Out of memory");
+    }
+    r = &w->ring[w->num_rings];
+    r->start = start;
+    r->size = --w->ring_points.size - start;    /* The first point is not repeated */
+    area_ring_measure(w, r);
+    if( r->area==0 ){
+      w->ring_points.size = start;
+      complete = 0;
+      continue;
+    }
+    w->order[w->num_rings] = (AreaOrder){ fabs(r->area), w->num_rings };
+    w->num_rings++;
+  }
+  return complete;
+}
+
+static int area_order_cmp(const void *a, const void *b) {
+  const AreaOrder *oa = a, *ob = b;
+  if( oa->size!=ob->size ) return oa->size>ob->size ? -1 : 1;
+  return oa->ring - ob->ring;
+}
+
+/*
+** Nesting of the rings: the parent of a ring is the smallest
+** larger ring around it
+*/
+static void area_nest_rings(AreaWorker *w) {
+  int i, j;
+  AreaRing *r;
+  qsort(w->order, w->num_rings, sizeof(AreaOrder), area_order_cmp);
+  for(i=0; i<w->num_rings; i++){
+    r = &w->ring[w->order[i].ring];
+    r->depth = 0;
+    r->parent = -1;
+    for(j=i-1; j>=0; j--){
+      if( area_ring_inside(w, r, &w->ring[w->order[j].ring]) ){
+        r->depth = w->ring[w->order[j].ring].depth + 1;
+        r->parent = r->depth % 2 ? w->order[j].ring : -1;
+        break;
+      }
+    }
+  }
+}
+
+static void area_write_ring(AreaWorker *w, const AreaRing *r, int64_t *last_lon, int64_t *last_lat) {
+  const Node *p = w->ring_points.node + r->start;
+  int64_t lon, lat;
+  size_t i, k;
+  /* Outer rings counterclockwise, inner rings clockwise */
+  int reverse = (r->depth % 2==0)!=(r->area>0);
+  protobuf_varint(&w->blob, r->size);
+  for(i=0; i<r->size; i++){
+    k = reverse ? r->size - 1 - i : i;
+    lon = llround(p[k].lon * 1e7);
+    lat = llround(p[k].lat * 1e7);
+    protobuf_varint(&w->blob, protobuf_zigzag(lon - *last_lon));
+    protobuf_varint(&w->blob, protobuf_zigzag(lat - *last_lat));
+    *last_lon = lon;
+    *last_lat = lat;
+  }
+}
+
+/*
+** Encodes the polygons (outer rings with their inner rings)
+*/
+static void area_encode(AreaWorker *w, bbox *b) {
+  int i, j, num_polygons = 0, num_inner;
+  int64_t last_lon = 0, last_lat = 0;
+  protobuf_clear(&w->blob);
+  for(i=0; i<w->num_rings; i++) if( w->ring[i].depth % 2==0 ) num_polygons++;
+  protobuf_varint(&w->blob, num_polygons);
+  *b = w->ring[w->order[0].ring].b;
+  for(i=0; i<w->num_rings; i++){
+    if( w->ring[i].depth % 2 ) continue;
+    if( w->ring[i].b.min_lon<b->min_lon ) b->min_lon = w->ring[i].b.min_lon;
+    if( w->ring[i].b.max_lon>b->max_lon ) b->max_lon = w->ring[i].b.max_lon;
+    if( w->ring[i].b.min_lat<b->min_lat ) b->min_lat = w->ring[i].b.min_lat;
+    if( w->ring[i].b.max_lat>b->max_lat ) b->max_lat = w->ring[i].b.max_lat;
+    for(num_inner=0, j=0; j<w->num_rings; j++) if( w->ring[j].parent==i ) num_inner++;
+    protobuf_varint(&w->blob, 1 + num_inner);
+    area_write_ring(w, &w->ring[i], &last_lon, &last_lat);
+    for(j=0; j<w->num_rings; j++){
+      if( w->ring[j].parent==i ) area_write_ring(w, &w->ring[j], &last_lon, &last_lat);
+    }
+  }
+}
+
+static void area_make(AreaWorker *w, const int64_t relation_id) {
+  int complete, result;
+  bbox b;
+  complete = area_load_ways(w, relation_id);
+  complete = area_build_rings(w) && complete;
+  if( w->num_rings==0 ){
+    pthread_mutex_lock(&areas.write_lock);
+    areas.num_failed++;
+    pthread_mutex_unlock(&areas.write_lock);
+    return;
+  }
+  area_nest_rings(w);
+  area_encode(w, &b);
+  pthread_mutex_lock(&areas.write_lock);
+  sqlite3_bind_int64(areas.stmt_insert, 1, relation_id);
+  sqlite3_bind_int(areas.stmt_insert, 2, complete);
+  sqlite3_bind_blob(areas.stmt_insert, 3, w->blob.data, w->blob.size, SQLITE_STATIC);
+  sqlite3_bind_double(areas.stmt_insert, 4, b.min_lon);
+  sqlite3_bind_double(areas.stmt_insert, 5, b.min_lat);
+  sqlite3_bind_double(areas.stmt_insert, 6, b.max_lon);
+  sqlite3_bind_double(areas.stmt_insert, 7, b.max_lat);
+  result = sqlite3_step(areas.stmt_insert);
+  if( result!=SQLITE_DONE ) abort_db_error(areas.out, result);
+  sqlite3_reset(areas.stmt_insert);
+  areas.num_areas++;
+  if( !complete ) areas.num_incomplete++;
+  pthread_mutex_unlock(&areas.write_lock);
+}
+
+static void *areas_worker(void *arg) {
+  AreaWorker w;
+  int first, last, i, result;
+  memset(&w, 0, sizeof(AreaWorker));
+  result = sqlite3_open_v2(areas.filename, &w.db, SQLITE_OPEN_READONLY, NULL);
+  if( result!=SQLITE_OK ) abort_db_error(w.db, result);
+  if( sqlite3_prepare_v2(w.db,
+        " SELECT ref_id FROM relation_members"
+        " WHERE relation_id=?1 AND ref='way'"
+        " ORDER BY member_order",
+        -1, &w.stmt_members, NULL)!=SQLITE_OK ||
+      sqlite3_prepare_v2(w.db,
+        " SELECT wn.node_id,n.lon,n.lat"
+        " FROM way_nodes AS wn"
+        " LEFT JOIN nodes AS n ON n.node_id=wn.node_id"
+        " WHERE wn.way_id=?1"
+        " ORDER BY wn.node_order",
+        -1, &w.stmt_nodes, NULL)!=SQLITE_OK ){
+    abort_db_error(w.db, sqlite3_errcode(w.db));
+  }
+  nodelist_init(&w.points);
+  nodelist_init(&w.ring_points);
+  protobuf_init(&w.blob);
+  w.cap_ways = 64;
+  w.way_start = malloc(w.cap_ways * sizeof(size_t));
+  w.end = malloc(2 * w.cap_ways * sizeof(AreaEnd));
+  w.used = malloc(w.cap_ways);
+  if( !w.way_start || !w.end || !w.used ) abort_msg("Out of memory");
+  while( 1 ){
+    /* Take the next block of relations */
+    pthread_mutex_lock(&areas.lock);
+    first = areas.next_relation;
+    areas.next_relation += AREAS_BLOCK_SIZE;
+    pthread_mutex_unlock(&areas.lock);
+    if( first>=areas.num_relations ) break;
+    last = first + AREAS_BLOCK_SIZE<areas.num_relations ? first + AREAS_BLOCK_SIZE : areas.num_relations;
+    for(i=first; i<last; i++) area_make(&w, areas.relation_id[i]);
+  }
+  nodelist_free(&w.points);
+  nodelist_free(&w.ring_points);
+  free(w.way_start);
+  free(w.end);
+  free(w.used);
+  free(w.ring);
+  free(w.order);
+  protobuf_free(&w.blob);
+  sqlite3_finalize(w.stmt_members);
+  sqlite3_finalize(w.stmt_nodes);
+  sqlite3_close(w.db);
+  return NULL;
+}
+
+/*
+** Creates the table areas and the R*Tree index rtree_area
+** of the relations with the tag type=multipolygon or type=boundary
+*/
+void add_areas(sqlite3 *db, int threads) {
+  sqlite3_stmt *stmt, *stmt_area, *stmt_rtree;
+  pthread_t *thread;
+  int cap = 1024, i;
+  double t0, t1;
+  t0 = time_now();
+  threads = db_worker_threads(threads);
+  areas.filename = sqlite3_db_filename(db, "main");
+  if( areas.filename==NULL || areas.filename[0]=='\0' ) abort_msg("Option areas: Database file required");
+  rc = sqlite3_prepare_v2(db,
+    " SELECT count(*) FROM sqlite_master"
+    " WHERE type='index' AND name IN ('way_nodes__way_id','relation_members__relation_id')",
+    -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  rc = sqlite3_step(stmt);
+  if( rc!=SQLITE_ROW ) abort_db_error(db, rc);
+  if( sqlite3_column_int(stmt, 0)!=2 ) abort_msg("Option areas: Indexes missing (option index)");
+  sqlite3_finalize(stmt);
+  /* Relations */
+  areas.relation_id = malloc(cap * sizeof(int64_t));
+  if( !areas.relation_id ) abort_msg("Out of memory");
+  areas.num_relations = 0;
+  rc = sqlite3_prepare_v2(db,
+    " SELECT DISTINCT relation_id FROM relation_tags"
+    " WHERE key='type' AND value IN ('multipolygon','boundary')"
+    " ORDER BY relation_id",
+    -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  while( (rc = sqlite3_step(stmt))==SQLITE_ROW ){
+    if( areas.num_relations==cap ){
+      cap *= 2;
+      areas.relation_id = realloc(areas.relation_id, cap * sizeof(int64_t));
+      if( !areas.relation_id ) abort_msg("Out of memory");
+    }
+    areas.relation_id[areas.num_relations++] = sqlite3_column_int64(stmt, 0);
+  }
+  if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+  sqlite3_finalize(stmt);
+  /* Temporary database for the results of the workers */
+  rc = sqlite3_open("", &areas.out);
+  if( rc!=SQLITE_OK ) abort_db_error(areas.out, rc);
+  rc = sqlite3_exec(areas.out,
+    " PRAGMA journal_mode = OFF;"
+    " CREATE TABLE areas (relation_id INTEGER PRIMARY KEY, complete INTEGER, geometry BLOB,"
+    "                     min_lon REAL, min_lat REAL, max_lon REAL, max_lat REAL);"
+    " BEGIN TRANSACTION;",
+    NULL, NULL, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(areas.out, rc);
+  rc = sqlite3_prepare_v2(areas.out,
+    "INSERT INTO areas VALUES (?1,?2,?3,?4,?5,?6,?7)", -1, &areas.stmt_insert, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(areas.out, rc);
+  areas.next_relation = 0;
+  areas.num_areas = areas.num_incomplete = areas.num_failed = 0;
+  pthread_mutex_init(&areas.lock, NULL);
+  pthread_mutex_init(&areas.write_lock, NULL);
+  /* Assembly in parallel */
+  thread = malloc(threads * sizeof(pthread_t));
+  if( !thread ) abort_msg("Out of memory");
+  for(i=0; i<threads; i++){
+    if( pthread_create(&thread[i], NULL, areas_worker, NULL)!=0 )
+      abort_msg("Option areas: Error creating thread");
+  }
+  for(i=0; i<threads; i++) pthread_join(thread[i], NULL);
+  sqlite3_finalize(areas.stmt_insert);
+  /* Copy into the database */
+  rc = sqlite3_exec(db,
+    " DROP TABLE IF EXISTS areas;"
+    " DROP TABLE IF EXISTS rtree_area;"
+    " CREATE TABLE areas (\n"
+    "  relation_id  INTEGER PRIMARY KEY,  -- relation ID\n"
+    "  complete     INTEGER,              -- 1 if all member ways are part of a ring\n"
+    "  geometry     BLOB                  -- polygons\n"
+    " );"
+    " CREATE VIRTUAL TABLE rtree_area USING rtree(relation_id, min_lat, max_lat, min_lon, max_lon);"
+    " BEGIN TRANSACTION;",
+    NULL, NULL, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  rc = sqlite3_prepare_v2(areas.out,
+    " SELECT relation_id,complete,geometry,min_lon,min_lat,max_lon,max_lat"
+    " FROM areas ORDER BY relation_id",
+    -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(areas.out, rc);
+  rc = sqlite3_prepare_v2(db, "INSERT INTO areas (relation_id,complete,geometry) VALUES (?1,?2,?3)",
+                          -1, &stmt_area, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  rc = sqlite3_prepare_v2(db,
+    "INSERT INTO rtree_area (relation_id,min_lat,max_lat,min_lon,max_lon) VALUES (?1,?3,?5,?2,?4)",
+    -1, &stmt_rtree, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  while( (rc = sqlite3_step(stmt))==SQLITE_ROW ){
+    sqlite3_bind_int64(stmt_area, 1, sqlite3_column_int64(stmt, 0));
+    sqlite3_bind_int(stmt_area, 2, sqlite3_column_int(stmt, 1));
+    sqlite3_bind_blob(stmt_area, 3, sqlite3_column_blob(stmt, 2), sqlite3_column_bytes(stmt, 2), SQLITE_STATIC);
+    rc = sqlite3_step(stmt_area);
+    if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+    sqlite3_reset(stmt_area);
+    sqlite3_bind_int64(stmt_rtree, 1, sqlite3_column_int64(stmt, 0));
+    for(i=2; i<=5; i++) sqlite3_bind_double(stmt_rtree, i, sqlite3_column_double(stmt, i+1));
+    rc = sqlite3_step(stmt_rtree);
+    if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+    sqlite3_reset(stmt_rtree);
+  }
+  if( rc!=SQLITE_DONE ) abort_db_error(areas.out, rc);
+  sqlite3_finalize(stmt);
+  sqlite3_finalize(stmt_area);
+  sqlite3_finalize(stmt_rtree);
+  rc = sqlite3_exec(db, "COMMIT TRANSACTION", NULL, NULL, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  rc = sqlite3_close(areas.out);
+  if( rc!=SQLITE_OK ) abort_db_error(areas.out, rc);
+  t1 = time_now();
+  fprintf(stderr, "areas: %d of %d relations (%d incomplete) in %.3f s with %d threads\n",
+          areas.num_areas, areas.num_relations, areas.num_incomplete, t1-t0, threads);
+  /* Cleanup */
+  free(areas.relation_id);
+  free(thread);
+  pthread_mutex_destroy(&areas.lock);
+  pthread_mutex_destroy(&areas.write_lock);
+}
+
+/*
+** Address tables with city and postcode from the areas
+**
+** Addresses without addr:city or addr:postcode get the name of the
+** smallest administrative area around them (admin_level 6 to 8, the
+** highest level wins) and the postal_code of the postal code area
+** around them. Only complete areas are used. Levels 4 and 5 are states
+** and regions in most countries, they are never used as city.
+**
+** The areas are held in memory: the points of all rings with 1e-7
+** degrees as int32, a grid over the boundingboxes (from rtree_area)
+** finds the candidates of an address. Areas with many edges get a band
+** index: the edges are sorted into horizontal bands, so the ring test
+** only looks at the edges in the band of the address.
+*/
+
+#define ADDR_GRID          256   /* Grid cells per direction */
+#define ADDR_BAND_EDGES    4     /* Average number of edges per band */
+#define ADDR_MIN_BAND      64    /* Areas with fewer edges: no band index */
+#define ADDR_BATCH_SIZE    4096  /* Number of addresses a worker takes at once */
+#define ADDR_MIN_LEVEL     6     /* admin_level of a city: district .. municipality */
+#define ADDR_MAX_LEVEL     8
+#define ADDR_CITY          0
+#define ADDR_POSTCODE      1
+
+typedef struct {
+  int kind;              /* ADDR_CITY or ADDR_POSTCODE */
+  int level;             /* admin_level */
+  char *value;           /* City or postcode */
+  int32_t min_lon, min_lat, max_lon, max_lat;
+  int32_t *lon, *lat;    /* Points of all rings, the first point repeated at the end */
+  int *ring_start;       /* Ring i: points ring_start[i] .. ring_start[i+1]-1 */
+  int num_points, num_rings;
+  int num_bands;         /* 0: no band index */
+  int32_t band_lat;      /* Lowest latitude of the points */
+  int64_t band_height;   /* Latitude range of the points + 1 */
+  int *band_start;       /* Band i: edges band_edge[band_start[i]] .. [band_start[i+1]-1] */
+  int *band_edge;        /* Edge: index of its first point */
+} AddrArea;
+
+static struct {
+  AddrArea *area;
+  int num_areas;
+  int32_t min_lon, min_lat, max_lon, max_lat;    /* Grid */
+  int *cell_start;       /* Cell i: areas cell_area[cell_start[i]] .. [cell_start[i+1]-1] */
+  int *cell_area;
+  int num_addr;          /* Addresses without city or postcode */
+  int64_t *addr_id;
+  int32_t *lon, *lat;
+  unsigned char *need;   /* Bit 0: city, bit 1: postcode */
+  int *found;            /* Index of the area: 2*i city, 2*i+1 postcode, -1: none */
+  int next_addr;
+  pthread_mutex_t lock;
+} addr_fill;
+
+static int addr_area_cmp(const void *a, const void *b) {
+  const AddrArea *aa = a, *ab = b;
+  if( aa->kind!=ab->kind ) return aa->kind - ab->kind;
+  return ab->level - aa->level;    /* Highest admin_level first */
+}
+
+static int addr_band(const AddrArea *a, const int32_t lat) {
+  int64_t band = (int64_t)(lat - a->band_lat) * a->num_bands / a->band_height;
+  return band<0 ? 0 : band>=a->num_bands ? a->num_bands - 1 : (int)band;
+}
+
+/*
+** Decodes the geometry blob into the rings of the area
+*/
+static void addr_area_decode(AddrArea *a, const unsigned char *blob, const int size) {
+  const unsigned char *p = blob, *end = blob + size;
+  uint64_t num_polygons, num_rings, num_points, i, j, k, v;
+  int64_t lon = 0, lat = 0;
+  int shift, cap_points = 0, cap_rings = 0;
+  a->lon = a->lat = NULL;
+  a->ring_start = NULL;
+  a->num_points = a->num_rings = 0;
+#define ADDR_VARINT(x) for(x=0, shift=0; p<end; shift+=7){ x |= (uint64_t)(*p & 0x7f) << shift; if( !(*p++ & 0x80) ) break; }
+  ADDR_VARINT(num_polygons)
+  for(i=0; i<num_polygons; i++){
+    ADDR_VARINT(num_rings)
+    for(j=0; j<num_rings; j++){
+      ADDR_VARINT(num_points)
+      if( a->num_rings + 2>cap_rings ){
+        cap_rings = 2 * cap_rings + 8;
+        a->ring_start = realloc(a->ring_start, cap_rings * sizeof(int));
+        if( !a->ring_start ) abort_msg("Out of memory");
+      }
+      if( a->num_points + (int)num_points + 1>cap_points ){
+        cap_points = 2 * cap_points + (int)num_points + 1;
+        a->lon = realloc(a->lon, cap_points * sizeof(int32_t));
+        a->lat = realloc(a->lat, cap_points * sizeof(int32_t));
+        if( !a->lon || !a->lat ) abort_msg("Out of memory");
+      }
+      a->ring_start[a->num_rings++] = a->num_points;
+      for(k=0; k<num_points; k++){
+        ADDR_VARINT(v)
+        lon += (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+        ADDR_VARINT(v)
+        lat += (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+        a->lon[a->num_points] = (int32_t)lon;
+        a->lat[a->num_points++] = (int32_t)lat;
+      }
+      a->lon[a->num_points] = a->lon[a->ring_start[a->num_rings-1]];
+      a->lat[a->num_points] = a->lat[a->ring_start[a->num_rings-1]];
+      a->num_points++;
+    }
+  }
+#undef ADDR_VARINT
+  if( a->num_rings>0 ) a->ring_start[a->num_rings] = a->num_points;
+}
+
+/*
+** Band index of an area with many edges
+*/
+static void addr_area_bands(AddrArea *a) {
+  int i, r, b, b0, b1, num_edges = a->num_points - a->num_rings;
+  int32_t max_lat;
+  a->num_bands = 0;
+  if( num_edges<ADDR_MIN_BAND ) return;
+  a->band_lat = max_lat = a->lat[0];
+  for(i=1; i<a->num_points; i++){
+    if( a->lat[i]<a->band_lat ) a->band_lat = a->lat[i];
+    if( a->lat[i]>max_lat ) max_lat = a->lat[i];
+  }
+  a->band_height = (int64_t)max_lat - a->band_lat + 1;
+  a->num_bands = num_edges / ADDR_BAND_EDGES;
+  a->band_start = calloc(a->num_bands + 1, sizeof(int));
+  if( !a->band_start ) abort_msg("Out of memory");
+  /* Count the edges of each band, then fill */
+  for(r=0; r<a->num_rings; r++){
+    for(i=a->ring_start[r]; i<a->ring_start[r+1]-1; i++){
+      b0 = addr_band(a, a->lat[i]<a->lat[i+1] ? a->lat[i] : a->lat[i+1]);
+      b1 = addr_band(a, a->lat[i]<a->lat[i+1] ? a->lat[i+1] : a->lat[i]);
+      for(b=b0; b<=b1; b++) a->band_start[b+1]++;
+    }
+  }
+  for(b=0; b<a->num_bands; b++) a->band_start[b+1] += a->band_start[b];
+  a->band_edge = malloc(a->band_start[a->num_bands] * sizeof(int));
+  if( !a->band_edge ) abort_msg("Out of memory");
+  for(r=0; r<a->num_rings; r++){
+    for(i=a->ring_start[r]; i<a->ring_start[r+1]-1; i++){
+      b0 = addr_band(a, a->lat[i]<a->lat[i+1] ? a->lat[i] : a->lat[i+1]);
+      b1 = addr_band(a, a->lat[i]<a->lat[i+1] ? a->lat[i+1] : a->lat[i]);
+      for(b=b0; b<=b1; b++) a->band_edge[a->band_start[b]++] = i;
+    }
+  }
+  for(b=a->num_bands; b>0; b--) a->band_start[b] = a->band_start[b-1];
+  a->band_start[0] = 0;
+}
+
+/*
+** 1 if the edge from point i to point i+1 crosses the ray
+** from (lon, lat) to the east
+*/
+static int addr_edge_crosses(const AddrArea *a, const int i, const int32_t lon, const int32_t lat) {
+  double d;
+  if( (a->lat[i]>lat)==(a->lat[i+1]>lat) ) return 0;
+  d = ((double)a->lon[i+1] - a->lon[i]) * ((double)lat - a->lat[i]) -
+      ((double)lon - a->lon[i]) * ((double)a->lat[i+1] - a->lat[i]);
+  return a->lat[i+1]>a->lat[i] ? d>0 : d<0;
+}
+
+/*
+** 1 if the point is inside the area (crossing number over all rings)
+*/
+static int addr_area_contains(const AddrArea *a, const int32_t lon, const int32_t lat) {
+  int i, r, b, inside = 0;
+  if( a->num_bands>0 ){
+    b = addr_band(a, lat);
+    for(i=a->band_start[b]; i<a->band_start[b+1]; i++){
+      inside ^= addr_edge_crosses(a, a->band_edge[i], lon, lat);
+    }
+    return inside;
+  }
+  for(r=0; r<a->num_rings; r++){
+    for(i=a->ring_start[r]; i<a->ring_start[r+1]-1; i++) inside ^= addr_edge_crosses(a, i, lon, lat);
+  }
+  return inside;
+}
+
+static int addr_cell(const int32_t v, const int32_t min, const int32_t max) {
+  int64_t c = ((int64_t)v - min) * ADDR_GRID / ((int64_t)max - min + 1);
+  return c<0 ? 0 : c>=ADDR_GRID ? ADDR_GRID - 1 : (int)c;
+}
+
+static void *addr_fill_worker(void *arg) {
+  int first, last, i, k, cell, need;
+  const AddrArea *a;
+  while( 1 ){
+    pthread_mutex_lock(&addr_fill.lock);
+    first = addr_fill.next_addr;
+    addr_fill.next_addr += ADDR_BATCH_SIZE;
+    pthread_mutex_unlock(&addr_fill.lock);
+    if( first>=addr_fill.num_addr ) break;
+    last = first + ADDR_BATCH_SIZE<addr_fill.num_addr ? first + ADDR_BATCH_SIZE : addr_fill.num_addr;
+    for(i=first; i<last; i++){
+      need = addr_fill.need[i];
+      addr_fill.found[2*i] = addr_fill.found[2*i+1] = -1;
+      if( addr_fill.lon[i]<addr_fill.min_lon || addr_fill.lon[i]>addr_fill.max_lon ||
+          addr_fill.lat[i]<addr_fill.min_lat || addr_fill.lat[i]>addr_fill.max_lat ) continue;
+      cell = addr_cell(addr_fill.lat[i], addr_fill.min_lat, addr_fill.max_lat) * ADDR_GRID +
+             addr_cell(addr_fill.lon[i], addr_fill.min_lon, addr_fill.max_lon);
+      /* The areas of a cell are sorted by kind and descending admin_level */
+      for(k=addr_fill.cell_start[cell]; k<addr_fill.cell_start[cell+1] && need; k++){
+        a = &addr_fill.area[addr_fill.cell_area[k]];
+        if( !(need & (1 << a->kind)) ) continue;
+        if( addr_fill.lon[i]<a->min_lon || addr_fill.lon[i]>a->max_lon ||
+            addr_fill.lat[i]<a->min_lat || addr_fill.lat[i]>a->max_lat ) continue;
+        if( addr_area_contains(a, addr_fill.lon[i], addr_fill.lat[i]) ){
+          addr_fill.found[2*i+a->kind] = addr_fill.cell_area[k];
+          need &= ~(1 << a->kind);
+        }
+      }
+    }
+  }
+  return NULL;
+}
+
+/*
+** Loads the complete administrative and postal code areas
+*/
+static void addr_load_areas(sqlite3 *db) {
+  sqlite3_stmt *stmt;
+  AddrArea *a;
+  const char *kind, *level, *name, *postcode;
+  int cap = 256;
+  addr_fill.area = malloc(cap * sizeof(AddrArea));
+  if( !addr_fill.area ) abort_msg("Out of memory");
+  addr_fill.num_areas = 0;
+  rc = sqlite3_prepare_v2(db,
+    " SELECT a.geometry,r.min_lon,r.min_lat,r.max_lon,r.max_lat,"
+    "        b.value,l.value,n.value,p.value"
+    " FROM areas AS a"
+    " JOIN rtree_area AS r ON r.relation_id=a.relation_id"
+    " JOIN relation_tags AS b ON b.relation_id=a.relation_id AND b.key='boundary'"
+    " LEFT JOIN relation_tags AS l ON l.relation_id=a.relation_id AND l.key='admin_level'"
+    " LEFT JOIN relation_tags AS n ON n.relation_id=a.relation_id AND n.key='name'"
+    " LEFT JOIN relation_tags AS p ON p.relation_id=a.relation_id AND p.key='postal_code'"
+    " WHERE a.complete=1 AND b.value IN ('administrative','postal_code')"
+    " ORDER BY a.relation_id",
+    -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  while( (rc = sqlite3_step(stmt))==SQLITE_ROW ){
+    kind = (const char *)sqlite3_column_text(stmt, 5);
+    level = (const char *)sqlite3_column_text(stmt, 6);
+    name = (const char *)sqlite3_column_text(stmt, 7);
+    postcode = (const char *)sqlite3_column_text(stmt, 8);
+    if( addr_fill.num_areas==cap ){
+      cap *= 2;
+      addr_fill.area = realloc(addr_fill.area, cap * sizeof(AddrArea));
+      if( !addr_fill.area ) abort_msg("Out of memory");
+    }
+    a = &addr_fill.area[addr_fill.num_areas];
+    if( strcmp(kind, "administrative")==0 ){
+      if( !level || !name ) continue;
+      a->kind = ADDR_CITY;
+      a->level = atoi(level);
+      if( a->level<ADDR_MIN_LEVEL || a->level>ADDR_MAX_LEVEL ) continue;
+      a->value = strdup(name);
+    }
+    else{
+      if( !postcode ) continue;
+      a->kind = ADDR_POSTCODE;
+      a->level = 0;
+      a->value = strdup(postcode);
+    }
+    if( !a->value ) abort_msg("Out of memory");
+    /* The R*Tree boundingbox is rounded outwards */
+    a->min_lon = (int32_t)floor(sqlite3_column_double(stmt, 1) * 1e7);
+    a->min_lat = (int32_t)floor(sqlite3_column_double(stmt, 2) * 1e7);
+    a->max_lon = (int32_t)ceil(sqlite3_column_double(stmt, 3) * 1e7);
+    a->max_lat = (int32_t)ceil(sqlite3_column_double(stmt, 4) * 1e7);
+    addr_area_decode(a, sqlite3_column_blob(stmt, 0), sqlite3_column_bytes(stmt, 0));
+    addr_area_bands(a);
+    addr_fill.num_areas++;
+  }
+  if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+  sqlite3_finalize(stmt);
+}
+
+/*
+** Grid over the boundingboxes of the areas
+*/
+static void addr_build_grid(void) {
+  int i, x, y, x0, x1, y0, y1, pass;
+  AddrArea *a;
+  qsort(addr_fill.area, addr_fill.num_areas, sizeof(AddrArea), addr_area_cmp);
+  addr_fill.min_lon = addr_fill.min_lat = INT32_MAX;
+  addr_fill.max_lon = addr_fill.max_lat = INT32_MIN;
+  for(i=0; i<addr_fill.num_areas; i++){
+    a = &addr_fill.area[i];
+    if( a->min_lon<addr_fill.min_lon ) addr_fill.min_lon = a->min_lon;
+    if( a->min_lat<addr_fill.min_lat ) addr_fill.min_lat = a->min_lat;
+    if( a->max_lon>addr_fill.max_lon ) addr_fill.max_lon = a->max_lon;
+    if( a->max_lat>addr_fill.max_lat ) addr_fill.max_lat = a->max_lat;
+  }
+  addr_fill.cell_start = calloc(ADDR_GRID * ADDR_GRID + 1, sizeof(int));
+  if( !addr_fill.cell_start ) abort_msg("Out of memory");
+  addr_fill.cell_area = NULL;
+  /* Pass 0 counts the areas of each cell, pass 1 fills the cells */
+  for(pass=0; pass<2; pass++){
+    for(i=0; i<addr_fill.num_areas; i++){
+      a = &addr_fill.area[i];
+      x0 = addr_cell(a->min_lon, addr_fill.min_lon, addr_fill.max_lon);
+      x1 = addr_cell(a->max_lon, addr_fill.min_lon, addr_fill.max_lon);
+      y0 = addr_cell(a->min_lat, addr_fill.min_lat, addr_fill.max_lat);
+      y1 = addr_cell(a->max_lat, addr_fill.min_lat, addr_fill.max_lat);
+      for(y=y0; y<=y1; y++){
+        for(x=x0; x<=x1; x++){
+          if( pass==0 ) addr_fill.cell_start[y*ADDR_GRID+x+1]++;
+          else addr_fill.cell_area[addr_fill.cell_start[y*ADDR_GRID+x]++] = i;
+        }
+      }
+    }
+    if( pass==0 ){
+      for(i=0; i<ADDR_GRID*ADDR_GRID; i++) addr_fill.cell_start[i+1] += addr_fill.cell_start[i];
+      addr_fill.cell_area = malloc((addr_fill.cell_start[ADDR_GRID*ADDR_GRID] + 1) * sizeof(int));
+      if( !addr_fill.cell_area ) abort_msg("Out of memory");
+    }
+  }
+  for(i=ADDR_GRID*ADDR_GRID; i>0; i--) addr_fill.cell_start[i] = addr_fill.cell_start[i-1];
+  addr_fill.cell_start[0] = 0;
+}
+
+/*
+** Fills the empty city and postcode of the addresses in tmp_addr
+*/
+static void addr_fill_from_areas(sqlite3 *db, int threads) {
+  sqlite3_stmt *stmt;
+  pthread_t *thread;
+  int cap = 4096, i, num_city = 0, num_postcode = 0;
+  double t0, t1;
+  t0 = time_now();
+  addr_load_areas(db);
+  addr_build_grid();
+  /* Addresses without city or postcode */
+  addr_fill.addr_id = malloc(cap * sizeof(int64_t));
+  addr_fill.lon = malloc(cap * sizeof(int32_t));
+  addr_fill.lat = malloc(cap * sizeof(int32_t));
+  addr_fill.need = malloc(cap);
+  if( !addr_fill.addr_id || !addr_fill.lon || !addr_fill.lat || !addr_fill.need ) abort_msg("Out of memory");
+  addr_fill.num_addr = 0;
+  rc = sqlite3_prepare_v2(db,
+    " SELECT addr_id,lon,lat,(city='')|((postcode='')<<1) FROM tmp_addr"
+    " WHERE (city='' OR postcode='') AND lon IS NOT NULL"
+    " ORDER BY addr_id",
+    -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  while( (rc = sqlite3_step(stmt))==SQLITE_ROW ){
+    if( addr_fill.num_addr==cap ){
+      cap *= 2;
+      addr_fill.addr_id = realloc(addr_fill.addr_id, cap * sizeof(int64_t));
+      addr_fill.lon = realloc(addr_fill.lon, cap * sizeof(int32_t));
+      addr_fill.lat = realloc(addr_fill.lat, cap * sizeof(int32_t));
+      addr_fill.need = realloc(addr_fill.need, cap);
+      if( !addr_fill.addr_id || !addr_fill.lon || !addr_fill.lat || !addr_fill.need ) abort_msg("Out of memory");
+    }
+    addr_fill.addr_id[addr_fill.num_addr] = sqlite3_column_int64(stmt, 0);
+    addr_fill.lon[addr_fill.num_addr] = (int32_t)llround(sqlite3_column_double(stmt, 1) * 1e7);
+    addr_fill.lat[addr_fill.num_addr] = (int32_t)llround(sqlite3_column_double(stmt, 2) * 1e7);
+    addr_fill.need[addr_fill.num_addr++] = (unsigned char)sqlite3_column_int(stmt, 3);
+  }
+  if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+  sqlite3_finalize(stmt);
+  addr_fill.found = malloc((2 * addr_fill.num_addr + 1) * sizeof(int));
+  if( !addr_fill.found ) abort_msg("Out of memory");
+  /* Point in polygon tests in parallel, the workers do not use SQLite */
+  addr_fill.next_addr = 0;
+  pthread_mutex_init(&addr_fill.lock, NULL);
+  thread = malloc(threads * sizeof(pthread_t));
+  if( !thread ) abort_msg("Out of memory");
+  for(i=0; i<threads; i++){
+    if( pthread_create(&thread[i], NULL, addr_fill_worker, NULL)!=0 )
+      abort_msg("Option addr areas: Error creating thread");
+  }
+  for(i=0; i<threads; i++) pthread_join(thread[i], NULL);
+  /* Update tmp_addr */
+  rc = sqlite3_prepare_v2(db,
+    " UPDATE tmp_addr SET"
+    "  city=CASE WHEN city='' THEN coalesce(?2,'') ELSE city END,"
+    "  postcode=CASE WHEN postcode='' THEN coalesce(?3,'') ELSE postcode END"
+    " WHERE addr_id=?1",
+    -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  for(i=0; i<addr_fill.num_addr; i++){
+    if( addr_fill.found[2*i]<0 && addr_fill.found[2*i+1]<0 ) continue;
+    sqlite3_bind_int64(stmt, 1, addr_fill.addr_id[i]);
+    if( addr_fill.found[2*i]>=0 ){
+      sqlite3_bind_text(stmt, 2, addr_fill.area[addr_fill.found[2*i]].value, -1, SQLITE_STATIC);
+      num_city++;
+    }
+    else sqlite3_bind_null(stmt, 2);
+    if( addr_fill.found[2*i+1]>=0 ){
+      sqlite3_bind_text(stmt, 3, addr_fill.area[addr_fill.found[2*i+1]].value, -1, SQLITE_STATIC);
+      num_postcode++;
+    }
+    else sqlite3_bind_null(stmt, 3);
+    rc = sqlite3_step(stmt);
+    if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  t1 = time_now();
+  fprintf(stderr, "addr: %d cities and %d postcodes of %d addresses from %d areas in %.3f s with %d threads\n",
+          num_city, num_postcode, addr_fill.num_addr, addr_fill.num_areas, t1-t0, threads);
+  /* Cleanup */
+  for(i=0; i<addr_fill.num_areas; i++){
+    free(addr_fill.area[i].value);
+    free(addr_fill.area[i].lon);
+    free(addr_fill.area[i].lat);
+    free(addr_fill.area[i].ring_start);
+    if( addr_fill.area[i].num_bands>0 ){
+      free(addr_fill.area[i].band_start);
+      free(addr_fill.area[i].band_edge);
+    }
+  }
+  free(addr_fill.area);
+  free(addr_fill.cell_start);
+  free(addr_fill.cell_area);
+  free(addr_fill.addr_id);
+  free(addr_fill.lon);
+  free(addr_fill.lat);
+  free(addr_fill.need);
+  free(addr_fill.found);
+  free(thread);
+  pthread_mutex_destroy(&addr_fill.lock);
+}
+
+/*
+** Option "addr areas": address tables, empty city and postcode
+** filled from the areas (created first if missing)
+*/
+void add_addr_areas(sqlite3 *db, int threads) {
+  if( !table_exists(db, "areas") ) add_areas(db, threads);
+  add_addr_tmp(db);
+  addr_fill_from_areas(db, threads);
+  add_addr_tables(db);
+}
@@ -0,0 +1,291 @@
+/**
+ * \file batch.c
+ * \brief Batch routing of origin-destination pairs from a CSV file
+ *
+ * Input (header line is optional):
+ *   id,lon1,lat1,lon2,lat2
+ * Output:
+ *   id,distance[,polyline]
+ *
+ * The routing graph is loaded once, the pairs are distributed over worker
+ * threads, each with its own search workspace.
+ */
+
+#define BATCH_BLOCK_SIZE  64   /* Number of pairs a worker takes at once */
+
+typedef struct {
+  char *id;          /* ID from the input file */
+  double lon1, lat1; /* Origin */
+  double lon2, lat2; /* Destination */
+  int distance;      /* Result, -1 if there is no route */
+  char *polyline;    /* Encoded geometry or NULL */
+} BatchPair;
+
+static struct {
+  const RoutingGraph *graph;
+  const Landmarks *lm;      /* Landmarks of the graph, may be empty */
+  int mask_permit;
+  int geometry;             /* 1 if the encoded polyline is requested */
+  BatchPair *pair;
+  int num_pairs;
+  int next_pair;            /* Next pair that is not yet assigned to a worker */
+  pthread_mutex_t lock;     /* Protects next_pair */
+} batch;
+
+/**
+ * \brief Reads the pairs from the CSV file
+ */
+static void batch_read_csv(const char *filename) {
+  FILE *csv;
+  char line[1024];
+  char *field[5], *p;
+  char *end;
+  int i, n, cap = 0, lineno = 0;
+  double v[4];
+  csv = fopen(filename, "r");
+  if( csv==NULL ) abort_msg("Error opening file");
+  batch.pair = NULL;
+  batch.num_pairs = 0;
+  while( fgets(line, sizeof(line), csv) ){
+    lineno++;
+    line[strcspn(line, "\r\n")] = '\0';
+    if( line[0]=='\0' ) continue;
+    /* split into 5 fields */
+    p = line;
+    for(n=0; n<5 && p; n++){
+      field[n] = p;
+      p = strchr(p, ',');
+      if( p ) *p++ = '\0';
+    }
+    if( n!=5 ){
+      fprintf(stderr, "route-batch: %s line %d: 5 columns expected\n", filename, lineno);
+      exit(EXIT_FAILURE);
+    }
+    for(i=0; i<4; i++){
+      v[i] = strtod(field[i+1], &end);
+      if( end==field[i+1] || *end!='\0' ) break;
+      if( i%2==1 && !valid_location(v[i-1], v[i]) ) break;    /* also nan and inf */
+    }
+    if( i<4 ){
+      if( lineno==1 ) continue;  /* header line */
+      fprintf(stderr, "route-batch: %s line %d: invalid coordinate\n", filename, lineno);
+      exit(EXIT_FAILURE);
+    }
+    if( batch.num_pairs==cap ){
+      cap = cap ? cap*2 : 1024;
+      batch.pair = realloc(batch.pair, cap * sizeof(BatchPair));
+      if( !batch.pair ) abort_msg("Out of memory");
+    }
+    BatchPair *bp = &batch.pair[batch.num_pairs++];
+    bp->id = malloc(strlen(field[0]) + 1);
+    if( !bp->id ) abort_msg("Out of memory");
+    strcpy(bp->id, field[0]);
+    bp->lon1 = v[0];
+    bp->lat1 = v[1];
+    bp->lon2 = v[2];
+    bp->lat2 = v[3];
+    bp->distance = -1;
+    bp->polyline = NULL;
+  }
+  fclose(csv);
+}
+
+static void *batch_worker(void *arg) {
+  DijkstraWorkspace ws;
+  Path path;
+  NodeList points, ends;
+  StrBuf sb;
+  BatchPair *bp;
+  int i, first, last;
+  SnapPoint snap[2];
+  dijkstra_workspace_init(&ws, batch.graph);
+  landmarks_attach(&ws, batch.lm, batch.mask_permit);
+  path_init(&path);
+  nodelist_init(&points);
+  nodelist_init(&ends);
+  strbuf_init(&sb);
+  while( 1 ){
+    /* Take the next block of pairs */
+    pthread_mutex_lock(&batch.lock);
+    first = batch.next_pair;
+    batch.next_pair += BATCH_BLOCK_SIZE;
+    pthread_mutex_unlock(&batch.lock);
+    if( first>=batch.num_pairs ) break;
+    last = first + BATCH_BLOCK_SIZE;
+    if( last>batch.num_pairs ) last = batch.num_pairs;
+    for(i=first; i<last; i++){
+      bp = &batch.pair[i];
+      nodelist_clear(&ends);
+      nodelist_add(&ends, bp->lon1, bp->lat1, -1);
+      nodelist_add(&ends, bp->lon2, bp->lat2, -1);
+      if( !snap_points(batch.graph, batch.mask_permit, &ends, snap) ) continue;
+      bp->distance = snap_route(&ws, batch.graph, batch.mask_permit, &snap[0], &snap[1], &path);
+      if( bp->distance==-1 || !batch.geometry ) continue;
+      nodelist_clear(&points);
+      path_points(batch.graph, &path, &points);
+      strbuf_clear(&sb);
+      nodelist_polyline(&points, &sb);
+      bp->polyline = malloc(sb.len + 1);
+      if( !bp->polyline ) abort_msg("Out of memory");
+      memcpy(bp->polyline, sb.s, sb.len + 1);
+    }
+  }
+  dijkstra_workspace_free(&ws);
+  path_free(&path);
+  nodelist_free(&points);
+  nodelist_free(&ends);
+  strbuf_free(&sb);
+  return NULL;
+}
+
+/**
+ * \brief Calculates the shortest paths for all pairs of a CSV file
+ *
+ * \param threads   Number of worker threads
+ * \param geometry  1: write the encoded polyline of each route
+ */
+void route_batch(
+  sqlite3 *db,
+  const char *permit,
+  const char *input_file,
+  const char *output_file,
+  const int threads,
+  const int geometry
+){
+  RoutingGraph graph;
+  Landmarks lm;
+  pthread_t *thread;
+  FILE *csv;
+  int i, failed, graph_image;
+  double t0, t1, t2;
+  if( threads<1 || threads>SERVE_MAX_THREADS ) abort_msg("Option route-batch: Invalid number of threads");
+  t0 = time_now();
+  batch_read_csv(input_file);
+  graph_image = routing_graph_load(db, NULL, 0, &graph);
+  landmarks_load(db, &graph, &lm);
+  batch.graph = &graph;
+  batch.lm = &lm;
+  batch.mask_permit = permit_mask(permit);
+  batch.geometry = geometry;
+  batch.next_pair = 0;
+  pthread_mutex_init(&batch.lock, NULL);
+  t1 = time_now();
+  /* Routing */
+  thread = malloc(threads * sizeof(pthread_t));
+  if( !thread ) abort_msg("Out of memory");
+  for(i=0; i<threads; i++){
+    if( pthread_create(&thread[i], NULL, batch_worker, NULL)!=0 )
+      abort_msg("Option route-batch: Error creating thread");
+  }
+  for(i=0; i<threads; i++) pthread_join(thread[i], NULL);
+  t2 = time_now();
+  /* Write the results in the order of the input file */
+  csv = fopen(output_file, "w");
+  if( csv==NULL ) abort_msg("Error opening file");
+  fprintf(csv, geometry ? "id,distance,polyline\r\n" : "id,distance\r\n");
+  failed = 0;
+  for(i=0; i<batch.num_pairs; i++){
+    fprintf(csv, "%s,", batch.pair[i].id);
+    if( batch.pair[i].distance!=-1 ) fprintf(csv, "%d", batch.pair[i].distance);
+    else failed++;
+    if( geometry ) fprintf(csv, ",%s", batch.pair[i].polyline ? batch.pair[i].polyline : "");
+    fprintf(csv, "\r\n");
+    free(batch.pair[i].id);
+    free(batch.pair[i].polyline);
+  }
+  if( fclose(csv)!=0 ) abort_msg("Error closing file");
+  fprintf(stderr, "route-batch: graph with %d vertices loaded from %s, %d landmarks in %.3f s\n",
+          graph.num_vertices, graph_image ? "graph image" : "tables", lm.num_landmarks, t1-t0);
+  fprintf(stderr, "route-batch: %d routes (%d without result) in %.3f s with %d threads, %.1f routes/s\n",
+          batch.num_pairs, failed, t2-t1, threads, t2>t1 ? batch.num_pairs/(t2-t1) : 0.0);
+  /* Cleanup */
+  free(thread);
+  free(batch.pair);
+  pthread_mutex_destroy(&batch.lock);
+  landmarks_free(&lm);
+  routing_graph_free(&graph);
+}
+
+/**
+ * \brief Compares the priority queues of the Dijkstra algorithm
+ *
+ * All pairs of the CSV file are routed in one thread once with each
+ * priority queue and, if the database has landmarks, once with the
+ * goal-directed search (alt). The time without snapping is printed per
+ * queue, the distances must be the same for all queues.
+ */
+void route_bench(
+  sqlite3 *db,
+  const char *permit,
+  const char *input_file
+){
+  RoutingGraph graph;
+  Landmarks lm;
+  DijkstraWorkspace ws;
+  Path path;
+  NodeList ends;
+  SnapPoint *snap;
+  int *dist;
+  int i, q, d, routes, graph_image, num_runs;
+  int64_t touched;
+  double t0, t1;
+  batch_read_csv(input_file);
+  graph_image = routing_graph_load(db, NULL, 0, &graph);
+  landmarks_load(db, &graph, &lm);
+  batch.mask_permit = permit_mask(permit);
+  /* Snap all points once, -1 in edge if a point is not on the graph */
+  snap = malloc((2 * (size_t)batch.num_pairs + 1) * sizeof(SnapPoint));
+  dist = malloc(((size_t)batch.num_pairs + 1) * sizeof(int));
+  if( !snap || !dist ) abort_msg("Out of memory");
+  routes = 0;
+  nodelist_init(&ends);
+  for(i=0; i<batch.num_pairs; i++){
+    nodelist_clear(&ends);
+    nodelist_add(&ends, batch.pair[i].lon1, batch.pair[i].lat1, -1);
+    nodelist_add(&ends, batch.pair[i].lon2, batch.pair[i].lat2, -1);
+    if( !snap_points(&graph, batch.mask_permit, &ends, &snap[2*i]) ) snap[2*i].edge = -1;
+    else routes++;
+  }
+  nodelist_free(&ends);
+  printf("graph with %d vertices loaded from %s, %d landmarks, %d of %d pairs on the graph\n",
+         graph.num_vertices, graph_image ? "graph image" : "tables", lm.num_landmarks,
+         routes, batch.num_pairs);
+  printf("queue   |  time (s) |  routes/s | vertices/route\n"
+         "--------+-----------+-----------+---------------\n");
+  dijkstra_workspace_init(&ws, &graph);
+  path_init(&path);
+  /* The last run (alt) uses the landmarks with the default queue */
+  num_runs = lm.num_landmarks>0 ? DIJKSTRA_NUM_QUEUES + 1 : DIJKSTRA_NUM_QUEUES;
+  for(q=0; q<num_runs; q++){
+    if( q==DIJKSTRA_NUM_QUEUES ){
+      dijkstra_workspace_set_queue(&ws, DIJKSTRA_QUEUE);
+      landmarks_attach(&ws, &lm, batch.mask_permit);
+    }
+    else dijkstra_workspace_set_queue(&ws, q);
+    touched = 0;
+    t0 = time_now();
+    for(i=0; i<batch.num_pairs; i++){
+      if( snap[2*i].edge==-1 ) continue;
+      d = snap_route(&ws, &graph, batch.mask_permit, &snap[2*i], &snap[2*i+1], &path);
+      touched += ws.num_touched;
+      if( q==0 ) dist[i] = d;
+      else if( d!=dist[i] ){
+        fprintf(stderr, "route-bench: queue %s: pair %s: distance %d instead of %d\n",
+                q<DIJKSTRA_NUM_QUEUES ? dijkstra_queue_name[q] : "alt", batch.pair[i].id, d, dist[i]);
+        exit(EXIT_FAILURE);
+      }
+    }
+    t1 = time_now();
+    printf("%-7s | %9.3f | %9.1f | %14.1f\n", q<DIJKSTRA_NUM_QUEUES ? dijkstra_queue_name[q] : "alt", t1-t0,
+           t1>t0 ? routes/(t1-t0) : 0.0, routes ? (double)touched/routes : 0.0);
+  }
+  /* Cleanup */
+  dijkstra_workspace_free(&ws);
+  path_free(&path);
+  for(i=0; i<batch.num_pairs; i++) free(batch.pair[i].id);
+  free(batch.pair);
+  free(snap);
+  free(dist);
+  landmarks_free(&lm);
+  routing_graph_free(&graph);
+}
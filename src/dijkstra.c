@@ -1,115 +1,242 @@
 /*
-** Graph data structures as an adjacency list
+** Structures for the Dijkstra Algorithm
 */
-struct AdjNode {
-  int dest;
-  int dist;
-  int edge;
-  struct AdjNode* next;
+struct Dijkstra {
+  int d;         /* Total distance to the node */
+  int v_node;    /* Predecessor node (shortest path tree) */
+  int v_edge;    /* Predecessor edge (shortest path tree) */
+  int pos_heap;  /* Contains the position of the node in b[] */
 };
 
-struct AdjList {
-  struct AdjNode* head;
-};
+/*
+** Priority queues
+**
+** DIJKSTRA_QUEUE_BINARY  Binary heap
+** DIJKSTRA_QUEUE_4ARY    4-ary heap, fewer levels than the binary heap
+** DIJKSTRA_QUEUE_RADIX   Radix heap for monotone integer distances
+** DIJKSTRA_QUEUE_BUCKET  Bucket queue (Dial), one bucket per distance modulo
+**                        the largest edge distance + 1
+**
+** The heaps keep one entry per vertex and its position in pos_heap. The radix
+** heap and the bucket queue insert a new entry when the distance of a vertex
+** decreases and skip outdated entries when they are removed, pos_heap is 1
+** while the vertex is in the queue.
+** The default can be chosen at compile time, e.g. -DDIJKSTRA_QUEUE=DIJKSTRA_QUEUE_RADIX
+*/
+#define DIJKSTRA_QUEUE_BINARY  0
+#define DIJKSTRA_QUEUE_4ARY    1
+#define DIJKSTRA_QUEUE_RADIX   2
+#define DIJKSTRA_QUEUE_BUCKET  3
+#define DIJKSTRA_NUM_QUEUES    4
 
-struct Graph {
-  int num_nodes;
-  struct AdjList* array;
-};
+#ifndef DIJKSTRA_QUEUE
+#define DIJKSTRA_QUEUE  DIJKSTRA_QUEUE_RADIX
+#endif
 
-struct AdjNode* newAdjListNode(int dest, int dist, int edge) {
-  struct AdjNode* newNode = (struct AdjNode*)malloc(sizeof(struct AdjNode));
-  if(!newNode) abort_msg("Out of memory");
-  newNode->dest = dest;
-  newNode->dist = dist;
-  newNode->edge = edge;
-  newNode->next = NULL;
-  return newNode;
-}
-
-struct Graph* createGraph(int V) {
-  struct Graph* graph = (struct Graph*)malloc(sizeof(struct Graph));
-  if(!graph) abort_msg("Out of memory");
-  V = V+1;
-  graph->num_nodes = V;
-  /* init adjacency list */
-  graph->array = (struct AdjList*)malloc(V * sizeof(struct AdjList));
-  if(!graph->array) abort_msg("Out of memory");
-  /* set head of all lists to NULL */
-  for (int i = 0; i < V; ++i)
-    graph->array[i].head = NULL;
-  return graph;
-}
-
-void destroyGraph(struct Graph* graph) {
-  for (int i = 0; i < graph->num_nodes; ++i) {
-    struct AdjNode* current = graph->array[i].head;
-    while (current != NULL) {
-      struct AdjNode* temp = current;
-      current = current->next;
-      free(temp);
-    }
+#define RADIX_BUCKETS  33   /* Bucket 0: distance equal to the last removed distance */
+
+const char *dijkstra_queue_name[DIJKSTRA_NUM_QUEUES] = { "binary", "4-ary", "radix", "bucket" };
+
+typedef struct {
+  int d;                  /* Distance of the vertex when the entry was inserted */
+  int v;                  /* Vertex */
+} QueueEntry;
+
+typedef struct {
+  QueueEntry *entry;
+  int size;
+  int cap;
+} QueueBucket;
+
+/*
+** Search workspace
+**
+** Contains all memory for one search. A workspace is allocated once per graph
+** and reused, so a thread with its own workspace can run searches in parallel
+** with other threads. Only the entries in node[] that were touched by the
+** previous search are reset.
+*/
+typedef struct {
+  struct Dijkstra *node;  /* Result of the search for each vertex */
+  int *b;                 /* Array b[] contains the nodes in the priority queue */
+  int b_size;             /* Contains the current number of nodes in the priority queue */
+  int *touched;           /* Vertices whose entry in node[] was changed */
+  int num_touched;
+  int num_vertices;
+  int queue;              /* Type of the priority queue (DIJKSTRA_QUEUE_...) */
+  QueueBucket *bucket;    /* Buckets of the radix heap or the bucket queue */
+  int num_buckets;
+  int last;               /* Last removed distance (radix heap, bucket queue) */
+  int max_dist;           /* Largest edge distance (bucket queue) */
+  int reverse;            /* 1: search along the arcs in reverse direction */
+  const int32_t *lm_dist; /* Landmark distances of the permit profile, NULL: none */
+  int lm_num;             /* Number of landmarks */
+  int goal;               /* 1: the search is directed to the goal vertices */
+  int num_goals;
+  const int32_t *lm_goal[2]; /* Landmark distances of the goal vertices */
+  int *potential;         /* Lower bound of the distance to the goals per touched vertex */
+} DijkstraWorkspace;
+
+#define LANDMARK_INFINITY  INT32_MAX
+
+/*
+** Selects the priority queue of the workspace
+*/
+void dijkstra_workspace_set_queue(DijkstraWorkspace *ws, int queue) {
+  int i;
+  for(i=0; i<ws->num_buckets; i++) free(ws->bucket[i].entry);
+  free(ws->bucket);
+  ws->queue = queue;
+  ws->num_buckets = queue==DIJKSTRA_QUEUE_RADIX ? RADIX_BUCKETS :
+                    queue==DIJKSTRA_QUEUE_BUCKET ? ws->max_dist + 1 : 0;
+  ws->bucket = calloc(ws->num_buckets + 1, sizeof(QueueBucket));
+  if(!ws->bucket) abort_msg("Out of memory");
+  ws->last = 0;
+}
+
+void dijkstra_workspace_init(DijkstraWorkspace *ws, const RoutingGraph *graph) {
+  int i;
+  ws->num_vertices = graph->num_vertices;
+  ws->node = (struct Dijkstra*) malloc((graph->num_vertices + 1) * sizeof(struct Dijkstra));
+  if(!ws->node) abort_msg("Out of memory");
+  ws->b = (int *) malloc((graph->num_vertices + 1) * sizeof(int));
+  if(!ws->b) abort_msg("Out of memory");
+  ws->touched = (int *) malloc((graph->num_vertices + 1) * sizeof(int));
+  if(!ws->touched) abort_msg("Out of memory");
+  for (i = 0; i < graph->num_vertices; i++) {
+    ws->node[i].d = INT_MAX;
+    ws->node[i].v_node = -1;
+    ws->node[i].v_edge = -1;
+    ws->node[i].pos_heap = 0;
   }
-  free(graph->array);
-  free(graph);
+  ws->b_size = 0;
+  ws->num_touched = 0;
+  ws->max_dist = 0;
+  for (i = 0; i < graph->num_edges; i++) {
+    if (graph->edge[i].dist > ws->max_dist) ws->max_dist = graph->edge[i].dist;
+  }
+  ws->bucket = NULL;
+  ws->num_buckets = 0;
+  dijkstra_workspace_set_queue(ws, DIJKSTRA_QUEUE);
+  ws->reverse = 0;
+  ws->lm_dist = NULL;
+  ws->lm_num = 0;
+  ws->goal = 0;
+  ws->num_goals = 0;
+  ws->potential = NULL;
+}
+
+void dijkstra_workspace_free(DijkstraWorkspace *ws) {
+  int i;
+  free(ws->node);
+  free(ws->b);
+  free(ws->touched);
+  for(i=0; i<ws->num_buckets; i++) free(ws->bucket[i].entry);
+  free(ws->bucket);
+  free(ws->potential);
 }
 
-void addEdge(struct Graph* graph, int src, int dest, int dist, int edge, int dir) {
-  struct AdjNode* newNode;
-  newNode = newAdjListNode(dest, dist, edge);  /* add edge from src to dest */
-  newNode->next = graph->array[src].head;
-  graph->array[src].head = newNode;
-  if(!dir){
-    newNode = newAdjListNode(src, dist, edge);  /* add edge from dest to src */
-    newNode->next = graph->array[dest].head;
-    graph->array[dest].head = newNode;
+/*
+** Reset the entries of the previous search
+*/
+void dijkstra_workspace_reset(DijkstraWorkspace *ws) {
+  int i, v;
+  for (i = 0; i < ws->num_touched; i++) {
+    v = ws->touched[i];
+    ws->node[v].d = INT_MAX;
+    ws->node[v].v_node = -1;
+    ws->node[v].v_edge = -1;
+    ws->node[v].pos_heap = 0;
   }
+  ws->num_touched = 0;
+  ws->b_size = 0;
+  for (i = 0; i < ws->num_buckets; i++) ws->bucket[i].size = 0;
+  ws->last = 0;
+  ws->goal = 0;
 }
 
-void printGraph(struct Graph* graph) {
-  printf("Graph (%d nodes):\n", graph->num_nodes);
-  for (int n = 0; n < graph->num_nodes; n++) {
-    struct AdjNode* pCrawl = graph->array[n].head;
-    printf("node %d\n", n);
-    while (pCrawl) {
-      printf("        -> node %d, dist %d, edge %d\n", pCrawl->dest, pCrawl->dist, pCrawl->edge);
-      pCrawl = pCrawl->next;
+/*
+** Goal-directed search (A* with landmarks, ALT)
+**
+** The distances of a vertex v from and to each landmark L give lower bounds
+** of the distance from v to a goal t (triangle inequality):
+**   d(v,t) >= d(L,t) - d(L,v)   and   d(v,t) >= d(v,L) - d(t,L)
+** The potential of v is the largest bound, for several goals the smallest
+** potential. If v cannot reach a landmark that t reaches, v cannot reach t
+** (potential INT_MAX). The potential is consistent, so the distances in the
+** priority queue (distance + potential) never decrease and every queue
+** except the bucket queue can be used.
+*/
+static int goal_potential(const DijkstraWorkspace *ws, int v) {
+  const int32_t *lv = ws->lm_dist + (size_t)v * 2 * ws->lm_num, *lt;
+  int g, l, h, best = INT_MAX;
+  for (g = 0; g < ws->num_goals; g++) {
+    lt = ws->lm_goal[g];
+    h = 0;
+    for (l = 0; l < 2*ws->lm_num; l += 2) {
+      if (lt[l] != LANDMARK_INFINITY && lv[l] != LANDMARK_INFINITY && lt[l] - lv[l] > h) {
+        h = lt[l] - lv[l];
+      }
+      if (lt[l+1] != LANDMARK_INFINITY) {
+        if (lv[l+1] == LANDMARK_INFINITY) { h = INT_MAX; break; }
+        if (lv[l+1] - lt[l+1] > h) h = lv[l+1] - lt[l+1];
+      }
     }
+    if (h < best) best = h;
   }
-  printf("\n");
+  return best;
 }
 
 /*
-** Structures for the Dijkstra Algorithm
+** Directs the next search to the goal vertices (after dijkstra_workspace_reset()
+** and before the start vertices are added). Without landmarks, for the bucket
+** queue and for a reverse search the normal search is used.
 */
-struct Dijkstra {
-  int d;         /* Total distance to the node */
-  int v_node;    /* Predecessor node (shortest path tree) */
-  int v_edge;    /* Predecessor edge (shortest path tree) */
-  int pos_heap;  /* Contains the position of the node in b[] */
-};
+void dijkstra_set_goal(DijkstraWorkspace *ws, const int *goal, int num_goals) {
+  int g;
+  if (ws->lm_dist == NULL || ws->reverse || ws->queue == DIJKSTRA_QUEUE_BUCKET ||
+      num_goals < 1 || num_goals > 2) return;
+  if (ws->potential == NULL) {
+    ws->potential = malloc((ws->num_vertices + 1) * sizeof(int));
+    if(!ws->potential) abort_msg("Out of memory");
+  }
+  for (g = 0; g < num_goals; g++) {
+    ws->lm_goal[g] = ws->lm_dist + (size_t)goal[g] * 2 * ws->lm_num;
+  }
+  ws->num_goals = num_goals;
+  ws->goal = 1;
+}
 
-/* Public variables */
-struct Dijkstra* node;
-int *b;          /* Array b[] contains the nodes in the priority queue */
-int b_size;      /* Contains the current number of nodes in the priority queue */
+/*
+** Converts the distances in the priority queue back to distances
+*/
+static void goal_finish(DijkstraWorkspace *ws) {
+  int i, v;
+  for (i = 0; i < ws->num_touched; i++) {
+    v = ws->touched[i];
+    if (ws->node[v].d != INT_MAX) ws->node[v].d -= ws->potential[v];
+  }
+  ws->goal = 0;
+}
 
 /*
-** Priority Queue
+** Binary heap
 **
 ** b_insert() : Insert node in priority queue
 ** b_remove() : Remove the node with minimal distance from priority queue
 ** b_relax()  : Reduce the distance, adjust priority queue
 **
 */
-void downheap(int k) {
+void downheap(DijkstraWorkspace *ws, int k) {
+  struct Dijkstra *node = ws->node;
+  int *b = ws->b;
   int j, v, v_k;
 
   v = node[ b[k] ].d;
   v_k = b[k];
-  while ( k <= b_size/2 ) {
+  while ( k <= ws->b_size/2 ) {
     j = k + k;
-    if ( j < b_size && node[ b[j] ].d > node[ b[j+1] ].d ) j++;
+    if ( j < ws->b_size && node[ b[j] ].d > node[ b[j+1] ].d ) j++;
     if ( v <= node[ b[j] ].d ) break;
     b[k] = b[j];
     node[ b[k] ].pos_heap = k;
@@ -119,13 +246,14 @@ void downheap(int k) {
   node[ b[k] ].pos_heap = k;
 }
 
-void upheap(int k) {
+void upheap(DijkstraWorkspace *ws, int k) {
+  struct Dijkstra *node = ws->node;
+  int *b = ws->b;
   int v, v_k;
 
   v = node[ b[k] ].d;
   v_k = b[k];
-  node[ 0 ].d = 0;
-  while ( node[ b[k/2] ].d > v ) {
+  while ( k > 1 && node[ b[k/2] ].d > v ) {
     b[k] = b[k/2];
     node[ b[k] ].pos_heap = k;
     k = k/2;
@@ -134,83 +262,354 @@ void upheap(int k) {
   node[ b[k] ].pos_heap = k;
 }
 
-void b_insert(int v) {
-  b[++b_size] = v;
-  upheap( b_size );
+void b_insert(DijkstraWorkspace *ws, int v) {
+  ws->b[++ws->b_size] = v;
+  upheap( ws, ws->b_size );
 }
 
-int b_remove(void) {
+int b_remove(DijkstraWorkspace *ws) {
   int v;
 
-  v = b[1];
-  b[1] = b[b_size--];
-  downheap( 1 );
-  node[v].pos_heap = 0;
+  v = ws->b[1];
+  ws->b[1] = ws->b[ws->b_size--];
+  if ( ws->b_size > 0 ) downheap( ws, 1 );
+  ws->node[v].pos_heap = 0;
   return v;
 }
 
-void b_relax(int k, int v) {
+void b_relax(DijkstraWorkspace *ws, int k, int v) {
+  struct Dijkstra *node = ws->node;
   if ( node[ k ].d > v ) {
     node[ k ].d = v;
-    if ( node[k].pos_heap > 0 ) upheap( node[k].pos_heap );
+    if ( node[k].pos_heap > 0 ) upheap( ws, node[k].pos_heap );
   }
   if ( node[ k ].d < v ) {
     node[ k ].d = v;
-    if ( node[k].pos_heap > 0 ) downheap( node[k].pos_heap );
+    if ( node[k].pos_heap > 0 ) downheap( ws, node[k].pos_heap );
   }
 }
 
+/*
+** 4-ary heap
+**
+** Same as the binary heap, the children of b[k] are b[4k-2] .. b[4k+1].
+*/
+static void downheap4(DijkstraWorkspace *ws, int k) {
+  struct Dijkstra *node = ws->node;
+  int *b = ws->b;
+  int c, j, last, v, v_k;
+
+  v = node[ b[k] ].d;
+  v_k = b[k];
+  while ( (c = 4*k - 2) <= ws->b_size ) {
+    last = c + 3 < ws->b_size ? c + 3 : ws->b_size;
+    for ( j = c++; c <= last; c++ ) {
+      if ( node[ b[c] ].d < node[ b[j] ].d ) j = c;
+    }
+    if ( v <= node[ b[j] ].d ) break;
+    b[k] = b[j];
+    node[ b[k] ].pos_heap = k;
+    k = j;
+  }
+  b[k] = v_k;
+  node[ b[k] ].pos_heap = k;
+}
+
+static void upheap4(DijkstraWorkspace *ws, int k) {
+  struct Dijkstra *node = ws->node;
+  int *b = ws->b;
+  int p, v, v_k;
+
+  v = node[ b[k] ].d;
+  v_k = b[k];
+  while ( k > 1 && node[ b[p = (k+2)/4] ].d > v ) {
+    b[k] = b[p];
+    node[ b[k] ].pos_heap = k;
+    k = p;
+  }
+  b[k] = v_k;
+  node[ b[k] ].pos_heap = k;
+}
+
+/*
+** Radix heap and bucket queue
+*/
+static void bucket_push(QueueBucket *bucket, int d, int v) {
+  if ( bucket->size == bucket->cap ) {
+    bucket->cap = bucket->cap ? bucket->cap*2 : 16;
+    bucket->entry = realloc(bucket->entry, bucket->cap * sizeof(QueueEntry));
+    if(!bucket->entry) abort_msg("Out of memory");
+  }
+  bucket->entry[bucket->size].d = d;
+  bucket->entry[bucket->size].v = v;
+  bucket->size++;
+}
+
+/* An entry is outdated if the vertex was removed or its distance decreased */
+static inline int entry_valid(const DijkstraWorkspace *ws, const QueueEntry *e) {
+  return ws->node[e->v].pos_heap > 0 && ws->node[e->v].d == e->d;
+}
+
+/* Radix heap: bucket i > 0 holds distances whose highest bit different from last is bit i-1 */
+static inline int radix_bucket(int last, int d) {
+  unsigned int x = (unsigned int)(d ^ last);
+#ifdef __GNUC__
+  return x ? 32 - __builtin_clz(x) : 0;
+#else
+  int i = 0;
+  while ( x ) { i++; x >>= 1; }
+  return i;
+#endif
+}
+
+/*
+** Radix heap: moves the entries with the smallest distance into bucket 0
+** and returns the vertex of the last entry in bucket 0
+*/
+static int radix_top(DijkstraWorkspace *ws) {
+  QueueBucket *b0 = &ws->bucket[0], *bi;
+  QueueEntry e;
+  int i, k, min;
+  while ( 1 ) {
+    while ( b0->size > 0 ) {
+      if ( entry_valid(ws, &b0->entry[b0->size-1]) ) return b0->entry[b0->size-1].v;
+      b0->size--;
+    }
+    for ( i = 1; i < RADIX_BUCKETS && ws->bucket[i].size == 0; i++ );
+    if ( i == RADIX_BUCKETS ) abort_msg("Radix heap is empty");
+    bi = &ws->bucket[i];
+    min = INT_MAX;
+    for ( k = 0; k < bi->size; k++ ) {
+      if ( bi->entry[k].d < min && entry_valid(ws, &bi->entry[k]) ) min = bi->entry[k].d;
+    }
+    if ( min != INT_MAX ) {
+      /* All other entries of the bucket go to lower buckets */
+      ws->last = min;
+      for ( k = 0; k < bi->size; k++ ) {
+        e = bi->entry[k];
+        if ( entry_valid(ws, &e) ) bucket_push(&ws->bucket[radix_bucket(min, e.d)], e.d, e.v);
+      }
+    }
+    bi->size = 0;
+  }
+}
+
+/*
+** Bucket queue: advances to the next bucket with a valid entry
+*/
+static int bucket_top(DijkstraWorkspace *ws) {
+  QueueBucket *b;
+  while ( 1 ) {
+    b = &ws->bucket[ws->last % ws->num_buckets];
+    while ( b->size > 0 ) {
+      if ( entry_valid(ws, &b->entry[b->size-1]) ) return b->entry[b->size-1].v;
+      b->size--;
+    }
+    ws->last++;
+  }
+}
+
+static void bucket_insert(DijkstraWorkspace *ws, int v) {
+  int d = ws->node[v].d;
+  if ( ws->queue == DIJKSTRA_QUEUE_RADIX ) {
+    bucket_push(&ws->bucket[radix_bucket(ws->last, d)], d, v);
+  } else {
+    if ( d - ws->last >= ws->num_buckets ) abort_msg("Bucket queue: distance out of range");
+    bucket_push(&ws->bucket[d % ws->num_buckets], d, v);
+  }
+}
+
+/*
+** Priority queue
+**
+** queue_insert()   : Insert vertex v with distance node[v].d
+** queue_top()      : Vertex with minimal distance (queue not empty)
+** queue_remove()   : Remove the vertex with minimal distance
+** queue_decrease() : Reduce the distance of vertex v in the queue to d
+*/
+static inline void queue_insert(DijkstraWorkspace *ws, int v) {
+  switch ( ws->queue ) {
+  case DIJKSTRA_QUEUE_BINARY:
+    b_insert(ws, v);
+    break;
+  case DIJKSTRA_QUEUE_4ARY:
+    ws->b[++ws->b_size] = v;
+    upheap4(ws, ws->b_size);
+    break;
+  default:
+    ws->b_size++;
+    ws->node[v].pos_heap = 1;
+    bucket_insert(ws, v);
+  }
+}
+
+static inline int queue_top(DijkstraWorkspace *ws) {
+  switch ( ws->queue ) {
+  case DIJKSTRA_QUEUE_RADIX:  return radix_top(ws);
+  case DIJKSTRA_QUEUE_BUCKET: return bucket_top(ws);
+  default:                    return ws->b[1];
+  }
+}
+
+static inline int queue_remove(DijkstraWorkspace *ws) {
+  int v;
+  switch ( ws->queue ) {
+  case DIJKSTRA_QUEUE_BINARY:
+    return b_remove(ws);
+  case DIJKSTRA_QUEUE_4ARY:
+    v = ws->b[1];
+    ws->b[1] = ws->b[ws->b_size--];
+    if ( ws->b_size > 0 ) downheap4( ws, 1 );
+    break;
+  default:
+    v = queue_top(ws);
+    ws->bucket[ws->queue == DIJKSTRA_QUEUE_RADIX ? 0 : ws->last % ws->num_buckets].size--;
+    ws->b_size--;
+  }
+  ws->node[v].pos_heap = 0;
+  return v;
+}
+
+static inline void queue_decrease(DijkstraWorkspace *ws, int v, int d) {
+  switch ( ws->queue ) {
+  case DIJKSTRA_QUEUE_BINARY:
+    b_relax(ws, v, d);
+    break;
+  case DIJKSTRA_QUEUE_4ARY:
+    ws->node[v].d = d;
+    upheap4(ws, ws->node[v].pos_heap);
+    break;
+  default:
+    ws->node[v].d = d;
+    bucket_insert(ws, v);
+  }
+}
+
+/*
+** Inserts a start vertex with an initial distance into the priority queue.
+** Several start vertices are possible, for example both ends of an edge.
+*/
+void dijkstra_add_start(DijkstraWorkspace *ws, int v, int d) {
+  struct Dijkstra *node = ws->node;
+  int h = 0;
+  if( ws->goal ){
+    h = node[v].d == INT_MAX ? goal_potential(ws, v) : ws->potential[v];
+    if( h == INT_MAX ) return;
+    d += h;
+  }
+  if( d >= node[v].d ) return;
+  if( node[v].d == INT_MAX ){
+    if( ws->goal ) ws->potential[v] = h;
+    ws->touched[ws->num_touched++] = v;
+    node[v].d = d;
+    queue_insert(ws, v);
+  }else{
+    queue_decrease(ws, v, d);
+  }
+  node[v].v_node = -1;
+  node[v].v_edge = -1;
+}
+
 /*
 ** Dijkstra Algorithm
 ** https://en.wikipedia.org/wiki/Dijkstra%27s_algorithm
+**
+** Continues the search from the start vertices in the priority queue.
+** Only arcs permitted by mask_permit are used. The search stops
+**  - when all num_dest vertices in dest[] are settled (dest NULL: no destination)
+**  - when num_targets vertices marked in target[] are settled (target NULL: no targets)
+**  - before a vertex with a distance greater than max_dist would be settled
+**
+** With a goal (dijkstra_set_goal()) the distances in the priority queue are
+** distance + potential, so max_dist limits the distance of the routes via
+** a vertex. At the end the potentials are subtracted again.
+**
+** The result is in ws->node[], vertices without predecessor have
+** v_node = -1 and v_edge = -1. Settled vertices have a distance and
+** pos_heap = 0, vertices still in the priority queue have pos_heap > 0.
 */
-void Dijkstra(struct Graph* graph, int start_node, int dest_node) {
-  int i, minD=0, minB=0;
-  /* Allocate memory */
-  node = (struct Dijkstra*) malloc(graph->num_nodes * sizeof(struct Dijkstra));
-  if(!node) abort_msg("Out of memory");
-  b = (int *) malloc(graph->num_nodes * sizeof(int));
-  if(!b) abort_msg("Out of memory");
-  /* Initialize distances and heap */
-  for (i = 0; i < graph->num_nodes; i++) {
-    node[i].d = INT_MAX;
-    node[i].v_node = 0;
-    node[i].v_edge = 0;
-    b[i] = 0;
-  }
-  b_size = 0;
-  /* Insert start node in priority queue */
-  b_insert(start_node);
-  node[start_node].d = 0;
+void dijkstra_run(
+  DijkstraWorkspace *ws,
+  const RoutingGraph* graph,
+  int mask_permit,
+  const int *dest,
+  int num_dest,
+  const unsigned char *target,
+  int num_targets,
+  int max_dist
+){
+  struct Dijkstra *node = ws->node;
+  int a, i, d, h=0, minD=0, minB=0;
+  const GraphArc *arc;
   /* While priority queue is not empty */
-  while( b_size!=0 ){
+  while( ws->b_size!=0 ){
+    /* Stop if the next node is beyond the distance limit */
+    if (node[queue_top(ws)].d > max_dist) break;
     /* Remove node u with minimal distance from priority queue */
-    minB = b_remove();
+    minB = queue_remove(ws);
     minD = node[minB].d;
-    /* If node u is the destination node, the algorithm can be aborted */
-    if (minB == dest_node) break;
+    if (ws->goal) minD -= ws->potential[minB];
+    /* If all destination nodes are settled, the algorithm can be aborted */
+    for (i = 0; i < num_dest && dest[i] != minB; i++);
+    if (i < num_dest) {
+      for (i = 0; i < num_dest && node[dest[i]].d != INT_MAX && node[dest[i]].pos_heap == 0; i++);
+      if (i == num_dest) break;
+    }
+    if (target && target[minB] && --num_targets <= 0) break;
     /* Get each neighbor v of node u */
-    struct AdjNode* pCrawl = graph->array[minB].head;
-    while (pCrawl) {
-      /* If node v has not yet been visited, then add it to the priority queue */
-      if (node[pCrawl->dest].d == INT_MAX) b_insert(pCrawl->dest);
+    for (a = graph->first_arc[minB]; a < graph->first_arc[minB+1]; a++) {
+      arc = &graph->arc[a];
+      if (!permit_allows(arc->permit, arc->backward ^ ws->reverse, mask_permit)) continue;
       /* If this path is shorter, then relax */
-      if (minD + pCrawl->dist < node[pCrawl->dest].d) {
-        /* Enter new distance in the priority queue, adjust priority */
-        b_relax(pCrawl->dest, minD + pCrawl->dist );
+      d = minD + arc->dist;
+      if (ws->goal) {
+        h = node[arc->head].d == INT_MAX ? goal_potential(ws, arc->head) : ws->potential[arc->head];
+        if (h == INT_MAX) continue;
+        d += h;
+      }
+      if (d < node[arc->head].d) {
+        if (node[arc->head].d == INT_MAX) {
+          /* Node v has not yet been visited, add it to the priority queue */
+          if (ws->goal) ws->potential[arc->head] = h;
+          ws->touched[ws->num_touched++] = arc->head;
+          node[arc->head].d = d;
+          queue_insert(ws, arc->head);
+        } else {
+          /* Enter new distance in the priority queue, adjust priority */
+          queue_decrease(ws, arc->head, d);
+        }
         /* Saving the predecessor node and edge */
-        node[pCrawl->dest].v_node = minB;
-        node[pCrawl->dest].v_edge = pCrawl->edge;
+        node[arc->head].v_node = minB;
+        node[arc->head].v_edge = arc->edge;
       }
-      pCrawl = pCrawl->next;
     }
 
   }
-  /* Free memory for the heap */
-  free(b);
+  if (ws->goal) goal_finish(ws);
 }
 
-void destroyDijkstra() {
-  free(node);
+/*
+** Search from start_node, see dijkstra_run() (dest_node -1: no destination)
+*/
+void dijkstra_search(
+  DijkstraWorkspace *ws,
+  const RoutingGraph* graph,
+  int start_node,
+  int mask_permit,
+  int dest_node,
+  const unsigned char *target,
+  int num_targets,
+  int max_dist
+){
+  dijkstra_workspace_reset(ws);
+  dijkstra_add_start(ws, start_node, 0);
+  dijkstra_run(ws, graph, mask_permit, &dest_node, dest_node >= 0 ? 1 : 0,
+               target, num_targets, max_dist);
 }
 
+/*
+** Shortest path tree from start_node until dest_node is settled
+*/
+void Dijkstra(DijkstraWorkspace *ws, const RoutingGraph* graph, int start_node, int dest_node, int mask_permit) {
+  dijkstra_search(ws, graph, start_node, mask_permit, dest_node, NULL, 0, INT_MAX);
+}
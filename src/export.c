@@ -0,0 +1,606 @@
+/**
+ * \file export.c
+ * \brief Export of the nodes and ways of a boundingbox as GeoJSON or FlatGeobuf
+ *
+ * The features are found with the R*Tree indexes: nodes with tags as points,
+ * ways as lines with the coordinates of their nodes. A filter key or
+ * key=value selects the features with this tag. Each feature has the
+ * properties osm_type, osm_id and tags (JSON object).
+ *
+ * The features are assembled one by one and written with buffered writes,
+ * the memory does not grow with the number of features:
+ *
+ *   geojson  FeatureCollection, one feature per line
+ *   fgb      FlatGeobuf with packed Hilbert R-tree index. The features are
+ *            sorted by SQLite in the order of the Hilbert curve. The size of
+ *            the index is known from the number of features, so the
+ *            features are written behind the space of the index and their
+ *            boundingboxes are filled in block by block. The upper levels
+ *            of the index are then made from the levels below in the file.
+ */
+
+#define EXPORT_BUFFER     65536   /* Size of the stdio buffer of the output file */
+#define FGB_NODE_SIZE     16      /* Number of children of a node of the index */
+#define FGB_BLOCK_ITEMS   4096    /* Index items written at once */
+#define FGB_ITEM_SIZE     40      /* minX, minY, maxX, maxY, offset */
+#define FGB_MAX_LEVELS    32
+#define FGB_REF           -4      /* Field with an offset to a table, string or vector */
+
+/* FlatGeobuf geometry and column types */
+#define FGB_UNKNOWN       0
+#define FGB_POINT         1
+#define FGB_LINESTRING    2
+#define FGB_LONG          7
+#define FGB_STRING        11
+#define FGB_JSON          12
+
+/*
+** Nodes with tags and ways within the boundingbox ?1..?4 with the tag ?5=?6
+** (?5 NULL: all, ?6 NULL: any value), boundingbox of the ways from the R*Tree
+*/
+#define EXPORT_FEATURES \
+  " SELECT 0 AS type,n.node_id AS id,n.lon AS min_lon,n.lat AS min_lat,n.lon AS max_lon,n.lat AS max_lat" \
+  " FROM rtree_node AS r" \
+  " JOIN nodes AS n ON n.node_id=r.node_id" \
+  " WHERE r.max_lon>=?1 AND r.min_lon<=?3 AND r.max_lat>=?2 AND r.min_lat<=?4" \
+  "   AND n.lon BETWEEN ?1 AND ?3 AND n.lat BETWEEN ?2 AND ?4" \
+  "   AND (?5 IS NULL OR EXISTS (SELECT 1 FROM node_tags AS t" \
+  "        WHERE t.node_id=r.node_id AND t.key=?5 AND (?6 IS NULL OR t.value=?6)))" \
+  " UNION ALL" \
+  " SELECT 1,r.way_id,r.min_lon,r.min_lat,r.max_lon,r.max_lat" \
+  " FROM rtree_way AS r" \
+  " WHERE r.max_lon>=?1 AND r.min_lon<=?3 AND r.max_lat>=?2 AND r.min_lat<=?4" \
+  "   AND (?5 IS NULL OR EXISTS (SELECT 1 FROM way_tags AS t" \
+  "        WHERE t.way_id=r.way_id AND t.key=?5 AND (?6 IS NULL OR t.value=?6)))" \
+  "   AND EXISTS (SELECT 1 FROM way_nodes AS wn JOIN nodes AS n ON n.node_id=wn.node_id" \
+  "        WHERE wn.way_id=r.way_id)"
+
+typedef struct {
+  FILE *f;
+  sqlite3_stmt *stmt_node_tags;
+  sqlite3_stmt *stmt_way_tags;
+  sqlite3_stmt *stmt_way_nodes;
+  NodeList points;       /* Geometry of the current feature */
+  StrBuf tags;           /* Tags of the current feature as JSON object */
+  int64_t num_features;
+} Export;
+
+/*
+** Appends a JSON string, NULL as empty string
+*/
+static void export_json_string(StrBuf *sb, const char *s) {
+  const char *run;
+  if( !s ) s = "";
+  strbuf_printf(sb, "\"");
+  while( *s ){
+    for(run=s; *s && *s!='"' && *s!='\\' && (unsigned char)*s>=0x20; s++);
+    if( s>run ) strbuf_printf(sb, "%.*s", (int)(s - run), run);
+    if( *s=='"' || *s=='\\' ) strbuf_printf(sb, "\\%c", *s++);
+    else if( *s ) strbuf_printf(sb, "\\u%04x", (unsigned char)*s++);
+  }
+  strbuf_printf(sb, "\"");
+}
+
+/*
+** Reads the geometry and the tags of a feature, returns 0 if no node
+** of the way is in the database (not exported)
+*/
+static int export_read_feature(Export *ex, const int is_way, const int64_t id, const double lon, const double lat) {
+  sqlite3_stmt *stmt;
+  int first = 1;
+  nodelist_clear(&ex->points);
+  if( is_way ){
+    sqlite3_bind_int64(ex->stmt_way_nodes, 1, id);
+    while( (rc = sqlite3_step(ex->stmt_way_nodes))==SQLITE_ROW ){
+      nodelist_add(&ex->points, sqlite3_column_double(ex->stmt_way_nodes, 0),
+                   sqlite3_column_double(ex->stmt_way_nodes, 1), 0);
+    }
+    if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+    sqlite3_reset(ex->stmt_way_nodes);
+    if( ex->points.size==0 ) return 0;
+    /* A line needs two points */
+    if( ex->points.size==1 ) nodelist_add(&ex->points, ex->points.node[0].lon, ex->points.node[0].lat, 0);
+  }
+  else nodelist_add(&ex->points, lon, lat, 0);
+  stmt = is_way ? ex->stmt_way_tags : ex->stmt_node_tags;
+  strbuf_clear(&ex->tags);
+  strbuf_printf(&ex->tags, "{");
+  sqlite3_bind_int64(stmt, 1, id);
+  while( (rc = sqlite3_step(stmt))==SQLITE_ROW ){
+    if( !first ) strbuf_printf(&ex->tags, ",");
+    export_json_string(&ex->tags, (const char *)sqlite3_column_text(stmt, 0));
+    strbuf_printf(&ex->tags, ":");
+    export_json_string(&ex->tags, (const char *)sqlite3_column_text(stmt, 1));
+    first = 0;
+  }
+  if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+  sqlite3_reset(stmt);
+  strbuf_printf(&ex->tags, "}");
+  return 1;
+}
+
+static void export_write_geojson(Export *ex, const int is_way, const int64_t id) {
+  size_t i;
+  fprintf(ex->f, "%s{\"type\":\"Feature\",\"geometry\":", ex->num_features>0 ? ",\n" : "");
+  if( is_way ){
+    fprintf(ex->f, "{\"type\":\"LineString\",\"coordinates\":[");
+    for(i=0; i<ex->points.size; i++){
+      fprintf(ex->f, "%s[%.7f,%.7f]", i>0 ? "," : "", ex->points.node[i].lon, ex->points.node[i].lat);
+    }
+    fprintf(ex->f, "]}");
+  }
+  else {
+    fprintf(ex->f, "{\"type\":\"Point\",\"coordinates\":[%.7f,%.7f]}",
+            ex->points.node[0].lon, ex->points.node[0].lat);
+  }
+  fprintf(ex->f, ",\"properties\":{\"osm_type\":\"%s\",\"osm_id\":%" PRId64 ",\"tags\":%s}}",
+          is_way ? "way" : "node", id, ex->tags.s);
+}
+
+/*
+** Writing FlatBuffers: the objects are written from front to back, a
+** vtable before its table and the strings, vectors and tables a table
+** refers to behind it. Offsets are filled in when the target is written.
+*/
+typedef struct {
+  int size;         /* 0: not present, 1, 2, 4, 8: scalar, FGB_REF: offset */
+  uint64_t value;   /* Value of a scalar */
+  size_t pos;       /* Position of the field in the buffer */
+} FgbField;
+
+static void fgb_set(ProtoBuf *pb, const size_t pos, uint64_t v, const int n) {
+  int i;
+  for(i=0; i<n; i++, v >>= 8) pb->data[pos + i] = (unsigned char)v;
+}
+
+static void fgb_put(ProtoBuf *pb, const uint64_t v, const int n) {
+  protobuf_reserve(pb, n);
+  fgb_set(pb, pb->size, v, n);
+  pb->size += n;
+}
+
+static void fgb_put_double(ProtoBuf *pb, const double d) {
+  uint64_t v;
+  memcpy(&v, &d, 8);
+  fgb_put(pb, v, 8);
+}
+
+/*
+** Zero bytes until (size + extra) is a multiple of align
+*/
+static void fgb_align(ProtoBuf *pb, const size_t align, const size_t extra) {
+  while( (pb->size + extra) % align ) fgb_put(pb, 0, 1);
+}
+
+/*
+** Sets the offset at pos to the object at target
+*/
+static void fgb_ref(ProtoBuf *pb, const size_t pos, const size_t target) {
+  fgb_set(pb, pos, target - pos, 4);
+}
+
+/*
+** Writes a vtable and a table with the fields, larger fields first
+** so each field is aligned. Returns the position of the table.
+*/
+static size_t fgb_table(ProtoBuf *pb, FgbField *field, const int num_fields) {
+  size_t vtable, table;
+  int i, s, size, offset[16], table_size = 4;
+  for(i=0; i<num_fields; i++) offset[i] = 0;
+  for(s=8; s>=1; s/=2){
+    for(i=0; i<num_fields; i++){
+      size = field[i].size==FGB_REF ? 4 : field[i].size;
+      if( size!=s ) continue;
+      table_size = (table_size + s - 1) / s * s;
+      offset[i] = table_size;
+      table_size += s;
+    }
+  }
+  fgb_align(pb, 2, 0);
+  vtable = pb->size;
+  fgb_put(pb, 4 + 2 * num_fields, 2);
+  fgb_put(pb, table_size, 2);
+  for(i=0; i<num_fields; i++) fgb_put(pb, offset[i], 2);
+  fgb_align(pb, 8, 0);
+  table = pb->size;
+  protobuf_reserve(pb, table_size);
+  memset(pb->data + table, 0, table_size);
+  pb->size += table_size;
+  fgb_set(pb, table, table - vtable, 4);
+  for(i=0; i<num_fields; i++){
+    field[i].pos = table + offset[i];
+    if( field[i].size>0 ) fgb_set(pb, field[i].pos, field[i].value, field[i].size);
+  }
+  return table;
+}
+
+/*
+** Starts a vector (or string) the field at pos refers to,
+** the elements follow the length
+*/
+static void fgb_vector(ProtoBuf *pb, const size_t pos, const size_t count, const size_t elem_size) {
+  fgb_align(pb, elem_size<4 ? 4 : elem_size, 4);
+  fgb_ref(pb, pos, pb->size);
+  fgb_put(pb, count, 4);
+}
+
+static void fgb_string(ProtoBuf *pb, const size_t pos, const char *s) {
+  fgb_vector(pb, pos, strlen(s), 1);
+  protobuf_raw(pb, s, strlen(s) + 1);
+}
+
+/*
+** Header with the columns osm_type, osm_id and tags
+*/
+static void fgb_header(ProtoBuf *pb, const bbox *extent, const int64_t num_features) {
+  static const char *const column_name[] = { "osm_type", "osm_id", "tags" };
+  static const int column_type[] = { FGB_STRING, FGB_LONG, FGB_JSON };
+  FgbField header[11] = {
+    { FGB_REF, 0, 0 },                   /* name */
+    { FGB_REF, 0, 0 },                   /* envelope */
+    { 1, FGB_UNKNOWN, 0 },               /* geometry_type: per feature */
+    { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 },
+    { FGB_REF, 0, 0 },                   /* columns */
+    { 8, (uint64_t)num_features, 0 },    /* features_count */
+    { 2, num_features>0 ? FGB_NODE_SIZE : 0, 0 },  /* index_node_size */
+    { FGB_REF, 0, 0 }                    /* crs */
+  };
+  FgbField column[2], crs[2];
+  size_t table, columns_pos;
+  int i;
+  fgb_put(pb, 0, 4);
+  fgb_ref(pb, 0, fgb_table(pb, header, 11));
+  fgb_string(pb, header[0].pos, "pbf2sqlite");
+  fgb_vector(pb, header[1].pos, 4, 8);
+  fgb_put_double(pb, extent->min_lon);
+  fgb_put_double(pb, extent->min_lat);
+  fgb_put_double(pb, extent->max_lon);
+  fgb_put_double(pb, extent->max_lat);
+  fgb_vector(pb, header[7].pos, 3, 4);
+  columns_pos = pb->size;
+  for(i=0; i<3; i++) fgb_put(pb, 0, 4);
+  for(i=0; i<3; i++){
+    column[0] = (FgbField){ FGB_REF, 0, 0 };              /* name */
+    column[1] = (FgbField){ 1, column_type[i], 0 };       /* type */
+    table = fgb_table(pb, column, 2);
+    fgb_ref(pb, columns_pos + 4 * i, table);
+    fgb_string(pb, column[0].pos, column_name[i]);
+  }
+  crs[0] = (FgbField){ 0, 0, 0 };                         /* org: EPSG */
+  crs[1] = (FgbField){ 4, 4326, 0 };                      /* code */
+  fgb_ref(pb, header[10].pos, fgb_table(pb, crs, 2));
+}
+
+/*
+** Feature with the geometry and the properties
+*/
+static void fgb_feature(ProtoBuf *pb, ProtoBuf *prop, const Export *ex, const int is_way, const int64_t id) {
+  FgbField feature[2] = {
+    { FGB_REF, 0, 0 },                   /* geometry */
+    { FGB_REF, 0, 0 }                    /* properties */
+  };
+  FgbField geometry[7] = {
+    { 0, 0, 0 },                         /* ends */
+    { FGB_REF, 0, 0 },                   /* xy */
+    { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 }, { 0, 0, 0 },
+    { 1, is_way ? FGB_LINESTRING : FGB_POINT, 0 }  /* type */
+  };
+  size_t i;
+  /* Properties: column index and value */
+  protobuf_clear(prop);
+  fgb_put(prop, 0, 2);
+  fgb_put(prop, is_way ? 3 : 4, 4);
+  protobuf_raw(prop, is_way ? "way" : "node", is_way ? 3 : 4);
+  fgb_put(prop, 1, 2);
+  fgb_put(prop, (uint64_t)id, 8);
+  fgb_put(prop, 2, 2);
+  fgb_put(prop, ex->tags.len, 4);
+  protobuf_raw(prop, ex->tags.s, ex->tags.len);
+  protobuf_clear(pb);
+  fgb_put(pb, 0, 4);
+  fgb_ref(pb, 0, fgb_table(pb, feature, 2));
+  fgb_ref(pb, feature[0].pos, fgb_table(pb, geometry, 7));
+  fgb_vector(pb, geometry[1].pos, 2 * ex->points.size, 8);
+  for(i=0; i<ex->points.size; i++){
+    fgb_put_double(pb, ex->points.node[i].lon);
+    fgb_put_double(pb, ex->points.node[i].lat);
+  }
+  fgb_vector(pb, feature[1].pos, prop->size, 1);
+  protobuf_raw(pb, prop->data, prop->size);
+}
+
+/*
+** Position on the Hilbert curve of a point in a grid of 65536 x 65536
+** (as in the reference implementation of FlatGeobuf)
+*/
+static uint32_t fgb_hilbert(const uint32_t x, const uint32_t y) {
+  uint32_t a = x ^ y;
+  uint32_t b = 0xFFFF ^ a;
+  uint32_t c = 0xFFFF ^ (x | y);
+  uint32_t d = x & (y ^ 0xFFFF);
+  uint32_t A = a | (b >> 1);
+  uint32_t B = (a >> 1) ^ a;
+  uint32_t C = ((c >> 1) ^ (b & (d >> 1))) ^ c;
+  uint32_t D = ((a & (c >> 1)) ^ (d >> 1)) ^ d;
+  uint32_t i0, i1;
+  a = A; b = B; c = C; d = D;
+  A = ((a & (a >> 2)) ^ (b & (b >> 2)));
+  B = ((a & (b >> 2)) ^ (b & ((a ^ b) >> 2)));
+  C ^= ((a & (c >> 2)) ^ (b & (d >> 2)));
+  D ^= ((b & (c >> 2)) ^ ((a ^ b) & (d >> 2)));
+  a = A; b = B; c = C; d = D;
+  A = ((a & (a >> 4)) ^ (b & (b >> 4)));
+  B = ((a & (b >> 4)) ^ (b & ((a ^ b) >> 4)));
+  C ^= ((a & (c >> 4)) ^ (b & (d >> 4)));
+  D ^= ((b & (c >> 4)) ^ ((a ^ b) & (d >> 4)));
+  a = A; b = B; c = C; d = D;
+  C ^= ((a & (c >> 8)) ^ (b & (d >> 8)));
+  D ^= ((b & (c >> 8)) ^ ((a ^ b) & (d >> 8)));
+  a = C ^ (C >> 1);
+  b = D ^ (D >> 1);
+  i0 = x ^ y;
+  i1 = b | (0xFFFF ^ (i0 | a));
+  i0 = (i0 | (i0 << 8)) & 0x00FF00FF;
+  i0 = (i0 | (i0 << 4)) & 0x0F0F0F0F;
+  i0 = (i0 | (i0 << 2)) & 0x33333333;
+  i0 = (i0 | (i0 << 1)) & 0x55555555;
+  i1 = (i1 | (i1 << 8)) & 0x00FF00FF;
+  i1 = (i1 | (i1 << 4)) & 0x0F0F0F0F;
+  i1 = (i1 | (i1 << 2)) & 0x33333333;
+  i1 = (i1 | (i1 << 1)) & 0x55555555;
+  return (i1 << 1) | i0;
+}
+
+/*
+** SQL function export_hilbert(lon, lat), position in the extent of the export
+*/
+static void fgb_hilbert_func(sqlite3_context *context, int argc, sqlite3_value **argv) {
+  const bbox *e = sqlite3_user_data(context);
+  double x, y;
+  x = e->max_lon>e->min_lon ? (sqlite3_value_double(argv[0]) - e->min_lon) / (e->max_lon - e->min_lon) : 0;
+  y = e->max_lat>e->min_lat ? (sqlite3_value_double(argv[1]) - e->min_lat) / (e->max_lat - e->min_lat) : 0;
+  x = x<0 ? 0 : x>1 ? 1 : x;
+  y = y<0 ? 0 : y>1 ? 1 : y;
+  sqlite3_result_int64(context, fgb_hilbert((uint32_t)(x * 0xFFFF), (uint32_t)(y * 0xFFFF)));
+}
+
+/* 64 bit offset, long has only 32 bits on Windows */
+static void fgb_seek(FILE *f, const int64_t pos) {
+#ifdef _WIN32
+  if( _fseeki64(f, pos, SEEK_SET)!=0 ) abort_msg("Option export: Error seeking in file");
+#else
+  if( fseeko(f, (off_t)pos, SEEK_SET)!=0 ) abort_msg("Option export: Error seeking in file");
+#endif
+}
+
+/*
+** Makes the upper levels of the index from the leaves in the file,
+** level_offset[i] and level_num[i] are the first node and the number
+** of nodes of level i (0: leaves)
+*/
+static void fgb_index_levels(
+  FILE *f,
+  const int64_t index_pos,
+  const uint64_t *level_offset,
+  const uint64_t *level_num,
+  const int num_levels
+){
+  unsigned char child[FGB_NODE_SIZE * 64 * FGB_ITEM_SIZE];
+  ProtoBuf parent;
+  uint64_t pos, end, next, n, k, i;
+  double v[4], item[4];
+  int l, j;
+  protobuf_init(&parent);
+  for(l=0; l<num_levels-1; l++){
+    pos = level_offset[l];
+    end = level_offset[l] + level_num[l];
+    next = level_offset[l+1];
+    while( pos<end ){
+      n = end - pos<FGB_NODE_SIZE * 64 ? end - pos : FGB_NODE_SIZE * 64;
+      fgb_seek(f, index_pos + pos * FGB_ITEM_SIZE);
+      if( fread(child, FGB_ITEM_SIZE, n, f)!=n ) abort_msg("Option export: Error reading file");
+      protobuf_clear(&parent);
+      for(k=0; k<n; k+=FGB_NODE_SIZE){
+        for(i=k; i<n && i<k+FGB_NODE_SIZE; i++){
+          for(j=0; j<4; j++){
+            uint64_t u = 0;
+            int b;
+            for(b=7; b>=0; b--) u = u << 8 | child[i * FGB_ITEM_SIZE + 8 * j + b];
+            memcpy(&item[j], &u, 8);
+          }
+          if( i==k ) memcpy(v, item, sizeof(v));
+          if( item[0]<v[0] ) v[0] = item[0];
+          if( item[1]<v[1] ) v[1] = item[1];
+          if( item[2]>v[2] ) v[2] = item[2];
+          if( item[3]>v[3] ) v[3] = item[3];
+        }
+        for(j=0; j<4; j++) fgb_put_double(&parent, v[j]);
+        fgb_put(&parent, pos + k, 8);   /* First child */
+      }
+      fgb_seek(f, index_pos + next * FGB_ITEM_SIZE);
+      if( fwrite(parent.data, 1, parent.size, f)!=parent.size ) abort_msg("Option export: Error writing file");
+      next += parent.size / FGB_ITEM_SIZE;
+      pos += n;
+    }
+  }
+  protobuf_free(&parent);
+}
+
+/**
+ * \brief Exports the nodes and ways of a boundingbox with a tag
+ *
+ * format is "geojson" or "fgb" (FlatGeobuf), filter is NULL (all nodes
+ * with tags and all ways), a key or key=value.
+ */
+void export_features(
+  sqlite3 *db,
+  const char *format,
+  const bbox b,
+  const char *filter,
+  const char *filename
+){
+  Export ex;
+  sqlite3_stmt *stmt;
+  char *key = NULL, *value = NULL;
+  int fgb, is_way, num_levels = 0;
+  int64_t id, num_features = 0, index_pos = 0, features_pos = 0, item = 0, leaves_flushed = 0;
+  uint64_t level_num[FGB_MAX_LEVELS], level_offset[FGB_MAX_LEVELS], num_nodes, n;
+  bbox extent = b;
+  ProtoBuf pb, prop, leaves;
+  double t0, t1;
+  size_t i;
+  t0 = time_now();
+  if( strcmp(format, "geojson")==0 ) fgb = 0;
+  else if( strcmp(format, "fgb")==0 ) fgb = 1;
+  else abort_msg("Option export: Format 'geojson' or 'fgb' expected");
+  if( filter ){
+    key = strdup(filter);
+    if( !key ) abort_msg("Out of memory");
+    value = strchr(key, '=');
+    if( value ) *value++ = '\0';
+    if( key[0]=='\0' ) abort_msg("Option export: key or key=value expected");
+  }
+  rc = sqlite3_prepare_v2(db, "SELECT key,value FROM node_tags WHERE node_id=?", -1, &ex.stmt_node_tags, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  rc = sqlite3_prepare_v2(db, "SELECT key,value FROM way_tags WHERE way_id=?", -1, &ex.stmt_way_tags, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  rc = sqlite3_prepare_v2(db,
+    " SELECT n.lon,n.lat"
+    " FROM way_nodes AS wn"
+    " JOIN nodes AS n ON n.node_id=wn.node_id"
+    " WHERE wn.way_id=?"
+    " ORDER BY wn.node_order", -1, &ex.stmt_way_nodes, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  /* FlatGeobuf: number and extent of the features for the header and the index */
+  if( fgb ){
+    rc = sqlite3_prepare_v2(db,
+      "SELECT count(*),min(min_lon),min(min_lat),max(max_lon),max(max_lat) FROM (" EXPORT_FEATURES ")",
+      -1, &stmt, NULL);
+    if( rc!=SQLITE_OK ) abort_msg("Option export: R*Tree indexes missing (option rtree)");
+    sqlite3_bind_double(stmt, 1, b.min_lon);
+    sqlite3_bind_double(stmt, 2, b.min_lat);
+    sqlite3_bind_double(stmt, 3, b.max_lon);
+    sqlite3_bind_double(stmt, 4, b.max_lat);
+    sqlite3_bind_text(stmt, 5, key, -1, NULL);
+    sqlite3_bind_text(stmt, 6, value, -1, NULL);
+    if( (rc = sqlite3_step(stmt))!=SQLITE_ROW ) abort_db_error(db, rc);
+    num_features = sqlite3_column_int64(stmt, 0);
+    if( num_features>0 ){
+      extent.min_lon = sqlite3_column_double(stmt, 1);
+      extent.min_lat = sqlite3_column_double(stmt, 2);
+      extent.max_lon = sqlite3_column_double(stmt, 3);
+      extent.max_lat = sqlite3_column_double(stmt, 4);
+    }
+    sqlite3_finalize(stmt);
+    rc = sqlite3_create_function(db, "export_hilbert", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                                 &extent, fgb_hilbert_func, NULL, NULL);
+    if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  }
+  rc = sqlite3_prepare_v2(db, fgb ?
+    "SELECT * FROM (" EXPORT_FEATURES ") ORDER BY export_hilbert((min_lon+max_lon)/2,(min_lat+max_lat)/2)" :
+    EXPORT_FEATURES, -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_msg("Option export: R*Tree indexes missing (option rtree)");
+  sqlite3_bind_double(stmt, 1, b.min_lon);
+  sqlite3_bind_double(stmt, 2, b.min_lat);
+  sqlite3_bind_double(stmt, 3, b.max_lon);
+  sqlite3_bind_double(stmt, 4, b.max_lat);
+  sqlite3_bind_text(stmt, 5, key, -1, NULL);
+  sqlite3_bind_text(stmt, 6, value, -1, NULL);
+  /* Output file */
+  ex.f = fopen(filename, fgb ? "w+b" : "w");
+  if( ex.f==NULL ) abort_msg("Error opening file");
+  setvbuf(ex.f, NULL, _IOFBF, EXPORT_BUFFER);
+  nodelist_init(&ex.points);
+  strbuf_init(&ex.tags);
+  ex.num_features = 0;
+  protobuf_init(&pb);
+  protobuf_init(&prop);
+  protobuf_init(&leaves);
+  if( fgb ){
+    /* Magic bytes, header and the space of the index */
+    fwrite("fgb\3fgb\0", 1, 8, ex.f);
+    fgb_header(&pb, &extent, num_features);
+    fgb_put(&prop, pb.size, 4);
+    fwrite(prop.data, 1, 4, ex.f);
+    fwrite(pb.data, 1, pb.size, ex.f);
+    index_pos = 12 + pb.size;
+    num_nodes = 0;
+    if( num_features>0 ){
+      n = num_features;
+      num_nodes = n;
+      level_num[num_levels++] = n;
+      do {
+        n = (n + FGB_NODE_SIZE - 1) / FGB_NODE_SIZE;
+        num_nodes += n;
+        level_num[num_levels++] = n;
+      } while( n!=1 );
+      n = num_nodes;
+      for(i=0; i<(size_t)num_levels; i++) level_offset[i] = n -= level_num[i];
+    }
+    features_pos = index_pos + num_nodes * FGB_ITEM_SIZE;
+    fgb_seek(ex.f, features_pos);
+  }
+  else fprintf(ex.f, "{\"type\":\"FeatureCollection\",\"features\":[\n");
+  while( (rc = sqlite3_step(stmt))==SQLITE_ROW ){
+    is_way = sqlite3_column_int(stmt, 0);
+    id = sqlite3_column_int64(stmt, 1);
+    /* Ways without nodes are not counted by EXPORT_FEATURES */
+    if( !export_read_feature(&ex, is_way, id, sqlite3_column_double(stmt, 2), sqlite3_column_double(stmt, 3)) ) continue;
+    if( fgb ){
+      double v[4];
+      if( ex.num_features==num_features ) abort_msg("Option export: Database changed during export");
+      /* Index item: boundingbox and offset of the feature */
+      v[0] = v[2] = ex.points.node[0].lon;
+      v[1] = v[3] = ex.points.node[0].lat;
+      for(i=1; i<ex.points.size; i++){
+        if( ex.points.node[i].lon<v[0] ) v[0] = ex.points.node[i].lon;
+        if( ex.points.node[i].lat<v[1] ) v[1] = ex.points.node[i].lat;
+        if( ex.points.node[i].lon>v[2] ) v[2] = ex.points.node[i].lon;
+        if( ex.points.node[i].lat>v[3] ) v[3] = ex.points.node[i].lat;
+      }
+      for(i=0; i<4; i++) fgb_put_double(&leaves, v[i]);
+      fgb_put(&leaves, item, 8);
+      fgb_feature(&pb, &prop, &ex, is_way, id);
+      protobuf_clear(&prop);
+      fgb_put(&prop, pb.size, 4);
+      fwrite(prop.data, 1, 4, ex.f);
+      fwrite(pb.data, 1, pb.size, ex.f);
+      item += 4 + pb.size;
+      if( leaves.size==FGB_BLOCK_ITEMS * FGB_ITEM_SIZE ){
+        fgb_seek(ex.f, index_pos + (level_offset[0] + leaves_flushed) * FGB_ITEM_SIZE);
+        fwrite(leaves.data, 1, leaves.size, ex.f);
+        leaves_flushed += FGB_BLOCK_ITEMS;
+        protobuf_clear(&leaves);
+        fgb_seek(ex.f, features_pos + item);
+      }
+    }
+    else export_write_geojson(&ex, is_way, id);
+    ex.num_features++;
+  }
+  if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+  sqlite3_finalize(stmt);
+  if( fgb ){
+    if( ex.num_features!=num_features ) abort_msg("Option export: Database changed during export");
+    if( num_features>0 ){
+      fgb_seek(ex.f, index_pos + (level_offset[0] + leaves_flushed) * FGB_ITEM_SIZE);
+      fwrite(leaves.data, 1, leaves.size, ex.f);
+      fgb_index_levels(ex.f, index_pos, level_offset, level_num, num_levels);
+    }
+  }
+  else fprintf(ex.f, "\n]}\n");
+  if( ferror(ex.f) ) abort_msg("Option export: Error writing file");
+  if( fclose(ex.f)!=0 ) abort_msg("Error closing file");
+  t1 = time_now();
+  fprintf(stderr, "export: %" PRId64 " features written to %s in %.3f s\n", ex.num_features, filename, t1-t0);
+  /* Cleanup */
+  if( fgb ) sqlite3_create_function(db, "export_hilbert", 2, SQLITE_UTF8, NULL, NULL, NULL, NULL);
+  protobuf_free(&leaves);
+  protobuf_free(&prop);
+  protobuf_free(&pb);
+  strbuf_free(&ex.tags);
+  nodelist_free(&ex.points);
+  sqlite3_finalize(ex.stmt_node_tags);
+  sqlite3_finalize(ex.stmt_way_tags);
+  sqlite3_finalize(ex.stmt_way_nodes);
+  free(key);
+}
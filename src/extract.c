@@ -0,0 +1,681 @@
+/**
+ * \file extract.c
+ * \brief Extract of a region of the database as OSM PBF file
+ *
+ * The region is a boundingbox or a polygon (Osmosis .poly file).
+ * Complete objects are selected with the R*Tree indexes:
+ *
+ *   - nodes with tags in the region
+ *   - ways with at least one node in the region, with all their nodes
+ *   - relations with a selected node or way as member and the relations
+ *     with these relations as member
+ *
+ * The IDs are collected in temporary tables, so the objects are read in
+ * the order of their IDs (Sort.Type_then_ID). The main thread encodes the
+ * blocks (DenseNodes, ways, relations), worker threads compress them with
+ * zlib. The blocks are kept in a ring of slots; when the main thread needs
+ * the slot of the oldest block again, this block is written to the file,
+ * so the blocks are written in the order of encoding.
+ */
+
+#define EXTRACT_BLOCK_OBJECTS   8000        /* Objects per block */
+#define EXTRACT_BLOCK_BYTES     (8 << 20)   /* Size of a block before compression */
+
+/*
+** Region: boundingbox and optional polygon (rings of points)
+*/
+typedef struct {
+  bbox b;
+  NodeList points;      /* Points of all rings */
+  int *ring;            /* Ring i: points ring[i] .. ring[i+1]-1 */
+  int num_rings;
+} ExtractRegion;
+
+/*
+** Reads a polygon file in the Osmosis format: a name, then sections
+** with a name (holes start with '!') and lines "lon lat", each section
+** and the file end with "END"
+*/
+static void extract_read_poly(ExtractRegion *r, const char *filename) {
+  FILE *f;
+  char line[256];
+  double lon, lat;
+  int in_section = 0;
+  size_t i;
+  f = fopen(filename, "r");
+  if( f==NULL ) abort_msg("Option extract-pbf: Error opening polygon file");
+  r->ring = malloc(sizeof(int));
+  if( !r->ring ) abort_msg("Out of memory");
+  r->ring[0] = 0;
+  if( !fgets(line, sizeof(line), f) ) abort_msg("Option extract-pbf: Empty polygon file");
+  while( fgets(line, sizeof(line), f) ){
+    if( strncmp(line, "END", 3)==0 ){
+      if( !in_section ) break;
+      in_section = 0;
+      if( (int)r->points.size==r->ring[r->num_rings] ) continue;
+      r->num_rings++;
+      r->ring = realloc(r->ring, (r->num_rings + 1) * sizeof(int));
+      if( !r->ring ) abort_msg("Out of memory");
+      r->ring[r->num_rings] = (int)r->points.size;
+    }
+    else if( in_section ){
+      if( sscanf(line, "%lf %lf", &lon, &lat)!=2 ) abort_msg("Option extract-pbf: Invalid line in polygon file");
+      nodelist_add(&r->points, lon, lat, 0);
+    }
+    else if( strspn(line, " \t\r\n")<strlen(line) ) in_section = 1;
+  }
+  fclose(f);
+  if( r->num_rings==0 ) abort_msg("Option extract-pbf: No polygon in polygon file");
+  r->b.min_lon = r->b.max_lon = r->points.node[0].lon;
+  r->b.min_lat = r->b.max_lat = r->points.node[0].lat;
+  for(i=1; i<r->points.size; i++){
+    if( r->points.node[i].lon<r->b.min_lon ) r->b.min_lon = r->points.node[i].lon;
+    if( r->points.node[i].lon>r->b.max_lon ) r->b.max_lon = r->points.node[i].lon;
+    if( r->points.node[i].lat<r->b.min_lat ) r->b.min_lat = r->points.node[i].lat;
+    if( r->points.node[i].lat>r->b.max_lat ) r->b.max_lat = r->points.node[i].lat;
+  }
+}
+
+/*
+** 1 if the point is in the region (even-odd rule, so holes are outside)
+*/
+static int extract_inside(const ExtractRegion *r, const double lon, const double lat) {
+  const Node *p = r->points.node;
+  int i, j, k, inside = 0;
+  if( lon<r->b.min_lon || lon>r->b.max_lon || lat<r->b.min_lat || lat>r->b.max_lat ) return 0;
+  if( r->num_rings==0 ) return 1;
+  for(k=0; k<r->num_rings; k++){
+    for(i=r->ring[k], j=r->ring[k+1]-1; i<r->ring[k+1]; j=i++){
+      if( (p[i].lat>lat)!=(p[j].lat>lat) &&
+          lon<(p[j].lon - p[i].lon) * (lat - p[i].lat) / (p[j].lat - p[i].lat) + p[i].lon ) inside = !inside;
+    }
+  }
+  return inside;
+}
+
+/*
+** SQL function extract_inside(lon, lat)
+*/
+static void extract_inside_func(sqlite3_context *context, int argc, sqlite3_value **argv) {
+  sqlite3_result_int(context, extract_inside(sqlite3_user_data(context),
+                     sqlite3_value_double(argv[0]), sqlite3_value_double(argv[1])));
+}
+
+/*
+** Block of the PBF file (PrimitiveBlock with one PrimitiveGroup)
+**
+** The strings of the block are stored once, a hash table finds the
+** index of a string that was already used (index 0 is the empty string).
+*/
+typedef struct {
+  int num_objects;
+  ProtoBuf chars;             /* Strings of the block */
+  size_t *string_pos;         /* String i: chars.data[string_pos[i]] .. chars.data[string_pos[i+1]-1] */
+  int num_strings, cap_strings;
+  int *hash;                  /* String index, 0: empty */
+  int hash_size;              /* Power of 2 */
+  ProtoBuf ids, lats, lons, keys_vals;          /* DenseNodes */
+  int64_t last_id, last_lat, last_lon;
+  ProtoBuf group;                               /* Encoded ways or relations */
+  ProtoBuf keys, vals, refs, roles, types, obj; /* Current way or relation */
+  int64_t last_ref;
+} PbfBlock;
+
+static void pbf_block_init(PbfBlock *k) {
+  memset(k, 0, sizeof(PbfBlock));
+  k->cap_strings = 256;
+  k->string_pos = malloc((k->cap_strings + 1) * sizeof(size_t));
+  k->hash_size = 512;
+  k->hash = calloc(k->hash_size, sizeof(int));
+  if( !k->string_pos || !k->hash ) abort_msg("Out of memory");
+}
+
+static void pbf_block_clear(PbfBlock *k) {
+  k->num_objects = 0;
+  protobuf_clear(&k->chars);
+  k->num_strings = 1;
+  k->string_pos[0] = k->string_pos[1] = 0;
+  memset(k->hash, 0, k->hash_size * sizeof(int));
+  protobuf_clear(&k->ids);
+  protobuf_clear(&k->lats);
+  protobuf_clear(&k->lons);
+  protobuf_clear(&k->keys_vals);
+  k->last_id = k->last_lat = k->last_lon = 0;
+  protobuf_clear(&k->group);
+}
+
+static void pbf_block_free(PbfBlock *k) {
+  ProtoBuf *pb[] = { &k->chars, &k->ids, &k->lats, &k->lons, &k->keys_vals, &k->group,
+                     &k->keys, &k->vals, &k->refs, &k->roles, &k->types, &k->obj };
+  size_t i;
+  for(i=0; i<sizeof(pb)/sizeof(pb[0]); i++) protobuf_free(pb[i]);
+  free(k->string_pos);
+  free(k->hash);
+}
+
+static int *pbf_string_slot(PbfBlock *k, const char *s, const size_t len) {
+  int i, *slot;
+  size_t pos;
+  for(i=mvt_hash((const unsigned char *)s, len) & (k->hash_size-1); ; i=(i+1) & (k->hash_size-1)){
+    slot = &k->hash[i];
+    if( *slot==0 ) return slot;
+    pos = k->string_pos[*slot];
+    if( k->string_pos[*slot+1]-pos==len && memcmp(k->chars.data+pos, s, len)==0 ) return slot;
+  }
+}
+
+/*
+** Index of the string in the string table of the block
+*/
+static int pbf_string(PbfBlock *k, const char *s) {
+  size_t len = strlen(s);
+  int *slot, i;
+  if( len==0 ) return 0;
+  slot = pbf_string_slot(k, s, len);
+  if( *slot ) return *slot;
+  if( k->num_strings==k->cap_strings ){
+    k->cap_strings *= 2;
+    k->string_pos = realloc(k->string_pos, (k->cap_strings + 1) * sizeof(size_t));
+    if( !k->string_pos ) abort_msg("Out of memory");
+  }
+  protobuf_raw(&k->chars, s, len);
+  *slot = k->num_strings++;
+  k->string_pos[k->num_strings] = k->chars.size;
+  /* Hash table at most half full */
+  if( 2*k->num_strings>=k->hash_size ){
+    k->hash_size *= 2;
+    k->hash = realloc(k->hash, k->hash_size * sizeof(int));
+    if( !k->hash ) abort_msg("Out of memory");
+    memset(k->hash, 0, k->hash_size * sizeof(int));
+    for(i=1; i<k->num_strings; i++){
+      *pbf_string_slot(k, (const char *)k->chars.data + k->string_pos[i],
+                       k->string_pos[i+1] - k->string_pos[i]) = i;
+    }
+  }
+  return k->num_strings - 1;
+}
+
+/*
+** Dense nodes: the tags of a node follow pbf_node(), pbf_node_end() ends the node
+*/
+static void pbf_node(PbfBlock *k, const int64_t id, const double lon, const double lat) {
+  int64_t ilat = llround(lat * 1e7), ilon = llround(lon * 1e7);   /* granularity 100 nanodegrees */
+  protobuf_varint(&k->ids, protobuf_zigzag(id - k->last_id));
+  protobuf_varint(&k->lats, protobuf_zigzag(ilat - k->last_lat));
+  protobuf_varint(&k->lons, protobuf_zigzag(ilon - k->last_lon));
+  k->last_id = id;
+  k->last_lat = ilat;
+  k->last_lon = ilon;
+  k->num_objects++;
+}
+
+static void pbf_node_tag(PbfBlock *k, const char *key, const char *value) {
+  protobuf_varint(&k->keys_vals, pbf_string(k, key ? key : ""));
+  protobuf_varint(&k->keys_vals, pbf_string(k, value ? value : ""));
+}
+
+static void pbf_node_end(PbfBlock *k) {
+  protobuf_varint(&k->keys_vals, 0);
+}
+
+/*
+** Ways and relations: tags, node references or members of the
+** current object, pbf_object_end() adds the object to the block
+*/
+static void pbf_object_begin(PbfBlock *k) {
+  protobuf_clear(&k->keys);
+  protobuf_clear(&k->vals);
+  protobuf_clear(&k->refs);
+  protobuf_clear(&k->roles);
+  protobuf_clear(&k->types);
+  k->last_ref = 0;
+}
+
+static void pbf_object_tag(PbfBlock *k, const char *key, const char *value) {
+  protobuf_varint(&k->keys, pbf_string(k, key ? key : ""));
+  protobuf_varint(&k->vals, pbf_string(k, value ? value : ""));
+}
+
+static void pbf_way_ref(PbfBlock *k, const int64_t node_id) {
+  protobuf_varint(&k->refs, protobuf_zigzag(node_id - k->last_ref));
+  k->last_ref = node_id;
+}
+
+static void pbf_relation_member(PbfBlock *k, const int type, const int64_t ref_id, const char *role) {
+  protobuf_varint(&k->roles, pbf_string(k, role ? role : ""));
+  protobuf_varint(&k->refs, protobuf_zigzag(ref_id - k->last_ref));
+  protobuf_varint(&k->types, type);
+  k->last_ref = ref_id;
+}
+
+static void pbf_object_end(PbfBlock *k, const int is_relation, const int64_t id) {
+  protobuf_clear(&k->obj);
+  protobuf_uint(&k->obj, 1, (uint64_t)id);
+  if( k->keys.size ) protobuf_bytes(&k->obj, 2, k->keys.data, k->keys.size);
+  if( k->vals.size ) protobuf_bytes(&k->obj, 3, k->vals.data, k->vals.size);
+  if( is_relation ){
+    if( k->roles.size ) protobuf_bytes(&k->obj, 8, k->roles.data, k->roles.size);
+    if( k->refs.size ) protobuf_bytes(&k->obj, 9, k->refs.data, k->refs.size);
+    if( k->types.size ) protobuf_bytes(&k->obj, 10, k->types.data, k->types.size);
+  }
+  else if( k->refs.size ) protobuf_bytes(&k->obj, 8, k->refs.data, k->refs.size);
+  protobuf_bytes(&k->group, is_relation ? 4 : 3, k->obj.data, k->obj.size);
+  k->num_objects++;
+}
+
+static int pbf_block_full(const PbfBlock *k) {
+  return k->num_objects>=EXTRACT_BLOCK_OBJECTS ||
+         k->group.size + k->ids.size + k->lats.size + k->lons.size + k->keys_vals.size +
+         k->chars.size>=EXTRACT_BLOCK_BYTES;
+}
+
+/*
+** Encodes the PrimitiveBlock, tmp is used for the nested messages
+*/
+static void pbf_block_encode(PbfBlock *k, ProtoBuf *out, ProtoBuf *tmp) {
+  int i;
+  protobuf_clear(out);
+  /* StringTable */
+  protobuf_clear(tmp);
+  for(i=0; i<k->num_strings; i++){
+    protobuf_bytes(tmp, 1, k->chars.data + k->string_pos[i], k->string_pos[i+1] - k->string_pos[i]);
+  }
+  protobuf_bytes(out, 1, tmp->data, tmp->size);
+  /* PrimitiveGroup */
+  if( k->ids.size ){
+    protobuf_clear(tmp);
+    protobuf_bytes(tmp, 1, k->ids.data, k->ids.size);
+    protobuf_bytes(tmp, 8, k->lats.data, k->lats.size);
+    protobuf_bytes(tmp, 9, k->lons.data, k->lons.size);
+    protobuf_bytes(tmp, 10, k->keys_vals.data, k->keys_vals.size);
+    protobuf_clear(&k->group);
+    protobuf_bytes(&k->group, 2, tmp->data, tmp->size);
+  }
+  protobuf_bytes(out, 2, k->group.data, k->group.size);
+}
+
+/*
+** Ring of blocks between encoding, compression and writing
+*/
+typedef struct {
+  const char *type;     /* "OSMHeader" or "OSMData" */
+  ProtoBuf raw;         /* Block before compression */
+  ProtoBuf zip, blob;   /* Compressed data, Blob */
+  ProtoBuf out;         /* Size of the BlobHeader, BlobHeader and Blob */
+  int done;             /* 1 if compressed */
+} ExtractSlot;
+
+static struct {
+  ExtractSlot *slot;
+  int num_slots;
+  int64_t num_encoded;        /* Blocks encoded by the main thread */
+  int64_t num_compressing;    /* Blocks taken by the workers */
+  int64_t num_written;        /* Blocks written to the file */
+  int64_t bytes_written;
+  int finished;               /* 1 if all blocks are encoded */
+  FILE *f;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} extract;
+
+/*
+** Compresses the block of the slot and makes the BlobHeader and the Blob
+*/
+static void extract_blob(ExtractSlot *s) {
+  ProtoBuf header;
+  uLongf zsize = compressBound(s->raw.size);
+  protobuf_clear(&s->zip);
+  protobuf_reserve(&s->zip, zsize);
+  if( compress2(s->zip.data, &zsize, s->raw.data, s->raw.size, Z_DEFAULT_COMPRESSION)!=Z_OK )
+    abort_msg("Option extract-pbf: Error compressing block");
+  s->zip.size = zsize;
+  protobuf_clear(&s->blob);
+  protobuf_uint(&s->blob, 2, s->raw.size);                  /* raw_size */
+  protobuf_bytes(&s->blob, 3, s->zip.data, s->zip.size);    /* zlib_data */
+  protobuf_init(&header);
+  protobuf_string(&header, 1, s->type);                     /* type */
+  protobuf_uint(&header, 3, s->blob.size);                  /* datasize */
+  protobuf_clear(&s->out);
+  protobuf_reserve(&s->out, 4);
+  s->out.data[0] = (unsigned char)(header.size >> 24);      /* Size in network byte order */
+  s->out.data[1] = (unsigned char)(header.size >> 16);
+  s->out.data[2] = (unsigned char)(header.size >> 8);
+  s->out.data[3] = (unsigned char)header.size;
+  s->out.size = 4;
+  protobuf_raw(&s->out, header.data, header.size);
+  protobuf_raw(&s->out, s->blob.data, s->blob.size);
+  protobuf_free(&header);
+}
+
+static void *extract_worker(void *arg) {
+  ExtractSlot *s;
+  pthread_mutex_lock(&extract.lock);
+  while( 1 ){
+    while( extract.num_compressing==extract.num_encoded && !extract.finished )
+      pthread_cond_wait(&extract.cond, &extract.lock);
+    if( extract.num_compressing==extract.num_encoded ) break;
+    s = &extract.slot[extract.num_compressing++ % extract.num_slots];
+    pthread_mutex_unlock(&extract.lock);
+    extract_blob(s);
+    pthread_mutex_lock(&extract.lock);
+    s->done = 1;
+    pthread_cond_broadcast(&extract.cond);
+  }
+  pthread_mutex_unlock(&extract.lock);
+  return NULL;
+}
+
+/*
+** Writes the blocks up to number n-1 in order, waits until they are
+** compressed (the lock is held by the caller)
+*/
+static void extract_write(const int64_t n) {
+  ExtractSlot *s;
+  while( extract.num_written<n ){
+    s = &extract.slot[extract.num_written % extract.num_slots];
+    while( !s->done ) pthread_cond_wait(&extract.cond, &extract.lock);
+    pthread_mutex_unlock(&extract.lock);
+    if( fwrite(s->out.data, 1, s->out.size, extract.f)!=s->out.size )
+      abort_msg("Option extract-pbf: Error writing file");
+    pthread_mutex_lock(&extract.lock);
+    extract.bytes_written += s->out.size;
+    s->done = 0;
+    extract.num_written++;
+  }
+}
+
+/*
+** Slot for the next block, the oldest block is written if all slots are used
+*/
+static ExtractSlot *extract_next_slot(void) {
+  pthread_mutex_lock(&extract.lock);
+  extract_write(extract.num_encoded - extract.num_slots + 1);
+  pthread_mutex_unlock(&extract.lock);
+  return &extract.slot[extract.num_encoded % extract.num_slots];
+}
+
+/*
+** Passes the encoded block in the slot to the workers
+*/
+static void extract_submit(ExtractSlot *s, const char *type) {
+  s->type = type;
+  pthread_mutex_lock(&extract.lock);
+  extract.num_encoded++;
+  pthread_cond_broadcast(&extract.cond);
+  pthread_mutex_unlock(&extract.lock);
+}
+
+static void extract_flush(PbfBlock *k, ProtoBuf *tmp) {
+  ExtractSlot *s;
+  if( k->num_objects==0 ) return;
+  s = extract_next_slot();
+  pbf_block_encode(k, &s->raw, tmp);
+  extract_submit(s, "OSMData");
+  pbf_block_clear(k);
+}
+
+static void extract_header(const bbox *b) {
+  ExtractSlot *s = extract_next_slot();
+  ProtoBuf bb;
+  protobuf_init(&bb);
+  protobuf_sint(&bb, 1, llround(b->min_lon * 1e9));   /* left */
+  protobuf_sint(&bb, 2, llround(b->max_lon * 1e9));   /* right */
+  protobuf_sint(&bb, 3, llround(b->max_lat * 1e9));   /* top */
+  protobuf_sint(&bb, 4, llround(b->min_lat * 1e9));   /* bottom */
+  protobuf_clear(&s->raw);
+  protobuf_bytes(&s->raw, 1, bb.data, bb.size);
+  protobuf_string(&s->raw, 4, "OsmSchema-V0.6");
+  protobuf_string(&s->raw, 4, "DenseNodes");
+  protobuf_string(&s->raw, 5, "Sort.Type_then_ID");
+  protobuf_string(&s->raw, 16, "pbf2sqlite " PBF2SQLITE_VERSION);
+  protobuf_free(&bb);
+  extract_submit(s, "OSMHeader");
+}
+
+static void extract_exec(sqlite3 *db, const char *sql) {
+  rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+}
+
+/*
+** Selects the IDs of the objects in the temporary tables extract_nodes,
+** extract_ways and extract_relations
+*/
+static void extract_select(sqlite3 *db, const ExtractRegion *r) {
+  sqlite3_stmt *stmt;
+  int i;
+  static const char *const sql_rtree[] = {
+    " INSERT INTO temp.extract_nodes (node_id)"
+    " SELECT r.node_id"
+    " FROM rtree_node AS r"
+    " JOIN nodes AS n ON n.node_id=r.node_id"
+    " WHERE r.max_lon>=?1 AND r.min_lon<=?3 AND r.max_lat>=?2 AND r.min_lat<=?4"
+    "   AND extract_inside(n.lon,n.lat)",
+    " INSERT INTO temp.extract_ways (way_id)"
+    " SELECT r.way_id"
+    " FROM rtree_way AS r"
+    " WHERE r.max_lon>=?1 AND r.min_lon<=?3 AND r.max_lat>=?2 AND r.min_lat<=?4"
+    "   AND EXISTS (SELECT 1 FROM way_nodes AS wn JOIN nodes AS n ON n.node_id=wn.node_id"
+    "               WHERE wn.way_id=r.way_id AND extract_inside(n.lon,n.lat))"
+  };
+  rc = sqlite3_create_function(db, "extract_inside", 2, SQLITE_UTF8, (void *)r, extract_inside_func, NULL, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  extract_exec(db,
+    " CREATE TEMP TABLE extract_nodes (node_id INTEGER PRIMARY KEY);"
+    " CREATE TEMP TABLE extract_ways (way_id INTEGER PRIMARY KEY);"
+    " CREATE TEMP TABLE extract_relations (relation_id INTEGER PRIMARY KEY);");
+  for(i=0; i<2; i++){
+    rc = sqlite3_prepare_v2(db, sql_rtree[i], -1, &stmt, NULL);
+    if( rc!=SQLITE_OK ) abort_msg("Option extract-pbf: R*Tree indexes missing (option rtree)");
+    sqlite3_bind_double(stmt, 1, r->b.min_lon);
+    sqlite3_bind_double(stmt, 2, r->b.min_lat);
+    sqlite3_bind_double(stmt, 3, r->b.max_lon);
+    sqlite3_bind_double(stmt, 4, r->b.max_lat);
+    rc = sqlite3_step(stmt);
+    if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+    sqlite3_finalize(stmt);
+  }
+  extract_exec(db,
+    /* All nodes of the ways */
+    " INSERT OR IGNORE INTO temp.extract_nodes (node_id)"
+    " SELECT wn.node_id FROM temp.extract_ways AS e"
+    " JOIN way_nodes AS wn ON wn.way_id=e.way_id;"
+    /* Relations with the nodes and ways as members */
+    " INSERT OR IGNORE INTO temp.extract_relations (relation_id)"
+    " SELECT m.relation_id FROM temp.extract_nodes AS e"
+    " JOIN relation_members AS m ON m.ref_id=e.node_id AND m.ref='node'"
+    " UNION"
+    " SELECT m.relation_id FROM temp.extract_ways AS e"
+    " JOIN relation_members AS m ON m.ref_id=e.way_id AND m.ref='way';"
+    /* Relations with these relations as members */
+    " INSERT OR IGNORE INTO temp.extract_relations (relation_id)"
+    " SELECT m.relation_id FROM temp.extract_relations AS e"
+    " JOIN relation_members AS m ON m.ref_id=e.relation_id AND m.ref='relation';");
+}
+
+/*
+** Tags of a way or relation
+*/
+static void extract_tags(sqlite3 *db, sqlite3_stmt *stmt, PbfBlock *k, const int64_t id) {
+  sqlite3_bind_int64(stmt, 1, id);
+  while( (rc = sqlite3_step(stmt))==SQLITE_ROW ){
+    pbf_object_tag(k, (const char *)sqlite3_column_text(stmt, 0), (const char *)sqlite3_column_text(stmt, 1));
+  }
+  if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+  sqlite3_reset(stmt);
+}
+
+/**
+ * \brief Writes the objects of a region as OSM PBF file
+ *
+ * The region is the boundingbox b or the polygon in poly_file (if not NULL).
+ */
+void extract_pbf(
+  sqlite3 *db,
+  const char *poly_file,
+  const bbox b,
+  const char *filename,
+  const int threads
+){
+  ExtractRegion region;
+  PbfBlock block;
+  ProtoBuf tmp;
+  sqlite3_stmt *stmt, *stmt_tags;
+  pthread_t *thread;
+  int64_t id, last_id, num_nodes = 0, num_ways = 0, num_relations = 0;
+  const char *ref;
+  double t0, t1;
+  int i;
+  t0 = time_now();
+  if( threads<1 || threads>SERVE_MAX_THREADS ) abort_msg("Option extract-pbf: Invalid number of threads");
+  /* Region */
+  nodelist_init(&region.points);
+  region.ring = NULL;
+  region.num_rings = 0;
+  region.b = b;
+  if( poly_file ) extract_read_poly(&region, poly_file);
+  if( region.b.min_lon>region.b.max_lon || region.b.min_lat>region.b.max_lat )
+    abort_msg("Option extract-pbf: Invalid boundingbox");
+  extract_select(db, &region);
+  /* Output file and compression threads */
+  extract.f = fopen(filename, "wb");
+  if( extract.f==NULL ) abort_msg("Error opening file");
+  extract.num_slots = 2 * threads + 2;
+  extract.slot = calloc(extract.num_slots, sizeof(ExtractSlot));
+  if( !extract.slot ) abort_msg("Out of memory");
+  extract.num_encoded = extract.num_compressing = extract.num_written = 0;
+  extract.bytes_written = 0;
+  extract.finished = 0;
+  pthread_mutex_init(&extract.lock, NULL);
+  pthread_cond_init(&extract.cond, NULL);
+  thread = malloc(threads * sizeof(pthread_t));
+  if( !thread ) abort_msg("Out of memory");
+  for(i=0; i<threads; i++){
+    if( pthread_create(&thread[i], NULL, extract_worker, NULL)!=0 )
+      abort_msg("Option extract-pbf: Error creating thread");
+  }
+  extract_header(&region.b);
+  pbf_block_init(&block);
+  pbf_block_clear(&block);
+  protobuf_init(&tmp);
+  /* Nodes */
+  rc = sqlite3_prepare_v2(db,
+    " SELECT n.node_id,n.lon,n.lat,t.key,t.value"
+    " FROM temp.extract_nodes AS e"
+    " JOIN nodes AS n ON n.node_id=e.node_id"
+    " LEFT JOIN node_tags AS t ON t.node_id=e.node_id"
+    " ORDER BY e.node_id", -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  last_id = 0;
+  while( (rc = sqlite3_step(stmt))==SQLITE_ROW ){
+    id = sqlite3_column_int64(stmt, 0);
+    if( num_nodes==0 || id!=last_id ){
+      if( num_nodes>0 ){
+        pbf_node_end(&block);
+        if( pbf_block_full(&block) ) extract_flush(&block, &tmp);
+      }
+      pbf_node(&block, id, sqlite3_column_double(stmt, 1), sqlite3_column_double(stmt, 2));
+      last_id = id;
+      num_nodes++;
+    }
+    if( sqlite3_column_type(stmt, 3)!=SQLITE_NULL ){
+      pbf_node_tag(&block, (const char *)sqlite3_column_text(stmt, 3), (const char *)sqlite3_column_text(stmt, 4));
+    }
+  }
+  if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+  sqlite3_finalize(stmt);
+  if( num_nodes>0 ) pbf_node_end(&block);
+  extract_flush(&block, &tmp);
+  /* Ways */
+  rc = sqlite3_prepare_v2(db, "SELECT key,value FROM way_tags WHERE way_id=?", -1, &stmt_tags, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  rc = sqlite3_prepare_v2(db,
+    " SELECT e.way_id,wn.node_id"
+    " FROM temp.extract_ways AS e"
+    " LEFT JOIN way_nodes AS wn ON wn.way_id=e.way_id"
+    " ORDER BY e.way_id,wn.node_order", -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  while( (rc = sqlite3_step(stmt))==SQLITE_ROW ){
+    id = sqlite3_column_int64(stmt, 0);
+    if( num_ways==0 || id!=last_id ){
+      if( num_ways>0 ){
+        pbf_object_end(&block, 0, last_id);
+        if( pbf_block_full(&block) ) extract_flush(&block, &tmp);
+      }
+      pbf_object_begin(&block);
+      extract_tags(db, stmt_tags, &block, id);
+      last_id = id;
+      num_ways++;
+    }
+    if( sqlite3_column_type(stmt, 1)!=SQLITE_NULL ) pbf_way_ref(&block, sqlite3_column_int64(stmt, 1));
+  }
+  if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+  sqlite3_finalize(stmt);
+  sqlite3_finalize(stmt_tags);
+  if( num_ways>0 ) pbf_object_end(&block, 0, last_id);
+  extract_flush(&block, &tmp);
+  /* Relations */
+  rc = sqlite3_prepare_v2(db, "SELECT key,value FROM relation_tags WHERE relation_id=?", -1, &stmt_tags, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  rc = sqlite3_prepare_v2(db,
+    " SELECT e.relation_id,m.ref,m.ref_id,m.role"
+    " FROM temp.extract_relations AS e"
+    " LEFT JOIN relation_members AS m ON m.relation_id=e.relation_id"
+    " ORDER BY e.relation_id,m.member_order", -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  while( (rc = sqlite3_step(stmt))==SQLITE_ROW ){
+    id = sqlite3_column_int64(stmt, 0);
+    if( num_relations==0 || id!=last_id ){
+      if( num_relations>0 ){
+        pbf_object_end(&block, 1, last_id);
+        if( pbf_block_full(&block) ) extract_flush(&block, &tmp);
+      }
+      pbf_object_begin(&block);
+      extract_tags(db, stmt_tags, &block, id);
+      last_id = id;
+      num_relations++;
+    }
+    ref = (const char *)sqlite3_column_text(stmt, 1);
+    if( ref ){
+      pbf_relation_member(&block, strcmp(ref, "node")==0 ? 0 : strcmp(ref, "way")==0 ? 1 : 2,
+                          sqlite3_column_int64(stmt, 2), (const char *)sqlite3_column_text(stmt, 3));
+    }
+  }
+  if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+  sqlite3_finalize(stmt);
+  sqlite3_finalize(stmt_tags);
+  if( num_relations>0 ) pbf_object_end(&block, 1, last_id);
+  extract_flush(&block, &tmp);
+  /* Remaining blocks */
+  pthread_mutex_lock(&extract.lock);
+  extract.finished = 1;
+  pthread_cond_broadcast(&extract.cond);
+  extract_write(extract.num_encoded);
+  pthread_mutex_unlock(&extract.lock);
+  for(i=0; i<threads; i++) pthread_join(thread[i], NULL);
+  if( fclose(extract.f)!=0 ) abort_msg("Error closing file");
+  t1 = time_now();
+  fprintf(stderr, "extract-pbf: %" PRId64 " nodes, %" PRId64 " ways, %" PRId64 " relations,"
+          " %" PRId64 " blocks with %.1f MB in %.3f s with %d threads\n",
+          num_nodes, num_ways, num_relations, extract.num_written, extract.bytes_written / 1e6, t1-t0, threads);
+  /* Cleanup */
+  extract_exec(db,
+    " DROP TABLE temp.extract_nodes;"
+    " DROP TABLE temp.extract_ways;"
+    " DROP TABLE temp.extract_relations;");
+  sqlite3_create_function(db, "extract_inside", 2, SQLITE_UTF8, NULL, NULL, NULL, NULL);
+  for(i=0; i<extract.num_slots; i++){
+    protobuf_free(&extract.slot[i].raw);
+    protobuf_free(&extract.slot[i].zip);
+    protobuf_free(&extract.slot[i].blob);
+    protobuf_free(&extract.slot[i].out);
+  }
+  free(extract.slot);
+  free(thread);
+  pthread_mutex_destroy(&extract.lock);
+  pthread_cond_destroy(&extract.cond);
+  protobuf_free(&tmp);
+  pbf_block_free(&block);
+  nodelist_free(&region.points);
+  free(region.ring);
+}
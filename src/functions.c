@@ -53,6 +53,95 @@ void abort_msg(const char *msg) {
   exit(EXIT_FAILURE);
 }
 
+/*
+** Growable string buffer
+*/
+typedef struct {
+  char *s;
+  size_t len;       /* length of the string */
+  size_t capacity;  /* allocated bytes */
+} StrBuf;
+
+void strbuf_init(StrBuf *sb) {
+  sb->len = 0;
+  sb->capacity = 256;
+  sb->s = malloc(sb->capacity);
+  if (!sb->s) abort_msg("Out of memory");
+  sb->s[0] = '\0';
+}
+
+void strbuf_clear(StrBuf *sb) {
+  sb->len = 0;
+  sb->s[0] = '\0';
+}
+
+/* Append formatted text */
+void strbuf_printf(StrBuf *sb, const char *format, ...) {
+  va_list args;
+  int n;
+  va_start(args, format);
+  n = vsnprintf(sb->s + sb->len, sb->capacity - sb->len, format, args);
+  va_end(args);
+  if( n<0 ) abort_msg("Error formatting string");
+  if( sb->len + n >= sb->capacity ){
+    while( sb->len + n >= sb->capacity ) sb->capacity *= 2;
+    sb->s = realloc(sb->s, sb->capacity);
+    if (!sb->s) abort_msg("Out of memory");
+    va_start(args, format);
+    vsnprintf(sb->s + sb->len, sb->capacity - sb->len, format, args);
+    va_end(args);
+  }
+  sb->len += n;
+}
+
+void strbuf_free(StrBuf *sb) {
+  free(sb->s);
+  sb->s = NULL;
+  sb->len = sb->capacity = 0;
+}
+
+/**
+ * \brief Wall clock time in seconds, for measuring durations
+ */
+double time_now(void) {
+#ifdef CLOCK_MONOTONIC
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+  return (double)time(NULL);
+#endif
+}
+
+/**
+ * \brief Number of online processors, at least 1
+ */
+int number_of_cpus(void) {
+#ifdef _SC_NPROCESSORS_ONLN
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if( n>0 ) return (int)n;
+#endif
+  return 1;
+}
+
+/**
+ * \brief Number of worker threads with their own database connections
+ *
+ * Without mutexes (SQLite compiled with SQLITE_THREADSAFE=0) only one
+ * connection may be used at a time, then only one worker is used.
+ */
+int db_worker_threads(int threads) {
+  return sqlite3_threadsafe() ? threads : 1;
+}
+
+/**
+ * \brief Checks a location in degrees
+ * \return 1 if lon is -180..180 and lat -90..90 (not NaN or infinite), otherwise 0
+ */
+int valid_location(double lon, double lat) {
+  return isfinite(lon) && isfinite(lat) && fabs(lon)<=180 && fabs(lat)<=90;
+}
+
 /**
  * \brief Conversion degree to radians
  */
@@ -17,12 +17,28 @@ void parse_args(sqlite3 *db, int argc, char **argv, int exec) {
     else if( strcmp("rtree", argv[i])==0 ){
       if( exec ) add_rtree(db);
     }
+    else if( strcmp("addr", argv[i])==0 && argc>=i+2 && strcmp("areas", argv[i+1])==0 ){
+      if( exec ) add_addr_areas(db, number_of_cpus());
+      i++;
+    }
     else if( strcmp("addr", argv[i])==0 ){
       if( exec ) add_addr(db);
     }
+    else if( strcmp("graph", argv[i])==0 && argc>=i+2 && strcmp("image", argv[i+1])==0 ){
+      if( exec ) add_graph_image(db);
+      i++;
+    }
+    else if( strcmp("graph", argv[i])==0 && argc>=i+3 && strcmp("landmarks", argv[i+1])==0 ){
+      id = get_argv_int64(argv, i+2);
+      if( exec ) add_graph_landmarks(db, (int)id);
+      i += 2;
+    }
     else if( strcmp("graph", argv[i])==0 ){
       if( exec ) add_graph(db);
     }
+    else if( strcmp("areas", argv[i])==0 ){
+      if( exec ) add_areas(db, number_of_cpus());
+    }
     else if( strcmp("node", argv[2])==0 && argc==4 ){
       id = get_argv_int64(argv, 3);
       if( exec ) show_node(db, id);
@@ -62,10 +78,81 @@ void parse_args(sqlite3 *db, int argc, char **argv, int exec) {
       if( exec ) sql_read_stdin(db);
       break;
     } 
+    else if( strcmp("tiles", argv[2])==0 && (argc==6 || argc==7) ){
+      int threads = argc==7 ? (int)get_argv_int64(argv, 6) : number_of_cpus();
+      if( exec ) write_tiles(db, (int)get_argv_int64(argv, 3), (int)get_argv_int64(argv, 4), argv[5], threads);
+      break;
+    } 
+    else if( strcmp("export", argv[2])==0 && (argc==9 || argc==10) ){
+      b.min_lon = get_argv_double(argv, 4);
+      b.min_lat = get_argv_double(argv, 5);
+      b.max_lon = get_argv_double(argv, 6);
+      b.max_lat = get_argv_double(argv, 7);
+      if( exec ) export_features(db, argv[3], b, argc==10 ? argv[8] : NULL, argv[argc-1]);
+      break;
+    } 
+    else if( strcmp("extract-pbf", argv[2])==0 && (argc==8 || argc==9) ){
+      int threads = argc==9 ? (int)get_argv_int64(argv, 8) : number_of_cpus();
+      b.min_lon = get_argv_double(argv, 3);
+      b.min_lat = get_argv_double(argv, 4);
+      b.max_lon = get_argv_double(argv, 5);
+      b.max_lat = get_argv_double(argv, 6);
+      if( exec ) extract_pbf(db, NULL, b, argv[7], threads);
+      break;
+    } 
+    else if( strcmp("extract-pbf", argv[2])==0 && (argc==5 || argc==6) ){
+      int threads = argc==6 ? (int)get_argv_int64(argv, 5) : number_of_cpus();
+      b.min_lon = -180;
+      b.min_lat = -90;
+      b.max_lon = 180;
+      b.max_lat = 90;
+      if( exec ) extract_pbf(db, argv[3], b, argv[4], threads);
+      break;
+    } 
     else if( strcmp("route", argv[2])==0 && argc>=9 ){
       if( exec ) route(db, argc, argv);
       break;
     } 
+    else if( strcmp("route-batch", argv[2])==0 && argc>=6 && argc<=8 ){
+      int threads = number_of_cpus();
+      int geometry = 0;
+      for(i=6; i<argc; i++){
+        if( strcmp("polyline", argv[i])==0 ) geometry = 1;
+        else threads = (int)get_argv_int64(argv, i);
+      }
+      if( exec ) route_batch(db, argv[3], argv[4], argv[5], threads, geometry);
+      break;
+    } 
+    else if( strcmp("route-bench", argv[2])==0 && argc==5 ){
+      if( exec ) route_bench(db, argv[3], argv[4]);
+      break;
+    } 
+    else if( strcmp("matrix", argv[2])==0 && (argc==7 || argc==8) ){
+      int threads = argc==8 ? (int)get_argv_int64(argv, 7) : number_of_cpus();
+      if( exec ) distance_matrix(db, argv[3], argv[4], argv[5], argv[6], threads);
+      break;
+    } 
+    else if( strcmp("isochrone", argv[2])==0 && argc==8 ){
+      if( exec ) isochrone(db, argv[3], get_argv_double(argv, 4), get_argv_double(argv, 5),
+                           (int)get_argv_int64(argv, 6), argv[7]);
+      break;
+    } 
+    else if( strcmp("nearest", argv[2])==0 && argc==8 ){
+      if( exec ) nearest(db, argv[3], get_argv_double(argv, 4), get_argv_double(argv, 5),
+                         argv[6], (int)get_argv_int64(argv, 7));
+      break;
+    } 
+    else if( strcmp("serve", argv[2])==0 && argc>=4 && argc<=6 ){
+      const char *socket_path = NULL;
+      int cache_mb = ROUTE_CACHE_MB;
+      id = get_argv_int64(argv, 3);
+      for(i=4; i<argc; i++){
+        if( strncmp("cache=", argv[i], 6)==0 ) cache_mb = atoi(argv[i]+6);
+        else socket_path = argv[i];
+      }
+      if( exec ) serve(db, (int)id, socket_path, cache_mb);
+      break;
+    } 
     else {
       printf("Incorrect option '%s'\n", argv[i]);
       exit(EXIT_FAILURE);
@@ -1,71 +1,3 @@
-/**
- * \brief Determine intermediate nodes of a way
- */
-void slice_way_nodes(
-  sqlite3 *db,
-  uint64_t way_id,
-  uint64_t start_node_id,
-  uint64_t end_node_id,
-  NodeList *nl
-){
-  int n;
-  sqlite3_stmt *stmt_points;
-  n = 0;
-  rc = sqlite3_prepare_v2(db,
-    " SELECT n.lon,n.lat,n.node_id"
-    " FROM way_nodes AS wn"
-    " LEFT JOIN nodes AS n ON wn.node_id=n.node_id"
-    " WHERE wn.way_id=?1"
-    "   AND wn.node_order>=(SELECT node_order FROM way_nodes"
-    "                       WHERE way_id=?2 AND node_id=?3)"
-    "   AND wn.node_order<=(SELECT node_order FROM way_nodes"
-    "                       WHERE way_id=?4 AND node_id=?5)"
-    " ORDER BY wn.node_order",
-     -1, &stmt_points, NULL);
-  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
-  sqlite3_bind_int64(stmt_points, 1, way_id);
-  sqlite3_bind_int64(stmt_points, 2, way_id);
-  sqlite3_bind_int64(stmt_points, 3, start_node_id);
-  sqlite3_bind_int64(stmt_points, 4, way_id);
-  sqlite3_bind_int64(stmt_points, 5, end_node_id);
-  while( sqlite3_step(stmt_points)==SQLITE_ROW ){
-    nodelist_add(nl, (double)sqlite3_column_double(stmt_points, 0),
-                     (double)sqlite3_column_double(stmt_points, 1),
-                     (double)sqlite3_column_int64(stmt_points, 2) );
-    n++;
-  }
-  sqlite3_finalize(stmt_points);
-  /*
-  ** If no nodes were found then search in the opposite direction
-  */
-  if( n==0 ){
-    rc = sqlite3_prepare_v2(db,
-      " SELECT n.lon,n.lat,n.node_id"
-      " FROM way_nodes AS wn"
-      " LEFT JOIN nodes AS n ON wn.node_id=n.node_id"
-      " WHERE wn.way_id=?1"
-      "   AND wn.node_order>=(SELECT node_order FROM way_nodes"
-      "                       WHERE way_id=?2 AND node_id=?3)"
-      "   AND wn.node_order<=(SELECT node_order FROM way_nodes"
-      "                       WHERE way_id=?4 AND node_id=?5)"
-      " ORDER BY wn.node_order DESC  -- nodes in reverse order",
-     -1, &stmt_points, NULL);
-    if( rc!=SQLITE_OK ) abort_db_error(db, rc);
-    sqlite3_bind_int64(stmt_points, 1, way_id);
-    sqlite3_bind_int64(stmt_points, 2, way_id);
-    sqlite3_bind_int64(stmt_points, 3, end_node_id);
-    sqlite3_bind_int64(stmt_points, 4, way_id);
-    sqlite3_bind_int64(stmt_points, 5, start_node_id);
-    while( sqlite3_step(stmt_points)==SQLITE_ROW ){
-      nodelist_add(nl, (double)sqlite3_column_double(stmt_points, 0),
-                       (double)sqlite3_column_double(stmt_points, 1),
-                       (double)sqlite3_column_int64(stmt_points, 2) );
-      n++;
-    }
-    sqlite3_finalize(stmt_points);
-  }
-}
-
 /**
  * \brief Create subgraph
  *
@@ -81,11 +13,12 @@ int create_subgraph_tables(
 ){
   sqlite3_stmt *stmt_subgraph, *stmt_count;
   int number_of_nodes;
+  graph_check_geometry(db);
   rc = sqlite3_exec(db, "DROP TABLE IF EXISTS subgraph", NULL, NULL, NULL);
   if( rc!=SQLITE_OK ) abort_db_error(db, rc);
   rc = sqlite3_prepare_v2(db,
     " CREATE TEMP TABLE subgraph AS"
-    " SELECT edge_id,start_node_id,end_node_id,dist,way_id,"
+    " SELECT edge_id,start_node_id,end_node_id,dist,way_id,permit,geometry,"
     "        CASE"
     "          WHEN (?1&2=2 AND permit&16=16) OR"
     "               (?2&4=4 AND permit&32=32) THEN 1"
@@ -145,50 +78,42 @@ int create_subgraph_tables(
 }
 
 /**
- * \brief Find the nearest node in the subgraph
+ * \brief Load the routing graph
+ *
+ *  Maps the graph image '<database>.graph' if it exists and is up to date.
+ *  Otherwise the graph is built from the tables, restricted to the
+ *  boundingbox and the permit mask if b is not NULL.
+ *
+ * \return 1 if the graph image is used, 0 if the graph was built
  */
-int64_t subgraph_nearest_node(
+int routing_graph_load(
   sqlite3 *db,
-  const double lon,
-  const double lat
+  const bbox *b,
+  const int mask_permit,
+  RoutingGraph *g
 ){
-  sqlite3_stmt *stmt;
-  double min_dist_node = DBL_MAX;
-  int64_t graph_node_no, no;
-  double graph_node_lon, graph_node_lat, dist;
-  no = -1;
-  rc = sqlite3_prepare_v2(db, "SELECT no,lon,lat FROM subgraph_nodes", -1, &stmt, NULL);
-  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
-  while( sqlite3_step(stmt)==SQLITE_ROW ){
-    graph_node_no = sqlite3_column_int64(stmt, 0);
-    graph_node_lon = sqlite3_column_double(stmt, 1);
-    graph_node_lat = sqlite3_column_double(stmt, 2);
-    dist = sqrt(pow(lon-graph_node_lon, 2) + pow(lat-graph_node_lat, 2));
-    if( dist < min_dist_node ){
-      no = graph_node_no;
-      min_dist_node = dist;
-    }
+  char *filename;
+  int64_t max_edge_id;
+  int mapped = 0;
+  max_edge_id = graph_max_edge_id(db);
+  filename = graph_image_filename(db);
+  if( filename ){
+    mapped = routing_graph_map(g, filename, max_edge_id);
+    free(filename);
   }
-  sqlite3_finalize(stmt);
-  return no;
-}
-
-/**
- * \brief Get node_id for a subgraph node no
- */
-int64_t subgraph_node_id(
-  sqlite3 *db,
-  const int64_t no
-){
-  sqlite3_stmt *stmt;
-  int64_t node_id = -1;
-  rc = sqlite3_prepare_v2(db, "SELECT node_id FROM subgraph_nodes WHERE no=?", -1, &stmt, NULL);
-  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
-  sqlite3_bind_int64(stmt, 1, no);
-  while( sqlite3_step(stmt)==SQLITE_ROW ){
-    node_id = sqlite3_column_int64(stmt, 0);
+  if( mapped ) return 1;
+  if( b==NULL ){
+    routing_graph_build_complete(db, g);
+    return 0;
   }
-  sqlite3_finalize(stmt);
-  return node_id;
+  create_subgraph_tables(db, *b, mask_permit);
+  routing_graph_build(db, g,
+    "SELECT no,node_id,lon,lat FROM subgraph_nodes ORDER BY no",
+    " SELECT s.edge_id,s.way_id,sns.no,sne.no,s.dist,s.permit,s.geometry"
+    " FROM subgraph AS s"
+    " LEFT JOIN subgraph_nodes AS sns ON s.start_node_id=sns.node_id"
+    " LEFT JOIN subgraph_nodes AS sne ON s.end_node_id=sne.node_id"
+    " ORDER BY s.edge_id",
+    max_edge_id);
+  return 0;
 }
-
@@ -0,0 +1,313 @@
+/**
+ * \file isochrone.c
+ * \brief Area reachable from a point within a distance limit
+ *
+ * A search from the position of the start point on the nearest edge
+ * stops at the distance limit.
+ * The reached vertices, the reached (partial) edges and a grid raster
+ * of the reachable area are written as GeoJSON and as HTML map.
+ */
+
+#define ISOCHRONE_GRID_CELLS  25   /* Number of grid cells per limit distance */
+
+/*
+** Grid raster of the reachable area, n x n cells
+*/
+typedef struct {
+  double lon0, lat0;     /* South-west corner */
+  double dlon, dlat;     /* Cell size in degrees */
+  int n;                 /* Number of cells per row and column */
+  unsigned char *cell;   /* 1 if the cell contains a part of the reached network */
+} IsoGrid;
+
+static void isogrid_mark(IsoGrid *grid, double lon, double lat) {
+  int x = (int)floor((lon - grid->lon0) / grid->dlon);
+  int y = (int)floor((lat - grid->lat0) / grid->dlat);
+  if( x>=0 && x<grid->n && y>=0 && y<grid->n ) grid->cell[y * grid->n + x] = 1;
+}
+
+/*
+** Marks all cells along the lines of a node list
+*/
+static void isogrid_mark_line(IsoGrid *grid, const NodeList *points) {
+  size_t i;
+  int k, steps;
+  double dx, dy;
+  for(i=0; i<points->size; i++){
+    isogrid_mark(grid, points->node[i].lon, points->node[i].lat);
+    if( i==0 ) continue;
+    dx = points->node[i].lon - points->node[i-1].lon;
+    dy = points->node[i].lat - points->node[i-1].lat;
+    steps = (int)ceil(2 * fmax(fabs(dx) / grid->dlon, fabs(dy) / grid->dlat));
+    for(k=1; k<steps; k++){
+      isogrid_mark(grid, points->node[i-1].lon + dx * k / steps,
+                         points->node[i-1].lat + dy * k / steps);
+    }
+  }
+}
+
+/*
+** Adds the neighbouring cells of all marked cells, so the area
+** between nearby reached roads is closed
+*/
+static void isogrid_dilate(IsoGrid *grid) {
+  int x, y, i, j, n = grid->n;
+  unsigned char *c = calloc((size_t)n * n, 1);
+  if( !c ) abort_msg("Out of memory");
+  for(y=0; y<n; y++){
+    for(x=0; x<n; x++){
+      if( !grid->cell[y * n + x] ) continue;
+      for(j=y-1; j<=y+1; j++){
+        for(i=x-1; i<=x+1; i++){
+          if( i>=0 && i<n && j>=0 && j<n ) c[j * n + i] = 1;
+        }
+      }
+    }
+  }
+  free(grid->cell);
+  grid->cell = c;
+}
+
+static char *isochrone_filename(const char *name, const char *ext) {
+  char *filename = malloc(strlen(name) + strlen(ext) + 1);
+  if( !filename ) abort_msg("Out of memory");
+  strcpy(filename, name);
+  strcat(filename, ext);
+  return filename;
+}
+
+/*
+** Writes a reached edge (or a part of it) to the GeoJSON and HTML files,
+** the line of the map is simplified
+*/
+static void isochrone_write_edge(
+  FILE *geojson,
+  FILE *html,
+  const GraphEdge *e,
+  NodeList *points,
+  const int partial,
+  const double tolerance
+){
+  size_t i;
+  fprintf(geojson, ",\n{\"type\":\"Feature\",\"properties\":{\"edge_id\":%" PRId64
+                   ",\"way_id\":%" PRId64 ",\"partial\":%d},"
+                   "\"geometry\":{\"type\":\"LineString\",\"coordinates\":[",
+                   e->edge_id, e->way_id, partial);
+  for(i=0; i<points->size; i++){
+    fprintf(geojson, "%s[%.7f,%.7f]", i>0 ? "," : "", points->node[i].lon, points->node[i].lat);
+  }
+  fprintf(geojson, "]}}");
+  nodelist_simplify(points, tolerance);
+  leaflet_layer_line(html, points, "", 0);
+}
+
+/**
+ * \brief Calculates the area reachable within a distance
+ *
+ * Creates two files
+ *  - GeoJSON file with the start point, the reached vertices and edges and the area
+ *  - HTML file with a map
+ */
+void isochrone(
+  sqlite3 *db,
+  const char *permit,
+  const double lon,
+  const double lat,
+  const int limit,
+  const char *name
+){
+  int mask_permit;                 /* Permit mask */
+  bbox b;                          /* Boundingbox of all reachable points */
+  double tolerance;                /* Simplification of the lines of the map in meters */
+  RoutingGraph graph;              /* Routing graph (CSR) */
+  int graph_image;                 /* 1 if the graph image is used */
+  DijkstraWorkspace ws;            /* Search workspace */
+  SnapPoint start;                 /* Position of the start point on an edge */
+  SnapPoint pa, pb;                /* Reached part of an edge */
+  int part[3][2], num_parts;       /* Reached parts of an edge in meters from the start of the edge */
+  int *reach;                      /* reach[2*edge+backward]: remaining distance at the edge, -1 not reached */
+  int *edges, num_edges;           /* Reached edges */
+  int num_vertices;                /* Number of reached vertices */
+  int i, j, a, e, v, r, rf, rb, d, x, y, x1, first;
+  const GraphArc *arc;
+  NodeList points;
+  IsoGrid grid;
+  double cell_size, t0, t1;
+  char *filename;
+  FILE *geojson, *html;
+  if( limit<=0 ) abort_msg("Option isochrone: Invalid limit");
+  mask_permit = permit_mask(permit);
+  /* All reachable points are within the limit as the crow flies */
+  cell_size = (double)limit / ISOCHRONE_GRID_CELLS;
+  grid.n = 2 * ISOCHRONE_GRID_CELLS + 4;
+  grid.dlat = cell_size / 111320.0;
+  grid.dlon = cell_size / (111320.0 * cos(radians(lat)));
+  grid.lon0 = lon - grid.dlon * grid.n / 2;
+  grid.lat0 = lat - grid.dlat * grid.n / 2;
+  grid.cell = calloc((size_t)grid.n * grid.n, 1);
+  if( !grid.cell ) abort_msg("Out of memory");
+  b.min_lon = grid.lon0;
+  b.min_lat = grid.lat0;
+  b.max_lon = grid.lon0 + grid.dlon * grid.n;
+  b.max_lat = grid.lat0 + grid.dlat * grid.n;
+  graph_image = routing_graph_load(db, &b, mask_permit, &graph);
+  if( !routing_graph_snap(&graph, lon, lat, mask_permit, &start) )
+    abort_msg("Option isochrone: Coordinates out of range");
+  /* Search until the distance limit */
+  t0 = time_now();
+  dijkstra_workspace_init(&ws, &graph);
+  dijkstra_workspace_reset(&ws);
+  snap_add_start(&ws, &graph, mask_permit, &start);
+  dijkstra_run(&ws, &graph, mask_permit, NULL, 0, NULL, 0, limit);
+  /* Remaining distance at the reached edges, from the start and from the end */
+  reach = malloc(2 * (size_t)graph.num_edges * sizeof(int) + 1);
+  edges = malloc((size_t)graph.num_edges * sizeof(int) + 1);
+  if( !reach || !edges ) abort_msg("Out of memory");
+  memset(reach, 0xff, 2 * (size_t)graph.num_edges * sizeof(int));
+  num_edges = 0;
+  num_vertices = 0;
+  for(i=0; i<ws.num_touched; i++){
+    v = ws.touched[i];
+    if( ws.node[v].pos_heap>0 || ws.node[v].d>limit ) continue;
+    num_vertices++;
+    r = limit - ws.node[v].d;
+    for(a=graph.first_arc[v]; a<graph.first_arc[v+1]; a++){
+      arc = &graph.arc[a];
+      if( !arc_permitted(arc, mask_permit) ) continue;
+      e = arc->edge;
+      if( reach[2*e]==-1 && reach[2*e+1]==-1 ) edges[num_edges++] = e;
+      if( reach[2*e+arc->backward]<r ) reach[2*e+arc->backward] = r;
+    }
+  }
+  if( reach[2*start.edge]==-1 && reach[2*start.edge+1]==-1 ) edges[num_edges++] = start.edge;
+  t1 = time_now();
+  /* GeoJSON and HTML files */
+  filename = isochrone_filename(name, ".geojson");
+  geojson = fopen(filename, "w");
+  if( geojson==NULL ) abort_msg("Error opening file");
+  free(filename);
+  filename = isochrone_filename(name, ".html");
+  html = fopen(filename, "w");
+  if( html==NULL ) abort_msg("Error opening file");
+  free(filename);
+  fprintf(geojson, "{\"type\":\"FeatureCollection\",\"features\":[\n"
+                   "{\"type\":\"Feature\",\"properties\":{\"start\":true,\"limit\":%d},"
+                   "\"geometry\":{\"type\":\"Point\",\"coordinates\":[%.7f,%.7f]}}",
+                   limit, lon, lat);
+  for(i=0; i<ws.num_touched; i++){
+    v = ws.touched[i];
+    if( ws.node[v].pos_heap>0 || ws.node[v].d>limit ) continue;
+    fprintf(geojson, ",\n{\"type\":\"Feature\",\"properties\":{\"node_id\":%" PRId64 ",\"distance\":%d},"
+                     "\"geometry\":{\"type\":\"Point\",\"coordinates\":[%.7f,%.7f]}}",
+                     graph.vertex[v].node_id, ws.node[v].d, graph.vertex[v].lon, graph.vertex[v].lat);
+    isogrid_mark(&grid, graph.vertex[v].lon, graph.vertex[v].lat);
+  }
+  leaflet_html_header(html, "map isochrone");
+  fprintf(html, "<h1>Isochrone</h1>\n<pre>\n");
+  fprintf(html, "# permit: %s (mask_permit: %d)\n", permit, mask_permit);
+  fprintf(html, "# start: %f %f (OSM Way %" PRId64 ")\n", lon, lat, graph.edge[start.edge].way_id);
+  fprintf(html, "# limit: %d m\n", limit);
+  fprintf(html, "# reached vertices: %d\n", num_vertices);
+  fprintf(html, "# reached edges: %d\n", num_edges);
+  fprintf(html, "# search time: %.3f s\n", t1-t0);
+  fprintf(html, "# grid cell size: %.0f m\n", cell_size);
+  fprintf(html, "#\n# graph number nodes: %d%s\n", graph.num_vertices, graph_image ? " (graph image)" : "");
+  fprintf(html, "</pre>\n");
+  fprintf(html, "<div id='map' style='width:100%%; height:500px;'></div>\n");
+  fprintf(html, "<script>\n");
+  leaflet_init(html, "map", b.min_lon, b.min_lat, b.max_lon, b.max_lat);
+  /* Reached edges, complete or the reached parts from both ends */
+  tolerance = leaflet_tolerance(b);
+  nodelist_init(&points);
+  leaflet_style(html, "#0000ff", 0.6, 3, "", "none", 1.0, 5);
+  leaflet_layer_begin(html, "map", "polyline", "");
+  for(i=0; i<num_edges; i++){
+    e = edges[i];
+    d = graph.edge[e].dist;
+    rf = reach[2*e];
+    rb = reach[2*e+1];
+    num_parts = 0;
+    if( rf>=0 ){
+      part[num_parts][0] = 0;
+      part[num_parts++][1] = rf<d ? rf : d;
+    }
+    if( rb>=0 ){
+      part[num_parts][0] = rb<d ? d - rb : 0;
+      part[num_parts++][1] = d;
+    }
+    if( e==start.edge ){
+      /* From the start position in both directions */
+      part[num_parts][0] = start.offset;
+      part[num_parts][1] = start.offset;
+      if( edge_permitted(&graph.edge[e], 1, mask_permit) )
+        part[num_parts][0] = start.offset>limit ? start.offset - limit : 0;
+      if( edge_permitted(&graph.edge[e], 0, mask_permit) )
+        part[num_parts][1] = d - start.offset>limit ? start.offset + limit : d;
+      num_parts++;
+    }
+    /* Sort by the beginning and merge overlapping parts */
+    for(a=1; a<num_parts; a++){
+      for(j=a; j>0 && part[j][0]<part[j-1][0]; j--){
+        x = part[j][0]; part[j][0] = part[j-1][0]; part[j-1][0] = x;
+        x = part[j][1]; part[j][1] = part[j-1][1]; part[j-1][1] = x;
+      }
+    }
+    for(a=0, j=1; j<num_parts; j++){
+      if( part[j][0]<=part[a][1] ){
+        if( part[j][1]>part[a][1] ) part[a][1] = part[j][1];
+      }else{
+        a++;
+        part[a][0] = part[j][0];
+        part[a][1] = part[j][1];
+      }
+    }
+    num_parts = num_parts>0 ? a+1 : 0;
+    for(a=0; a<num_parts; a++){
+      if( part[a][0]>=part[a][1] && d>0 ) continue;
+      pa = edge_position(&graph, e, part[a][0]);
+      pb = edge_position(&graph, e, part[a][1]);
+      nodelist_clear(&points);
+      edge_slice_points(&graph, &pa, &pb, &points);
+      isogrid_mark_line(&grid, &points);
+      isochrone_write_edge(geojson, html, &graph.edge[e], &points, part[a][0]>0 || part[a][1]<d, tolerance);
+    }
+  }
+  leaflet_layer_end(html);
+  /* Area: rows of neighbouring grid cells as rectangles */
+  isogrid_dilate(&grid);
+  leaflet_style(html, "#ff7800", 0.0, 0, "", "#ff7800", 0.3, 5);
+  leaflet_layer_begin(html, "map", "rectangle", "");
+  fprintf(geojson, ",\n{\"type\":\"Feature\",\"properties\":{\"area\":true,\"cell_size\":%.0f},"
+                   "\"geometry\":{\"type\":\"MultiPolygon\",\"coordinates\":[", cell_size);
+  first = 1;
+  for(y=0; y<grid.n; y++){
+    for(x=0; x<grid.n; x++){
+      if( !grid.cell[y * grid.n + x] ) continue;
+      for(x1=x; x<grid.n && grid.cell[y * grid.n + x]; x++);
+      fprintf(geojson, "%s\n[[[%.7f,%.7f],[%.7f,%.7f],[%.7f,%.7f],[%.7f,%.7f],[%.7f,%.7f]]]",
+              first ? "" : ",",
+              grid.lon0 + x1 * grid.dlon, grid.lat0 + y * grid.dlat,
+              grid.lon0 + x * grid.dlon,  grid.lat0 + y * grid.dlat,
+              grid.lon0 + x * grid.dlon,  grid.lat0 + (y+1) * grid.dlat,
+              grid.lon0 + x1 * grid.dlon, grid.lat0 + (y+1) * grid.dlat,
+              grid.lon0 + x1 * grid.dlon, grid.lat0 + y * grid.dlat);
+      leaflet_layer_rectangle(html, grid.lon0 + x1 * grid.dlon, grid.lat0 + y * grid.dlat,
+                              grid.lon0 + x * grid.dlon, grid.lat0 + (y+1) * grid.dlat, "");
+      first = 0;
+    }
+  }
+  fprintf(geojson, "]}}\n]}\n");
+  leaflet_layer_end(html);
+  leaflet_marker(html, "map", lon, lat, "Start");
+  fprintf(html, "</script>\n");
+  leaflet_html_footer(html);
+  if( fclose(geojson)!=0 ) abort_msg("Error closing file");
+  if( fclose(html)!=0 ) abort_msg("Error closing file");
+  /* Cleanup */
+  nodelist_free(&points);
+  free(reach);
+  free(edges);
+  free(grid.cell);
+  dijkstra_workspace_free(&ws);
+  routing_graph_free(&graph);
+}
@@ -0,0 +1,288 @@
+/**
+ * \file landmarks.c
+ * \brief Landmarks for goal-directed routing (A*, landmarks, triangle inequality)
+ *
+ * A few vertices far apart from each other are selected as landmarks.
+ * For each permit profile (foot, bike, car) the distances from each landmark
+ * to all vertices and from all vertices to each landmark are calculated and
+ * stored in the file <database>.landmarks next to the graph image.
+ * The search uses these distances as lower bounds, see dijkstra_set_goal().
+ */
+
+#define LANDMARKS_MAGIC     "PBF2SQLL"
+#define LANDMARKS_VERSION   1
+#define LANDMARKS_MAX       64
+
+/*
+** Landmarks file
+**
+** The file is mapped like the graph image:
+**   header
+**   int32_t vertex[num_landmarks]
+**   int32_t dist[num_profiles][num_vertices][num_landmarks][2]
+** dist[p][v][l][0] is the distance from landmark l to vertex v,
+** dist[p][v][l][1] the distance from vertex v to landmark l
+** (LANDMARK_INFINITY: no route). The distances of one vertex are
+** adjacent, so the potential of a vertex reads one block of memory.
+*/
+typedef struct {
+  char magic[8];          /* "PBF2SQLL" */
+  uint32_t version;       /* file format version */
+  uint32_t header_size;   /* sizeof(LandmarksHeader) */
+  int32_t num_vertices;   /* number of vertices of the graph */
+  int32_t num_edges;      /* number of edges of the graph */
+  int32_t num_landmarks;  /* number of landmarks */
+  int32_t num_profiles;   /* number of permit profiles */
+  int64_t max_edge_id;    /* max(edge_id) of table graph_edges, detects outdated files */
+  uint64_t size;          /* size of the file in bytes */
+} LandmarksHeader;
+
+typedef struct {
+  void *mem;              /* header, vertices and distances in one block */
+  size_t mem_size;
+  int mapped;             /* 1: mem is mapped, 0: mem is allocated */
+  int num_landmarks;
+  int num_vertices;
+  int32_t *vertex;        /* landmark vertices */
+  int32_t *dist;          /* distances, see above */
+} Landmarks;
+
+static size_t landmarks_size(int num_vertices, int num_landmarks) {
+  return sizeof(LandmarksHeader) + num_landmarks * sizeof(int32_t) +
+         (size_t)GRAPH_PROFILES * num_vertices * num_landmarks * 2 * sizeof(int32_t);
+}
+
+static void landmarks_attach_mem(Landmarks *lm, void *mem, size_t size, int mapped) {
+  LandmarksHeader *h = mem;
+  lm->mem = mem;
+  lm->mem_size = size;
+  lm->mapped = mapped;
+  lm->num_landmarks = h->num_landmarks;
+  lm->num_vertices = h->num_vertices;
+  lm->vertex = (int32_t *)((char *)mem + sizeof(LandmarksHeader));
+  lm->dist = lm->vertex + h->num_landmarks;
+}
+
+/**
+ * \brief Filename of the landmarks: database filename + '.landmarks'
+ * \return Allocated filename or NULL for in-memory and temporary databases
+ */
+char *landmarks_filename(sqlite3 *db) {
+  return db_related_filename(db, ".landmarks");
+}
+
+void landmarks_free(Landmarks *lm) {
+  if( lm->mem ) image_file_unmap(lm->mem, lm->mem_size, lm->mapped);
+  lm->mem = NULL;
+  lm->num_landmarks = 0;
+}
+
+/**
+ * \brief Maps the landmarks of the database if they match the graph
+ * \return 1 if the landmarks can be used, otherwise 0
+ */
+int landmarks_load(sqlite3 *db, const RoutingGraph *graph, Landmarks *lm) {
+  LandmarksHeader *h;
+  char *filename;
+  void *mem;
+  size_t size;
+  lm->mem = NULL;
+  lm->num_landmarks = 0;
+  filename = landmarks_filename(db);
+  if( filename==NULL ) return 0;
+  mem = image_file_map(filename, sizeof(LandmarksHeader), &size);
+  if( mem==NULL ){
+    free(filename);
+    return 0;
+  }
+  h = mem;
+  if( memcmp(h->magic, LANDMARKS_MAGIC, 8)!=0 ||
+      h->version!=LANDMARKS_VERSION ||
+      h->header_size!=sizeof(LandmarksHeader) ||
+      h->num_profiles!=GRAPH_PROFILES ||
+      h->num_landmarks<1 || h->num_landmarks>LANDMARKS_MAX ||
+      h->size!=size ||
+      landmarks_size(h->num_vertices, h->num_landmarks)!=size ||
+      h->num_vertices!=graph->num_vertices ||
+      h->num_edges!=graph->num_edges ||
+      h->max_edge_id!=graph->header->max_edge_id ){
+    fprintf(stderr, "%s is outdated or invalid and is ignored\n", filename);
+    image_file_unmap(mem, size, 1);
+    free(filename);
+    return 0;
+  }
+  free(filename);
+  landmarks_attach_mem(lm, mem, size, 1);
+  return 1;
+}
+
+/**
+ * \brief Uses the landmarks of the permit profile for the searches of the workspace
+ *
+ * Without landmarks or for a permit mask without profile the searches
+ * are not directed.
+ */
+void landmarks_attach(DijkstraWorkspace *ws, const Landmarks *lm, const int mask_permit) {
+  int p = graph_profile(mask_permit);
+  ws->lm_dist = NULL;
+  ws->lm_num = 0;
+  if( lm==NULL || lm->num_landmarks==0 || p<0 ) return;
+  ws->lm_dist = lm->dist + (size_t)p * lm->num_vertices * 2 * lm->num_landmarks;
+  ws->lm_num = lm->num_landmarks;
+}
+
+/*
+** Farthest vertex of the last search, -1 if only landmarks were reached
+*/
+static int landmarks_farthest(const DijkstraWorkspace *ws, const int32_t *vertex, int num) {
+  int i, l, v, best = -1, best_d = -1;
+  for(i=0; i<ws->num_touched; i++){
+    v = ws->touched[i];
+    if( ws->node[v].d<=best_d ) continue;
+    for(l=0; l<num && vertex[l]!=v; l++);
+    if( l<num ) continue;
+    best = v;
+    best_d = ws->node[v].d;
+  }
+  return best;
+}
+
+/*
+** Selects up to k landmarks (farthest-first)
+**
+** The search ignores the directions and permits of the edges. It starts
+** in the largest of the first few components found. The first landmark
+** is the vertex farthest from the start, each next landmark the vertex
+** farthest from all landmarks selected so far.
+** Returns the number of landmarks.
+*/
+static int landmarks_select(const RoutingGraph *graph, int k, int32_t *vertex) {
+  DijkstraWorkspace ws;
+  unsigned char *reached;
+  int i, l, v, start, best_start, best_size, tries;
+  reached = calloc(graph->num_vertices + 1, 1);
+  if( !reached ) abort_msg("Out of memory");
+  dijkstra_workspace_init(&ws, graph);
+  best_start = -1;
+  best_size = 0;
+  start = 0;
+  for(tries=0; tries<16 && start<graph->num_vertices; tries++){
+    dijkstra_search(&ws, graph, start, 0, -1, NULL, 0, INT_MAX);
+    for(i=0; i<ws.num_touched; i++) reached[ws.touched[i]] = 1;
+    if( ws.num_touched>best_size ){
+      best_size = ws.num_touched;
+      best_start = start;
+    }
+    if( best_size>=graph->num_vertices/2 ) break;
+    while( start<graph->num_vertices && reached[start] ) start++;
+  }
+  free(reached);
+  if( best_start==-1 ){
+    dijkstra_workspace_free(&ws);
+    return 0;
+  }
+  dijkstra_search(&ws, graph, best_start, 0, -1, NULL, 0, INT_MAX);
+  vertex[0] = landmarks_farthest(&ws, vertex, 0);
+  for(l=1; l<k; l++){
+    dijkstra_workspace_reset(&ws);
+    for(i=0; i<l; i++) dijkstra_add_start(&ws, vertex[i], 0);
+    dijkstra_run(&ws, graph, 0, NULL, 0, NULL, 0, INT_MAX);
+    v = landmarks_farthest(&ws, vertex, l);
+    if( v==-1 ) break;
+    vertex[l] = v;
+  }
+  dijkstra_workspace_free(&ws);
+  return l;
+}
+
+/*
+** Distances of the landmarks, one task per landmark, profile and direction
+*/
+static struct {
+  const RoutingGraph *graph;
+  Landmarks *lm;
+  int next_task;
+  pthread_mutex_t lock;          /* Protects next_task */
+} lmcalc;
+
+static void *landmarks_worker(void *arg) {
+  DijkstraWorkspace ws;
+  Landmarks *lm = lmcalc.lm;
+  int task, l, p, reverse, i, v, k2 = 2 * lm->num_landmarks;
+  int32_t *dist;
+  dijkstra_workspace_init(&ws, lmcalc.graph);
+  while( 1 ){
+    pthread_mutex_lock(&lmcalc.lock);
+    task = lmcalc.next_task++;
+    pthread_mutex_unlock(&lmcalc.lock);
+    if( task>=lm->num_landmarks * GRAPH_PROFILES * 2 ) break;
+    l = task / (GRAPH_PROFILES * 2);
+    p = task / 2 % GRAPH_PROFILES;
+    reverse = task % 2;
+    /* The reverse search gives the distances to the landmark */
+    ws.reverse = reverse;
+    dijkstra_search(&ws, lmcalc.graph, lm->vertex[l], graph_profile_mask[p], -1, NULL, 0, INT_MAX);
+    dist = lm->dist + (size_t)p * lm->num_vertices * k2 + 2*l + reverse;
+    for(i=0; i<ws.num_touched; i++){
+      v = ws.touched[i];
+      dist[(size_t)v * k2] = ws.node[v].d;
+    }
+  }
+  dijkstra_workspace_free(&ws);
+  return NULL;
+}
+
+/**
+ * \brief Selects up to k landmarks and calculates their distances
+ *
+ * The result is allocated in one block that can be written with
+ * image_file_write(lm->mem, lm->mem_size, filename).
+ */
+void landmarks_calculate(const RoutingGraph *graph, const int k, Landmarks *lm) {
+  LandmarksHeader *h;
+  pthread_t *thread;
+  int32_t vertex[LANDMARKS_MAX];
+  int i, num, threads;
+  size_t n, size;
+  double t0, t1, t2;
+  t0 = time_now();
+  num = landmarks_select(graph, k, vertex);
+  if( num==0 ) abort_msg("Option graph landmarks: Graph has no vertices");
+  t1 = time_now();
+  /* Header and distances in one block, unreachable vertices keep LANDMARK_INFINITY */
+  size = landmarks_size(graph->num_vertices, num);
+  h = malloc(size);
+  if( !h ) abort_msg("Out of memory");
+  memset(h, 0, sizeof(LandmarksHeader));
+  memcpy(h->magic, LANDMARKS_MAGIC, 8);
+  h->version = LANDMARKS_VERSION;
+  h->header_size = sizeof(LandmarksHeader);
+  h->num_vertices = graph->num_vertices;
+  h->num_edges = graph->num_edges;
+  h->num_landmarks = num;
+  h->num_profiles = GRAPH_PROFILES;
+  h->max_edge_id = graph->header->max_edge_id;
+  h->size = size;
+  landmarks_attach_mem(lm, h, size, 0);
+  memcpy(lm->vertex, vertex, num * sizeof(int32_t));
+  for(n=0; n<(size_t)GRAPH_PROFILES * graph->num_vertices * num * 2; n++) lm->dist[n] = LANDMARK_INFINITY;
+  /* One search per landmark, profile and direction in parallel */
+  lmcalc.graph = graph;
+  lmcalc.lm = lm;
+  lmcalc.next_task = 0;
+  pthread_mutex_init(&lmcalc.lock, NULL);
+  threads = number_of_cpus();
+  if( threads>num * GRAPH_PROFILES * 2 ) threads = num * GRAPH_PROFILES * 2;
+  thread = malloc(threads * sizeof(pthread_t));
+  if( !thread ) abort_msg("Out of memory");
+  for(i=0; i<threads; i++){
+    if( pthread_create(&thread[i], NULL, landmarks_worker, NULL)!=0 )
+      abort_msg("Option graph landmarks: Error creating thread");
+  }
+  for(i=0; i<threads; i++) pthread_join(thread[i], NULL);
+  t2 = time_now();
+  fprintf(stderr, "graph landmarks: %d landmarks selected in %.3f s, distances in %.3f s with %d threads\n",
+          num, t1-t0, t2-t1, threads);
+  free(thread);
+  pthread_mutex_destroy(&lmcalc.lock);
+}
@@ -3,6 +3,8 @@
  * \brief Functions for creating an HTML file with Leaflet.js for visualizing map data
  */
 
+#define LEAFLET_TOLERANCE_PIXELS  4000   /* Lines are simplified to 1/4000 of the map width */
+
 /**
  * \brief Write HTML header with Leaflet.js library
  */
@@ -51,6 +53,35 @@ void leaflet_html_header(FILE *html, const char *title) {
     "//const tile_server = 'https://{s}.tile.openstreetmap.org/{z}/{x}/{y}.png';\n"
     "//const tile_server = 'https://{s}.tile.openstreetmap.fr/osmfr/{z}/{x}/{y}.png';\n"
     "const tile_server = 'https://{s}.tile.openstreetmap.de/{z}/{x}/{y}.png';\n"
+    "// Creates the features of a layer, see leaflet_layer_begin()\n"
+    "function pbf_layer(map, type, style, prefix, features, mask, style2, style_mask) {\n"
+    "  var group = L.featureGroup(), lon = 0, lat = 0;\n"
+    "  mask = mask || 0;\n"
+    "  for (var i = 0; i < features.length; i++) {\n"
+    "    var c = features[i][0], flags = features[i][2] || 0, s = style, p = [], f;\n"
+    "    for (var j = 0; j < c.length; j += 2) {\n"
+    "      lon += c[j];\n"
+    "      lat += c[j+1];\n"
+    "      p.push([lat / 1e7, lon / 1e7]);\n"
+    "    }\n"
+    "    if ((flags & mask) != mask) continue;\n"
+    "    if (flags & style_mask) s = style2;\n"
+    "    if (type == 'marker') f = L.marker(p[0]);\n"
+    "    else if (type == 'circlemarker') f = L.circleMarker(p[0], s);\n"
+    "    else if (type == 'circle') f = L.circle(p[0], s);\n"
+    "    else if (type == 'rectangle') f = L.rectangle(p, s);\n"
+    "    else if (type == 'polygon') f = L.polygon(p, s);\n"
+    "    else f = L.polyline(p, s);\n"
+    "    if (features[i][1] !== undefined && features[i][1] !== '') f.label = prefix + features[i][1];\n"
+    "    group.addLayer(f);\n"
+    "  }\n"
+    "  group.on('click', function(e) {\n"
+    "    if (e.layer.label === undefined) return;\n"
+    "    L.DomEvent.stopPropagation(e);\n"
+    "    L.popup().setLatLng(e.latlng).setContent(e.layer.label).openOn(map);\n"
+    "  });\n"
+    "  group.addTo(map);\n"
+    "}\n"
     "</script>\n", title
   );
 }
@@ -79,7 +110,7 @@ void leaflet_init(
   const double lat2
 ){
   fprintf(html, "// init %s\n", mapid);
-  fprintf(html, "const %s = L.map('%s').fitBounds([ [%.7f, %.7f], [%.7f, %.7f] ], "
+  fprintf(html, "const %s = L.map('%s', {preferCanvas: true}).fitBounds([ [%.7f, %.7f], [%.7f, %.7f] ], "
                 "{padding: [0,0], maxZoom: 19});\n",
                  mapid, mapid, lat1, lon1, lat2, lon2);
   fprintf(html, "L.tileLayer(tile_server, {maxZoom:19}).addTo(%s);\n", mapid);
@@ -100,6 +131,155 @@ void leaflet_init(
                 "dashArray:'none', fillColor:'#ff7800', fillOpacity:0.5 };\n");
 }
 
+/*
+** Layers
+**
+** The features of a layer are written as data, one client-side loop
+** (pbf_layer() in the HTML header) creates the Leaflet objects:
+**   pbf_layer(map, type, style, prefix, [ [[coordinates], label, flags], ... ]);
+** The coordinates are integers in 1e-7 degrees (lon, lat, lon, lat, ...),
+** each value is the difference to the previous value of the layer.
+** The popup of a feature is prefix + label, features without label have no popup.
+** The flags are optional: the features can be written once as data array
+** and shown in several layers, each with the features that have all bits
+** of a mask (see leaflet_layer_data()).
+*/
+static struct {
+  int64_t lon, lat;       /* Last coordinate of the layer in 1e-7 degrees */
+} leaflet_layer_pos;
+
+/*
+** Writes a JavaScript string literal, '</' is escaped so the
+** string cannot end the script element
+*/
+static void leaflet_js_string(FILE *html, const char *text) {
+  const char *c;
+  fputc('"', html);
+  for(c=text; *c; c++){
+    if( *c=='"' || *c=='\\' ) fputc('\\', html);
+    if( *c=='\n' ){
+      fputs("\\n", html);
+      continue;
+    }
+    if( *c=='/' && c>text && c[-1]=='<' ) fputc('\\', html);
+    fputc(*c, html);
+  }
+  fputc('"', html);
+}
+
+static void leaflet_layer_coord(FILE *html, const double lon, const double lat, const int first) {
+  int64_t x = llround(lon * 1e7), y = llround(lat * 1e7);
+  fprintf(html, "%s%" PRId64 ",%" PRId64, first ? "" : ",",
+          x - leaflet_layer_pos.lon, y - leaflet_layer_pos.lat);
+  leaflet_layer_pos.lon = x;
+  leaflet_layer_pos.lat = y;
+}
+
+static void leaflet_layer_label(FILE *html, const char *label, const int flags) {
+  const char *c;
+  fputc(']', html);
+  if( (label && label[0]!='\0') || flags ){
+    /* Numbers without quotes */
+    for(c=label ? label : ""; *c>='0' && *c<='9'; c++);
+    fputc(',', html);
+    if( label && label[0]!='\0' && *c=='\0' && label[0]!='0' ) fputs(label, html);
+    else leaflet_js_string(html, label ? label : "");
+  }
+  if( flags ) fprintf(html, ",%d", flags);
+  fputs("],\n", html);
+}
+
+/**
+ * \brief Begins a layer of features with the current style
+ *
+ * type is 'marker', 'circlemarker', 'circle', 'polyline', 'polygon' or 'rectangle'
+ * (two corners), prefix is prepended to the label of each feature in the popup.
+ * The features follow with leaflet_layer_point() and leaflet_layer_line(),
+ * leaflet_layer_end() closes the layer.
+ */
+void leaflet_layer_begin(FILE *html, const char *mapid, const char *type, const char *prefix) {
+  fprintf(html, "pbf_layer(%s, '%s', style, ", mapid, type);
+  leaflet_js_string(html, prefix);
+  fprintf(html, ", [\n");
+  leaflet_layer_pos.lon = 0;
+  leaflet_layer_pos.lat = 0;
+}
+
+/**
+ * \brief Begins a data array of features that can be shown in several layers
+ */
+void leaflet_data_begin(FILE *html, const char *name) {
+  fprintf(html, "const %s = [\n", name);
+  leaflet_layer_pos.lon = 0;
+  leaflet_layer_pos.lat = 0;
+}
+
+void leaflet_data_end(FILE *html) {
+  fputs("];\n", html);
+}
+
+/**
+ * \brief Shows the features of a data array with all bits of mask in the flags
+ *
+ * Features with a bit of style_mask in the flags are drawn with the style
+ * in the JavaScript variable style2, all others with the current style.
+ */
+void leaflet_layer_data(
+  FILE *html,
+  const char *mapid,
+  const char *type,
+  const char *prefix,
+  const char *data,
+  const int mask,
+  const char *style2,
+  const int style_mask
+){
+  fprintf(html, "pbf_layer(%s, '%s', style, ", mapid, type);
+  leaflet_js_string(html, prefix);
+  fprintf(html, ", %s, %d, %s, %d);\n", data, mask, style2 ? style2 : "style", style_mask);
+}
+
+/**
+ * \brief Adds a feature with one point to the layer
+ */
+void leaflet_layer_point(FILE *html, const double lon, const double lat, const char *label, const int flags) {
+  fputs("[[", html);
+  leaflet_layer_coord(html, lon, lat, 1);
+  leaflet_layer_label(html, label, flags);
+}
+
+/**
+ * \brief Adds a feature with the points of a node list to the layer
+ */
+void leaflet_layer_line(FILE *html, const NodeList *points, const char *label, const int flags) {
+  fputs("[[", html);
+  for(size_t i=0; i<points->size; i++){
+    leaflet_layer_coord(html, points->node[i].lon, points->node[i].lat, i==0);
+  }
+  leaflet_layer_label(html, label, flags);
+}
+
+/**
+ * \brief Adds a rectangle to the layer
+ */
+void leaflet_layer_rectangle(
+  FILE *html,
+  const double lon1,
+  const double lat1,
+  const double lon2,
+  const double lat2,
+  const char *label
+){
+  fputs("[[", html);
+  leaflet_layer_coord(html, lon1, lat1, 1);
+  leaflet_layer_coord(html, lon2, lat2, 0);
+  leaflet_layer_label(html, label, 0);
+}
+
+void leaflet_layer_end(FILE *html) {
+  fputs("]);\n", html);
+}
+
 /**
  * \brief Write Leaflet.js code to set a marker
  */
@@ -110,9 +290,9 @@ void leaflet_marker(
   const double lat,
   const char *text
 ){
-  fprintf(html, "L.marker([%.7f, %.7f]).addTo(%s)", lat, lon, mapid);
-  if( text[0]!='\0' ) fprintf(html, ".bindPopup(\"%s\")", text);
-  fprintf(html, ";\n");
+  leaflet_layer_begin(html, mapid, "marker", "");
+  leaflet_layer_point(html, lon, lat, text, 0);
+  leaflet_layer_end(html);
 }
 
 /**
@@ -124,14 +304,20 @@ void leaflet_polyline(
   NodeList *pointlist,
   const char *text
 ){
-  fprintf(html, "L.polyline( [\n");
-  for(int i=0; i<pointlist->size; i++){
-    if( i>0 ) fprintf(html, ",\n");
-    fprintf(html, "[%.7f, %.7f]", pointlist->node[i].lat, pointlist->node[i].lon);
-  }
-  fprintf(html, " ], style).addTo(%s)",  mapid);
-  if( text[0]!='\0' ) fprintf(html, ".bindPopup(\"%s\")", text);
-  fprintf(html, ";\n");
+  leaflet_layer_begin(html, mapid, "polyline", "");
+  leaflet_layer_line(html, pointlist, text, 0);
+  leaflet_layer_end(html);
+}
+
+/**
+ * \brief Tolerance in meters for simplifying the lines of a map of the boundingbox
+ *
+ * A quarter of a pixel if the width of the boundingbox is shown with
+ * 1000 pixels, so lines still look the same two zoom levels closer.
+ */
+double leaflet_tolerance(const bbox b) {
+  double lat = (b.min_lat + b.max_lat) / 2;
+  return distance(b.min_lon, lat, b.max_lon, lat) / LEAFLET_TOLERANCE_PIXELS;
 }
 
 /**
@@ -146,10 +332,12 @@ void leaflet_line(
   const double lat2,
   const char *text
 ){
-  fprintf(html, "L.polyline([ [%.7f, %.7f], [%.7f, %.7f] ]).addTo(%s)",
-          lat1, lon1, lat2, lon2, mapid);
-  if( text[0]!='\0' ) fprintf(html, ".bindPopup(\"%s\")", text);
-  fprintf(html, ";\n");
+  leaflet_layer_begin(html, mapid, "polyline", "");
+  fputs("[[", html);
+  leaflet_layer_coord(html, lon1, lat1, 1);
+  leaflet_layer_coord(html, lon2, lat2, 0);
+  leaflet_layer_label(html, text, 0);
+  leaflet_layer_end(html);
 }
 
 /**
@@ -161,14 +349,9 @@ void leaflet_polygon(
   NodeList *pointlist,
   const char *text
 ){
-  fprintf(html, "L.polygon( [\n");
-  for(int i=0; i<pointlist->size; i++){
-    if( i>0 ) fprintf(html, ",\n");
-    fprintf(html, "[%.7f, %.7f]", pointlist->node[i].lat, pointlist->node[i].lon);
-  }
-  fprintf(html, " ], style).addTo(%s)",  mapid);
-  if( text[0]!='\0' ) fprintf(html, ".bindPopup(\"%s\")", text);
-  fprintf(html, ";\n");
+  leaflet_layer_begin(html, mapid, "polygon", "");
+  leaflet_layer_line(html, pointlist, text, 0);
+  leaflet_layer_end(html);
 }
 
 /**
@@ -182,9 +365,10 @@ void leaflet_circle(
   const int radius,
   const char *text
 ){
-  fprintf(html, "L.circle([%.7f, %.7f], %d, style).addTo(%s)", lat, lon, radius, mapid);
-  if( text[0]!='\0' ) fprintf(html, ".bindPopup(\"%s\")", text);
-  fprintf(html, ";\n");
+  fprintf(html, "style.radius = %d;\n", radius);
+  leaflet_layer_begin(html, mapid, "circle", "");
+  leaflet_layer_point(html, lon, lat, text, 0);
+  leaflet_layer_end(html);
 }
 
 /**
@@ -197,9 +381,9 @@ void leaflet_circlemarker(
   const double lat,
   const char *text
 ){
-  fprintf(html, "L.circleMarker([%.7f, %.7f], style).addTo(%s)", lat, lon,  mapid);
-  if( text[0]!='\0' ) fprintf(html, ".bindPopup(\"%s\")", text);
-  fprintf(html, ";\n");
+  leaflet_layer_begin(html, mapid, "circlemarker", "");
+  leaflet_layer_point(html, lon, lat, text, 0);
+  leaflet_layer_end(html);
 }
 
 /**
@@ -214,9 +398,9 @@ void leaflet_rectangle(
   const double lat2,
   const char *text
 ){
-  fprintf(html, "L.rectangle([[%.7f, %.7f], [%.7f, %.7f]], style).addTo(%s)", lat1, lon1, lat2, lon2, mapid);
-  if( text[0]!='\0' ) fprintf(html, ".bindPopup(\"%s\")", text);
-  fprintf(html, ";\n");
+  leaflet_layer_begin(html, mapid, "rectangle", "");
+  leaflet_layer_rectangle(html, lon1, lat1, lon2, lat2, text);
+  leaflet_layer_end(html);
 }
 
 /**
@@ -1,6 +1,8 @@
 /**
  * pbf2sqlite
  */
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64    /* 64 bit off_t for fseeko */
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -11,8 +13,22 @@
 #include <math.h>
 #include <limits.h>
 #include <errno.h>
+#include <time.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <pthread.h>
 #include <sqlite3.h>
 #include <readosm.h>
+#include <zlib.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/select.h>
+#endif
 
 #ifndef M_PI
 # define M_PI   3.141592653589793238462643383279502884
@@ -56,7 +72,11 @@ static char *help =
   "  index            Add basic indexes\n"
   "  rtree            Add R*Tree indexes\n"
   "  addr             Add address tables\n"
+  "  addr areas       Add address tables, missing city and postcode from the areas\n"
   "  graph            Add graph tables\n"
+  "  graph image      Write graph image <database>.graph for fast routing\n"
+  "  graph landmarks <k>  Write <k> landmarks <database>.landmarks for faster routes\n"
+  "  areas            Add areas of the multipolygon and boundary relations\n"
   "\n"
   "Options for displaying data:\n"
   "  node <id>                                           Show data of a node\n"
@@ -65,9 +85,20 @@ static char *help =
   "  vaddr <lon1> <lat1> <lon2> <lat2> <htmlfile>        Generates a map of the addresses\n"
   "  vgraph <lon1> <lat1> <lon2> <lat2> <htmlfile>       Generates a map of the graph\n"
   "  sql [<stmt>]                                        Executes an SQL statement\n"
+  "  tiles <minzoom> <maxzoom> <mbtiles> [<threads>]     Writes vector tiles into an MBTiles file\n"
+  "  export <format> <lon1> <lat1> <lon2> <lat2> [<key>[=<value>]] <file>\n"
+  "                           Exports nodes and ways as GeoJSON or FlatGeobuf ('geojson', 'fgb')\n"
+  "  extract-pbf <lon1> <lat1> <lon2> <lat2> <pbffile> [<threads>]   Writes a region as OSM PBF file\n"
+  "  extract-pbf <polyfile> <pbffile> [<threads>]                     (region: boundingbox or .poly file)\n"
   "\n"
-  "Option to calculate the shortest path:\n"
-  "  route <permit> <lon1> <lat1> <lon2> <lat2> [<lon3> <lat3> ...] <file>\n"
+  "Options to calculate shortest paths:\n"
+  "  route <permit> <lon1> <lat1> <lon2> <lat2> [<lon3> <lat3> ...] <file> [alternatives=<k>] [simplify=<m>]\n"
+  "  route-batch <permit> <input.csv> <output.csv> [<threads>] [polyline]\n"
+  "  matrix <permit> <sources.csv> <targets.csv> <output> [<threads>]\n"
+  "  route-bench <permit> <input.csv>   Compare the priority queues with the pairs\n"
+  "  isochrone <permit> <lon> <lat> <limit> <file>   Area reachable within <limit> meters\n"
+  "  nearest <permit> <lon> <lat> <key=value> <k>   k nearest nodes/ways with the tag\n"
+  "  serve <threads> [<socket>] [cache=<MB>]   Routing server, JSON requests from stdin or socket\n"
   "        (<permit>: 'foot', 'bike' or 'car')\n"
   "\n"
   "This is pbf2sqlite version " PBF2SQLITE_VERSION "\n"
@@ -75,12 +106,26 @@ static char *help =
 
 #include "functions.c"
 #include "nodelist.c"
+#include "protobuf.c"
 #include "leaflet.c"
+#include "routing_graph.c"
 #include "dijkstra.c"
+#include "landmarks.c"
 #include "graph.c"
 #include "routing.c"
+#include "route_cache.c"
+#include "serve.c"
+#include "batch.c"
+#include "matrix.c"
+#include "isochrone.c"
+#include "nearest.c"
 #include "read_osm.c"
 #include "options.c"
+#include "areas.c"
+#include "vtab.c"
+#include "tiles.c"
+#include "export.c"
+#include "extract.c"
 #include "show_data.c"
 #include "get_args.c"
 
@@ -102,6 +147,7 @@ int main(int argc, char **argv) {
           " PRAGMA page_size = 65536;", NULL, NULL, NULL);
   if( rc!=SQLITE_OK ) abort_db_error(db, rc);
   register_functions(db);              /* Register custom functions */
+  register_vtabs(db);                  /* Register table-valued functions */
   parse_args(db, argc, argv, 1);       /* Execute args */
   rc = sqlite3_close(db);              /* Close database connection */
   if( rc!=SQLITE_OK ) abort_db_error(db, rc);
@@ -0,0 +1,229 @@
+/**
+ * \file matrix.c
+ * \brief Many-to-many distance matrix
+ *
+ * For each source one search runs until all targets are settled.
+ * The sources are distributed over worker threads.
+ */
+
+/**
+ * \brief Reads points from a CSV file with the columns id,lon,lat
+ *
+ * A header line is skipped. The IDs are stored in ids[] (allocated).
+ */
+void read_points_csv(
+  const char *filename,
+  NodeList *points,
+  char ***ids
+){
+  FILE *csv;
+  char line[1024];
+  char *field[3], *p, *end1, *end2;
+  int n, lineno = 0;
+  size_t cap = 0;
+  double lon, lat;
+  csv = fopen(filename, "r");
+  if( csv==NULL ) abort_msg("Error opening file");
+  nodelist_init(points);
+  *ids = NULL;
+  while( fgets(line, sizeof(line), csv) ){
+    lineno++;
+    line[strcspn(line, "\r\n")] = '\0';
+    if( line[0]=='\0' ) continue;
+    p = line;
+    for(n=0; n<3 && p; n++){
+      field[n] = p;
+      p = strchr(p, ',');
+      if( p ) *p++ = '\0';
+    }
+    if( n==3 ){
+      lon = strtod(field[1], &end1);
+      lat = strtod(field[2], &end2);
+    }
+    if( n!=3 || end1==field[1] || *end1!='\0' || end2==field[2] || *end2!='\0' || !valid_location(lon, lat) ){
+      if( lineno==1 ) continue;  /* header line */
+      fprintf(stderr, "%s line %d: columns id,lon,lat expected\n", filename, lineno);
+      exit(EXIT_FAILURE);
+    }
+    if( points->size==cap ){
+      cap = cap ? cap*2 : 256;
+      *ids = realloc(*ids, cap * sizeof(char *));
+      if( !*ids ) abort_msg("Out of memory");
+    }
+    (*ids)[points->size] = malloc(strlen(field[0]) + 1);
+    if( !(*ids)[points->size] ) abort_msg("Out of memory");
+    strcpy((*ids)[points->size], field[0]);
+    nodelist_add(points, lon, lat, -1);
+  }
+  fclose(csv);
+}
+
+static struct {
+  const RoutingGraph *graph;
+  int mask_permit;
+  NodeList sources;
+  NodeList targets;
+  SnapPoint *source_snap;        /* Positions on the edges, edge -1 if not found */
+  SnapPoint *target_snap;
+  unsigned char *target_vertex;  /* 1 for each vertex from which a target can be reached */
+  int num_target_vertices;       /* Number of different target vertices */
+  int32_t *dist;                 /* Result: dist[source * num_targets + target] */
+  int next_source;
+  pthread_mutex_t lock;          /* Protects next_source */
+} matrix;
+
+static void *matrix_worker(void *arg) {
+  DijkstraWorkspace ws;
+  int s, t, d, direct, v, backward;
+  int32_t *row;
+  dijkstra_workspace_init(&ws, matrix.graph);
+  while( 1 ){
+    pthread_mutex_lock(&matrix.lock);
+    s = matrix.next_source++;
+    pthread_mutex_unlock(&matrix.lock);
+    if( s>=(int)matrix.sources.size ) break;
+    row = matrix.dist + (size_t)s * matrix.targets.size;
+    if( matrix.source_snap[s].edge==-1 ){
+      for(t=0; t<(int)matrix.targets.size; t++) row[t] = -1;
+      continue;
+    }
+    /* One search settles all targets */
+    dijkstra_workspace_reset(&ws);
+    snap_add_start(&ws, matrix.graph, matrix.mask_permit, &matrix.source_snap[s]);
+    dijkstra_run(&ws, matrix.graph, matrix.mask_permit, NULL, 0,
+                 matrix.target_vertex, matrix.num_target_vertices, INT_MAX);
+    for(t=0; t<(int)matrix.targets.size; t++){
+      row[t] = -1;
+      if( matrix.target_snap[t].edge==-1 ) continue;
+      d = snap_arrival(&ws, matrix.graph, matrix.mask_permit, &matrix.target_snap[t], &v, &backward);
+      direct = snap_direct(matrix.graph, matrix.mask_permit, &matrix.source_snap[s],
+                           &matrix.target_snap[t], &backward);
+      if( direct<d ) d = direct;
+      if( d!=INT_MAX ) row[t] = d;
+    }
+  }
+  dijkstra_workspace_free(&ws);
+  return NULL;
+}
+
+/*
+** Positions of the points on the nearest edges of the largest component,
+** so no point is on an island that cannot be reached from the other points
+*/
+static SnapPoint *matrix_snap(const NodeList *points) {
+  SnapPoint *snap = malloc((points->size + 1) * sizeof(SnapPoint));
+  if( !snap ) abort_msg("Out of memory");
+  for(size_t i=0; i<points->size; i++){
+    if( !routing_graph_snap_component(matrix.graph, points->node[i].lon, points->node[i].lat,
+                                      matrix.mask_permit, 1, &snap[i]) ){
+      routing_graph_snap(matrix.graph, points->node[i].lon, points->node[i].lat, matrix.mask_permit, &snap[i]);
+    }
+  }
+  return snap;
+}
+
+/**
+ * \brief Calculates the distances between all sources and all targets
+ *
+ * If the output file ends with '.csv' a CSV table is written
+ * (one row per source, one column per target), otherwise a binary file:
+ * "PBF2SQLM", int32 number of sources, int32 number of targets,
+ * int32 distances row by row (-1: no route), native byte order.
+ */
+void distance_matrix(
+  sqlite3 *db,
+  const char *permit,
+  const char *sources_file,
+  const char *targets_file,
+  const char *output_file,
+  const int threads
+){
+  RoutingGraph graph;
+  char **source_ids, **target_ids;
+  pthread_t *thread;
+  FILE *out;
+  size_t i, j, len;
+  int32_t n;
+  int dest[2], k, num_dest;
+  int graph_image;
+  double t0, t1;
+  if( threads<1 || threads>SERVE_MAX_THREADS ) abort_msg("Option matrix: Invalid number of threads");
+  read_points_csv(sources_file, &matrix.sources, &source_ids);
+  read_points_csv(targets_file, &matrix.targets, &target_ids);
+  graph_image = routing_graph_load(db, NULL, 0, &graph);
+  matrix.graph = &graph;
+  matrix.mask_permit = permit_mask(permit);
+  t0 = time_now();
+  /* Snap sources and targets, mark the target vertices */
+  matrix.source_snap = matrix_snap(&matrix.sources);
+  matrix.target_snap = matrix_snap(&matrix.targets);
+  matrix.target_vertex = calloc(graph.num_vertices + 1, 1);
+  if( !matrix.target_vertex ) abort_msg("Out of memory");
+  matrix.num_target_vertices = 0;
+  for(j=0; j<matrix.targets.size; j++){
+    if( matrix.target_snap[j].edge==-1 ) continue;
+    num_dest = snap_dest(&graph, matrix.mask_permit, &matrix.target_snap[j], dest);
+    for(k=0; k<num_dest; k++){
+      if( !matrix.target_vertex[dest[k]] ) matrix.num_target_vertices++;
+      matrix.target_vertex[dest[k]] = 1;
+    }
+  }
+  matrix.dist = malloc((matrix.sources.size * matrix.targets.size + 1) * sizeof(int32_t));
+  if( !matrix.dist ) abort_msg("Out of memory");
+  /* One-to-many searches in parallel */
+  matrix.next_source = 0;
+  pthread_mutex_init(&matrix.lock, NULL);
+  thread = malloc(threads * sizeof(pthread_t));
+  if( !thread ) abort_msg("Out of memory");
+  for(i=0; i<(size_t)threads; i++){
+    if( pthread_create(&thread[i], NULL, matrix_worker, NULL)!=0 )
+      abort_msg("Option matrix: Error creating thread");
+  }
+  for(i=0; i<(size_t)threads; i++) pthread_join(thread[i], NULL);
+  t1 = time_now();
+  /* Write the matrix */
+  len = strlen(output_file);
+  out = fopen(output_file, "wb");
+  if( out==NULL ) abort_msg("Error opening file");
+  if( len>=4 && strcmp(output_file+len-4, ".csv")==0 ){
+    fprintf(out, "id");
+    for(j=0; j<matrix.targets.size; j++) fprintf(out, ",%s", target_ids[j]);
+    fprintf(out, "\r\n");
+    for(i=0; i<matrix.sources.size; i++){
+      fprintf(out, "%s", source_ids[i]);
+      for(j=0; j<matrix.targets.size; j++){
+        n = matrix.dist[i * matrix.targets.size + j];
+        if( n>=0 ) fprintf(out, ",%d", n);
+        else fprintf(out, ",");
+      }
+      fprintf(out, "\r\n");
+    }
+  }else{
+    fwrite("PBF2SQLM", 1, 8, out);
+    n = (int32_t)matrix.sources.size;
+    fwrite(&n, sizeof(n), 1, out);
+    n = (int32_t)matrix.targets.size;
+    fwrite(&n, sizeof(n), 1, out);
+    if( fwrite(matrix.dist, sizeof(int32_t), matrix.sources.size * matrix.targets.size, out)
+          !=matrix.sources.size * matrix.targets.size ) abort_msg("Error writing file");
+  }
+  if( fclose(out)!=0 ) abort_msg("Error closing file");
+  fprintf(stderr, "matrix: graph with %d vertices loaded from %s\n",
+          graph.num_vertices, graph_image ? "graph image" : "tables");
+  fprintf(stderr, "matrix: %zu x %zu distances in %.3f s with %d threads\n",
+          matrix.sources.size, matrix.targets.size, t1-t0, threads);
+  /* Cleanup */
+  for(i=0; i<matrix.sources.size; i++) free(source_ids[i]);
+  for(j=0; j<matrix.targets.size; j++) free(target_ids[j]);
+  free(source_ids);
+  free(target_ids);
+  free(thread);
+  free(matrix.dist);
+  free(matrix.target_vertex);
+  free(matrix.source_snap);
+  free(matrix.target_snap);
+  nodelist_free(&matrix.sources);
+  nodelist_free(&matrix.targets);
+  pthread_mutex_destroy(&matrix.lock);
+  routing_graph_free(&graph);
+}
@@ -0,0 +1,229 @@
+/**
+ * \file nearest.c
+ * \brief Nearest points of interest by network distance
+ *
+ * The candidates (nodes and ways with a tag key=value) are found with the
+ * R*Tree indexes in a square around the start point and projected onto
+ * the graph. One search from the start stops when enough candidates are
+ * reached, a second search bounded by the distance of the k-th candidate
+ * gives the exact distances and paths. If fewer than k candidates are
+ * within the radius of the square, the radius is enlarged.
+ */
+
+#define NEAREST_RADIUS      1000     /* First radius in meters */
+#define NEAREST_MAX_RADIUS  256000   /* Larger radius: all candidates of the database */
+
+typedef struct {
+  int is_way;          /* 0: node, 1: way */
+  int64_t id;          /* node_id or way_id */
+  double lon, lat;     /* Node or center of the way */
+  SnapPoint snap;      /* Position on the nearest edge */
+  int d;               /* Distance in meters, INT_MAX: not reached */
+} NearestPoi;
+
+/*
+** Nodes and ways with the tag key=value within the boundingbox
+** (NULL: all), ways with the center of their boundingbox
+*/
+static NearestPoi *nearest_candidates(
+  sqlite3 *db,
+  const char *key,
+  const char *value,
+  const bbox *b,
+  int *num
+){
+  sqlite3_stmt *stmt;
+  NearestPoi *poi;
+  int cap = 64;
+  rc = sqlite3_prepare_v2(db,
+    " SELECT 0,r.node_id,n.lon,n.lat"
+    " FROM rtree_node AS r"
+    " JOIN node_tags AS t ON t.node_id=r.node_id"
+    " JOIN nodes AS n ON n.node_id=r.node_id"
+    " WHERE r.max_lon>=?1 AND r.min_lon<=?2 AND r.max_lat>=?3 AND r.min_lat<=?4"
+    "   AND t.key=?5 AND t.value=?6"
+    " UNION ALL"
+    " SELECT 1,r.way_id,(r.min_lon+r.max_lon)/2,(r.min_lat+r.max_lat)/2"
+    " FROM rtree_way AS r"
+    " JOIN way_tags AS t ON t.way_id=r.way_id"
+    " WHERE r.max_lon>=?1 AND r.min_lon<=?2 AND r.max_lat>=?3 AND r.min_lat<=?4"
+    "   AND t.key=?5 AND t.value=?6",
+    -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_msg("Option nearest: R*Tree indexes missing (option rtree)");
+  sqlite3_bind_double(stmt, 1, b ? b->min_lon : -180);
+  sqlite3_bind_double(stmt, 2, b ? b->max_lon : 180);
+  sqlite3_bind_double(stmt, 3, b ? b->min_lat : -90);
+  sqlite3_bind_double(stmt, 4, b ? b->max_lat : 90);
+  sqlite3_bind_text(stmt, 5, key, -1, NULL);
+  sqlite3_bind_text(stmt, 6, value, -1, NULL);
+  poi = malloc(cap * sizeof(NearestPoi));
+  if( !poi ) abort_msg("Out of memory");
+  *num = 0;
+  while( (rc = sqlite3_step(stmt))==SQLITE_ROW ){
+    if( *num==cap ){
+      cap *= 2;
+      poi = realloc(poi, cap * sizeof(NearestPoi));
+      if( !poi ) abort_msg("Out of memory");
+    }
+    poi[*num].is_way = sqlite3_column_int(stmt, 0);
+    poi[*num].id = sqlite3_column_int64(stmt, 1);
+    poi[*num].lon = sqlite3_column_double(stmt, 2);
+    poi[*num].lat = sqlite3_column_double(stmt, 3);
+    (*num)++;
+  }
+  if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+  sqlite3_finalize(stmt);
+  return poi;
+}
+
+static int nearest_cmp(const void *a, const void *b) {
+  const NearestPoi *pa = a, *pb = b;
+  if( pa->d!=pb->d ) return pa->d<pb->d ? -1 : 1;
+  if( pa->is_way!=pb->is_way ) return pa->is_way - pb->is_way;
+  return pa->id<pb->id ? -1 : pa->id>pb->id;
+}
+
+/*
+** Distances of all candidates after a search from the start position
+*/
+static void nearest_distances(
+  const DijkstraWorkspace *ws,
+  const RoutingGraph *graph,
+  const int mask_permit,
+  const SnapPoint *start,
+  NearestPoi *poi,
+  const int num
+){
+  int i, d, direct, v, backward;
+  for(i=0; i<num; i++){
+    poi[i].d = INT_MAX;
+    if( poi[i].snap.edge==-1 ) continue;
+    d = snap_arrival(ws, graph, mask_permit, &poi[i].snap, &v, &backward);
+    direct = snap_direct(graph, mask_permit, start, &poi[i].snap, &backward);
+    if( direct<d ) d = direct;
+    poi[i].d = d;
+  }
+}
+
+/**
+ * \brief Finds the k nearest nodes and ways with a tag by network distance
+ *
+ * Writes a CSV table to stdout: rank, type (node or way), id, coordinates,
+ * distance in meters and the path as encoded polyline.
+ */
+void nearest(
+  sqlite3 *db,
+  const char *permit,
+  const double lon,
+  const double lat,
+  const char *tag,
+  const int k
+){
+  int mask_permit;                 /* Permit mask */
+  RoutingGraph graph;              /* Routing graph (CSR) */
+  int graph_image;                 /* 1 if the graph image is used */
+  DijkstraWorkspace ws;            /* Search workspace */
+  SnapPoint start;                 /* Position of the start point on an edge */
+  NearestPoi *poi;                 /* Candidates */
+  int num_poi, num_found;          /* Number of candidates, reached within the radius */
+  unsigned char *target;           /* 1 for each vertex from which a candidate can be reached */
+  int num_targets;                 /* Number of different target vertices */
+  int dest[2], num_dest, radius, max_dist, i, j;
+  char *key, *value;
+  bbox b;
+  Path path;
+  NodeList points;
+  StrBuf sb;
+  double t0, t1;
+  if( k<1 ) abort_msg("Option nearest: Invalid number");
+  value = strchr(tag, '=');
+  if( value==NULL || value==tag ) abort_msg("Option nearest: key=value expected");
+  key = malloc(value - tag + 1);
+  if( !key ) abort_msg("Out of memory");
+  memcpy(key, tag, value - tag);
+  key[value - tag] = '\0';
+  value++;
+  mask_permit = permit_mask(permit);
+  graph_image = routing_graph_load(db, NULL, 0, &graph);
+  if( !routing_graph_snap_component(&graph, lon, lat, mask_permit, 1, &start) &&
+      !routing_graph_snap(&graph, lon, lat, mask_permit, &start) )
+    abort_msg("Option nearest: Coordinates out of range");
+  t0 = time_now();
+  dijkstra_workspace_init(&ws, &graph);
+  target = malloc(graph.num_vertices + 1);
+  if( !target ) abort_msg("Out of memory");
+  radius = NEAREST_RADIUS;
+  while( 1 ){
+    /* Candidates within the radius as the crow flies, all beyond the maximum radius */
+    b.min_lat = lat - radius / 111320.0;
+    b.max_lat = lat + radius / 111320.0;
+    b.min_lon = lon - radius / (111320.0 * cos(radians(lat)));
+    b.max_lon = lon + radius / (111320.0 * cos(radians(lat)));
+    poi = nearest_candidates(db, key, value, radius>NEAREST_MAX_RADIUS ? NULL : &b, &num_poi);
+    memset(target, 0, graph.num_vertices);
+    num_targets = 0;
+    for(i=0; i<num_poi; i++){
+      if( !routing_graph_snap_component(&graph, poi[i].lon, poi[i].lat, mask_permit, 1, &poi[i].snap) &&
+          !routing_graph_snap(&graph, poi[i].lon, poi[i].lat, mask_permit, &poi[i].snap) ){
+        poi[i].snap.edge = -1;
+        continue;
+      }
+      num_dest = snap_dest(&graph, mask_permit, &poi[i].snap, dest);
+      for(j=0; j<num_dest; j++){
+        if( !target[dest[j]] ) num_targets++;
+        target[dest[j]] = 1;
+      }
+    }
+    /* Each candidate has at most two target vertices, so at least k candidates
+       are reached when 2k target vertices are settled */
+    if( num_poi>=k ){
+      dijkstra_workspace_reset(&ws);
+      snap_add_start(&ws, &graph, mask_permit, &start);
+      dijkstra_run(&ws, &graph, mask_permit, NULL, 0, target, num_targets<2*k ? num_targets : 2*k, INT_MAX);
+      nearest_distances(&ws, &graph, mask_permit, &start, poi, num_poi);
+      qsort(poi, num_poi, sizeof(NearestPoi), nearest_cmp);
+    }
+    /* All vertices up to the distance of the k-th candidate give the exact distances */
+    max_dist = num_poi>=k ? poi[k-1].d : INT_MAX;
+    if( radius<=NEAREST_MAX_RADIUS && max_dist>radius ) max_dist = radius;
+    dijkstra_workspace_reset(&ws);
+    snap_add_start(&ws, &graph, mask_permit, &start);
+    dijkstra_run(&ws, &graph, mask_permit, NULL, 0, NULL, 0, max_dist);
+    nearest_distances(&ws, &graph, mask_permit, &start, poi, num_poi);
+    qsort(poi, num_poi, sizeof(NearestPoi), nearest_cmp);
+    for(num_found=0; num_found<num_poi && num_found<k && poi[num_found].d<=radius; num_found++);
+    if( num_found==k || radius>NEAREST_MAX_RADIUS ) break;
+    free(poi);
+    radius *= 4;
+  }
+  for(num_found=0; num_found<num_poi && num_found<k && poi[num_found].d!=INT_MAX; num_found++);
+  t1 = time_now();
+  /* Result with the paths from the tree of the last search */
+  path_init(&path);
+  nodelist_init(&points);
+  strbuf_init(&sb);
+  printf("rank,type,id,lon,lat,distance,polyline\n");
+  for(i=0; i<num_found; i++){
+    snap_tree_path(&ws, &graph, mask_permit, &start, &poi[i].snap, &path);
+    nodelist_clear(&points);
+    path_points(&graph, &path, &points);
+    strbuf_clear(&sb);
+    nodelist_polyline(&points, &sb);
+    printf("%d,%s,%" PRId64 ",%.7f,%.7f,%d,%s\n", i+1, poi[i].is_way ? "way" : "node",
+           poi[i].id, poi[i].lon, poi[i].lat, poi[i].d, sb.s);
+  }
+  fprintf(stderr, "nearest: graph with %d vertices loaded from %s\n",
+          graph.num_vertices, graph_image ? "graph image" : "tables");
+  if( radius>NEAREST_MAX_RADIUS ) fprintf(stderr, "nearest: %d candidates (all)", num_poi);
+  else fprintf(stderr, "nearest: %d candidates within %d m", num_poi, radius);
+  fprintf(stderr, ", %d found in %.3f s\n", num_found, t1-t0);
+  /* Cleanup */
+  strbuf_free(&sb);
+  nodelist_free(&points);
+  path_free(&path);
+  free(poi);
+  free(target);
+  free(key);
+  dijkstra_workspace_free(&ws);
+  routing_graph_free(&graph);
+}
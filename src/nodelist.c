@@ -51,3 +51,89 @@ void nodelist_show(NodeList *list) {
   }
 }
 
+/*
+** Simplifies the line in place (Douglas-Peucker): points closer than
+** tolerance meters to the simplified line are removed, the first and
+** the last point are kept. The distances are measured in a plane around
+** the first point. The list is compacted while the segments are checked
+** from the start to the end, the only memory is a stack of segment ends.
+** Returns the new number of points.
+*/
+size_t nodelist_simplify(NodeList *list, const double tolerance) {
+  size_t *stack, top, first, last, i, imax, out;
+  double kx, ky, dx, dy, px, py, t, len2, d, dmax;
+  Node *node = list->node;
+  if( list->size<3 || tolerance<=0 ) return list->size;
+  stack = malloc(list->size * sizeof(size_t));
+  if( !stack ) abort_msg("Out of memory");
+  ky = 111320.0;
+  kx = ky * cos(radians(node[0].lat));
+  first = 0;
+  out = 1;
+  top = 0;
+  stack[top++] = list->size - 1;
+  while( top>0 ){
+    last = stack[top-1];
+    dx = (node[last].lon - node[first].lon) * kx;
+    dy = (node[last].lat - node[first].lat) * ky;
+    len2 = dx*dx + dy*dy;
+    dmax = 0;
+    imax = first;
+    for(i=first+1; i<last; i++){
+      px = (node[i].lon - node[first].lon) * kx;
+      py = (node[i].lat - node[first].lat) * ky;
+      if( len2>0 ){
+        t = (px*dx + py*dy) / len2;
+        if( t<0 ) t = 0;
+        if( t>1 ) t = 1;
+        px -= t * dx;
+        py -= t * dy;
+      }
+      d = px*px + py*py;
+      if( d>dmax ){
+        dmax = d;
+        imax = i;
+      }
+    }
+    if( dmax>tolerance*tolerance ){
+      stack[top++] = imax;     /* Check the first half next */
+    }else{
+      node[out++] = node[last];  /* out<=last, the points after last are not yet moved */
+      first = last;
+      top--;
+    }
+  }
+  free(stack);
+  list->size = out;
+  return out;
+}
+
+
+/*
+** Encoded polyline of the nodes (precision 5)
+** https://developers.google.com/maps/documentation/utilities/polylinealgorithm
+*/
+static void polyline_value(StrBuf *sb, int64_t value) {
+  uint64_t v = value < 0 ? ~((uint64_t)value << 1) : (uint64_t)value << 1;
+  char c[16];
+  int n = 0;
+  while (v >= 0x20) {
+    c[n++] = (char)((0x20 | (v & 0x1f)) + 63);
+    v >>= 5;
+  }
+  c[n++] = (char)(v + 63);
+  c[n] = '\0';
+  strbuf_printf(sb, "%s", c);
+}
+
+void nodelist_polyline(const NodeList *list, StrBuf *sb) {
+  int64_t lon, lat, prev_lon = 0, prev_lat = 0;
+  for (size_t i = 0; i < list->size; i++) {
+    lat = llround(list->node[i].lat * 1e5);
+    lon = llround(list->node[i].lon * 1e5);
+    polyline_value(sb, lat - prev_lat);
+    polyline_value(sb, lon - prev_lon);
+    prev_lat = lat;
+    prev_lon = lon;
+  }
+}
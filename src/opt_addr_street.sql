@@ -0,0 +1,20 @@
+" /*"
+" ** 5. Fill tables 'addr_street' and 'addr_housenumber'"
+" */"
+" INSERT INTO addr_street (country,postcode,city,street,min_lon,min_lat,max_lon,max_lat)"
+"  SELECT country,postcode,city,street,min(lon),min(lat),max(lon),max(lat)"
+"  FROM tmp_addr"
+"  GROUP BY country,postcode,city,street;"
+" INSERT INTO addr_housenumber (street_id,housenumber,lon,lat,way_id,node_id)"
+"  SELECT s.street_id,a.housenumber,a.lon,a.lat,a.way_id,a.node_id"
+"  FROM tmp_addr AS a"
+"  LEFT JOIN addr_street AS s ON a.country=s.country AND a.postcode=s.postcode AND a.city=s.city AND a.street=s.street;"
+" CREATE INDEX addr_housenumber__street_id ON addr_housenumber (street_id);\n"
+" /*"
+" ** 6. Delete temporary tables"
+" */"
+" DROP TABLE tmp_addr_way;"
+" DROP TABLE tmp_addr_way_coordinates;"
+" DROP TABLE tmp_addr_node;"
+" DROP TABLE tmp_addr;"
+" COMMIT TRANSACTION;"
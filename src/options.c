@@ -28,7 +28,11 @@ void add_rtree(sqlite3 *db) {
   if( rc!=SQLITE_OK ) abort_db_error(db, rc);
 }
 
-void add_addr(sqlite3 *db) {
+/*
+** Address tables, part 1: temporary table tmp_addr with all addresses
+** (opens a transaction)
+*/
+void add_addr_tmp(sqlite3 *db) {
   const char *sql = 
   #include "opt_addr.sql"
   ;
@@ -36,6 +40,23 @@ void add_addr(sqlite3 *db) {
   if( rc!=SQLITE_OK ) abort_db_error(db, rc);
 }
 
+/*
+** Address tables, part 2: tables addr_street and addr_housenumber
+** from tmp_addr (commits the transaction)
+*/
+void add_addr_tables(sqlite3 *db) {
+  const char *sql = 
+  #include "opt_addr_street.sql"
+  ;
+  rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+}
+
+void add_addr(sqlite3 *db) {
+  add_addr_tmp(db);
+  add_addr_tables(db);
+}
+
 void fill_graph_permit(sqlite3 *db) {
   sqlite3_stmt *stmt, *stmt_mask, *stmt_update;
   int64_t way_id;
@@ -84,19 +105,26 @@ void fill_graph_permit(sqlite3 *db) {
   sqlite3_finalize(stmt_update);
 }
 
-void create_table_graph_permit(sqlite3 *db) {
+/*
+** Checks whether a table exists in the database
+*/
+int table_exists(sqlite3 *db, const char *name) {
   sqlite3_stmt *stmt_check;
-  /* do not create the table if it already exists */
+  int exists;
   rc = sqlite3_prepare_v2(db,
     " SELECT name FROM sqlite_master"
-    " WHERE type='table' AND name='graph_permit'",
+    " WHERE type='table' AND name=?",
     -1, &stmt_check, NULL);
   if( rc!=SQLITE_OK ) abort_db_error(db, rc);
-  if( sqlite3_step(stmt_check)==SQLITE_ROW ) {
-        sqlite3_finalize(stmt_check);
-        return;
-  }
+  sqlite3_bind_text(stmt_check, 1, name, -1, NULL);
+  exists = sqlite3_step(stmt_check)==SQLITE_ROW;
   sqlite3_finalize(stmt_check);
+  return exists;
+}
+
+void create_table_graph_permit(sqlite3 *db) {
+  /* do not create the table if it already exists */
+  if( table_exists(db, "graph_permit") ) return;
   /* else create the table */
   const char *sql = 
   #include "opt_graph_permit.sql"
@@ -105,7 +133,51 @@ void create_table_graph_permit(sqlite3 *db) {
   if( rc!=SQLITE_OK ) abort_db_error(db, rc);
 }
 
+/*
+** Stores the strongly connected components of the routing graph
+** for foot, bike and car in table graph_vertices
+*/
+void fill_graph_components(sqlite3 *db) {
+  sqlite3_stmt *stmt;
+  RoutingGraph graph;
+  int v, p;
+  routing_graph_build_complete(db, &graph);
+  rc = sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+  rc = sqlite3_prepare_v2(db,
+    " UPDATE graph_vertices SET component_foot=?1,component_bike=?2,component_car=?3"
+    " WHERE node_id=?4",
+    -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  for(v=0; v<graph.num_vertices; v++){
+    for(p=0; p<GRAPH_PROFILES; p++){
+      sqlite3_bind_int(stmt, p+1, graph.component[(size_t)p * graph.num_vertices + v]);
+    }
+    sqlite3_bind_int64(stmt, 4, graph.vertex[v].node_id);
+    rc = sqlite3_step(stmt);
+    if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  rc = sqlite3_exec(db, "COMMIT TRANSACTION", NULL, NULL, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  routing_graph_free(&graph);
+}
+
 void add_graph(sqlite3 *db) {
+  char *filename;
+  /* an existing graph image, landmarks and cached routes would be outdated */
+  filename = graph_image_filename(db);
+  if( filename ){
+    remove(filename);
+    free(filename);
+  }
+  filename = landmarks_filename(db);
+  if( filename ){
+    remove(filename);
+    free(filename);
+  }
+  rc = sqlite3_exec(db, "DROP TABLE IF EXISTS route_cache", NULL, NULL, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
   rc = sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
   rc = sqlite3_exec(
     db,
@@ -116,7 +188,8 @@ void add_graph(sqlite3 *db) {
     "  dist          INTEGER,              -- distance in meters\n"
     "  way_id        INTEGER,              -- way ID\n"
     "  nodes         INTEGER,              -- number of nodes\n"
-    "  permit        INTEGER DEFAULT 15    -- bit field access\n"
+    "  permit        INTEGER DEFAULT 15,   -- bit field access\n"
+    "  geometry      BLOB                  -- node IDs and coordinates of the edge\n"
     " )\n",
     NULL, NULL, NULL);
   if( rc!=SQLITE_OK ) abort_db_error(db, rc);
@@ -146,11 +219,13 @@ void add_graph(sqlite3 *db) {
   int64_t start_node_id = -1;
   double dist = 0;
   int nodes = 1;
+  GeometryBlob geometry;
+  geometry_blob_init(&geometry);
 
   sqlite3_stmt *stmt_insert_graph;
   rc = sqlite3_prepare_v2(
     db,
-    "INSERT INTO graph_edges (start_node_id,end_node_id,dist,way_id,nodes) VALUES (?1,?2,?3,?4,?5)",
+    "INSERT INTO graph_edges (start_node_id,end_node_id,dist,way_id,nodes,geometry) VALUES (?1,?2,?3,?4,?5,?6)",
     -1, &stmt_insert_graph, NULL);
   if( rc!=SQLITE_OK ) abort_db_error(db, rc);
 
@@ -188,6 +263,7 @@ void add_graph(sqlite3 *db) {
       sqlite3_bind_int  (stmt_insert_graph, 3, lroundf(dist));
       sqlite3_bind_int64(stmt_insert_graph, 4, prev_way_id);
       sqlite3_bind_int  (stmt_insert_graph, 5, nodes);
+      sqlite3_bind_blob (stmt_insert_graph, 6, geometry.data, geometry.size, SQLITE_STATIC);
       rc = sqlite3_step(stmt_insert_graph);
       if( rc==SQLITE_DONE ) {
         sqlite3_reset(stmt_insert_graph);
@@ -204,7 +280,9 @@ void add_graph(sqlite3 *db) {
       start_node_id = node_id;
       dist = 0;
       nodes = 1;
+      geometry_blob_clear(&geometry);
     }
+    geometry_blob_add(&geometry, node_id, lon, lat);
     if( node_id_crossing > -1 && way_id == prev_way_id ) {
       if( start_node_id != -1 ) {
         sqlite3_bind_int64(stmt_insert_graph, 1, start_node_id);
@@ -212,6 +290,7 @@ void add_graph(sqlite3 *db) {
         sqlite3_bind_int  (stmt_insert_graph, 3, lroundf(dist));
         sqlite3_bind_int64(stmt_insert_graph, 4, way_id);
         sqlite3_bind_int  (stmt_insert_graph, 5, nodes);
+        sqlite3_bind_blob (stmt_insert_graph, 6, geometry.data, geometry.size, SQLITE_STATIC);
         rc = sqlite3_step(stmt_insert_graph);
         if( rc==SQLITE_DONE ) {
           sqlite3_reset(stmt_insert_graph);
@@ -223,6 +302,8 @@ void add_graph(sqlite3 *db) {
       start_node_id = node_id;
       dist = 0;
       nodes = 1;
+      geometry_blob_clear(&geometry);
+      geometry_blob_add(&geometry, node_id, lon, lat);
     }
     prev_lon = lon;
     prev_lat = lat;
@@ -236,6 +317,7 @@ void add_graph(sqlite3 *db) {
     sqlite3_bind_int  (stmt_insert_graph, 3, lroundf(dist));
     sqlite3_bind_int64(stmt_insert_graph, 4, way_id);
     sqlite3_bind_int  (stmt_insert_graph, 5, nodes);
+    sqlite3_bind_blob (stmt_insert_graph, 6, geometry.data, geometry.size, SQLITE_STATIC);
     rc = sqlite3_step(stmt_insert_graph);
     if( rc==SQLITE_DONE ) {
       sqlite3_reset(stmt_insert_graph);
@@ -244,13 +326,17 @@ void add_graph(sqlite3 *db) {
     }
   }
   sqlite3_finalize(stmt_insert_graph);
+  geometry_blob_free(&geometry);
   rc = sqlite3_exec(db, "CREATE INDEX graph_edges__way_id ON graph_edges (way_id)", NULL, NULL, NULL);
   if( rc!=SQLITE_OK ) abort_db_error(db, rc);
   rc = sqlite3_exec(db,
     " CREATE TABLE graph_vertices (\n"
-    "  vertex_id INTEGER PRIMARY KEY,  -- vertex ID\n"
-    "  node_id   INTEGER,              -- node ID\n"
-    "  num_edges INTEGER               -- number of edges\n"
+    "  vertex_id      INTEGER PRIMARY KEY,  -- vertex ID\n"
+    "  node_id        INTEGER,              -- node ID\n"
+    "  num_edges      INTEGER,              -- number of edges\n"
+    "  component_foot INTEGER DEFAULT 0,    -- strongly connected component for foot\n"
+    "  component_bike INTEGER DEFAULT 0,    -- strongly connected component for bike\n"
+    "  component_car  INTEGER DEFAULT 0     -- strongly connected component for car\n"
     " );\n"
     " INSERT INTO graph_vertices (node_id, num_edges)"
     " SELECT node_id,count(*) AS num_edges FROM"
@@ -268,4 +354,45 @@ void add_graph(sqlite3 *db) {
   if( rc!=SQLITE_OK ) abort_db_error(db, rc);
   create_table_graph_permit(db);
   fill_graph_permit(db);
+  fill_graph_components(db);
+}
+
+/*
+** Writes the graph image '<database>.graph', creates the graph tables if necessary
+*/
+void add_graph_image(sqlite3 *db) {
+  RoutingGraph graph;
+  char *filename;
+  filename = graph_image_filename(db);
+  if( filename==NULL ) abort_msg("Option graph image: Database has no filename");
+  if( !table_exists(db, "graph_edges") ) add_graph(db);
+  routing_graph_build_complete(db, &graph);
+  routing_graph_write(&graph, filename);
+  routing_graph_free(&graph);
+  free(filename);
+}
+
+/**
+ * \brief Selects k landmarks and writes their distances to <database>.landmarks
+ *
+ * The graph image is written first if it is missing or outdated.
+ */
+void add_graph_landmarks(sqlite3 *db, const int k) {
+  RoutingGraph graph;
+  Landmarks lm;
+  char *filename, *image;
+  if( k<1 || k>LANDMARKS_MAX ) abort_msg("Option graph landmarks: Number of landmarks must be 1 .. 64");
+  filename = landmarks_filename(db);
+  if( filename==NULL ) abort_msg("Option graph landmarks: Database has no filename");
+  if( !table_exists(db, "graph_edges") ) add_graph(db);
+  if( !routing_graph_load(db, NULL, 0, &graph) ){
+    image = graph_image_filename(db);
+    routing_graph_write(&graph, image);
+    free(image);
+  }
+  landmarks_calculate(&graph, k, &lm);
+  image_file_write(lm.mem, lm.mem_size, filename);
+  free(filename);
+  landmarks_free(&lm);
+  routing_graph_free(&graph);
 }
@@ -0,0 +1,93 @@
+/**
+ * \file protobuf.c
+ * \brief Writing Protocol Buffers messages into a growable byte buffer
+ *
+ * Only what the writers of this program need: varints, zigzag encoded
+ * integers and length-delimited fields. A nested message is written into
+ * a buffer of its own and added with protobuf_bytes().
+ */
+
+typedef struct {
+  unsigned char *data;
+  size_t size;      /* bytes used */
+  size_t capacity;  /* bytes allocated */
+} ProtoBuf;
+
+#define PROTOBUF_VARINT  0   /* Wire type varint */
+#define PROTOBUF_LEN     2   /* Wire type length-delimited */
+
+void protobuf_init(ProtoBuf *pb) {
+  pb->data = NULL;
+  pb->size = pb->capacity = 0;
+}
+
+void protobuf_clear(ProtoBuf *pb) {
+  pb->size = 0;
+}
+
+void protobuf_free(ProtoBuf *pb) {
+  free(pb->data);
+  pb->data = NULL;
+  pb->size = pb->capacity = 0;
+}
+
+/**
+ * \brief Makes room for n more bytes
+ */
+void protobuf_reserve(ProtoBuf *pb, size_t n) {
+  if( pb->size + n<=pb->capacity ) return;
+  while( pb->size + n>pb->capacity ) pb->capacity = pb->capacity ? pb->capacity * 2 : 256;
+  pb->data = realloc(pb->data, pb->capacity);
+  if( !pb->data ) abort_msg("Out of memory");
+}
+
+void protobuf_raw(ProtoBuf *pb, const void *data, size_t len) {
+  protobuf_reserve(pb, len);
+  if( len ) memcpy(pb->data + pb->size, data, len);
+  pb->size += len;
+}
+
+void protobuf_varint(ProtoBuf *pb, uint64_t v) {
+  protobuf_reserve(pb, 10);
+  while( v>=0x80 ){
+    pb->data[pb->size++] = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  pb->data[pb->size++] = (unsigned char)v;
+}
+
+static uint64_t protobuf_zigzag(int64_t v) {
+  return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+void protobuf_key(ProtoBuf *pb, int field, int wire_type) {
+  protobuf_varint(pb, (uint64_t)field << 3 | wire_type);
+}
+
+/**
+ * \brief Field with an unsigned integer (uint32, uint64, enum, bool)
+ */
+void protobuf_uint(ProtoBuf *pb, int field, uint64_t v) {
+  protobuf_key(pb, field, PROTOBUF_VARINT);
+  protobuf_varint(pb, v);
+}
+
+/**
+ * \brief Field with a signed integer (sint32, sint64)
+ */
+void protobuf_sint(ProtoBuf *pb, int field, int64_t v) {
+  protobuf_uint(pb, field, protobuf_zigzag(v));
+}
+
+/**
+ * \brief Length-delimited field: bytes, string, nested message or packed values
+ */
+void protobuf_bytes(ProtoBuf *pb, int field, const void *data, size_t len) {
+  protobuf_key(pb, field, PROTOBUF_LEN);
+  protobuf_varint(pb, len);
+  protobuf_raw(pb, data, len);
+}
+
+void protobuf_string(ProtoBuf *pb, int field, const char *s) {
+  protobuf_bytes(pb, field, s, strlen(s));
+}
@@ -0,0 +1,291 @@
+/**
+ * \file route_cache.c
+ * \brief Cache of calculated routes between snapped positions
+ *
+ * The key of a route is the permit mask and the start and end position
+ * (edge and distance from the start of the edge). Positions with the same
+ * key give the same search, so the distance and the edges of the path can
+ * be reused. The least recently used routes are removed when the memory
+ * bound is exceeded. All threads share one cache.
+ *
+ * The cache can be saved to the table route_cache and loaded again,
+ * so a new server process starts with the routes of the previous one.
+ */
+
+#define ROUTE_CACHE_MB  64   /* Default memory bound in MB */
+
+typedef struct RouteCacheEntry {
+  struct RouteCacheEntry *hash_next;  /* Next entry with the same hash */
+  struct RouteCacheEntry *prev;       /* LRU list, more recently used */
+  struct RouteCacheEntry *next;       /* LRU list, less recently used */
+  int32_t mask_permit;
+  int32_t from_edge, from_offset;
+  int32_t to_edge, to_offset;
+  int32_t distance;                   /* -1: no route */
+  uint8_t direct, from_backward, to_backward;
+  int32_t num_steps;
+  PathStep step[];                    /* Edges of the path */
+} RouteCacheEntry;
+
+typedef struct {
+  RouteCacheEntry **bucket;
+  size_t num_buckets;                 /* Power of 2 */
+  RouteCacheEntry *head, *tail;       /* Most and least recently used */
+  size_t num_entries;
+  size_t bytes;                       /* Memory of the entries */
+  size_t max_bytes;
+  int64_t hits, misses;
+  pthread_mutex_t lock;
+} RouteCache;
+
+static size_t route_cache_hash(int mask, int from_edge, int from_offset, int to_edge, int to_offset) {
+  uint64_t h = 14695981039346656037ULL;
+  h = (h ^ (uint32_t)mask) * 1099511628211ULL;
+  h = (h ^ (uint32_t)from_edge) * 1099511628211ULL;
+  h = (h ^ (uint32_t)from_offset) * 1099511628211ULL;
+  h = (h ^ (uint32_t)to_edge) * 1099511628211ULL;
+  h = (h ^ (uint32_t)to_offset) * 1099511628211ULL;
+  return (size_t)(h ^ (h >> 32));
+}
+
+static size_t route_cache_entry_size(int num_steps) {
+  return sizeof(RouteCacheEntry) + num_steps * sizeof(PathStep);
+}
+
+/**
+ * \brief Initializes an empty cache with max_mb megabytes
+ */
+void route_cache_init(RouteCache *cache, const int max_mb) {
+  cache->max_bytes = (size_t)max_mb * 1024 * 1024;
+  cache->num_buckets = 1024;
+  while( cache->num_buckets * 512 < cache->max_bytes ) cache->num_buckets *= 2;
+  cache->bucket = calloc(cache->num_buckets, sizeof(RouteCacheEntry *));
+  if( !cache->bucket ) abort_msg("Out of memory");
+  cache->head = cache->tail = NULL;
+  cache->num_entries = 0;
+  cache->bytes = 0;
+  cache->hits = cache->misses = 0;
+  pthread_mutex_init(&cache->lock, NULL);
+}
+
+void route_cache_free(RouteCache *cache) {
+  RouteCacheEntry *e, *next;
+  for(e=cache->head; e; e=next){
+    next = e->next;
+    free(e);
+  }
+  free(cache->bucket);
+  cache->bucket = NULL;
+  pthread_mutex_destroy(&cache->lock);
+}
+
+/*
+** LRU list
+*/
+static void route_cache_unlink(RouteCache *cache, RouteCacheEntry *e) {
+  if( e->prev ) e->prev->next = e->next;
+  else cache->head = e->next;
+  if( e->next ) e->next->prev = e->prev;
+  else cache->tail = e->prev;
+}
+
+static void route_cache_push_front(RouteCache *cache, RouteCacheEntry *e) {
+  e->prev = NULL;
+  e->next = cache->head;
+  if( cache->head ) cache->head->prev = e;
+  cache->head = e;
+  if( !cache->tail ) cache->tail = e;
+}
+
+/* Removes the least recently used entry */
+static void route_cache_evict(RouteCache *cache) {
+  RouteCacheEntry *e = cache->tail, **pp;
+  pp = &cache->bucket[route_cache_hash(e->mask_permit, e->from_edge, e->from_offset,
+                                       e->to_edge, e->to_offset) & (cache->num_buckets - 1)];
+  while( *pp!=e ) pp = &(*pp)->hash_next;
+  *pp = e->hash_next;
+  route_cache_unlink(cache, e);
+  cache->bytes -= route_cache_entry_size(e->num_steps);
+  cache->num_entries--;
+  free(e);
+}
+
+static RouteCacheEntry *route_cache_find(
+  RouteCache *cache,
+  int mask, int from_edge, int from_offset, int to_edge, int to_offset
+){
+  RouteCacheEntry *e;
+  e = cache->bucket[route_cache_hash(mask, from_edge, from_offset, to_edge, to_offset) & (cache->num_buckets - 1)];
+  for(; e; e=e->hash_next){
+    if( e->mask_permit==mask && e->from_edge==from_edge && e->from_offset==from_offset &&
+        e->to_edge==to_edge && e->to_offset==to_offset ) return e;
+  }
+  return NULL;
+}
+
+/*
+** Inserts a route as most recently used entry (the key must not be in the cache)
+*/
+static void route_cache_insert(
+  RouteCache *cache,
+  int mask, int from_edge, int from_offset, int to_edge, int to_offset,
+  int distance, int direct, int from_backward, int to_backward,
+  const PathStep *step, int num_steps
+){
+  RouteCacheEntry *e, **b;
+  size_t size = route_cache_entry_size(num_steps);
+  if( size>cache->max_bytes ) return;
+  while( cache->bytes + size>cache->max_bytes ) route_cache_evict(cache);
+  e = malloc(size);
+  if( !e ) abort_msg("Out of memory");
+  e->mask_permit = mask;
+  e->from_edge = from_edge;
+  e->from_offset = from_offset;
+  e->to_edge = to_edge;
+  e->to_offset = to_offset;
+  e->distance = distance;
+  e->direct = (uint8_t)direct;
+  e->from_backward = (uint8_t)from_backward;
+  e->to_backward = (uint8_t)to_backward;
+  e->num_steps = num_steps;
+  if( num_steps>0 ) memcpy(e->step, step, num_steps * sizeof(PathStep));
+  b = &cache->bucket[route_cache_hash(mask, from_edge, from_offset, to_edge, to_offset) & (cache->num_buckets - 1)];
+  e->hash_next = *b;
+  *b = e;
+  route_cache_push_front(cache, e);
+  cache->bytes += size;
+  cache->num_entries++;
+}
+
+/**
+ * \brief Shortest path between two positions, from the cache if possible
+ *
+ * Same as snap_route(). Without cache (NULL) the route is always calculated.
+ *
+ * \return Distance in meters or -1 if there is no path
+ */
+int route_cache_route(
+  RouteCache *cache,
+  DijkstraWorkspace *ws,
+  const RoutingGraph *graph,
+  const int mask_permit,
+  const SnapPoint *from,
+  const SnapPoint *to,
+  Path *path
+){
+  RouteCacheEntry *e;
+  int d, i;
+  if( cache==NULL ) return snap_route(ws, graph, mask_permit, from, to, path);
+  pthread_mutex_lock(&cache->lock);
+  e = route_cache_find(cache, mask_permit, from->edge, from->offset, to->edge, to->offset);
+  if( e ){
+    cache->hits++;
+    route_cache_unlink(cache, e);
+    route_cache_push_front(cache, e);
+    path_clear(path);
+    for(i=0; i<e->num_steps; i++) path_add(path, e->step[i].edge, e->step[i].backward);
+    path->snapped = e->distance!=-1;
+    path->from = *from;
+    path->to = *to;
+    path->direct = e->direct;
+    path->from_backward = e->from_backward;
+    path->to_backward = e->to_backward;
+    d = e->distance;
+    pthread_mutex_unlock(&cache->lock);
+    return d;
+  }
+  cache->misses++;
+  pthread_mutex_unlock(&cache->lock);
+  /* Calculate without lock, another thread may insert the same route meanwhile */
+  d = snap_route(ws, graph, mask_permit, from, to, path);
+  pthread_mutex_lock(&cache->lock);
+  if( !route_cache_find(cache, mask_permit, from->edge, from->offset, to->edge, to->offset) ){
+    route_cache_insert(cache, mask_permit, from->edge, from->offset, to->edge, to->offset,
+                       d, path->direct, d!=-1 && path->from_backward, d!=-1 && path->to_backward,
+                       path->step, (int)path->size);
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return d;
+}
+
+/**
+ * \brief Loads the routes of table route_cache that belong to the graph
+ *
+ * The rows are inserted in the order of the table, the last row becomes
+ * the most recently used route.
+ */
+void route_cache_load(sqlite3 *db, RouteCache *cache, const RoutingGraph *graph) {
+  sqlite3_stmt *stmt;
+  const PathStep *step;
+  int i, num_steps, ok;
+  rc = sqlite3_prepare_v2(db,
+    " SELECT mask_permit,from_edge,from_offset,to_edge,to_offset,distance,flags,steps"
+    " FROM route_cache WHERE graph=? ORDER BY rowid",
+    -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) return;          /* no table route_cache */
+  sqlite3_bind_int64(stmt, 1, graph->header->max_edge_id);
+  while( sqlite3_step(stmt)==SQLITE_ROW ){
+    step = sqlite3_column_blob(stmt, 7);
+    num_steps = sqlite3_column_bytes(stmt, 7) / (int)sizeof(PathStep);
+    ok = sqlite3_column_int(stmt, 1)>=0 && sqlite3_column_int(stmt, 1)<graph->num_edges &&
+         sqlite3_column_int(stmt, 3)>=0 && sqlite3_column_int(stmt, 3)<graph->num_edges;
+    for(i=0; ok && i<num_steps; i++) ok = step[i].edge>=0 && step[i].edge<graph->num_edges;
+    if( !ok || route_cache_find(cache, sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1),
+                                sqlite3_column_int(stmt, 2), sqlite3_column_int(stmt, 3),
+                                sqlite3_column_int(stmt, 4)) ) continue;
+    route_cache_insert(cache, sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1),
+                       sqlite3_column_int(stmt, 2), sqlite3_column_int(stmt, 3),
+                       sqlite3_column_int(stmt, 4), sqlite3_column_int(stmt, 5),
+                       sqlite3_column_int(stmt, 6) & 1, (sqlite3_column_int(stmt, 6) >> 1) & 1,
+                       (sqlite3_column_int(stmt, 6) >> 2) & 1, step, num_steps);
+  }
+  sqlite3_finalize(stmt);
+}
+
+/**
+ * \brief Replaces the content of table route_cache with the routes of the cache
+ *
+ * The edges are stored as indexes in the routing graph, column graph
+ * contains the highest edge ID of table graph_edges to detect outdated rows.
+ */
+void route_cache_save(sqlite3 *db, RouteCache *cache, const RoutingGraph *graph) {
+  sqlite3_stmt *stmt;
+  RouteCacheEntry *e;
+  rc = sqlite3_exec(db,
+    " DROP TABLE IF EXISTS route_cache;"
+    " CREATE TABLE route_cache (\n"
+    "  mask_permit INTEGER,  -- permit mask of the route\n"
+    "  from_edge   INTEGER,  -- edge of the start position (index in the routing graph)\n"
+    "  from_offset INTEGER,  -- meters from the start of the edge\n"
+    "  to_edge     INTEGER,  -- edge of the end position\n"
+    "  to_offset   INTEGER,  -- meters from the start of the edge\n"
+    "  distance    INTEGER,  -- distance in meters, -1: no route\n"
+    "  flags       INTEGER,  -- bit 0: direct, bit 1: from backward, bit 2: to backward\n"
+    "  steps       BLOB,     -- edges of the path (int32 edge, int32 backward)\n"
+    "  graph       INTEGER   -- max(edge_id) of table graph_edges\n"
+    " )",
+    NULL, NULL, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  rc = sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
+  rc = sqlite3_prepare_v2(db,
+    "INSERT INTO route_cache VALUES (?1,?2,?3,?4,?5,?6,?7,?8,?9)", -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  /* From the least to the most recently used route */
+  for(e=cache->tail; e; e=e->prev){
+    sqlite3_bind_int(stmt, 1, e->mask_permit);
+    sqlite3_bind_int(stmt, 2, e->from_edge);
+    sqlite3_bind_int(stmt, 3, e->from_offset);
+    sqlite3_bind_int(stmt, 4, e->to_edge);
+    sqlite3_bind_int(stmt, 5, e->to_offset);
+    sqlite3_bind_int(stmt, 6, e->distance);
+    sqlite3_bind_int(stmt, 7, e->direct | e->from_backward << 1 | e->to_backward << 2);
+    sqlite3_bind_blob(stmt, 8, e->step, e->num_steps * (int)sizeof(PathStep), SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 9, graph->header->max_edge_id);
+    rc = sqlite3_step(stmt);
+    if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  rc = sqlite3_exec(db, "COMMIT TRANSACTION", NULL, NULL, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+}
@@ -99,6 +99,684 @@ int permit_mask(const char *permit){
   return mask_permit;
 }
 
+/*
+** Structures and functions for paths (sequence of edges in the routing graph)
+*/
+typedef struct {
+  int32_t edge;      /* Edge index in the routing graph */
+  int32_t backward;  /* 1 if the edge is traversed from end to start */
+} PathStep;
+
+typedef struct {
+  PathStep *step;
+  size_t size;        /* number of elements used */
+  size_t capacity;    /* allocated elements */
+  int snapped;        /* 1 if the path begins and ends at positions on edges */
+  SnapPoint from;     /* Start position */
+  SnapPoint to;       /* End position */
+  int from_backward;  /* 1 if the edge of the start position is traversed towards its start */
+  int to_backward;    /* 1 if the edge of the end position is traversed towards its start */
+  int direct;         /* 1 if start and end are on the same edge without steps in between */
+} Path;
+
+void path_init(Path *path) {
+  path->size = 0;
+  path->snapped = 0;
+  path->capacity = 16;
+  path->step = malloc(path->capacity * sizeof(PathStep));
+  if (!path->step) abort_msg("Out of memory");
+}
+
+void path_add(Path *path, int edge, int backward) {
+  if (path->size == path->capacity) {
+    path->capacity *= 2;
+    path->step = realloc(path->step, path->capacity * sizeof(PathStep));
+    if (!path->step) abort_msg("Out of memory");
+  }
+  path->step[path->size++] = (PathStep){edge, backward};
+}
+
+void path_clear(Path *path) {
+  path->size = 0;
+  path->snapped = 0;
+}
+
+void path_free(Path *path) {
+  free(path->step);
+  path->step = NULL;
+  path->size = path->capacity = 0;
+}
+
+/**
+ * \brief Calculates the shortest path between two vertices
+ *
+ * The edges of the shortest path are appended to path in the direction of travel.
+ *
+ * \return Distance in meters or -1 if there is no path
+ */
+int shortest_path(
+  DijkstraWorkspace *ws,
+  const RoutingGraph *graph,
+  const int start,
+  const int dest,
+  const int mask_permit,
+  Path *path
+){
+  int v, first;
+  size_t i, j;
+  PathStep tmp;
+  Dijkstra(ws, graph, start, dest, mask_permit);
+  if( ws->node[dest].d==INT_MAX ) return -1;
+  /* Follow the predecessors back to the start, then reverse the new steps */
+  first = path->size;
+  for(v=dest; ws->node[v].v_edge!=-1; v=ws->node[v].v_node){
+    path_add(path, ws->node[v].v_edge, graph->edge[ws->node[v].v_edge].start!=ws->node[v].v_node);
+  }
+  for(i=first, j=path->size-1; path->size>0 && i<j; i++, j--){
+    tmp = path->step[i];
+    path->step[i] = path->step[j];
+    path->step[j] = tmp;
+  }
+  return ws->node[dest].d;
+}
+
+/*
+** Checks whether an edge may be travelled from offset a to offset b.
+** A position at a vertex (zero length) is always connected to the vertex,
+** so the result does not depend on which edge of the vertex was snapped.
+*/
+static int snap_travel(const GraphEdge *e, const int mask_permit, const int a, const int b) {
+  if( a==b ) return 1;
+  return edge_permitted(e, a>b, mask_permit);
+}
+
+/*
+** Starts a search at a position on an edge: both ends of the edge are
+** start vertices with the partial distance (virtual start vertex)
+*/
+void snap_add_start(
+  DijkstraWorkspace *ws,
+  const RoutingGraph *graph,
+  const int mask_permit,
+  const SnapPoint *sp
+){
+  const GraphEdge *e = &graph->edge[sp->edge];
+  if( snap_travel(e, mask_permit, sp->offset, e->dist) ) dijkstra_add_start(ws, e->end, e->dist - sp->offset);
+  if( snap_travel(e, mask_permit, sp->offset, 0) ) dijkstra_add_start(ws, e->start, sp->offset);
+}
+
+/*
+** Vertices from which a position on an edge can be reached
+*/
+int snap_dest(
+  const RoutingGraph *graph,
+  const int mask_permit,
+  const SnapPoint *sp,
+  int *dest
+){
+  const GraphEdge *e = &graph->edge[sp->edge];
+  int n = 0;
+  if( snap_travel(e, mask_permit, 0, sp->offset) ) dest[n++] = e->start;
+  if( snap_travel(e, mask_permit, e->dist, sp->offset) ) dest[n++] = e->end;
+  return n;
+}
+
+/*
+** Distance of a position on an edge after a search
+** \return Distance in meters or INT_MAX, *vertex is the vertex at which
+**         the edge is entered and *backward the direction on the edge
+*/
+int snap_arrival(
+  const DijkstraWorkspace *ws,
+  const RoutingGraph *graph,
+  const int mask_permit,
+  const SnapPoint *sp,
+  int *vertex,
+  int *backward
+){
+  const GraphEdge *e = &graph->edge[sp->edge];
+  const struct Dijkstra *node = ws->node;
+  int d = INT_MAX;
+  *vertex = -1;
+  if( snap_travel(e, mask_permit, 0, sp->offset) && node[e->start].d!=INT_MAX && node[e->start].pos_heap==0 ){
+    d = node[e->start].d + sp->offset;
+    *vertex = e->start;
+    *backward = 0;
+  }
+  if( snap_travel(e, mask_permit, e->dist, sp->offset) && node[e->end].d!=INT_MAX && node[e->end].pos_heap==0 &&
+      node[e->end].d + e->dist - sp->offset < d ){
+    d = node[e->end].d + e->dist - sp->offset;
+    *vertex = e->end;
+    *backward = 1;
+  }
+  return d;
+}
+
+/*
+** Distance between two positions on the same edge without leaving the edge
+** \return Distance in meters or INT_MAX, *backward is the direction on the edge
+*/
+int snap_direct(
+  const RoutingGraph *graph,
+  const int mask_permit,
+  const SnapPoint *from,
+  const SnapPoint *to,
+  int *backward
+){
+  const GraphEdge *e = &graph->edge[from->edge];
+  int d = INT_MAX;
+  if( from->edge!=to->edge ) return INT_MAX;
+  if( to->offset>=from->offset && snap_travel(e, mask_permit, from->offset, to->offset) ){
+    d = to->offset - from->offset;
+    *backward = 0;
+  }
+  if( from->offset>=to->offset && snap_travel(e, mask_permit, from->offset, to->offset) && from->offset - to->offset<d ){
+    d = from->offset - to->offset;
+    *backward = 1;
+  }
+  return d;
+}
+
+/**
+ * \brief Shortest path to a position on an edge from the tree of the last search
+ *
+ * The search must have started at the position from (snap_add_start()).
+ * The path on the start edge only (without leaving it) is used if it is shorter.
+ * The steps of the path are the complete edges between the two partial edges.
+ *
+ * \return Distance in meters or -1 if there is no path
+ */
+int snap_tree_path(
+  const DijkstraWorkspace *ws,
+  const RoutingGraph *graph,
+  const int mask_permit,
+  const SnapPoint *from,
+  const SnapPoint *to,
+  Path *path
+){
+  const GraphEdge *e = &graph->edge[from->edge];
+  int best, d, v, backward;
+  size_t i, j;
+  PathStep tmp;
+  path_clear(path);
+  path->snapped = 1;
+  path->from = *from;
+  path->to = *to;
+  path->direct = 0;
+  best = snap_direct(graph, mask_permit, from, to, &backward);
+  if( best!=INT_MAX ){
+    path->direct = 1;
+    path->from_backward = path->to_backward = backward;
+  }
+  d = snap_arrival(ws, graph, mask_permit, to, &v, &backward);
+  if( d<best ){
+    best = d;
+    path->direct = 0;
+    path->to_backward = backward;
+    /* Follow the predecessors back to the start vertex, then reverse the steps */
+    for(; ws->node[v].v_edge!=-1; v=ws->node[v].v_node){
+      path_add(path, ws->node[v].v_edge, graph->edge[ws->node[v].v_edge].start!=ws->node[v].v_node);
+    }
+    for(i=0, j=path->size-1; path->size>0 && i<j; i++, j--){
+      tmp = path->step[i];
+      path->step[i] = path->step[j];
+      path->step[j] = tmp;
+    }
+    /* The start vertex is the end (forward) or the start (backward) of the start edge */
+    if( e->start!=e->end ) path->from_backward = v==e->start;
+    else path->from_backward = snap_travel(e, mask_permit, from->offset, 0) && ws->node[v].d==from->offset;
+  }
+  if( best==INT_MAX ){
+    path->snapped = 0;
+    return -1;
+  }
+  return best;
+}
+
+/**
+ * \brief Calculates the shortest path between two positions on edges
+ *
+ * The search starts at both ends of the start edge and ends when the
+ * vertices from which the end position can be reached are settled.
+ * If landmarks are attached to the workspace the search is directed to
+ * the end position (A*).
+ *
+ * \return Distance in meters or -1 if there is no path
+ */
+int snap_route(
+  DijkstraWorkspace *ws,
+  const RoutingGraph *graph,
+  const int mask_permit,
+  const SnapPoint *from,
+  const SnapPoint *to,
+  Path *path
+){
+  int dest[2], num_dest, direct, backward;
+  direct = snap_direct(graph, mask_permit, from, to, &backward);
+  dijkstra_workspace_reset(ws);
+  num_dest = snap_dest(graph, mask_permit, to, dest);
+  dijkstra_set_goal(ws, dest, num_dest);
+  snap_add_start(ws, graph, mask_permit, from);
+  dijkstra_run(ws, graph, mask_permit, dest, num_dest, NULL, 0, direct==INT_MAX ? INT_MAX : direct-1);
+  return snap_tree_path(ws, graph, mask_permit, from, to, path);
+}
+
+/*
+** Position at the start (at_end 0) or at the end (at_end 1) of an edge
+*/
+SnapPoint edge_end_position(const RoutingGraph *graph, const int edge, const int at_end) {
+  SnapPoint sp;
+  const GraphPoint *p;
+  sp.edge = edge;
+  sp.point = at_end ? graph->edge_first_point[edge+1] - 2 : graph->edge_first_point[edge];
+  sp.t = at_end ? 1 : 0;
+  p = &graph->point[at_end ? sp.point + 1 : sp.point];
+  sp.lon = GRAPH_POINT_LON(*p);
+  sp.lat = GRAPH_POINT_LAT(*p);
+  sp.offset = at_end ? graph->edge[edge].dist : 0;
+  return sp;
+}
+
+/*
+** Position on an edge at a distance from the start of the edge
+*/
+SnapPoint edge_position(const RoutingGraph *graph, const int edge, const int offset) {
+  SnapPoint sp;
+  const GraphEdge *e = &graph->edge[edge];
+  double total = 0, len = 0, target, seg = 0;
+  int p, first = graph->edge_first_point[edge], last = graph->edge_first_point[edge+1] - 1;
+  if( offset<=0 ) return edge_end_position(graph, edge, 0);
+  if( offset>=e->dist ) return edge_end_position(graph, edge, 1);
+  for(p=first; p<last; p++){
+    total += distance(GRAPH_POINT_LON(graph->point[p]), GRAPH_POINT_LAT(graph->point[p]),
+                      GRAPH_POINT_LON(graph->point[p+1]), GRAPH_POINT_LAT(graph->point[p+1]));
+  }
+  target = total * offset / e->dist;
+  for(p=first; p<last; p++){
+    seg = distance(GRAPH_POINT_LON(graph->point[p]), GRAPH_POINT_LAT(graph->point[p]),
+                   GRAPH_POINT_LON(graph->point[p+1]), GRAPH_POINT_LAT(graph->point[p+1]));
+    if( len + seg>=target || p==last-1 ) break;
+    len += seg;
+  }
+  sp.edge = edge;
+  sp.point = p;
+  sp.t = seg>0 ? (target - len) / seg : 0;
+  if( sp.t>1 ) sp.t = 1;
+  sp.lon = GRAPH_POINT_LON(graph->point[p]) + sp.t * (GRAPH_POINT_LON(graph->point[p+1]) - GRAPH_POINT_LON(graph->point[p]));
+  sp.lat = GRAPH_POINT_LAT(graph->point[p]) + sp.t * (GRAPH_POINT_LAT(graph->point[p+1]) - GRAPH_POINT_LAT(graph->point[p]));
+  sp.offset = offset;
+  return sp;
+}
+
+/*
+** Appends a point, a point equal to the last point is omitted
+*/
+static void points_add(NodeList *points, double lon, double lat, int64_t node_id) {
+  Node *last;
+  if( points->size>0 ){
+    last = &points->node[points->size-1];
+    if( (node_id!=-1 && last->node_id==node_id) || (last->lon==lon && last->lat==lat) ) return;
+  }
+  nodelist_add(points, lon, lat, node_id);
+}
+
+/**
+ * \brief Appends the points of an edge between two positions on the edge
+ *
+ * The points are appended in the direction from a to b.
+ */
+void edge_slice_points(
+  const RoutingGraph *graph,
+  const SnapPoint *a,
+  const SnapPoint *b,
+  NodeList *points
+){
+  int p;
+  const GraphPoint *gp = graph->point;
+  points_add(points, a->lon, a->lat, a->t==0 ? gp[a->point].node_id :
+                                    a->t==1 ? gp[a->point+1].node_id : -1);
+  if( a->point<b->point || (a->point==b->point && a->t<=b->t) ){
+    for(p=a->point+1; p<=b->point; p++){
+      points_add(points, GRAPH_POINT_LON(gp[p]), GRAPH_POINT_LAT(gp[p]), gp[p].node_id);
+    }
+  }else{
+    for(p=a->point; p>b->point; p--){
+      points_add(points, GRAPH_POINT_LON(gp[p]), GRAPH_POINT_LAT(gp[p]), gp[p].node_id);
+    }
+  }
+  points_add(points, b->lon, b->lat, b->t==0 ? gp[b->point].node_id :
+                                    b->t==1 ? gp[b->point+1].node_id : -1);
+}
+
+/**
+ * \brief Determines the points of an edge in the direction of travel
+ *
+ * The points are appended to the node list.
+ */
+void edge_points(
+  const RoutingGraph *graph,
+  const int edge,
+  const int backward,
+  NodeList *points
+){
+  int p;
+  const GraphPoint *gp = graph->point;
+  if( !backward ){
+    for(p=graph->edge_first_point[edge]; p<graph->edge_first_point[edge+1]; p++){
+      points_add(points, GRAPH_POINT_LON(gp[p]), GRAPH_POINT_LAT(gp[p]), gp[p].node_id);
+    }
+  }else{
+    for(p=graph->edge_first_point[edge+1]-1; p>=graph->edge_first_point[edge]; p--){
+      points_add(points, GRAPH_POINT_LON(gp[p]), GRAPH_POINT_LAT(gp[p]), gp[p].node_id);
+    }
+  }
+}
+
+/**
+ * \brief Determines the points of a path
+ *
+ * Appends the points of all edges of the path to the node list,
+ * duplicate points at the junctions of the edges are omitted.
+ * Only the geometry in the routing graph is used, no database access.
+ */
+void path_points(
+  const RoutingGraph *graph,
+  const Path *path,
+  NodeList *points
+){
+  size_t i;
+  SnapPoint sp;
+  /* Partial edge from the start position */
+  if( path->snapped && path->direct ){
+    edge_slice_points(graph, &path->from, &path->to, points);
+  }else if( path->snapped ){
+    sp = edge_end_position(graph, path->from.edge, !path->from_backward);
+    edge_slice_points(graph, &path->from, &sp, points);
+  }
+  for(i=0; i<path->size; i++){
+    /* Points of the edge, observing the direction */
+    edge_points(graph, path->step[i].edge, path->step[i].backward, points);
+#ifdef DEBUG
+    const GraphEdge *e = &graph->edge[path->step[i].edge];
+    printf(" %15" PRId64 " | %15" PRId64 " | %15" PRId64 " | %15" PRId64 " | %7d \n",
+           e->edge_id, e->way_id, graph->vertex[e->start].node_id,
+           graph->vertex[e->end].node_id, e->dist);
+#endif
+  }
+  /* Partial edge to the end position */
+  if( path->snapped && !path->direct ){
+    sp = edge_end_position(graph, path->to.edge, path->to_backward);
+    edge_slice_points(graph, &sp, &path->to, points);
+  }
+}
+
+/*
+** Component that contains the edges of all positions, 0 if there is none.
+** An edge between two components (e.g. a oneway into a dead end) is in none.
+*/
+static int32_t snap_common_component(
+  const RoutingGraph *graph,
+  const int32_t *component,
+  const SnapPoint *snap,
+  const size_t n
+){
+  const GraphEdge *e;
+  int32_t c = component[graph->edge[snap[0].edge].start];
+  size_t i;
+  for(i=0; i<n; i++){
+    e = &graph->edge[snap[i].edge];
+    if( component[e->start]!=c || component[e->end]!=c ) return 0;
+  }
+  return c;
+}
+
+/*
+** Checks whether a route from the position (start 1) can reach the largest
+** component and whether a route to the position (dest 1) can come from it
+*/
+static int snap_largest_component(
+  const RoutingGraph *graph,
+  const int mask_permit,
+  const uint8_t *reach,
+  const SnapPoint *sp,
+  const int start,
+  const int dest
+){
+  const GraphEdge *e = &graph->edge[sp->edge];
+  int fwd = edge_permitted(e, 0, mask_permit), bwd = edge_permitted(e, 1, mask_permit);
+  if( start && !((fwd && (reach[e->end] & GRAPH_REACH_TO)) ||
+                 (bwd && (reach[e->start] & GRAPH_REACH_TO))) ) return 0;
+  if( dest && !((fwd && (reach[e->start] & GRAPH_REACH_FROM)) ||
+                (bwd && (reach[e->end] & GRAPH_REACH_FROM))) ) return 0;
+  return 1;
+}
+
+/**
+ * \brief Projects the route points onto the nearest edges
+ *
+ * If the positions are not in one strongly connected component of the
+ * permit profile, a point may be on an island (e.g. a private road) and a
+ * search would explore the whole graph without result. Each point from
+ * which the largest component cannot be reached (start) or which cannot be
+ * reached from the largest component (destination) is then projected onto
+ * the largest component instead.
+ *
+ * \return 1 if all points were projected, otherwise 0
+ */
+int snap_points(
+  const RoutingGraph *graph,
+  const int mask_permit,
+  const NodeList *points,
+  SnapPoint *snap
+){
+  const int p = graph_profile(mask_permit);
+  const int32_t *component;
+  SnapPoint sp;
+  size_t i;
+  for(i=0; i<points->size; i++){
+    if( !routing_graph_snap(graph, points->node[i].lon, points->node[i].lat, mask_permit, &snap[i]) ) return 0;
+  }
+  if( p<0 || points->size<2 ) return 1;
+  component = graph->component + (size_t)p * graph->num_vertices;
+  if( snap_common_component(graph, component, snap, points->size) ) return 1;
+  for(i=0; i<points->size; i++){
+    if( snap_largest_component(graph, mask_permit, graph->reach + (size_t)p * graph->num_vertices,
+                               &snap[i], i<points->size-1, i>0) ) continue;
+    if( routing_graph_snap_component(graph, points->node[i].lon, points->node[i].lat, mask_permit, 1, &sp) ){
+      snap[i] = sp;
+    }
+  }
+  return 1;
+}
+
+/*
+** Alternative routes (plateau method)
+**
+** A forward search from the start and a backward search from the end
+** give two shortest path trees. An edge in both trees is on a shortest
+** path from the start to the end via this edge. The edges in both trees
+** form paths (plateaus), each plateau gives the route: tree path from the
+** start to the plateau, the plateau, tree path to the end. A long plateau
+** means that a large part of the route is a shortest path itself.
+**
+** ALT_MAX_STRETCH  maximum length of an alternative in percent above the shortest route
+** ALT_MAX_OVERLAP  maximum length shared with the routes found before in percent
+**                  of the shortest route
+** ALT_MIN_PLATEAU  minimum length of the plateau in percent of the shortest route
+*/
+#define ALT_MAX_STRETCH  25
+#define ALT_MAX_OVERLAP  80
+#define ALT_MIN_PLATEAU  20
+
+typedef struct {
+  int vertex;        /* First vertex of the plateau */
+  int distance;      /* Length of the route via the plateau */
+  int plateau;       /* Length of the plateau */
+} AltCandidate;
+
+static int alt_candidate_cmp(const void *a, const void *b) {
+  const AltCandidate *ca = a, *cb = b;
+  int va = ca->distance - ca->plateau, vb = cb->distance - cb->plateau;
+  if( va!=vb ) return va<vb ? -1 : 1;
+  return ca->vertex - cb->vertex;
+}
+
+/*
+** Starts a backward search at a position on an edge: the vertices from
+** which the position can be reached with the partial distance
+*/
+static void snap_add_dest(
+  DijkstraWorkspace *ws,
+  const RoutingGraph *graph,
+  const int mask_permit,
+  const SnapPoint *sp
+){
+  const GraphEdge *e = &graph->edge[sp->edge];
+  if( snap_travel(e, mask_permit, 0, sp->offset) ) dijkstra_add_start(ws, e->start, sp->offset);
+  if( snap_travel(e, mask_permit, e->dist, sp->offset) ) dijkstra_add_start(ws, e->end, e->dist - sp->offset);
+}
+
+static int alt_settled(const DijkstraWorkspace *ws, int v) {
+  return ws->node[v].d!=INT_MAX && ws->node[v].pos_heap==0;
+}
+
+/*
+** Checks whether the edge from v towards the end (backward tree)
+** is also in the forward tree
+*/
+static int alt_plateau_next(const DijkstraWorkspace *fw, const DijkstraWorkspace *bw, int v) {
+  int w = bw->node[v].v_node;
+  return w!=-1 && alt_settled(fw, w) && fw->node[w].v_node==v && fw->node[w].v_edge==bw->node[v].v_edge;
+}
+
+/*
+** Route via vertex v: forward tree from the start to v, backward tree from v to the end
+*/
+static void alt_via_path(
+  const DijkstraWorkspace *fw,
+  const DijkstraWorkspace *bw,
+  const RoutingGraph *graph,
+  const int mask_permit,
+  const SnapPoint *from,
+  const SnapPoint *to,
+  int v,
+  Path *path
+){
+  const GraphEdge *ef = &graph->edge[from->edge], *et = &graph->edge[to->edge];
+  size_t i, j;
+  int u;
+  PathStep tmp;
+  path_clear(path);
+  path->snapped = 1;
+  path->from = *from;
+  path->to = *to;
+  path->direct = 0;
+  for(u=v; fw->node[u].v_edge!=-1; u=fw->node[u].v_node){
+    path_add(path, fw->node[u].v_edge, graph->edge[fw->node[u].v_edge].start!=fw->node[u].v_node);
+  }
+  for(i=0, j=path->size-1; path->size>0 && i<j; i++, j--){
+    tmp = path->step[i];
+    path->step[i] = path->step[j];
+    path->step[j] = tmp;
+  }
+  if( ef->start!=ef->end ) path->from_backward = u==ef->start;
+  else path->from_backward = snap_travel(ef, mask_permit, from->offset, 0) && fw->node[u].d==from->offset;
+  for(u=v; bw->node[u].v_edge!=-1; u=bw->node[u].v_node){
+    path_add(path, bw->node[u].v_edge, graph->edge[bw->node[u].v_edge].start!=u);
+  }
+  if( et->start!=et->end ) path->to_backward = u==et->end;
+  else path->to_backward = !(snap_travel(et, mask_permit, 0, to->offset) && bw->node[u].d==to->offset);
+}
+
+/**
+ * \brief Calculates alternative routes between two positions on edges
+ *
+ * One forward and one backward search, both bounded by the maximum length
+ * of an alternative, are shared by all alternatives. The alternatives are
+ * taken in the order of length minus plateau length, an alternative that
+ * shares too much with the routes found before or that visits a vertex twice
+ * is skipped.
+ *
+ * \param shortest  Shortest path (snap_route()) with the length distance
+ * \return Number of alternatives in alt[] and alt_distance[] (max. k)
+ */
+int snap_alternatives(
+  DijkstraWorkspace *fw,
+  DijkstraWorkspace *bw,
+  const RoutingGraph *graph,
+  const int mask_permit,
+  const SnapPoint *from,
+  const SnapPoint *to,
+  const Path *shortest,
+  const int distance,
+  const int k,
+  Path *alt,
+  int *alt_distance
+){
+  AltCandidate *cand;
+  unsigned char *used;             /* 1 for each edge of the routes found */
+  int *visited;                    /* Number of the candidate that visited the vertex last */
+  const GraphEdge *e = NULL;
+  int num_cand, num_alt, max_dist, i, v, w, shared, loop;
+  size_t j;
+  if( distance<=0 || k<1 ) return 0;
+  max_dist = (int)((int64_t)distance * (100 + ALT_MAX_STRETCH) / 100);
+  /* Shortest path trees from the start and to the end */
+  dijkstra_workspace_reset(fw);
+  snap_add_start(fw, graph, mask_permit, from);
+  dijkstra_run(fw, graph, mask_permit, NULL, 0, NULL, 0, max_dist);
+  dijkstra_workspace_reset(bw);
+  bw->reverse = 1;
+  snap_add_dest(bw, graph, mask_permit, to);
+  dijkstra_run(bw, graph, mask_permit, NULL, 0, NULL, 0, max_dist);
+  bw->reverse = 0;
+  /* Plateaus: begin at a vertex without plateau edge from the start side */
+  cand = malloc((fw->num_touched + 1) * sizeof(AltCandidate));
+  if( !cand ) abort_msg("Out of memory");
+  num_cand = 0;
+  for(i=0; i<fw->num_touched; i++){
+    v = fw->touched[i];
+    if( !alt_settled(fw, v) || !alt_settled(bw, v) ) continue;
+    if( fw->node[v].d + (int64_t)bw->node[v].d > max_dist ) continue;
+    w = fw->node[v].v_node;
+    if( w!=-1 && alt_settled(bw, w) && bw->node[w].v_node==v && alt_plateau_next(fw, bw, w) ) continue;
+    for(w=v; alt_plateau_next(fw, bw, w); w=bw->node[w].v_node);
+    if( (int64_t)(fw->node[w].d - fw->node[v].d) * 100 < (int64_t)distance * ALT_MIN_PLATEAU ) continue;
+    cand[num_cand].vertex = v;
+    cand[num_cand].distance = fw->node[v].d + bw->node[v].d;
+    cand[num_cand].plateau = fw->node[w].d - fw->node[v].d;
+    num_cand++;
+  }
+  qsort(cand, num_cand, sizeof(AltCandidate), alt_candidate_cmp);
+  /* Take the candidates that do not share too much with the routes found */
+  used = calloc(graph->num_edges + 1, 1);
+  visited = calloc(graph->num_vertices + 1, sizeof(int));
+  if( !used || !visited ) abort_msg("Out of memory");
+  for(j=0; j<shortest->size; j++) used[shortest->step[j].edge] = 1;
+  num_alt = 0;
+  for(i=0; i<num_cand && num_alt<k; i++){
+    alt_via_path(fw, bw, graph, mask_permit, from, to, cand[i].vertex, &alt[num_alt]);
+    shared = 0;
+    loop = 0;
+    for(j=0; j<alt[num_alt].size; j++){
+      e = &graph->edge[alt[num_alt].step[j].edge];
+      v = alt[num_alt].step[j].backward ? e->end : e->start;
+      if( visited[v]==i+1 ) loop = 1;
+      visited[v] = i + 1;
+      if( used[alt[num_alt].step[j].edge] ) shared += e->dist;
+    }
+    if( j>0 && visited[alt[num_alt].step[j-1].backward ? e->start : e->end]==i+1 ) loop = 1;
+    if( loop || (int64_t)shared * 100 > (int64_t)distance * ALT_MAX_OVERLAP ) continue;
+    for(j=0; j<alt[num_alt].size; j++) used[alt[num_alt].step[j].edge] = 1;
+    alt_distance[num_alt] = cand[i].distance;
+    num_alt++;
+  }
+  free(cand);
+  free(used);
+  free(visited);
+  return num_alt;
+}
+
 /**
  * \brief Calculate shortest path
  *
@@ -106,6 +784,13 @@ int permit_mask(const char *permit){
  *  - HTML file with a map of the route
  *  - CSV and GPX files
  *
+ * With the last parameter alternatives=<k> up to k alternative routes
+ * between two route points are added to the map and written to the
+ * CSV and GPX files <file>_alt1, <file>_alt2, ...
+ * With simplify=<m> the lines of the CSV and GPX files are simplified
+ * with a tolerance of m meters. The lines of the map are always
+ * simplified with the tolerance of the boundingbox.
+ *
  * \param ARGV
  */
 void route(
@@ -120,21 +805,39 @@ void route(
   double lon, lat;                             /* Coordinates of a route point */
   bbox bp;                                     /* Bounding box of the route points */
   bbox b;                                      /* Enlarged bounding box */
-  int number_nodes;                            /* Number of nodes in the subgraph */
-  int64_t no;                                  /* Node ID subgraph */
-  struct Graph* graph;                         /* Adjacency list */
-  sqlite3_stmt *stmt_insert_path_edges;        /* SQLite statement handler */
-  NodeList path, path2;                        /* Contains all points of the shortest path */
-  int distance;                                /* Distance of the shortest path in meters */
-  int64_t v;                                   /* Previous node of the shortest way */
-  int sequence;                                /* Contain the sequence of edges */
-  int64_t edge_id, way_id, start_node_id, end_node_id;  /* Cache ID */
-  sqlite3_stmt *stmt;                          /* SQLite statement handler */
-  int64_t first_node_id;                       /* Node ID of the first node in the path */
+  SnapPoint *snap;                             /* Positions of the route points on the edges */
+  RoutingGraph graph;                          /* Routing graph (CSR) */
+  int graph_image;                             /* 1 if the graph image is used */
+  Landmarks lm;                                /* Landmarks of the graph image */
+  DijkstraWorkspace ws;                        /* Search workspace */
+  Path path;                                   /* Edges of the shortest path */
+  NodeList path_nodes;                         /* Contains all points of the shortest path */
+  int distance, d;                             /* Distance of the shortest path in meters */
   FILE *html;                                  /* File pointer HTML file */
   char *ext = ".html";                         /* File extension */
   char buffer[30];                             /* Buffer */
   char *filename;                              /* File name HTML file */
+  int k_alt = 0, num_alt = 0;                  /* Number of alternatives requested, found */
+  Path *alt;                                   /* Alternative routes */
+  int *alt_distance;                           /* Distances of the alternative routes */
+  NodeList alt_nodes;                          /* Points of an alternative route */
+  DijkstraWorkspace bw;                        /* Backward search for the alternatives */
+  double tolerance = 0;                        /* Simplification of the CSV and GPX files in meters */
+  double map_tolerance;                        /* Simplification of the map in meters */
+  double t0, t1;
+  /* Optional last parameters alternatives=<k> and simplify=<m> */
+  while( argc>4 ){
+    if( strncmp(argv[argc-1], "alternatives=", 13)==0 ){
+      k_alt = atoi(argv[argc-1] + 13);
+      if( k_alt<1 ) abort_msg("Option route: Invalid number of alternatives");
+    }
+    else if( strncmp(argv[argc-1], "simplify=", 9)==0 ){
+      tolerance = atof(argv[argc-1] + 9);
+      if( tolerance<=0 ) abort_msg("Option route: Invalid tolerance");
+    }
+    else break;
+    argc--;
+  }
   /* Number of parameters must be even */
   if( argc % 2 == 0 ) abort_msg("Option route: Incorrect number of parameters");
   /* Get permit mask, coordinates of all route points and filename without extension */
@@ -154,132 +857,69 @@ void route(
     if( bp.max_lat < lat ) bp.max_lat = lat;
   }
   name = argv[argc-1];
-  /* Enlarge boundingbox for the subgraph, create subgraph tables */
+  if( k_alt>0 && route_points.size!=2 ) abort_msg("Option route: Alternatives only between two route points");
+  /* Enlarge boundingbox, map the graph image or build the subgraph */
   b = resize_boundingbox(bp, 2.0);
-  number_nodes = create_subgraph_tables(db, b, mask_permit);
-  /* For all route points get nearest node in the subgraph */
-  for (i = 0; i < route_points.size; i++) {
-    no = subgraph_nearest_node(db, route_points.node[i].lon, route_points.node[i].lat);
-    if( no == -1 ) abort_msg("Option route: Coordinates out of range");
-    route_points.node[i].node_id = no;  /* Attention: Inserts Node ID subgraph, not OSM Node ID */
-  }
-  /* Fill adjacency list */
-  graph = createGraph(number_nodes);
-  rc = sqlite3_prepare_v2(db,
-    " SELECT sns.no,sne.no,s.dist,s.edge_id,s.directed"
-    " FROM subgraph AS s"
-    " LEFT JOIN subgraph_nodes AS sns ON s.start_node_id=sns.node_id"
-    " LEFT JOIN subgraph_nodes AS sne ON s.end_node_id=sne.node_id", -1, &stmt, NULL);
-  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
-  while( sqlite3_step(stmt)==SQLITE_ROW ){
-    addEdge(graph, sqlite3_column_int64(stmt, 0),
-                   sqlite3_column_int64(stmt, 1),
-                   sqlite3_column_int64(stmt, 2),
-                   sqlite3_column_int64(stmt, 3),
-                   sqlite3_column_int64(stmt, 4));
-  }
-  sqlite3_finalize(stmt);
-  /* Routing */
-  nodelist_init(&path);
+  graph_image = routing_graph_load(db, &b, mask_permit, &graph);
+  /* For all route points get the nearest position on an edge */
+  snap = malloc(route_points.size * sizeof(SnapPoint));
+  if (!snap) abort_msg("Out of memory");
+  if( !snap_points(&graph, mask_permit, &route_points, snap) )
+    abort_msg("Option route: Coordinates out of range");
+  /* Routing, get the points of the shortest path */
+  dijkstra_workspace_init(&ws, &graph);
+  lm.mem = NULL;
+  lm.num_landmarks = 0;
+  if( graph_image && landmarks_load(db, &graph, &lm) ) landmarks_attach(&ws, &lm, mask_permit);
+  path_init(&path);
+  nodelist_init(&path_nodes);
   distance = 0;
-  rc = sqlite3_exec(db,
-    " DROP TABLE IF EXISTS path_edges;"
-    " CREATE TEMP TABLE path_edges ("
-    "  section  INTEGER,"
-    "  sequence INTEGER,"
-    "  edge_id  INTEGER"
-    " );",
-     NULL, NULL, NULL);
-  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
-  rc = sqlite3_prepare_v2(db, "INSERT INTO path_edges (section, sequence, edge_id) VALUES (?1,?2,?3)",
-         -1, &stmt_insert_path_edges, NULL);
-  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
   for (i = 0; i < route_points.size-1; i++) {
 #ifdef DEBUG
-    printf("dijkstra: %8" PRId64 " -> %8" PRId64 "         (node_id: %15" PRId64 " -> %15" PRId64 ")\n",
-        route_points.node[i].node_id, route_points.node[i+1].node_id,
-        subgraph_node_id(db, route_points.node[i].node_id), subgraph_node_id(db, route_points.node[i+1].node_id) );
-#endif
-    Dijkstra(graph, route_points.node[i].node_id, route_points.node[i+1].node_id);
-    distance = distance + node[route_points.node[i+1].node_id].d;
-    /* Get the edges from the shortest path and store them in table 'path_edges' */
-    v = route_points.node[i+1].node_id;
-    sequence = 0;
-    while ( node[v].v_edge != 0 ) {
-      edge_id = node[v].v_edge;
-      sqlite3_bind_int64(stmt_insert_path_edges, 1, i);
-      sqlite3_bind_int64(stmt_insert_path_edges, 2, sequence);
-      sqlite3_bind_int64(stmt_insert_path_edges, 3, edge_id);
-      rc = sqlite3_step(stmt_insert_path_edges);
-      if( rc==SQLITE_DONE ) {
-        sqlite3_reset(stmt_insert_path_edges);
-      } else {
-        abort_db_error(db, rc);
-      }
-      sequence++;
-      /* get previous node of the shortest way */
-      v = node[v].v_node;
-    }
-    destroyDijkstra();
-  }
-  sqlite3_finalize(stmt_insert_path_edges);
-  /* Get all edges in the right order */
-  first_node_id = subgraph_node_id(db, route_points.node[0].node_id);
-  rc = sqlite3_prepare_v2(db,
-    " SELECT pe.section,pe.sequence,pe.edge_id,ge.way_id,ge.start_node_id,ge.end_node_id,ge.dist"
-    " FROM path_edges AS pe"
-    " LEFT JOIN graph_edges AS ge ON pe.edge_id=ge.edge_id"
-    " ORDER BY pe.section,pe.sequence DESC", -1, &stmt, NULL);
-  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
-#ifdef DEBUG
-  printf("first_node_id: %" PRId64 "\n", first_node_id);
-  printf(" section | sequence |     edge_id     |      way_id     |  start_node_id  |   end_node_id   |   dist  \n"
-         "---------+----------+-----------------+-----------------+-----------------+-----------------+---------\n");
-#endif
-  while( sqlite3_step(stmt)==SQLITE_ROW ) {
-    way_id = (int64_t)sqlite3_column_int64(stmt, 3);
-    start_node_id = (int64_t)sqlite3_column_int64(stmt, 4);
-    end_node_id = (int64_t)sqlite3_column_int64(stmt, 5);
-    /* Determination of the points on an edge, observing the direction */
-    if( first_node_id==start_node_id ) {
-      slice_way_nodes(db, way_id, start_node_id, end_node_id, &path);
-      first_node_id = end_node_id;
-    }else{
-      slice_way_nodes(db, way_id, end_node_id, start_node_id, &path);
-      first_node_id = start_node_id;
-    }
-#ifdef DEBUG
-    printf(" %7" PRId64 " | %8" PRId64 " | %15" PRId64 " | %15" PRId64 " | %15" PRId64 " | %15" PRId64 " | %7" PRId64 " \n",
-             (int64_t)sqlite3_column_int64(stmt, 0),
-             (int64_t)sqlite3_column_int64(stmt, 1),
-             (int64_t)sqlite3_column_int64(stmt, 2),
-             (int64_t)sqlite3_column_int64(stmt, 3),
-             (int64_t)sqlite3_column_int64(stmt, 4),
-             (int64_t)sqlite3_column_int64(stmt, 5),
-             (int64_t)sqlite3_column_int64(stmt, 6)
-          );
+    printf("dijkstra: edge %8d +%5d m -> edge %8d +%5d m\n",
+        snap[i].edge, snap[i].offset, snap[i+1].edge, snap[i+1].offset);
+    printf("     edge_id     |      way_id     |  start_node_id  |   end_node_id   |   dist  \n"
+           "-----------------+-----------------+-----------------+-----------------+---------\n");
 #endif
+    d = snap_route(&ws, &graph, mask_permit, &snap[i], &snap[i+1], &path);
+    if( d == -1 ) abort_msg("Option route: No route found");
+    distance = distance + d;
+    path_points(&graph, &path, &path_nodes);
   }
-  sqlite3_finalize(stmt);
-  /*
-   * Dirty Hack
-   * remove double points in the nodelist
-   */
-  nodelist_init(&path2);
-  v = -1;
-  for (i = 0; i < path.size; i++) {
-    if( v!=path.node[i].node_id ){
-      nodelist_add(&path2, path.node[i].lon, path.node[i].lat, path.node[i].node_id);
-    }
-    v = path.node[i].node_id;
+  /* Alternatives with the search trees from the start and to the end */
+  alt = malloc((k_alt + 1) * sizeof(Path));
+  alt_distance = malloc((k_alt + 1) * sizeof(int));
+  if( !alt || !alt_distance ) abort_msg("Out of memory");
+  for(i=0; i<k_alt; i++) path_init(&alt[i]);
+  t0 = time_now();
+  if( k_alt>0 ){
+    dijkstra_workspace_init(&bw, &graph);
+    num_alt = snap_alternatives(&ws, &bw, &graph, mask_permit, &snap[0], &snap[1],
+                                &path, distance, k_alt, alt, alt_distance);
+    dijkstra_workspace_free(&bw);
   }
+  t1 = time_now();
+  dijkstra_workspace_free(&ws);
+  landmarks_free(&lm);
 #ifdef DEBUG
-  nodelist_show(&path);
-  nodelist_show(&path2);
+  nodelist_show(&path_nodes);
 #endif
   /* Create CSV and GPX files with the path coordinates */
-  write_file_csv(name, &path2);
-  write_file_gpx(name, &path2);
+  nodelist_simplify(&path_nodes, tolerance);
+  write_file_csv(name, &path_nodes);
+  write_file_gpx(name, &path_nodes);
+  filename = malloc(strlen(name) + 20);
+  if (!filename) abort_msg("Out of memory");
+  nodelist_init(&alt_nodes);
+  for (i = 0; i < num_alt; i++) {
+    snprintf(filename, strlen(name) + 20, "%s_alt%d", name, i+1);
+    nodelist_clear(&alt_nodes);
+    path_points(&graph, &alt[i], &alt_nodes);
+    nodelist_simplify(&alt_nodes, tolerance);
+    write_file_csv(filename, &alt_nodes);
+    write_file_gpx(filename, &alt_nodes);
+  }
+  free(filename);
   /* Create HTML file */
   filename = malloc(strlen(argv[argc-1]) + strlen(ext) + 1);
   if (!filename) abort_msg("Out of memory");
@@ -291,13 +931,20 @@ void route(
   fprintf(html, "<h1>Route</h1>\n<pre>\n");
   fprintf(html, "# permit: %s (mask_permit: %d)\n", argv[3], mask_permit);
   for (i = 0; i < route_points.size; i++) {
-    fprintf(html, "# %d.  %f %f (OSM Node %" PRId64 ")\n",
+    fprintf(html, "# %d.  %f %f (OSM Way %" PRId64 ", %d m from the start of the edge)\n",
        i+1, route_points.node[i].lon, route_points.node[i].lat,
-       subgraph_node_id(db, route_points.node[i].node_id) );
+       graph.edge[snap[i].edge].way_id, snap[i].offset );
   }
   fprintf(html, "# route distance: %d m\n", distance);
+  if( k_alt>0 ){
+    fprintf(html, "# alternatives: %d of %d found in %.3f s\n", num_alt, k_alt, t1-t0);
+    for (i = 0; i < num_alt; i++) {
+      fprintf(html, "# alternative %d: %d m (+%d%%)\n", i+1, alt_distance[i],
+              (int)((alt_distance[i] - distance) * 100LL / (distance>0 ? distance : 1)));
+    }
+  }
   fprintf(html, "#\n# boundingbox: %f %f - %f %f\n", b.min_lon, b.min_lat, b.max_lon, b.max_lat);
-  fprintf(html, "# graph number nodes: %d\n", number_nodes);
+  fprintf(html, "# graph number nodes: %d%s\n", graph.num_vertices, graph_image ? " (graph image)" : "");
   fprintf(html, "</pre>\n");
   fprintf(html, "<div id='map' style='width:100%%; height:500px;'></div>\n");            /* Show map */
   fprintf(html, "<script>\n");
@@ -308,15 +955,31 @@ void route(
     snprintf(buffer, sizeof(buffer), "Point %d", i+1);
     leaflet_marker(html, "map", route_points.node[i].lon, route_points.node[i].lat, buffer);
   }
+  map_tolerance = leaflet_tolerance(b);
+  if( map_tolerance<tolerance ) map_tolerance = tolerance;
+  leaflet_style(html, "#ff7800", 0.6, 5, "", "none", 1.0, 5);                            /* alternatives */
+  for (i = 0; i < num_alt; i++) {
+    snprintf(buffer, sizeof(buffer), "Alternative %d: %d m", i+1, alt_distance[i]);
+    nodelist_clear(&alt_nodes);
+    path_points(&graph, &alt[i], &alt_nodes);
+    nodelist_simplify(&alt_nodes, map_tolerance);
+    leaflet_polyline(html, "map", &alt_nodes, buffer);
+  }
   leaflet_style(html, "#0000ff", 0.5, 6, "", "none", 1.0, 5);                            /* path */
-  leaflet_polyline(html, "map", &path2, "Shortest way");
+  nodelist_simplify(&path_nodes, map_tolerance);
+  leaflet_polyline(html, "map", &path_nodes, "Shortest way");
   fprintf(html, "</script>\n");
   leaflet_html_footer(html);
   if( fclose(html)!=0 ) abort_msg("Error closing file");
   /* Cleanup */
   free(filename);
-  nodelist_free(&path);
-  nodelist_free(&path2);
+  free(snap);
+  for(i=0; i<k_alt; i++) path_free(&alt[i]);
+  free(alt);
+  free(alt_distance);
+  nodelist_free(&alt_nodes);
+  path_free(&path);
+  nodelist_free(&path_nodes);
   nodelist_free(&route_points);
-  destroyGraph(graph);
+  routing_graph_free(&graph);
 }
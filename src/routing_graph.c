@@ -0,0 +1,1239 @@
+/**
+ * \file routing_graph.c
+ * \brief Routing graph in compressed sparse row (CSR) format and its binary image
+ *
+ * All vertices, edges and arcs are stored in one memory block with a fixed
+ * layout. The same block is written to the image file '<database>.graph',
+ * so the image can be mapped read-only and is shared between processes
+ * through the page cache.
+ *
+ * Layout of the block (every section is aligned to 8 bytes):
+ *   GraphImageHeader
+ *   GraphVertex[num_vertices]
+ *   int32_t first_arc[num_vertices+1]
+ *   GraphArc[num_arcs]
+ *   GraphEdge[num_edges]
+ *   int32_t grid_first[grid_cols*grid_rows+1]
+ *   int32_t grid_vertex[num_vertices]
+ *   int32_t edge_first_point[num_edges+1]
+ *   GraphPoint point[num_points]
+ *   int32_t seg_first[grid_cols*grid_rows+1]
+ *   GraphSegment seg[num_segments]
+ *
+ * The grid is a spatial index of the vertices and of the edge segments for
+ * snapping points to the graph. The vertices of cell c are
+ * grid_vertex[grid_first[c]] .. grid_vertex[grid_first[c+1]-1],
+ * cell c = row * grid_cols + column. The segments work the same way with
+ * seg_first[] and seg[], a segment is entered in every cell it crosses.
+ *
+ * The geometry of edge e are the points point[edge_first_point[e]] ..
+ * point[edge_first_point[e+1]-1] from the start to the end of the edge.
+ *
+ * The vertices are ordered along a Hilbert curve and the edges by their
+ * start vertex, so the data of a search area is close together in memory.
+ */
+
+#define GRAPH_IMAGE_MAGIC    "PBF2SQLG"
+#define GRAPH_IMAGE_VERSION  4
+#define GRAPH_GRID_VERTICES  2   /* Average number of vertices per grid cell */
+
+typedef struct {
+  char magic[8];          /* "PBF2SQLG" */
+  uint32_t version;       /* image format version */
+  uint32_t header_size;   /* sizeof(GraphImageHeader) */
+  int32_t num_vertices;   /* number of vertices */
+  int32_t num_edges;      /* number of edges */
+  int32_t num_arcs;       /* number of arcs (two per edge) */
+  int32_t num_points;     /* number of points of the edge geometries */
+  int64_t max_edge_id;    /* max(edge_id) of table graph_edges, detects outdated images */
+  uint64_t size;          /* size of the block in bytes */
+  int32_t grid_cols;      /* number of grid columns */
+  int32_t grid_rows;      /* number of grid rows */
+  int32_t num_segments;   /* number of segment entries in the grid */
+  int32_t reserved;
+  double grid_min_lon;    /* south-west corner of the grid */
+  double grid_min_lat;
+  double grid_cell_size;  /* width and height of a grid cell in degrees */
+} GraphImageHeader;
+
+typedef struct {
+  int64_t node_id;        /* OSM node ID */
+  double lon;             /* longitude */
+  double lat;             /* latitude */
+} GraphVertex;
+
+typedef struct {
+  int32_t head;           /* target vertex */
+  int32_t edge;           /* edge index */
+  int32_t dist;           /* distance in meters */
+  uint8_t permit;         /* bit field access of the edge */
+  uint8_t backward;       /* 1 if the arc runs from the end to the start of the edge */
+  uint16_t unused;
+} GraphArc;
+
+typedef struct {
+  int64_t edge_id;        /* edge ID in table graph_edges */
+  int64_t way_id;         /* way ID */
+  int32_t start;          /* start vertex */
+  int32_t end;            /* end vertex */
+  int32_t dist;           /* distance in meters */
+  int32_t permit;         /* bit field access */
+} GraphEdge;
+
+typedef struct {
+  int64_t node_id;        /* OSM node ID */
+  int32_t lon;            /* longitude in 1e-7 degrees */
+  int32_t lat;            /* latitude in 1e-7 degrees */
+} GraphPoint;
+
+typedef struct {
+  int32_t edge;           /* edge index */
+  int32_t point;          /* first point of the segment in point[] */
+} GraphSegment;
+
+#define GRAPH_POINT_LON(p)  ((p).lon / 1e7)
+#define GRAPH_POINT_LAT(p)  ((p).lat / 1e7)
+
+/*
+** Geometry blob of an edge (column geometry of table graph_edges)
+**
+** The points of the edge from the start to the end node. Each point is
+** stored as the differences to the previous point (node ID, lon and lat
+** in 1e-7 degrees), each difference as a zigzag encoded varint.
+** The first point is stored as difference to 0.
+*/
+#define GEOMETRY_BLOB_POINT_MAX  20   /* maximum size of one point in bytes */
+
+static int geometry_blob_put_varint(unsigned char *p, const int64_t v) {
+  uint64_t u = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+  int n = 0;
+  while( u>=0x80 ){
+    p[n++] = (unsigned char)(u | 0x80);
+    u >>= 7;
+  }
+  p[n++] = (unsigned char)u;
+  return n;
+}
+
+static int geometry_blob_get_varint(const unsigned char *blob, const int size, int *pos, int64_t *v) {
+  uint64_t u = 0;
+  int shift = 0;
+  while( *pos<size && shift<64 ){
+    u |= (uint64_t)(blob[*pos] & 0x7f) << shift;
+    if( (blob[(*pos)++] & 0x80)==0 ){
+      *v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+      return 1;
+    }
+    shift += 7;
+  }
+  return 0;
+}
+
+typedef struct {
+  unsigned char *data;
+  int size;
+  int cap;
+  GraphPoint prev;        /* last point */
+} GeometryBlob;
+
+void geometry_blob_init(GeometryBlob *gb) {
+  gb->data = NULL;
+  gb->size = 0;
+  gb->cap = 0;
+  gb->prev = (GraphPoint){ 0, 0, 0 };
+}
+
+void geometry_blob_clear(GeometryBlob *gb) {
+  gb->size = 0;
+  gb->prev = (GraphPoint){ 0, 0, 0 };
+}
+
+void geometry_blob_free(GeometryBlob *gb) {
+  free(gb->data);
+  geometry_blob_init(gb);
+}
+
+/**
+ * \brief Appends a point to a geometry blob
+ */
+void geometry_blob_add(GeometryBlob *gb, const int64_t node_id, const double lon, const double lat) {
+  GraphPoint pt = { node_id, (int32_t)lround(lon * 1e7), (int32_t)lround(lat * 1e7) };
+  if( gb->size + GEOMETRY_BLOB_POINT_MAX > gb->cap ){
+    gb->cap = gb->cap ? gb->cap*2 : 256;
+    gb->data = realloc(gb->data, gb->cap);
+    if( !gb->data ) abort_msg("Out of memory");
+  }
+  gb->size += geometry_blob_put_varint(gb->data + gb->size, (int64_t)((uint64_t)pt.node_id - (uint64_t)gb->prev.node_id));
+  gb->size += geometry_blob_put_varint(gb->data + gb->size, (int64_t)pt.lon - gb->prev.lon);
+  gb->size += geometry_blob_put_varint(gb->data + gb->size, (int64_t)pt.lat - gb->prev.lat);
+  gb->prev = pt;
+}
+
+/**
+ * \brief Reads the next point of a geometry blob
+ *
+ * pt contains the previous point ({0,0,0} and *pos 0 at the start)
+ * and is replaced by the next point.
+ * \return 1 if a point was read, 0 at the end of the blob
+ */
+int geometry_blob_next(const void *blob, const int size, int *pos, GraphPoint *pt) {
+  const unsigned char *b = blob;
+  int64_t dn, dlon, dlat;
+  if( !geometry_blob_get_varint(b, size, pos, &dn) ||
+      !geometry_blob_get_varint(b, size, pos, &dlon) ||
+      !geometry_blob_get_varint(b, size, pos, &dlat) ) return 0;
+  pt->node_id = (int64_t)((uint64_t)pt->node_id + (uint64_t)dn);
+  pt->lon = (int32_t)(pt->lon + dlon);
+  pt->lat = (int32_t)(pt->lat + dlat);
+  return 1;
+}
+
+typedef struct {
+  GraphImageHeader *header;
+  int num_vertices;
+  int num_edges;
+  int num_arcs;
+  GraphVertex *vertex;
+  int32_t *first_arc;     /* arcs of vertex v: first_arc[v] .. first_arc[v+1]-1 */
+  GraphArc *arc;
+  GraphEdge *edge;
+  int32_t *grid_first;    /* vertices of grid cell c: grid_first[c] .. grid_first[c+1]-1 */
+  int32_t *grid_vertex;
+  int32_t *edge_first_point; /* geometry of edge e: edge_first_point[e] .. edge_first_point[e+1]-1 */
+  GraphPoint *point;
+  int32_t *seg_first;     /* segments of grid cell c: seg_first[c] .. seg_first[c+1]-1 */
+  GraphSegment *seg;
+  int32_t *component;     /* component of vertex v for profile p: component[p*num_vertices + v] */
+  uint8_t *reach;         /* same index, GRAPH_REACH_... bits */
+  void *mem;              /* memory block or mapped image */
+  size_t mem_size;
+  int mapped;             /* 1 if mem is a mapped image file */
+} RoutingGraph;
+
+/*
+** Permit profiles with precalculated data (components, landmarks): foot, bike, car
+*/
+#define GRAPH_PROFILES  3
+
+static const int graph_profile_mask[GRAPH_PROFILES] = { 1, 2, 4 };
+
+#define GRAPH_REACH_TO    1   /* the vertex can reach the largest component */
+#define GRAPH_REACH_FROM  2   /* the vertex can be reached from the largest component */
+
+/* Profile of a permit mask, -1 if the mask is not a profile */
+static inline int graph_profile(const int mask_permit) {
+  int p;
+  for(p=0; p<GRAPH_PROFILES && graph_profile_mask[p]!=mask_permit; p++);
+  return p<GRAPH_PROFILES ? p : -1;
+}
+
+static size_t graph_align(size_t n) {
+  return (n + 7) & ~(size_t)7;
+}
+
+/**
+ * \brief Size of the memory block for the given number of elements
+ */
+static size_t routing_graph_size(const GraphImageHeader *h) {
+  size_t grid_cells = (size_t)h->grid_cols * h->grid_rows;
+  return graph_align(sizeof(GraphImageHeader))
+       + graph_align((size_t)h->num_vertices * sizeof(GraphVertex))
+       + graph_align(((size_t)h->num_vertices + 1) * sizeof(int32_t))
+       + graph_align((size_t)h->num_arcs * sizeof(GraphArc))
+       + graph_align((size_t)h->num_edges * sizeof(GraphEdge))
+       + graph_align((grid_cells + 1) * sizeof(int32_t))
+       + graph_align((size_t)h->num_vertices * sizeof(int32_t))
+       + graph_align(((size_t)h->num_edges + 1) * sizeof(int32_t))
+       + graph_align((size_t)h->num_points * sizeof(GraphPoint))
+       + graph_align((grid_cells + 1) * sizeof(int32_t))
+       + graph_align((size_t)h->num_segments * sizeof(GraphSegment))
+       + graph_align((size_t)GRAPH_PROFILES * h->num_vertices * sizeof(int32_t))
+       + graph_align((size_t)GRAPH_PROFILES * h->num_vertices);
+}
+
+/**
+ * \brief Set the pointers of the graph to the sections of a memory block
+ */
+static void routing_graph_attach(RoutingGraph *g, void *mem, size_t mem_size, int mapped) {
+  char *p = mem;
+  g->mem = mem;
+  g->mem_size = mem_size;
+  g->mapped = mapped;
+  g->header = (GraphImageHeader *)p;
+  g->num_vertices = g->header->num_vertices;
+  g->num_edges = g->header->num_edges;
+  g->num_arcs = g->header->num_arcs;
+  p += graph_align(sizeof(GraphImageHeader));
+  g->vertex = (GraphVertex *)p;
+  p += graph_align((size_t)g->num_vertices * sizeof(GraphVertex));
+  g->first_arc = (int32_t *)p;
+  p += graph_align(((size_t)g->num_vertices + 1) * sizeof(int32_t));
+  g->arc = (GraphArc *)p;
+  p += graph_align((size_t)g->num_arcs * sizeof(GraphArc));
+  g->edge = (GraphEdge *)p;
+  p += graph_align((size_t)g->num_edges * sizeof(GraphEdge));
+  g->grid_first = (int32_t *)p;
+  p += graph_align(((size_t)g->header->grid_cols * g->header->grid_rows + 1) * sizeof(int32_t));
+  g->grid_vertex = (int32_t *)p;
+  p += graph_align((size_t)g->num_vertices * sizeof(int32_t));
+  g->edge_first_point = (int32_t *)p;
+  p += graph_align(((size_t)g->num_edges + 1) * sizeof(int32_t));
+  g->point = (GraphPoint *)p;
+  p += graph_align((size_t)g->header->num_points * sizeof(GraphPoint));
+  g->seg_first = (int32_t *)p;
+  p += graph_align(((size_t)g->header->grid_cols * g->header->grid_rows + 1) * sizeof(int32_t));
+  g->seg = (GraphSegment *)p;
+  p += graph_align((size_t)g->header->num_segments * sizeof(GraphSegment));
+  g->component = (int32_t *)p;
+  p += graph_align((size_t)GRAPH_PROFILES * g->num_vertices * sizeof(int32_t));
+  g->reach = (uint8_t *)p;
+}
+
+/*
+** Grid cell of a coordinate, coordinates outside the grid are clamped
+*/
+static void graph_grid_cell(const GraphImageHeader *h, double lon, double lat, int *col, int *row) {
+  double x = floor((lon - h->grid_min_lon) / h->grid_cell_size);
+  double y = floor((lat - h->grid_min_lat) / h->grid_cell_size);
+  *col = x<0 ? 0 : x>=h->grid_cols ? h->grid_cols-1 : (int)x;
+  *row = y<0 ? 0 : y>=h->grid_rows ? h->grid_rows-1 : (int)y;
+}
+
+/*
+** Dimensions of the grid: square cells with GRAPH_GRID_VERTICES vertices
+** on average, the number of cells is limited for narrow boundingboxes
+*/
+static void graph_grid_dimensions(const GraphVertex *vertex, int num_vertices, GraphImageHeader *h) {
+  int i;
+  double min_lon = 180, min_lat = 90, max_lon = -180, max_lat = -90;
+  double w, hg, cells, cell;
+  for(i=0; i<num_vertices; i++){
+    if( vertex[i].lon<min_lon ) min_lon = vertex[i].lon;
+    if( vertex[i].lat<min_lat ) min_lat = vertex[i].lat;
+    if( vertex[i].lon>max_lon ) max_lon = vertex[i].lon;
+    if( vertex[i].lat>max_lat ) max_lat = vertex[i].lat;
+  }
+  if( num_vertices==0 ) min_lon = min_lat = max_lon = max_lat = 0;
+  w = max_lon - min_lon;
+  hg = max_lat - min_lat;
+  cells = num_vertices / GRAPH_GRID_VERTICES + 1;
+  cell = fmax(sqrt(w * hg / cells), fmax(w, hg) / cells);
+  if( cell<=0 ) cell = 1;
+  h->grid_min_lon = min_lon;
+  h->grid_min_lat = min_lat;
+  h->grid_cell_size = cell;
+  h->grid_cols = (int32_t)(w / cell) + 1;
+  h->grid_rows = (int32_t)(hg / cell) + 1;
+}
+
+/**
+ * \brief Checks whether an arc may be used with the permit mask
+ *
+ * Same rule as in create_subgraph_tables(): the edge must have all bits of
+ * the mask, and oneway edges for bike or car can only be used forward.
+ */
+static inline int permit_allows(const int permit, const int backward, const int mask_permit) {
+  if( (permit & mask_permit)!=mask_permit ) return 0;
+  if( backward && (((mask_permit & 2) && (permit & 16)) ||
+                   ((mask_permit & 4) && (permit & 32))) ) return 0;
+  return 1;
+}
+
+static inline int arc_permitted(const GraphArc *a, const int mask_permit) {
+  return permit_allows(a->permit, a->backward, mask_permit);
+}
+
+/* Same for an edge traversed forward (backward 0) or backward (backward 1) */
+static inline int edge_permitted(const GraphEdge *e, const int backward, const int mask_permit) {
+  return permit_allows(e->permit, backward, mask_permit);
+}
+
+/*
+** Edge geometries while the graph is built
+*/
+typedef struct {
+  GraphPoint *point;
+  int num_points;
+  int cap_points;
+  int32_t *first;         /* first point of each edge */
+  int32_t *count;         /* number of points of each edge */
+} GraphGeometry;
+
+static void graph_geometry_add(GraphGeometry *geo, int64_t node_id, int32_t lon, int32_t lat) {
+  if( geo->num_points==geo->cap_points ){
+    geo->cap_points = geo->cap_points ? geo->cap_points*2 : 4096;
+    geo->point = realloc(geo->point, geo->cap_points * sizeof(GraphPoint));
+    if( !geo->point ) abort_msg("Out of memory");
+  }
+  geo->point[geo->num_points++] = (GraphPoint){ node_id, lon, lat };
+}
+
+/*
+** Straight line between the vertices if the nodes of the way are missing
+*/
+static void graph_geometry_line(GraphGeometry *geo, const GraphVertex *vertex, const GraphEdge *e, int index) {
+  geo->first[index] = geo->num_points;
+  geo->count[index] = 2;
+  graph_geometry_add(geo, vertex[e->start].node_id, (int32_t)lround(vertex[e->start].lon * 1e7),
+                                                    (int32_t)lround(vertex[e->start].lat * 1e7));
+  graph_geometry_add(geo, vertex[e->end].node_id, (int32_t)lround(vertex[e->end].lon * 1e7),
+                                                  (int32_t)lround(vertex[e->end].lat * 1e7));
+}
+
+/*
+** Geometry of an edge from its geometry blob. A blob that does not run
+** from the start to the end vertex is replaced by a straight line.
+*/
+static void graph_geometry_edge(
+  GraphGeometry *geo,
+  const GraphVertex *vertex,
+  const GraphEdge *e,
+  int index,
+  const void *blob,
+  int size
+){
+  GraphPoint pt = { 0, 0, 0 };
+  int pos = 0;
+  geo->first[index] = geo->num_points;
+  while( geometry_blob_next(blob, size, &pos, &pt) ) graph_geometry_add(geo, pt.node_id, pt.lon, pt.lat);
+  geo->count[index] = geo->num_points - geo->first[index];
+  if( geo->count[index]<2 || pos!=size ||
+      geo->point[geo->first[index]].node_id!=vertex[e->start].node_id ||
+      geo->point[geo->num_points-1].node_id!=vertex[e->end].node_id ){
+    geo->num_points = geo->first[index];
+    graph_geometry_line(geo, vertex, e, index);
+  }
+}
+
+/*
+** Position of a point (x, y) on a Hilbert curve through a 65536 x 65536 grid
+** https://en.wikipedia.org/wiki/Hilbert_curve
+*/
+static uint64_t hilbert_index(uint32_t x, uint32_t y) {
+  const uint32_t n = 65536;
+  uint32_t s, rx, ry, t;
+  uint64_t d = 0;
+  for(s=n/2; s>0; s/=2){
+    rx = (x & s)>0;
+    ry = (y & s)>0;
+    d += (uint64_t)s * s * ((3 * rx) ^ ry);
+    if( ry==0 ){
+      if( rx==1 ){
+        x = n-1 - x;
+        y = n-1 - y;
+      }
+      t = x;
+      x = y;
+      y = t;
+    }
+  }
+  return d;
+}
+
+typedef struct {
+  uint64_t key;
+  int32_t index;
+} GraphOrder;
+
+static int graph_order_cmp(const void *a, const void *b) {
+  const GraphOrder *x = a, *y = b;
+  if( x->key!=y->key ) return x->key<y->key ? -1 : 1;
+  return x->index<y->index ? -1 : x->index>y->index;
+}
+
+/*
+** Renumbers the vertices along a Hilbert curve of their coordinates and
+** sorts the edges by start and end vertex, so vertices that are close in
+** space are also close in memory and a search touches fewer cache lines.
+*/
+static void graph_renumber(
+  GraphVertex *vertex,
+  const int num_vertices,
+  GraphEdge *edge,
+  const int num_edges,
+  GraphGeometry *geo
+){
+  GraphOrder *order;
+  GraphVertex *tmp_vertex;
+  GraphEdge *tmp_edge;
+  int32_t *new_index, *tmp_first, *tmp_count;
+  double min_lon = 180, min_lat = 90, max_lon = -180, max_lat = -90, sx, sy;
+  int i;
+  if( num_vertices<2 ) return;
+  for(i=0; i<num_vertices; i++){
+    if( vertex[i].lon<min_lon ) min_lon = vertex[i].lon;
+    if( vertex[i].lat<min_lat ) min_lat = vertex[i].lat;
+    if( vertex[i].lon>max_lon ) max_lon = vertex[i].lon;
+    if( vertex[i].lat>max_lat ) max_lat = vertex[i].lat;
+  }
+  sx = max_lon>min_lon ? 65535 / (max_lon - min_lon) : 0;
+  sy = max_lat>min_lat ? 65535 / (max_lat - min_lat) : 0;
+  order = malloc(((size_t)(num_vertices>num_edges ? num_vertices : num_edges) + 1) * sizeof(GraphOrder));
+  new_index = malloc(((size_t)num_vertices + 1) * sizeof(int32_t));
+  tmp_vertex = malloc(((size_t)num_vertices + 1) * sizeof(GraphVertex));
+  tmp_edge = malloc(((size_t)num_edges + 1) * sizeof(GraphEdge));
+  tmp_first = malloc(((size_t)num_edges + 1) * sizeof(int32_t));
+  tmp_count = malloc(((size_t)num_edges + 1) * sizeof(int32_t));
+  if( !order || !new_index || !tmp_vertex || !tmp_edge || !tmp_first || !tmp_count ) abort_msg("Out of memory");
+  /* Vertices */
+  for(i=0; i<num_vertices; i++){
+    order[i].key = hilbert_index((uint32_t)((vertex[i].lon - min_lon) * sx),
+                                 (uint32_t)((vertex[i].lat - min_lat) * sy));
+    order[i].index = i;
+  }
+  qsort(order, num_vertices, sizeof(GraphOrder), graph_order_cmp);
+  memcpy(tmp_vertex, vertex, num_vertices * sizeof(GraphVertex));
+  for(i=0; i<num_vertices; i++){
+    vertex[i] = tmp_vertex[order[i].index];
+    new_index[order[i].index] = i;
+  }
+  /* Edges */
+  for(i=0; i<num_edges; i++){
+    edge[i].start = new_index[edge[i].start];
+    edge[i].end = new_index[edge[i].end];
+    order[i].key = (uint64_t)edge[i].start << 32 | (uint32_t)edge[i].end;
+    order[i].index = i;
+  }
+  qsort(order, num_edges, sizeof(GraphOrder), graph_order_cmp);
+  if( num_edges>0 ){
+    memcpy(tmp_edge, edge, num_edges * sizeof(GraphEdge));
+    memcpy(tmp_first, geo->first, num_edges * sizeof(int32_t));
+    memcpy(tmp_count, geo->count, num_edges * sizeof(int32_t));
+  }
+  for(i=0; i<num_edges; i++){
+    edge[i] = tmp_edge[order[i].index];
+    geo->first[i] = tmp_first[order[i].index];
+    geo->count[i] = tmp_count[order[i].index];
+  }
+  free(order);
+  free(new_index);
+  free(tmp_vertex);
+  free(tmp_edge);
+  free(tmp_first);
+  free(tmp_count);
+}
+
+/*
+** Enters a segment in all grid cells it crosses. With seg==NULL the
+** entries are only counted in cell_index[c+1], otherwise the segment is
+** stored at seg[cell_index[c]++].
+*/
+static void graph_grid_segment(
+  const GraphImageHeader *h,
+  GraphPoint a,
+  GraphPoint b,
+  int32_t *cell_index,
+  GraphSegment *seg,
+  const GraphSegment entry
+){
+  double ax, ay, bx, by, x0, x1, y0, y1;
+  int col, row, c0, c1, r0, r1, tmp;
+  size_t c;
+  if( a.lon>b.lon ){
+    GraphPoint t = a;
+    a = b;
+    b = t;
+  }
+  ax = GRAPH_POINT_LON(a);
+  ay = GRAPH_POINT_LAT(a);
+  bx = GRAPH_POINT_LON(b);
+  by = GRAPH_POINT_LAT(b);
+  graph_grid_cell(h, ax, ay, &c0, &tmp);
+  graph_grid_cell(h, bx, by, &c1, &tmp);
+  for(col=c0; col<=c1; col++){
+    /* Part of the segment within the column */
+    x0 = col==c0 ? ax : h->grid_min_lon + col * h->grid_cell_size;
+    x1 = col==c1 ? bx : h->grid_min_lon + (col + 1) * h->grid_cell_size;
+    y0 = bx>ax ? ay + (by - ay) * (x0 - ax) / (bx - ax) : ay;
+    y1 = bx>ax ? ay + (by - ay) * (x1 - ax) / (bx - ax) : by;
+    graph_grid_cell(h, x0, fmin(y0, y1), &tmp, &r0);
+    graph_grid_cell(h, x0, fmax(y0, y1), &tmp, &r1);
+    for(row=r0; row<=r1; row++){
+      c = (size_t)row * h->grid_cols + col;
+      if( seg ) seg[cell_index[c]++] = entry;
+      else cell_index[c+1]++;
+    }
+  }
+}
+
+/*
+** Strongly connected components of the arcs permitted for profile p
+**
+** Tarjan's algorithm without recursion. The components are numbered by size,
+** 1 is the largest component. Vertices without an edge for the profile
+** get component 0. In addition reach[] marks the vertices from which the
+** largest component can be reached and vice versa.
+*/
+static void graph_components_profile(RoutingGraph *g, const int p) {
+  const int mask_permit = graph_profile_mask[p];
+  const GraphArc *a;
+  int32_t *component = g->component + (size_t)p * g->num_vertices;
+  uint8_t *reach = g->reach + (size_t)p * g->num_vertices;
+  int32_t *dfs_no, *low, *stack, *call, *next_arc, *rank;
+  unsigned char *on_stack;
+  GraphOrder *order;
+  int n = g->num_vertices, counter = 0, sp = 0, cp = 0, num = 0;
+  int root, v, w, u, i, flag;
+  dfs_no = malloc(((size_t)n + 1) * sizeof(int32_t));
+  low = malloc(((size_t)n + 1) * sizeof(int32_t));
+  stack = malloc(((size_t)n + 1) * sizeof(int32_t));
+  call = malloc(((size_t)n + 1) * sizeof(int32_t));
+  next_arc = malloc(((size_t)n + 1) * sizeof(int32_t));
+  on_stack = calloc((size_t)n + 1, 1);
+  if( !dfs_no || !low || !stack || !call || !next_arc || !on_stack ) abort_msg("Out of memory");
+  for(v=0; v<n; v++) dfs_no[v] = -1;
+  for(root=0; root<n; root++){
+    if( dfs_no[root]!=-1 ) continue;
+    dfs_no[root] = low[root] = counter++;
+    stack[sp++] = root;
+    on_stack[root] = 1;
+    next_arc[root] = g->first_arc[root];
+    call[cp++] = root;
+    while( cp>0 ){
+      v = call[cp-1];
+      if( next_arc[v]<g->first_arc[v+1] ){
+        a = &g->arc[next_arc[v]++];
+        if( !arc_permitted(a, mask_permit) ) continue;
+        w = a->head;
+        if( dfs_no[w]==-1 ){
+          dfs_no[w] = low[w] = counter++;
+          stack[sp++] = w;
+          on_stack[w] = 1;
+          next_arc[w] = g->first_arc[w];
+          call[cp++] = w;
+        }else if( on_stack[w] && dfs_no[w]<low[v] ){
+          low[v] = dfs_no[w];
+        }
+        continue;
+      }
+      /* All arcs of v done, v is the root of a component or passes low to its parent */
+      cp--;
+      if( cp>0 && low[v]<low[call[cp-1]] ) low[call[cp-1]] = low[v];
+      if( low[v]==dfs_no[v] ){
+        do {
+          u = stack[--sp];
+          on_stack[u] = 0;
+          component[u] = num;
+        } while( u!=v );
+        num++;
+      }
+    }
+  }
+  /* Number the components by size, low[] counts the vertices per component */
+  for(i=0; i<num; i++) low[i] = 0;
+  for(v=0; v<n; v++){
+    for(i=g->first_arc[v]; i<g->first_arc[v+1] && (g->arc[i].permit & mask_permit)!=mask_permit; i++);
+    if( i<g->first_arc[v+1] ) low[component[v]]++;
+  }
+  order = malloc(((size_t)num + 1) * sizeof(GraphOrder));
+  rank = malloc(((size_t)num + 1) * sizeof(int32_t));
+  if( !order || !rank ) abort_msg("Out of memory");
+  for(i=0; i<num; i++) order[i] = (GraphOrder){ (uint64_t)(INT32_MAX - low[i]), i };
+  qsort(order, num, sizeof(GraphOrder), graph_order_cmp);
+  for(i=0; i<num; i++) rank[order[i].index] = low[order[i].index]>0 ? i + 1 : 0;
+  for(v=0; v<n; v++) component[v] = rank[component[v]];
+  /* Vertices connected with the largest component, search along the arcs and reverse */
+  for(i=0; i<2; i++){
+    flag = i==0 ? GRAPH_REACH_FROM : GRAPH_REACH_TO;
+    sp = 0;
+    for(v=0; v<n; v++){
+      if( component[v]!=1 ) continue;
+      reach[v] |= flag;
+      stack[sp++] = v;
+    }
+    while( sp>0 ){
+      v = stack[--sp];
+      for(a=&g->arc[g->first_arc[v]]; a<&g->arc[g->first_arc[v+1]]; a++){
+        if( (reach[a->head] & flag) || !permit_allows(a->permit, a->backward ^ i, mask_permit) ) continue;
+        reach[a->head] |= flag;
+        stack[sp++] = a->head;
+      }
+    }
+  }
+  free(order);
+  free(rank);
+  free(dfs_no);
+  free(low);
+  free(stack);
+  free(call);
+  free(next_arc);
+  free(on_stack);
+}
+
+/**
+ * \brief Builds the routing graph from two SQL queries
+ *
+ * \param sql_vertices  Columns: no, node_id, lon, lat (ordered by no, no = 1,2,3...)
+ * \param sql_edges     Columns: edge_id, way_id, start no, end no, dist, permit, geometry
+ * \param max_edge_id   Stored in the header
+ *
+ * The vertices are renumbered along a Hilbert curve (see graph_renumber()),
+ * vertex i of the graph is in general not vertex no i+1 of the query.
+ * The strongly connected components are calculated for each profile
+ * (see graph_components_profile()).
+ */
+void routing_graph_build(
+  sqlite3 *db,
+  RoutingGraph *g,
+  const char *sql_vertices,
+  const char *sql_edges,
+  const int64_t max_edge_id
+){
+  sqlite3_stmt *stmt;
+  GraphVertex *vertex = NULL;
+  GraphEdge *edge = NULL;
+  GraphGeometry geo;
+  GraphImageHeader hdr;
+  int32_t *fill, *seg_count;
+  int num_vertices = 0, cap_vertices = 0;
+  int num_edges = 0, cap_edges = 0;
+  int i, a, p, col, row;
+  size_t c, cells, size;
+  /* Vertices */
+  rc = sqlite3_prepare_v2(db, sql_vertices, -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  while( sqlite3_step(stmt)==SQLITE_ROW ){
+    if( sqlite3_column_int64(stmt, 0)!=num_vertices+1 )
+      abort_msg("Graph vertices are not numbered consecutively");
+    if( num_vertices==cap_vertices ){
+      cap_vertices = cap_vertices ? cap_vertices*2 : 1024;
+      vertex = realloc(vertex, cap_vertices * sizeof(GraphVertex));
+      if( !vertex ) abort_msg("Out of memory");
+    }
+    vertex[num_vertices].node_id = sqlite3_column_int64(stmt, 1);
+    vertex[num_vertices].lon = sqlite3_column_double(stmt, 2);
+    vertex[num_vertices].lat = sqlite3_column_double(stmt, 3);
+    num_vertices++;
+  }
+  sqlite3_finalize(stmt);
+  /* Edges and their geometry */
+  memset(&geo, 0, sizeof(geo));
+  rc = sqlite3_prepare_v2(db, sql_edges, -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  while( sqlite3_step(stmt)==SQLITE_ROW ){
+    if( num_edges==cap_edges ){
+      cap_edges = cap_edges ? cap_edges*2 : 1024;
+      edge = realloc(edge, cap_edges * sizeof(GraphEdge));
+      geo.first = realloc(geo.first, (cap_edges + 1) * sizeof(int32_t));
+      geo.count = realloc(geo.count, (cap_edges + 1) * sizeof(int32_t));
+      if( !edge || !geo.first || !geo.count ) abort_msg("Out of memory");
+    }
+    edge[num_edges].edge_id = sqlite3_column_int64(stmt, 0);
+    edge[num_edges].way_id = sqlite3_column_int64(stmt, 1);
+    edge[num_edges].start = sqlite3_column_int(stmt, 2) - 1;
+    edge[num_edges].end = sqlite3_column_int(stmt, 3) - 1;
+    edge[num_edges].dist = sqlite3_column_int(stmt, 4);
+    edge[num_edges].permit = sqlite3_column_int(stmt, 5);
+    if( edge[num_edges].start<0 || edge[num_edges].start>=num_vertices ||
+        edge[num_edges].end<0 || edge[num_edges].end>=num_vertices )
+      abort_msg("Graph edge with unknown vertex");
+    graph_geometry_edge(&geo, vertex, &edge[num_edges], num_edges,
+                        sqlite3_column_blob(stmt, 6), sqlite3_column_bytes(stmt, 6));
+    num_edges++;
+  }
+  sqlite3_finalize(stmt);
+  /* Order of the vertices and edges in memory */
+  graph_renumber(vertex, num_vertices, edge, num_edges, &geo);
+  /* Grid */
+  memset(&hdr, 0, sizeof(hdr));
+  graph_grid_dimensions(vertex, num_vertices, &hdr);
+  cells = (size_t)hdr.grid_cols * hdr.grid_rows;
+  seg_count = calloc(cells + 1, sizeof(int32_t));
+  if( !seg_count ) abort_msg("Out of memory");
+  for(i=0; i<num_edges; i++){
+    for(p=geo.first[i]; p<geo.first[i]+geo.count[i]-1; p++){
+      graph_grid_segment(&hdr, geo.point[p], geo.point[p+1], seg_count, NULL, (GraphSegment){0, 0});
+    }
+  }
+  for(c=0; c<cells; c++) seg_count[c+1] += seg_count[c];
+  /* Allocate the block and fill the header */
+  memcpy(hdr.magic, GRAPH_IMAGE_MAGIC, 8);
+  hdr.version = GRAPH_IMAGE_VERSION;
+  hdr.header_size = sizeof(GraphImageHeader);
+  hdr.num_vertices = num_vertices;
+  hdr.num_edges = num_edges;
+  hdr.num_arcs = 2*num_edges;
+  hdr.num_points = geo.num_points;
+  hdr.num_segments = seg_count[cells];
+  hdr.max_edge_id = max_edge_id;
+  size = routing_graph_size(&hdr);
+  hdr.size = size;
+  void *mem = calloc(1, size);
+  if( !mem ) abort_msg("Out of memory");
+  memcpy(mem, &hdr, sizeof(hdr));
+  routing_graph_attach(g, mem, size, 0);
+  if( num_vertices>0 ) memcpy(g->vertex, vertex, num_vertices * sizeof(GraphVertex));
+  if( num_edges>0 ) memcpy(g->edge, edge, num_edges * sizeof(GraphEdge));
+  free(vertex);
+  free(edge);
+  /* Arcs: count per vertex, prefix sums, then fill */
+  for(i=0; i<num_edges; i++){
+    g->first_arc[g->edge[i].start+1]++;
+    g->first_arc[g->edge[i].end+1]++;
+  }
+  for(i=0; i<num_vertices; i++) g->first_arc[i+1] += g->first_arc[i];
+  fill = malloc(((size_t)num_vertices + 1) * sizeof(int32_t));
+  if( !fill ) abort_msg("Out of memory");
+  memcpy(fill, g->first_arc, ((size_t)num_vertices + 1) * sizeof(int32_t));
+  for(i=0; i<num_edges; i++){
+    a = fill[g->edge[i].start]++;
+    g->arc[a] = (GraphArc){ g->edge[i].end, i, g->edge[i].dist, g->edge[i].permit, 0, 0 };
+    a = fill[g->edge[i].end]++;
+    g->arc[a] = (GraphArc){ g->edge[i].start, i, g->edge[i].dist, g->edge[i].permit, 1, 0 };
+  }
+  free(fill);
+  /* Grid of the vertices: count per cell, prefix sums, then fill in the order of the vertices */
+  for(i=0; i<num_vertices; i++){
+    graph_grid_cell(&hdr, g->vertex[i].lon, g->vertex[i].lat, &col, &row);
+    g->grid_first[(size_t)row * hdr.grid_cols + col + 1]++;
+  }
+  for(c=0; c<cells; c++) g->grid_first[c+1] += g->grid_first[c];
+  fill = malloc((cells + 1) * sizeof(int32_t));
+  if( !fill ) abort_msg("Out of memory");
+  memcpy(fill, g->grid_first, (cells + 1) * sizeof(int32_t));
+  for(i=0; i<num_vertices; i++){
+    graph_grid_cell(&hdr, g->vertex[i].lon, g->vertex[i].lat, &col, &row);
+    g->grid_vertex[fill[(size_t)row * hdr.grid_cols + col]++] = i;
+  }
+  /* Geometry in the order of the edges */
+  g->edge_first_point[0] = 0;
+  for(i=0; i<num_edges; i++){
+    g->edge_first_point[i+1] = g->edge_first_point[i] + geo.count[i];
+    memcpy(&g->point[g->edge_first_point[i]], &geo.point[geo.first[i]], geo.count[i] * sizeof(GraphPoint));
+  }
+  free(geo.point);
+  free(geo.first);
+  free(geo.count);
+  /* Grid of the segments */
+  memcpy(g->seg_first, seg_count, (cells + 1) * sizeof(int32_t));
+  memcpy(fill, seg_count, (cells + 1) * sizeof(int32_t));
+  for(i=0; i<num_edges; i++){
+    for(p=g->edge_first_point[i]; p<g->edge_first_point[i+1]-1; p++){
+      graph_grid_segment(&hdr, g->point[p], g->point[p+1], fill, g->seg, (GraphSegment){i, p});
+    }
+  }
+  free(fill);
+  free(seg_count);
+  /* Components per profile */
+  for(p=0; p<GRAPH_PROFILES; p++) graph_components_profile(g, p);
+}
+
+/**
+ * \brief Writes a memory block to a file
+ *
+ * The file is written under a temporary name and then renamed, so processes
+ * that still have the old file mapped are not affected.
+ */
+void image_file_write(const void *mem, const size_t size, const char *filename) {
+  FILE *f;
+  char *ext = ".tmp";
+  char *tmpname = malloc(strlen(filename) + strlen(ext) + 1);
+  if( !tmpname ) abort_msg("Out of memory");
+  strcpy(tmpname, filename);
+  strcat(tmpname, ext);
+  f = fopen(tmpname, "wb");
+  if( f==NULL ) abort_msg("Error opening file");
+  if( fwrite(mem, 1, size, f)!=size ) abort_msg("Error writing file");
+  if( fclose(f)!=0 ) abort_msg("Error closing file");
+  remove(filename);                    /* rename() on Windows fails if the file exists */
+  if( rename(tmpname, filename)!=0 ) abort_msg("Error renaming file");
+  free(tmpname);
+}
+
+/**
+ * \brief Maps a file read-only (on Windows: reads the file into memory)
+ * \return Pointer to the content or NULL if the file is missing or
+ *         smaller than min_size
+ */
+void *image_file_map(const char *filename, const size_t min_size, size_t *size) {
+  void *mem;
+#ifndef _WIN32
+  struct stat st;
+  int fd = open(filename, O_RDONLY);
+  if( fd<0 ) return NULL;
+  if( fstat(fd, &st)!=0 || (size_t)st.st_size<min_size ){
+    close(fd);
+    return NULL;
+  }
+  *size = (size_t)st.st_size;
+  mem = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if( mem==MAP_FAILED ) return NULL;
+#else
+  FILE *f = fopen(filename, "rb");
+  if( f==NULL ) return NULL;
+  fseek(f, 0, SEEK_END);
+  *size = (size_t)ftell(f);
+  fseek(f, 0, SEEK_SET);
+  mem = malloc(*size>0 ? *size : 1);
+  if( !mem ) abort_msg("Out of memory");
+  if( *size<min_size || fread(mem, 1, *size, f)!=*size ){
+    fclose(f);
+    free(mem);
+    return NULL;
+  }
+  fclose(f);
+#endif
+  return mem;
+}
+
+/**
+ * \brief Releases a block of image_file_map() or a block allocated with malloc()
+ */
+void image_file_unmap(void *mem, const size_t size, const int mapped) {
+#ifndef _WIN32
+  if( mapped ) munmap(mem, size);
+  else free(mem);
+#else
+  free(mem);
+#endif
+}
+
+/**
+ * \brief Writes the routing graph to an image file
+ */
+void routing_graph_write(const RoutingGraph *g, const char *filename) {
+  image_file_write(g->mem, g->mem_size, filename);
+}
+
+/**
+ * \brief Maps an image file read-only
+ * \return 1 if the image is valid and matches max_edge_id, otherwise 0
+ */
+int routing_graph_map(RoutingGraph *g, const char *filename, const int64_t max_edge_id) {
+  GraphImageHeader *h;
+  void *mem;
+  size_t size;
+  mem = image_file_map(filename, sizeof(GraphImageHeader), &size);
+  if( mem==NULL ) return 0;
+  h = mem;
+  if( memcmp(h->magic, GRAPH_IMAGE_MAGIC, 8)!=0 ||
+      h->version!=GRAPH_IMAGE_VERSION ||
+      h->header_size!=sizeof(GraphImageHeader) ||
+      h->size!=size ||
+      h->grid_cols<1 || h->grid_rows<1 ||
+      routing_graph_size(h)!=size ||
+      h->max_edge_id!=max_edge_id ){
+    fprintf(stderr, "%s is outdated or invalid and is ignored\n", filename);
+    image_file_unmap(mem, size, 1);
+    return 0;
+  }
+  routing_graph_attach(g, mem, size, 1);
+  return 1;
+}
+
+/**
+ * \brief Frees or unmaps the routing graph
+ */
+void routing_graph_free(RoutingGraph *g) {
+  image_file_unmap(g->mem, g->mem_size, g->mapped);
+  g->mem = NULL;
+  g->mem_size = 0;
+}
+
+/**
+ * \brief Filename of a file next to the database: database filename + ext
+ * \return Allocated filename or NULL for in-memory and temporary databases
+ */
+char *db_related_filename(sqlite3 *db, const char *ext) {
+  const char *dbname = sqlite3_db_filename(db, "main");
+  char *filename;
+  if( dbname==NULL || dbname[0]=='\0' ) return NULL;
+  filename = malloc(strlen(dbname) + strlen(ext) + 1);
+  if( !filename ) abort_msg("Out of memory");
+  strcpy(filename, dbname);
+  strcat(filename, ext);
+  return filename;
+}
+
+/**
+ * \brief Filename of the graph image: database filename + '.graph'
+ * \return Allocated filename or NULL for in-memory and temporary databases
+ */
+char *graph_image_filename(sqlite3 *db) {
+  return db_related_filename(db, ".graph");
+}
+
+/**
+ * \brief Highest edge ID in table graph_edges
+ */
+int64_t graph_max_edge_id(sqlite3 *db) {
+  sqlite3_stmt *stmt;
+  int64_t max_edge_id = -1;
+  rc = sqlite3_prepare_v2(db, "SELECT max(edge_id) FROM graph_edges", -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  if( sqlite3_step(stmt)==SQLITE_ROW ) max_edge_id = sqlite3_column_int64(stmt, 0);
+  sqlite3_finalize(stmt);
+  return max_edge_id;
+}
+
+/**
+ * \brief Aborts if table graph_edges has no column geometry (created by an older version)
+ */
+void graph_check_geometry(sqlite3 *db) {
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(db, "SELECT geometry FROM graph_edges LIMIT 0", -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_msg("Table graph_edges has no edge geometry, run option 'graph' again");
+  sqlite3_finalize(stmt);
+}
+
+/**
+ * \brief Builds the complete routing graph from the tables graph_edges and graph_vertices
+ */
+void routing_graph_build_complete(sqlite3 *db, RoutingGraph *g) {
+  graph_check_geometry(db);
+  routing_graph_build(db, g,
+    " SELECT gv.vertex_id,gv.node_id,n.lon,n.lat"
+    " FROM graph_vertices AS gv"
+    " LEFT JOIN nodes AS n ON gv.node_id=n.node_id"
+    " ORDER BY gv.vertex_id",
+    " SELECT ge.edge_id,ge.way_id,gvs.vertex_id,gve.vertex_id,ge.dist,ge.permit,ge.geometry"
+    " FROM graph_edges AS ge"
+    " LEFT JOIN graph_vertices AS gvs ON ge.start_node_id=gvs.node_id"
+    " LEFT JOIN graph_vertices AS gve ON ge.end_node_id=gve.node_id"
+    " ORDER BY ge.edge_id",
+    graph_max_edge_id(db));
+}
+
+/*
+** Checks the vertices of a grid cell and keeps the k nearest vertices in
+** near[] (sorted by distance, equal distances by vertex number)
+*/
+static void graph_grid_check_cell(
+  const RoutingGraph *g,
+  const int col,
+  const int row,
+  const double lon,
+  const double lat,
+  const int mask_permit,
+  const int k,
+  int *near,
+  double *near_dist,
+  int *num_near
+){
+  int i, j, v, a;
+  double dist;
+  size_t c = (size_t)row * g->header->grid_cols + col;
+  for(i=g->grid_first[c]; i<g->grid_first[c+1]; i++){
+    v = g->grid_vertex[i];
+    dist = (lon - g->vertex[v].lon) * (lon - g->vertex[v].lon)
+         + (lat - g->vertex[v].lat) * (lat - g->vertex[v].lat);
+    if( *num_near==k && (dist>near_dist[k-1] || (dist==near_dist[k-1] && v>near[k-1])) ) continue;
+    for(a=g->first_arc[v]; a<g->first_arc[v+1]; a++){
+      if( (g->arc[a].permit & mask_permit)==mask_permit ) break;
+    }
+    if( a==g->first_arc[v+1] ) continue;
+    /* Insert sorted */
+    if( *num_near<k ) (*num_near)++;
+    for(j=*num_near-1; j>0 && (near_dist[j-1]>dist || (near_dist[j-1]==dist && near[j-1]>v)); j--){
+      near[j] = near[j-1];
+      near_dist[j] = near_dist[j-1];
+    }
+    near[j] = v;
+    near_dist[j] = dist;
+  }
+}
+
+/**
+ * \brief Find the k nearest vertices that can be used with the permit mask
+ *
+ * The grid cells are searched in rings around the cell of the coordinate
+ * until no closer vertex can be found in the remaining cells.
+ *
+ * \param near  Array for k vertices, sorted by distance
+ * \return Number of vertices found (less than k if the graph is small)
+ */
+int routing_graph_nearest_vertices(
+  const RoutingGraph *g,
+  const double lon,
+  const double lat,
+  const int mask_permit,
+  const int k,
+  int *near
+){
+  const GraphImageHeader *h = g->header;
+  double *near_dist, bound;
+  int num_near = 0, col, row, r, r_max, x, y;
+  if( k<1 || g->num_vertices==0 || !valid_location(lon, lat) ) return 0;
+  near_dist = malloc(k * sizeof(double));
+  if( !near_dist ) abort_msg("Out of memory");
+  graph_grid_cell(h, lon, lat, &col, &row);
+  r_max = h->grid_cols>h->grid_rows ? h->grid_cols : h->grid_rows;
+  for(r=0; r<=r_max; r++){
+    /* Cells of ring r: rows row-r and row+r, columns col-r and col+r */
+    for(x=col-r; x<=col+r; x++){
+      if( x<0 || x>=h->grid_cols ) continue;
+      if( row-r>=0 ) graph_grid_check_cell(g, x, row-r, lon, lat, mask_permit, k, near, near_dist, &num_near);
+      if( r>0 && row+r<h->grid_rows ) graph_grid_check_cell(g, x, row+r, lon, lat, mask_permit, k, near, near_dist, &num_near);
+    }
+    for(y=row-r+1; y<=row+r-1; y++){
+      if( y<0 || y>=h->grid_rows ) continue;
+      if( col-r>=0 ) graph_grid_check_cell(g, col-r, y, lon, lat, mask_permit, k, near, near_dist, &num_near);
+      if( col+r<h->grid_cols ) graph_grid_check_cell(g, col+r, y, lon, lat, mask_permit, k, near, near_dist, &num_near);
+    }
+    /* The cells not yet searched are at least this far away */
+    if( num_near==k ){
+      bound = DBL_MAX;
+      if( col-r>0 ) bound = fmin(bound, lon - (h->grid_min_lon + (col - r) * h->grid_cell_size));
+      if( col+r+1<h->grid_cols ) bound = fmin(bound, h->grid_min_lon + (col + r + 1) * h->grid_cell_size - lon);
+      if( row-r>0 ) bound = fmin(bound, lat - (h->grid_min_lat + (row - r) * h->grid_cell_size));
+      if( row+r+1<h->grid_rows ) bound = fmin(bound, h->grid_min_lat + (row + r + 1) * h->grid_cell_size - lat);
+      if( bound==DBL_MAX || bound * bound>near_dist[k-1] ) break;
+    }
+  }
+  free(near_dist);
+  return num_near;
+}
+
+/**
+ * \brief Find the nearest vertex that can be used with the permit mask
+ * \return vertex or -1 if no vertex was found
+ */
+int routing_graph_nearest_vertex(
+  const RoutingGraph *g,
+  const double lon,
+  const double lat,
+  const int mask_permit
+){
+  int nearest;
+  if( routing_graph_nearest_vertices(g, lon, lat, mask_permit, 1, &nearest)==0 ) return -1;
+  return nearest;
+}
+
+/*
+** Position of a point on an edge of the routing graph
+*/
+typedef struct {
+  int edge;         /* edge index */
+  int point;        /* first point of the segment in point[] */
+  double t;         /* position on the segment from 0 to 1 */
+  double lon;       /* coordinates of the position */
+  double lat;
+  int offset;       /* distance from the start of the edge in meters */
+} SnapPoint;
+
+/*
+** Checks the segments of a grid cell, the distance is measured in degrees
+** latitude with the longitude scaled by kx
+*/
+static void graph_grid_check_segments(
+  const RoutingGraph *g,
+  const int col,
+  const int row,
+  const double lon,
+  const double lat,
+  const double kx,
+  const int mask_permit,
+  const int32_t *component,
+  const int32_t comp,
+  SnapPoint *sp,
+  double *min_dist
+){
+  int i;
+  double ax, ay, dx, dy, px, py, t, dist;
+  const GraphSegment *s;
+  size_t c = (size_t)row * g->header->grid_cols + col;
+  for(i=g->seg_first[c]; i<g->seg_first[c+1]; i++){
+    s = &g->seg[i];
+    if( (g->edge[s->edge].permit & mask_permit)!=mask_permit ) continue;
+    if( component && (component[g->edge[s->edge].start]!=comp ||
+                      component[g->edge[s->edge].end]!=comp) ) continue;
+    ax = GRAPH_POINT_LON(g->point[s->point]);
+    ay = GRAPH_POINT_LAT(g->point[s->point]);
+    dx = (GRAPH_POINT_LON(g->point[s->point+1]) - ax) * kx;
+    dy = GRAPH_POINT_LAT(g->point[s->point+1]) - ay;
+    px = (lon - ax) * kx;
+    py = lat - ay;
+    t = dx*dx + dy*dy > 0 ? (px*dx + py*dy) / (dx*dx + dy*dy) : 0;
+    t = t<0 ? 0 : t>1 ? 1 : t;
+    dist = (px - t*dx) * (px - t*dx) + (py - t*dy) * (py - t*dy);
+    if( dist>*min_dist ) continue;
+    if( dist==*min_dist && (s->edge>sp->edge || (s->edge==sp->edge && s->point>=sp->point)) ) continue;
+    *min_dist = dist;
+    sp->edge = s->edge;
+    sp->point = s->point;
+    sp->t = t;
+    sp->lon = ax + t * dx / kx;
+    sp->lat = ay + t * dy;
+  }
+}
+
+/**
+ * \brief Projects a point onto the nearest edge that can be used with the permit mask
+ *
+ * The grid cells are searched in rings around the cell of the coordinate
+ * like in routing_graph_nearest_vertices(). If comp is not 0 and the permit
+ * mask is a profile, only edges with both vertices in component comp are used.
+ *
+ * \return 1 if an edge was found, otherwise 0
+ */
+int routing_graph_snap_component(
+  const RoutingGraph *g,
+  const double lon,
+  const double lat,
+  const int mask_permit,
+  const int32_t comp,
+  SnapPoint *sp
+){
+  const GraphImageHeader *h = g->header;
+  const int32_t *component = NULL;
+  double min_dist = DBL_MAX, bound, kx, part, total, seg;
+  int col, row, r, r_max, x, y, p;
+  const GraphEdge *e;
+  sp->edge = -1;
+  if( g->num_edges==0 || !valid_location(lon, lat) ) return 0;
+  p = graph_profile(mask_permit);
+  if( comp!=0 && p>=0 ) component = g->component + (size_t)p * g->num_vertices;
+  kx = cos(radians(lat));
+  graph_grid_cell(h, lon, lat, &col, &row);
+  r_max = h->grid_cols>h->grid_rows ? h->grid_cols : h->grid_rows;
+  for(r=0; r<=r_max; r++){
+    for(x=col-r; x<=col+r; x++){
+      if( x<0 || x>=h->grid_cols ) continue;
+      if( row-r>=0 ) graph_grid_check_segments(g, x, row-r, lon, lat, kx, mask_permit, component, comp, sp, &min_dist);
+      if( r>0 && row+r<h->grid_rows ) graph_grid_check_segments(g, x, row+r, lon, lat, kx, mask_permit, component, comp, sp, &min_dist);
+    }
+    for(y=row-r+1; y<=row+r-1; y++){
+      if( y<0 || y>=h->grid_rows ) continue;
+      if( col-r>=0 ) graph_grid_check_segments(g, col-r, y, lon, lat, kx, mask_permit, component, comp, sp, &min_dist);
+      if( col+r<h->grid_cols ) graph_grid_check_segments(g, col+r, y, lon, lat, kx, mask_permit, component, comp, sp, &min_dist);
+    }
+    /* The cells not yet searched are at least this far away */
+    if( sp->edge!=-1 ){
+      bound = DBL_MAX;
+      if( col-r>0 ) bound = fmin(bound, (lon - (h->grid_min_lon + (col - r) * h->grid_cell_size)) * kx);
+      if( col+r+1<h->grid_cols ) bound = fmin(bound, (h->grid_min_lon + (col + r + 1) * h->grid_cell_size - lon) * kx);
+      if( row-r>0 ) bound = fmin(bound, lat - (h->grid_min_lat + (row - r) * h->grid_cell_size));
+      if( row+r+1<h->grid_rows ) bound = fmin(bound, h->grid_min_lat + (row + r + 1) * h->grid_cell_size - lat);
+      if( bound==DBL_MAX || bound * bound>min_dist ) break;
+    }
+  }
+  if( sp->edge==-1 ) return 0;
+  /* Distance from the start of the edge, in proportion to the length of the geometry */
+  e = &g->edge[sp->edge];
+  part = total = 0;
+  for(p=g->edge_first_point[sp->edge]; p<g->edge_first_point[sp->edge+1]-1; p++){
+    seg = distance(GRAPH_POINT_LON(g->point[p]), GRAPH_POINT_LAT(g->point[p]),
+                   GRAPH_POINT_LON(g->point[p+1]), GRAPH_POINT_LAT(g->point[p+1]));
+    if( p<sp->point ) part += seg;
+    if( p==sp->point ) part += sp->t * seg;
+    total += seg;
+  }
+  sp->offset = total>0 ? (int)lround(e->dist * part / total) : 0;
+  if( sp->offset>e->dist ) sp->offset = e->dist;
+  return 1;
+}
+
+/**
+ * \brief Projects a point onto the nearest edge that can be used with the permit mask
+ * \return 1 if an edge was found, otherwise 0
+ */
+int routing_graph_snap(
+  const RoutingGraph *g,
+  const double lon,
+  const double lat,
+  const int mask_permit,
+  SnapPoint *sp
+){
+  return routing_graph_snap_component(g, lon, lat, mask_permit, 0, sp);
+}
@@ -0,0 +1,683 @@
+/**
+ * \file serve.c
+ * \brief Routing server for newline-delimited JSON route requests
+ *
+ * The routing graph and one search workspace per worker thread stay in memory.
+ * Requests are read from stdin or from the clients of a Unix domain socket,
+ * one JSON object per line:
+ *
+ *   {"id":1,"permit":"foot","points":[[11.3317806,50.9777393],[11.3310429,50.9785668]]}
+ *
+ * Each request is answered with one line, in the order of completion:
+ *
+ *   {"id":1,"distance":281,"points":[[11.3317825,50.9777418],...]}
+ *   {"id":1,"error":"No route found"}
+ *
+ * The routes between the snapped positions are kept in a route cache,
+ * which is loaded from and saved to table route_cache. The server stops
+ * at the end of stdin or, with a socket, at SIGINT or SIGTERM.
+ */
+
+#define SERVE_MAX_THREADS  256   /* Max. number of worker threads */
+#define SERVE_MAX_JOBS     1024  /* Max. number of queued requests */
+
+/*
+** Minimal JSON parser for the route requests
+*/
+static void json_skip_ws(const char **p) {
+  while( **p==' ' || **p=='\t' || **p=='\r' || **p=='\n' ) (*p)++;
+}
+
+/* Parse a string, the result is truncated to size-1 characters */
+static int json_parse_string(const char **p, char *buf, size_t size) {
+  size_t n = 0;
+  char c;
+  if( **p!='"' ) return 0;
+  (*p)++;
+  while( **p!='"' ){
+    if( **p=='\0' ) return 0;
+    c = *(*p)++;
+    if( c=='\\' ){
+      c = *(*p)++;
+      switch( c ){
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'u':             /* \uXXXX is not needed for requests */
+          if( strlen(*p)<4 ) return 0;
+          *p += 4;
+          c = '?';
+          break;
+        case '\0': return 0;
+      }
+    }
+    if( n+1<size ) buf[n++] = c;
+  }
+  (*p)++;
+  if( size>0 ) buf[n] = '\0';
+  return 1;
+}
+
+/* End of a JSON number or NULL (strtod also accepts nan, inf, hex, ...) */
+static const char *json_scan_number(const char *p) {
+  if( *p=='-' ) p++;
+  if( *p=='0' ) p++;
+  else if( *p>='1' && *p<='9' ) while( *p>='0' && *p<='9' ) p++;
+  else return NULL;
+  if( *p=='.' ){
+    p++;
+    if( *p<'0' || *p>'9' ) return NULL;
+    while( *p>='0' && *p<='9' ) p++;
+  }
+  if( *p=='e' || *p=='E' ){
+    p++;
+    if( *p=='+' || *p=='-' ) p++;
+    if( *p<'0' || *p>'9' ) return NULL;
+    while( *p>='0' && *p<='9' ) p++;
+  }
+  return p;
+}
+
+static int json_parse_number(const char **p, double *value) {
+  const char *end = json_scan_number(*p);
+  char *end_strtod;
+  if( !end ) return 0;
+  *value = strtod(*p, &end_strtod);
+  if( end_strtod!=end || !isfinite(*value) ) return 0;    /* 1e999 is inf */
+  *p = end;
+  return 1;
+}
+
+/* Skip a number, true, false or null, followed by a delimiter */
+static int json_skip_scalar(const char **p) {
+  const char *end = json_scan_number(*p);
+  if( !end ){
+    if( strncmp(*p, "true", 4)==0 || strncmp(*p, "null", 4)==0 ) end = *p + 4;
+    else if( strncmp(*p, "false", 5)==0 ) end = *p + 5;
+    else return 0;
+  }
+  if( *end!='\0' && !strchr(",}] \t\r\n", *end) ) return 0;
+  *p = end;
+  return 1;
+}
+
+/* Skip any value (string, number, literal, object or array) */
+static int json_skip_value(const char **p) {
+  int depth = 0;
+  json_skip_ws(p);
+  do {
+    switch( **p ){
+      case '\0':
+        return 0;
+      case '"':
+        if( !json_parse_string(p, NULL, 0) ) return 0;
+        break;
+      case '{': case '[':
+        depth++;
+        (*p)++;
+        break;
+      case '}': case ']':
+        if( depth==0 ) return 0;
+        depth--;
+        (*p)++;
+        break;
+      case ',': case ':': case ' ': case '\t': case '\r': case '\n':
+        if( depth==0 ) return 0;
+        (*p)++;
+        break;
+      default:
+        if( !json_skip_scalar(p) ) return 0;
+    }
+  } while( depth>0 );
+  return 1;
+}
+
+/**
+ * \brief Parses a route request
+ *
+ * \param id     Raw JSON value of "id" (or "null")
+ * \param permit Value of "permit"
+ * \param points Coordinates of "points"
+ * \return Error message or NULL
+ */
+static const char *serve_parse_request(
+  const char *line,
+  char *id, const size_t id_size,
+  char *permit, const size_t permit_size,
+  NodeList *points
+){
+  const char *p = line;
+  const char *start;
+  char key[32];
+  double lon, lat;
+  snprintf(id, id_size, "null");
+  permit[0] = '\0';
+  nodelist_clear(points);
+  json_skip_ws(&p);
+  if( *p!='{' ) return "Request is not a JSON object";
+  p++;
+  json_skip_ws(&p);
+  while( *p!='}' ){
+    if( !json_parse_string(&p, key, sizeof(key)) ) return "Invalid JSON";
+    json_skip_ws(&p);
+    if( *p!=':' ) return "Invalid JSON";
+    p++;
+    json_skip_ws(&p);
+    if( strcmp(key, "id")==0 ){
+      /* Returned unchanged: only a string, number, true, false or null */
+      start = p;
+      if( *p=='"' ? !json_parse_string(&p, NULL, 0) : !json_skip_scalar(&p) ) return "Invalid value of 'id'";
+      if( (size_t)(p-start)>=id_size ) return "Value of 'id' is too long";
+      memcpy(id, start, p-start);
+      id[p-start] = '\0';
+    }else if( strcmp(key, "permit")==0 ){
+      if( *p=='"' ){
+        if( !json_parse_string(&p, permit, permit_size) ) return "Invalid JSON";
+      }else{
+        start = p;
+        if( !json_scan_number(p) || !json_skip_scalar(&p) || (size_t)(p-start)>=permit_size )
+          return "Invalid value of 'permit'";
+        memcpy(permit, start, p-start);
+        permit[p-start] = '\0';
+      }
+    }else if( strcmp(key, "points")==0 ){
+      if( *p!='[' ) return "Value of 'points' is not an array";
+      p++;
+      json_skip_ws(&p);
+      while( *p!=']' ){
+        if( *p!='[' ) return "Point is not an array [lon,lat]";
+        p++;
+        json_skip_ws(&p);
+        if( !json_parse_number(&p, &lon) ) return "Invalid longitude";
+        json_skip_ws(&p);
+        if( *p!=',' ) return "Point is not an array [lon,lat]";
+        p++;
+        json_skip_ws(&p);
+        if( !json_parse_number(&p, &lat) ) return "Invalid latitude";
+        json_skip_ws(&p);
+        if( *p!=']' ) return "Point is not an array [lon,lat]";
+        p++;
+        if( !valid_location(lon, lat) ) return "Coordinates out of range";
+        nodelist_add(points, lon, lat, 0);
+        json_skip_ws(&p);
+        if( *p==',' ){ p++; json_skip_ws(&p); }
+        else if( *p!=']' ) return "Invalid JSON";
+      }
+      p++;
+    }else{
+      if( !json_skip_value(&p) ) return "Invalid JSON";
+    }
+    json_skip_ws(&p);
+    if( *p==',' ){ p++; json_skip_ws(&p); }
+    else if( *p!='}' ) return "Invalid JSON";
+  }
+  if( permit[0]=='\0' ) return "Missing 'permit'";
+  if( points->size<2 ) return "At least two points are required";
+  return NULL;
+}
+
+/*
+** Clients, jobs and the job queue
+*/
+typedef struct {
+  FILE *in;                /* Requests */
+  FILE *out;               /* Responses */
+  int owned;               /* 1 if in and out must be closed */
+  int refs;                /* Reader and pending jobs */
+  pthread_mutex_t lock;
+} ServeClient;
+
+typedef struct ServeJob {
+  char *line;              /* Request */
+  ServeClient *client;
+  struct ServeJob *next;
+} ServeJob;
+
+typedef struct {
+  pthread_t thread;
+  DijkstraWorkspace ws;    /* Search workspace of this worker */
+  Path path;
+  NodeList route_points;
+  SnapPoint *snap;         /* Positions of the route points on the edges */
+  size_t snap_capacity;
+  NodeList points;
+  StrBuf response;
+} ServeWorker;
+
+static struct {
+  const RoutingGraph *graph;
+  const Landmarks *lm;          /* Landmarks of the graph, may be empty */
+  RouteCache *cache;            /* Routes between snapped positions, NULL: no cache */
+  pthread_mutex_t queue_lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  ServeJob *head, *tail;
+  int num_jobs;
+  int closed;                   /* No more jobs will be added */
+} server;
+
+static ServeClient *serve_client_new(FILE *in, FILE *out, int owned) {
+  ServeClient *c = malloc(sizeof(ServeClient));
+  if( !c ) abort_msg("Out of memory");
+  c->in = in;
+  c->out = out;
+  c->owned = owned;
+  c->refs = 1;
+  pthread_mutex_init(&c->lock, NULL);
+  return c;
+}
+
+static void serve_client_unref(ServeClient *c) {
+  int refs;
+  pthread_mutex_lock(&c->lock);
+  refs = --c->refs;
+  pthread_mutex_unlock(&c->lock);
+  if( refs>0 ) return;
+  if( c->owned ){
+    fclose(c->in);
+    fclose(c->out);
+  }else{
+    fflush(c->out);
+  }
+  pthread_mutex_destroy(&c->lock);
+  free(c);
+}
+
+static void serve_queue_push(char *line, ServeClient *client) {
+  ServeJob *job = malloc(sizeof(ServeJob));
+  if( !job ) abort_msg("Out of memory");
+  job->line = line;
+  job->client = client;
+  job->next = NULL;
+  pthread_mutex_lock(&server.queue_lock);
+  while( server.num_jobs>=SERVE_MAX_JOBS && !server.closed ) pthread_cond_wait(&server.not_full, &server.queue_lock);
+  if( server.closed ){    /* Server stopped, the request is not answered */
+    pthread_mutex_unlock(&server.queue_lock);
+    free(line);
+    free(job);
+    return;
+  }
+  pthread_mutex_lock(&client->lock);
+  client->refs++;
+  pthread_mutex_unlock(&client->lock);
+  if( server.tail ) server.tail->next = job;
+  else server.head = job;
+  server.tail = job;
+  server.num_jobs++;
+  pthread_cond_signal(&server.not_empty);
+  pthread_mutex_unlock(&server.queue_lock);
+}
+
+/* Returns the next job or NULL if the queue is closed and empty */
+static ServeJob *serve_queue_pop(void) {
+  ServeJob *job;
+  pthread_mutex_lock(&server.queue_lock);
+  while( server.head==NULL && !server.closed ) pthread_cond_wait(&server.not_empty, &server.queue_lock);
+  job = server.head;
+  if( job ){
+    server.head = job->next;
+    if( server.head==NULL ) server.tail = NULL;
+    server.num_jobs--;
+    pthread_cond_signal(&server.not_full);
+  }
+  pthread_mutex_unlock(&server.queue_lock);
+  return job;
+}
+
+static void serve_queue_close(void) {
+  pthread_mutex_lock(&server.queue_lock);
+  server.closed = 1;
+  pthread_cond_broadcast(&server.not_empty);
+  pthread_cond_broadcast(&server.not_full);
+  pthread_mutex_unlock(&server.queue_lock);
+}
+
+/* Reads a line of any length, returns 0 at end of file */
+static int serve_read_line(FILE *in, char **line, size_t *capacity) {
+  size_t len = 0;
+  int c;
+  while( (c = fgetc(in))!=EOF && c!='\n' ){
+    if( len+2>*capacity ){
+      *capacity = *capacity ? *capacity*2 : 1024;
+      *line = realloc(*line, *capacity);
+      if( !*line ) abort_msg("Out of memory");
+    }
+    (*line)[len++] = (char)c;
+  }
+  if( c==EOF && len==0 ) return 0;
+  if( *line==NULL ){
+    *capacity = 1024;
+    *line = malloc(*capacity);
+    if( !*line ) abort_msg("Out of memory");
+  }
+  if( len>0 && (*line)[len-1]=='\r' ) len--;
+  (*line)[len] = '\0';
+  return 1;
+}
+
+/* Reads all requests of a client and adds them to the queue */
+static void serve_read_requests(ServeClient *client) {
+  char *line = NULL;
+  size_t capacity = 0;
+  char *request;
+  while( serve_read_line(client->in, &line, &capacity) ){
+    if( line[strspn(line, " \t")]=='\0' ) continue;  /* skip empty lines */
+    request = malloc(strlen(line) + 1);
+    if( !request ) abort_msg("Out of memory");
+    strcpy(request, line);
+    serve_queue_push(request, client);
+  }
+  free(line);
+}
+
+/**
+ * \brief Answers one route request, the response is in w->response
+ */
+static void serve_request(ServeWorker *w, const char *line) {
+  const RoutingGraph *graph = server.graph;
+  char id[64], permit[32];
+  const char *error;
+  int mask_permit, d, distance;
+  size_t i;
+  strbuf_clear(&w->response);
+  error = serve_parse_request(line, id, sizeof(id), permit, sizeof(permit), &w->route_points);
+  if( error ){
+    strbuf_printf(&w->response, "{\"id\":%s,\"error\":\"%s\"}", id, error);
+    return;
+  }
+  mask_permit = permit_mask(permit);
+  landmarks_attach(&w->ws, server.lm, mask_permit);
+  /* Nearest position on an edge for all route points */
+  if( w->route_points.size>w->snap_capacity ){
+    w->snap_capacity = w->route_points.size;
+    w->snap = realloc(w->snap, w->snap_capacity * sizeof(SnapPoint));
+    if( !w->snap ) abort_msg("Out of memory");
+  }
+  if( !snap_points(graph, mask_permit, &w->route_points, w->snap) ){
+    strbuf_printf(&w->response, "{\"id\":%s,\"error\":\"Coordinates out of range\"}", id);
+    return;
+  }
+  /* Shortest path through all route points and its geometry */
+  nodelist_clear(&w->points);
+  distance = 0;
+  for(i=0; i<w->route_points.size-1; i++){
+    d = route_cache_route(server.cache, &w->ws, graph, mask_permit, &w->snap[i], &w->snap[i+1], &w->path);
+    if( d==-1 ){
+      strbuf_printf(&w->response, "{\"id\":%s,\"error\":\"No route found\"}", id);
+      return;
+    }
+    distance += d;
+    path_points(graph, &w->path, &w->points);
+  }
+  strbuf_printf(&w->response, "{\"id\":%s,\"distance\":%d,\"points\":[", id, distance);
+  for(i=0; i<w->points.size; i++){
+    strbuf_printf(&w->response, "%s[%.7f,%.7f]", i>0 ? "," : "",
+                  w->points.node[i].lon, w->points.node[i].lat);
+  }
+  strbuf_printf(&w->response, "]}");
+}
+
+static void *serve_worker(void *arg) {
+  ServeWorker *w = arg;
+  ServeJob *job;
+  while( (job = serve_queue_pop())!=NULL ){
+    serve_request(w, job->line);
+    pthread_mutex_lock(&job->client->lock);
+    fprintf(job->client->out, "%s\n", w->response.s);
+    fflush(job->client->out);
+    pthread_mutex_unlock(&job->client->lock);
+    serve_client_unref(job->client);
+    free(job->line);
+    free(job);
+  }
+  return NULL;
+}
+
+#ifndef _WIN32
+static volatile sig_atomic_t serve_stop = 0;
+
+static void serve_signal(int sig) {
+  serve_stop = 1;
+}
+
+/*
+** Reader threads of the socket clients, finished readers are joined by
+** the accept loop, the others at the stop
+*/
+typedef struct {
+  pthread_t thread;
+  ServeClient *client;
+  int fd;
+  int done;                /* 1 if the reader has finished, fd may be closed */
+} ServeReader;
+
+static struct {
+  ServeReader **reader;
+  int num, cap;
+  pthread_mutex_t lock;    /* Protects done and fd */
+} serve_readers;
+
+static void *serve_socket_reader(void *arg) {
+  ServeReader *r = arg;
+  serve_read_requests(r->client);
+  pthread_mutex_lock(&serve_readers.lock);
+  r->done = 1;
+  pthread_mutex_unlock(&serve_readers.lock);
+  serve_client_unref(r->client);
+  return NULL;
+}
+
+static void serve_reader_start(FILE *in, FILE *out, const int fd) {
+  ServeReader *r = malloc(sizeof(ServeReader));
+  if( !r ) abort_msg("Out of memory");
+  r->client = serve_client_new(in, out, 1);
+  r->fd = fd;
+  r->done = 0;
+  if( serve_readers.num==serve_readers.cap ){
+    serve_readers.cap = serve_readers.cap ? 2 * serve_readers.cap : 16;
+    serve_readers.reader = realloc(serve_readers.reader, serve_readers.cap * sizeof(ServeReader *));
+    if( !serve_readers.reader ) abort_msg("Out of memory");
+  }
+  serve_readers.reader[serve_readers.num++] = r;
+  if( pthread_create(&r->thread, NULL, serve_socket_reader, r)!=0 )
+    abort_msg("Option serve: Error creating thread");
+}
+
+/*
+** Joins the finished readers or, if stop, all readers: their clients
+** get end of file, the requests read so far are still queued
+*/
+static void serve_readers_join(const int stop) {
+  ServeReader *r;
+  int i, n = 0, done;
+  for(i=0; i<serve_readers.num; i++){
+    r = serve_readers.reader[i];
+    pthread_mutex_lock(&serve_readers.lock);
+    done = r->done;
+    if( !done && stop ) shutdown(r->fd, SHUT_RD);
+    pthread_mutex_unlock(&serve_readers.lock);
+    if( done || stop ){
+      pthread_join(r->thread, NULL);
+      free(r);
+    }else{
+      serve_readers.reader[n++] = r;
+    }
+  }
+  serve_readers.num = n;
+}
+
+/*
+** Creates the Unix domain socket. SIGINT and SIGTERM stop the server:
+** they are blocked in all threads (call before the threads are started)
+** and only received while the accept loop waits, the mask before is
+** returned in wait_mask.
+*/
+static int serve_socket_listen(const char *socket_path, sigset_t *wait_mask) {
+  struct sockaddr_un addr;
+  struct sigaction sa;
+  sigset_t block;
+  int fd_listen;
+  if( strlen(socket_path)>=sizeof(addr.sun_path) ) abort_msg("Option serve: Socket path too long");
+  fd_listen = socket(AF_UNIX, SOCK_STREAM, 0);
+  if( fd_listen<0 ) abort_msg("Option serve: Error creating socket");
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+  unlink(socket_path);
+  if( bind(fd_listen, (struct sockaddr *)&addr, sizeof(addr))!=0 ||
+      listen(fd_listen, 64)!=0 ) abort_msg("Option serve: Error binding socket");
+  sigemptyset(&block);
+  sigaddset(&block, SIGINT);
+  sigaddset(&block, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &block, wait_mask);
+  sigdelset(wait_mask, SIGINT);
+  sigdelset(wait_mask, SIGTERM);
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = serve_signal;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  return fd_listen;
+}
+
+/*
+** Accepts clients until SIGINT or SIGTERM, then closes and removes the
+** socket and waits for the readers of the clients
+*/
+static void serve_socket(const int fd_listen, const char *socket_path, const sigset_t *wait_mask) {
+  fd_set fds;
+  int fd;
+  FILE *in, *out;
+  serve_readers.reader = NULL;
+  serve_readers.num = serve_readers.cap = 0;
+  pthread_mutex_init(&serve_readers.lock, NULL);
+  fprintf(stderr, "serve: listening on %s\n", socket_path);
+  while( !serve_stop ){
+    FD_ZERO(&fds);
+    FD_SET(fd_listen, &fds);
+    if( pselect(fd_listen + 1, &fds, NULL, NULL, NULL, wait_mask)<0 ){
+      if( errno==EINTR ) continue;
+      abort_msg("Option serve: Error waiting for connections");
+    }
+    fd = accept(fd_listen, NULL, NULL);
+    if( fd<0 ){
+      if( errno==EINTR || errno==ECONNABORTED ) continue;
+      abort_msg("Option serve: Error accepting connection");
+    }
+    in = fdopen(fd, "r");
+    out = fdopen(dup(fd), "w");
+    if( in==NULL || out==NULL ) abort_msg("Option serve: Error opening connection");
+    serve_readers_join(0);
+    serve_reader_start(in, out, fd);
+  }
+  close(fd_listen);
+  unlink(socket_path);
+  serve_readers_join(1);
+  free(serve_readers.reader);
+  pthread_mutex_destroy(&serve_readers.lock);
+  fprintf(stderr, "serve: stopped\n");
+}
+#endif
+
+/**
+ * \brief Routing server
+ *
+ * \param threads      Number of worker threads
+ * \param socket_path  Unix domain socket or NULL for stdin/stdout
+ * \param cache_mb     Memory bound of the route cache in MB, 0: no cache
+ */
+void serve(
+  sqlite3 *db,
+  const int threads,
+  const char *socket_path,
+  const int cache_mb
+){
+  RoutingGraph graph;
+  Landmarks lm;
+  RouteCache cache;
+  ServeWorker *worker;
+  int i, graph_image;
+#ifndef _WIN32
+  int fd_listen = -1;
+  sigset_t wait_mask;
+#endif
+  if( threads<1 || threads>SERVE_MAX_THREADS ) abort_msg("Option serve: Invalid number of threads");
+  if( cache_mb<0 ) abort_msg("Option serve: Invalid size of the route cache");
+#ifdef _WIN32
+  if( socket_path ) abort_msg("Option serve: Unix domain sockets are not supported");
+#endif
+#ifdef SIGPIPE
+  signal(SIGPIPE, SIG_IGN);    /* A client closing its connection must not terminate the server */
+#endif
+  graph_image = routing_graph_load(db, NULL, 0, &graph);
+  landmarks_load(db, &graph, &lm);
+  fprintf(stderr, "serve: graph with %d vertices loaded from %s, %d landmarks, %d threads\n",
+          graph.num_vertices, graph_image ? "graph image" : "tables", lm.num_landmarks, threads);
+  server.graph = &graph;
+  server.lm = &lm;
+  server.cache = NULL;
+  if( cache_mb>0 ){
+    route_cache_init(&cache, cache_mb);
+    route_cache_load(db, &cache, &graph);
+    server.cache = &cache;
+    fprintf(stderr, "serve: route cache %d MB, %zu routes loaded\n", cache_mb, cache.num_entries);
+  }
+  server.head = server.tail = NULL;
+  server.num_jobs = 0;
+  server.closed = 0;
+  pthread_mutex_init(&server.queue_lock, NULL);
+  pthread_cond_init(&server.not_empty, NULL);
+  pthread_cond_init(&server.not_full, NULL);
+#ifndef _WIN32
+  if( socket_path ) fd_listen = serve_socket_listen(socket_path, &wait_mask);
+#endif
+  /* Start the workers */
+  worker = malloc(threads * sizeof(ServeWorker));
+  if( !worker ) abort_msg("Out of memory");
+  for(i=0; i<threads; i++){
+    dijkstra_workspace_init(&worker[i].ws, &graph);
+    path_init(&worker[i].path);
+    nodelist_init(&worker[i].route_points);
+    worker[i].snap = NULL;
+    worker[i].snap_capacity = 0;
+    nodelist_init(&worker[i].points);
+    strbuf_init(&worker[i].response);
+    if( pthread_create(&worker[i].thread, NULL, serve_worker, &worker[i])!=0 )
+      abort_msg("Option serve: Error creating thread");
+  }
+  /* Socket: until SIGINT or SIGTERM, stdin: until end of file */
+  if( socket_path ){
+#ifndef _WIN32
+    serve_socket(fd_listen, socket_path, &wait_mask);
+#endif
+  }else{
+    ServeClient *client = serve_client_new(stdin, stdout, 0);
+    serve_read_requests(client);
+    serve_client_unref(client);
+  }
+  /* Wait for the workers, they answer the queued requests */
+  serve_queue_close();
+  for(i=0; i<threads; i++){
+    pthread_join(worker[i].thread, NULL);
+    dijkstra_workspace_free(&worker[i].ws);
+    path_free(&worker[i].path);
+    nodelist_free(&worker[i].route_points);
+    free(worker[i].snap);
+    nodelist_free(&worker[i].points);
+    strbuf_free(&worker[i].response);
+  }
+  free(worker);
+  pthread_mutex_destroy(&server.queue_lock);
+  pthread_cond_destroy(&server.not_empty);
+  pthread_cond_destroy(&server.not_full);
+  if( server.cache ){
+    fprintf(stderr, "serve: route cache %" PRId64 " hits, %" PRId64 " misses, %zu routes saved\n",
+            cache.hits, cache.misses, cache.num_entries);
+    route_cache_save(db, &cache, &graph);
+    route_cache_free(&cache);
+  }
+  landmarks_free(&lm);
+  routing_graph_free(&graph);
+}
@@ -204,6 +204,8 @@ void html_map_addr(
     " WHERE lon>=?1 AND lat>=?2 AND lon<=?3 AND lat<=?4"
     " ORDER BY postcode,street,abs(housenumber)";
   /* 1. Map Marker */
+  leaflet_style(html, "#ffffff", 0.8, 1, "", "#ff7800", 0.8, 5);
+  leaflet_layer_begin(html, "map", "circlemarker", "");
   rc = sqlite3_prepare_v2(db, query, -1, &stmt_addr, NULL);
   if( rc!=SQLITE_OK ) abort_db_error(db, rc);
   sqlite3_bind_double(stmt_addr, 1, b.min_lon);
@@ -225,11 +227,12 @@ void html_map_addr(
         (char *)sqlite3_column_text(stmt_addr, 5),
         (char *)sqlite3_column_text(stmt_addr, 6)
     );
-    leaflet_marker(html, "map",
+    leaflet_layer_point(html,
         (double)sqlite3_column_double(stmt_addr, 7),
         (double)sqlite3_column_double(stmt_addr, 8),
-        popup_text);
+        popup_text, 0);
   }
+  leaflet_layer_end(html);
   /* show boundingbox */
   leaflet_style(html, "#000000", 0.3, 2, "5 5", "none", 0.3, 5);
   leaflet_rectangle(html, "map", b.min_lon, b.min_lat, b.max_lon, b.max_lat, "");
@@ -284,67 +287,123 @@ void html_map_addr(
   sqlite3_finalize(stmt_addr);
 }
 
+typedef struct {
+  int64_t node_id;
+  int32_t lon, lat;       /* Coordinates in 1e-7 degrees */
+  int flags;              /* Permits of the edges */
+} GraphMapNode;
+
+static int graph_map_node_cmp(const void *a, const void *b) {
+  const GraphMapNode *na = a, *nb = b;
+  return na->node_id<nb->node_id ? -1 : na->node_id>nb->node_id;
+}
+
 /**
- * \brief Creates the Leaflet commands to visualize the graph
+ * \brief Writes the graph as data arrays graph_edges and graph_nodes
+ *
+ * The flags of an edge are the permits and the oneway bits of the edge,
+ * the flags of a node are the permits of its edges, so the maps for each
+ * permit show a part of the same data. The edges are read in one scan,
+ * the nodes are the first and last points of their geometry. The lines
+ * are simplified with the tolerance of the boundingbox.
  */
 void write_graph(
   sqlite3 *db,
   FILE *html,
-  const char *mapid,
-  const bbox b,
-  const int mask_permit
+  const bbox b
 ){
-  sqlite3_stmt *stmt_nodes, *stmt_edges;
-  int directed;
-  char popuptext[200];
-  int64_t node_id, way_id, start_node_id, end_node_id;
-  double lon, lat;
-  /*  */
-  create_subgraph_tables(db, b, mask_permit);
-  /* show graph nodes */
-  leaflet_style(html, "none", 0.9, 2, "", "#ff5348", 0.5, 5);
-  rc = sqlite3_prepare_v2(db,
-    "SELECT node_id,lon,lat FROM subgraph_nodes",
-     -1, &stmt_nodes, NULL);
-  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
-  while( sqlite3_step(stmt_nodes)==SQLITE_ROW ){
-    node_id = (int64_t)sqlite3_column_int64(stmt_nodes, 0);
-    lon = (double)sqlite3_column_double(stmt_nodes, 1);
-    lat = (double)sqlite3_column_double(stmt_nodes, 2);
-    snprintf(popuptext, sizeof(popuptext), "node_id %" PRId64, node_id);
-    leaflet_circlemarker(html, mapid, lon, lat, popuptext);
-  }
-  /* show graph edges */
+  sqlite3_stmt *stmt;
+  int pos, size, permit;
+  const void *blob;
+  char label[30];
+  GraphPoint pt;
   NodeList nodelist;
-  nodelist_init(&nodelist);
-  leaflet_style(html, "#0000ff", 0.5, 3, "", "none", 1.0, 5);
+  GraphMapNode *node;
+  size_t num_nodes, cap, i, j;
+  double tolerance = leaflet_tolerance(b);
+  graph_check_geometry(db);
   rc = sqlite3_prepare_v2(db,
-    "SELECT start_node_id,end_node_id,way_id,directed FROM subgraph",
-     -1, &stmt_edges, NULL);
+    " SELECT way_id,permit,geometry FROM graph_edges"
+    " WHERE way_id IN ("
+    "                  SELECT way_id FROM rtree_way"
+    "                  WHERE max_lon>=?1 AND min_lon<=?2"
+    "                    AND max_lat>=?3 AND min_lat<=?4"
+    "                 )"
+    " ORDER BY edge_id",
+     -1, &stmt, NULL);
   if( rc!=SQLITE_OK ) abort_db_error(db, rc);
-  while( sqlite3_step(stmt_edges)==SQLITE_ROW ){
-    start_node_id = (int64_t)sqlite3_column_int64(stmt_edges, 0);
-    end_node_id = (int64_t)sqlite3_column_int64(stmt_edges, 1);
-    way_id = (int64_t)sqlite3_column_int64(stmt_edges, 2);
-    directed = (int)sqlite3_column_int(stmt_edges, 3);
+  sqlite3_bind_double(stmt, 1, b.min_lon);
+  sqlite3_bind_double(stmt, 2, b.max_lon);
+  sqlite3_bind_double(stmt, 3, b.min_lat);
+  sqlite3_bind_double(stmt, 4, b.max_lat);
+  /* graph edges with permit and oneway bits */
+  cap = 1024;
+  node = malloc(cap * sizeof(GraphMapNode));
+  if( !node ) abort_msg("Out of memory");
+  num_nodes = 0;
+  nodelist_init(&nodelist);
+  leaflet_data_begin(html, "graph_edges");
+  while( (rc = sqlite3_step(stmt))==SQLITE_ROW ){
+    permit = sqlite3_column_int(stmt, 1);
+    blob = sqlite3_column_blob(stmt, 2);
+    size = sqlite3_column_bytes(stmt, 2);
     nodelist_clear(&nodelist);
-    slice_way_nodes(db, way_id, start_node_id, end_node_id, &nodelist);
-    snprintf(popuptext, sizeof(popuptext), "way_id %" PRId64, way_id);
-    if( directed ){
-      leaflet_style(html, "#0000ff", 0.5, 3, "5 5", "none", 1.0, 5);
-      leaflet_polyline(html, mapid, &nodelist, popuptext);
-      leaflet_style(html, "#0000ff", 0.5, 3, "", "none", 1.0, 5);
-    }else{
-      leaflet_polyline(html, mapid, &nodelist, popuptext);
+    pt = (GraphPoint){ 0, 0, 0 };
+    pos = 0;
+    while( geometry_blob_next(blob, size, &pos, &pt) ){
+      nodelist_add(&nodelist, GRAPH_POINT_LON(pt), GRAPH_POINT_LAT(pt), pt.node_id);
+      /* start node */
+      if( nodelist.size==1 ) node[num_nodes++] = (GraphMapNode){ pt.node_id, pt.lon, pt.lat, permit & 7 };
+    }
+    if( nodelist.size==0 ) continue;
+    /* end node */
+    node[num_nodes++] = (GraphMapNode){ pt.node_id, pt.lon, pt.lat, permit & 7 };
+    if( num_nodes+2>cap ){
+      cap *= 2;
+      node = realloc(node, cap * sizeof(GraphMapNode));
+      if( !node ) abort_msg("Out of memory");
     }
+    snprintf(label, sizeof(label), "%" PRId64, (int64_t)sqlite3_column_int64(stmt, 0));
+    nodelist_simplify(&nodelist, tolerance);
+    leaflet_layer_line(html, &nodelist, label, permit & 0x37);
   }
+  if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+  leaflet_data_end(html);
+  sqlite3_finalize(stmt);
+  nodelist_free(&nodelist);
+  /* graph nodes with the permits of their edges */
+  qsort(node, num_nodes, sizeof(GraphMapNode), graph_map_node_cmp);
+  leaflet_data_begin(html, "graph_nodes");
+  for(i=0; i<num_nodes; i=j){
+    for(j=i+1; j<num_nodes && node[j].node_id==node[i].node_id; j++) node[i].flags |= node[j].flags;
+    snprintf(label, sizeof(label), "%" PRId64, node[i].node_id);
+    leaflet_layer_point(html, node[i].lon / 1e7, node[i].lat / 1e7, label, node[i].flags);
+  }
+  leaflet_data_end(html);
+  free(node);
+}
+
+/**
+ * \brief Shows the part of the graph permitted for mask_permit in a map
+ *
+ * Oneway edges (bike: bit 16, car: bit 32) are dashed.
+ */
+void write_graph_layers(
+  FILE *html,
+  const char *mapid,
+  const bbox b,
+  const int mask_permit
+){
+  leaflet_style(html, "none", 0.9, 2, "", "#ff5348", 0.5, 5);
+  leaflet_layer_data(html, mapid, "circlemarker", "node_id ", "graph_nodes", mask_permit, NULL, 0);
+  leaflet_style(html, "#0000ff", 0.5, 3, "5 5", "none", 1.0, 5);
+  fprintf(html, "var style_oneway = style;\n");
+  leaflet_style(html, "#0000ff", 0.5, 3, "", "none", 1.0, 5);
+  leaflet_layer_data(html, mapid, "polyline", "way_id ", "graph_edges", mask_permit, "style_oneway",
+                     (mask_permit & 2 ? 16 : 0) | (mask_permit & 4 ? 32 : 0));
   /* show boundingbox */
   leaflet_style(html, "#000000", 0.3, 2, "5 5", "none", 0.3, 5);
   leaflet_rectangle(html, mapid, b.min_lon, b.min_lat, b.max_lon, b.max_lat, "");
-  /*  */
-  nodelist_free(&nodelist);
-  sqlite3_finalize(stmt_nodes);
-  sqlite3_finalize(stmt_edges);
 }
 
 /**
@@ -373,10 +432,11 @@ void html_map_graph(
   leaflet_init(html, "map2", b.min_lon, b.min_lat, b.max_lon, b.max_lat);
   leaflet_init(html, "map3", b.min_lon, b.min_lat, b.max_lon, b.max_lat);
   leaflet_init(html, "map4", b.min_lon, b.min_lat, b.max_lon, b.max_lat);
-  write_graph(db, html, "map1", b, 0);  /* graph complete */
-  write_graph(db, html, "map2", b, 1);  /* graph foot */
-  write_graph(db, html, "map3", b, 2);  /* graph bike */
-  write_graph(db, html, "map4", b, 4);  /* graph car */
+  write_graph(db, html, b);
+  write_graph_layers(html, "map1", b, 0);  /* graph complete */
+  write_graph_layers(html, "map2", b, 1);  /* graph foot */
+  write_graph_layers(html, "map3", b, 2);  /* graph bike */
+  write_graph_layers(html, "map4", b, 4);  /* graph car */
   fprintf(html,
       "</script>\n"
       "<p>dashed line ➔ one way</p>\n"
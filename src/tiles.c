@@ -0,0 +1,854 @@
+/**
+ * \file tiles.c
+ * \brief Mapbox Vector Tiles of highways, graph and addresses in an MBTiles file
+ *
+ * The tiles of each zoom level cover the boundingbox of the ways. The
+ * edges of a tile are found with the R*Tree of the ways, their geometry
+ * is projected to the tile (Web Mercator, extent 4096), clipped to the
+ * tile with a small buffer and simplified: points closer than a few
+ * units to the last point are dropped. Layers:
+ *
+ *   highways   one feature per way (id: way_id), highway, name, permit, foot, bike, car
+ *              (below zoom level TILES_MINOR_ZOOM only the major highways)
+ *   graph      one feature per edge (id: edge_id), permit, dist, way_id
+ *              (from zoom level TILES_GRAPH_ZOOM)
+ *   addresses  points with housenumber, street, postcode, city
+ *              (from zoom level TILES_ADDR_ZOOM)
+ *
+ * The tiles are made by worker threads, each with its own read-only
+ * connection to the database, and are written gzip compressed into the
+ * table tiles of the MBTiles file.
+ */
+
+#define TILES_MAX_ZOOM      18
+#define TILES_EXTENT        4096   /* Coordinates of a tile */
+#define TILES_BUFFER        64     /* Geometry beyond the border of the tile */
+#define TILES_TOLERANCE     8      /* Minimum distance of the points (16 units = 1 pixel) */
+#define TILES_MINOR_ZOOM    12     /* All highways from this zoom level */
+#define TILES_GRAPH_ZOOM    13     /* Layer graph from this zoom level */
+#define TILES_ADDR_ZOOM     15     /* Layer addresses from this zoom level */
+#define TILES_BLOCK_SIZE    16     /* Number of tiles a worker takes at once */
+
+static const char *const tiles_major_highway[] = {
+  "motorway", "motorway_link", "trunk", "trunk_link", "primary", "primary_link",
+  "secondary", "secondary_link", "tertiary", "tertiary_link", NULL
+};
+
+/*
+** Position in tiles of zoom level z (Web Mercator), y from north to south
+*/
+static double tile_x(const double lon, const int z) {
+  return (mercator_x(lon) / (M_PI * 6378137.0) + 1) / 2 * (1 << z);
+}
+
+static double tile_y(double lat, const int z) {
+  if( lat>85.0511 ) lat = 85.0511;
+  if( lat<-85.0511 ) lat = -85.0511;
+  return (1 - mercator_y(lat) / (M_PI * 6378137.0)) / 2 * (1 << z);
+}
+
+static double tile_lon(const double x, const int z) {
+  return x / (1 << z) * 360.0 - 180.0;
+}
+
+static double tile_lat(const double y, const int z) {
+  return degrees(atan(sinh(M_PI * (1 - 2 * y / (1 << z)))));
+}
+
+/*
+** Lines of a feature in tile coordinates, clipped and simplified
+**
+** tile_line_to() adds the next point of a line. Parts outside the
+** clipping square are cut off, so a line can consist of several parts.
+*/
+typedef struct {
+  int32_t x, y;
+} TilePoint;
+
+typedef struct {
+  TilePoint *pt;
+  size_t num_points, cap_points;
+  size_t *part;           /* First point of each part */
+  size_t num_parts, cap_parts;
+  size_t last_fixed;      /* Last point that is not dropped by the simplification */
+  double px, py;          /* Previous point */
+  int has_prev;           /* 1 if px, py is set */
+  int open;               /* 1 if the previous point is the end of the last part */
+} TileLine;
+
+static void tile_line_init(TileLine *l) {
+  memset(l, 0, sizeof(TileLine));
+}
+
+static void tile_line_clear(TileLine *l) {
+  l->num_points = l->num_parts = 0;
+  l->has_prev = l->open = 0;
+}
+
+static void tile_line_free(TileLine *l) {
+  free(l->pt);
+  free(l->part);
+}
+
+/*
+** Removes the last part if it has less than two points
+*/
+static void tile_line_end(TileLine *l) {
+  if( l->num_parts>0 && l->num_points - l->part[l->num_parts-1]<2 ){
+    l->num_points = l->part[--l->num_parts];
+  }
+}
+
+static void tile_line_part(TileLine *l) {
+  tile_line_end(l);
+  if( l->num_parts==l->cap_parts ){
+    l->cap_parts = l->cap_parts ? l->cap_parts * 2 : 16;
+    l->part = realloc(l->part, l->cap_parts * sizeof(size_t));
+    if( !l->part ) abort_msg("Out of memory");
+  }
+  l->part[l->num_parts++] = l->num_points;
+}
+
+/*
+** Adds a point to the last part. A point closer than TILES_TOLERANCE to
+** the last fixed point replaces the previous point if that is not fixed,
+** so the end of a line is always kept.
+*/
+static void tile_line_point(TileLine *l, const double x, const double y) {
+  TilePoint p = { (int32_t)lround(x), (int32_t)lround(y) };
+  TilePoint f;
+  size_t first = l->part[l->num_parts-1];
+  if( l->num_points>first ){
+    if( l->pt[l->num_points-1].x==p.x && l->pt[l->num_points-1].y==p.y ) return;
+    if( l->num_points-1>l->last_fixed ) l->num_points--;
+  }
+  if( l->num_points==l->cap_points ){
+    l->cap_points = l->cap_points ? l->cap_points * 2 : 256;
+    l->pt = realloc(l->pt, l->cap_points * sizeof(TilePoint));
+    if( !l->pt ) abort_msg("Out of memory");
+  }
+  l->pt[l->num_points++] = p;
+  if( l->num_points-1==first ){
+    l->last_fixed = first;
+    return;
+  }
+  f = l->pt[l->last_fixed];
+  if( (double)(p.x-f.x)*(p.x-f.x) + (double)(p.y-f.y)*(p.y-f.y)>=TILES_TOLERANCE*TILES_TOLERANCE )
+    l->last_fixed = l->num_points - 1;
+}
+
+/*
+** Clips the segment from (x0,y0) to (x0+dx,y0+dy) to the square with the
+** buffer (Liang-Barsky), t0 and t1 are the parameters of the visible part
+*/
+static int tile_clip(const double x0, const double y0, const double dx, const double dy,
+                     double *t0, double *t1) {
+  const double lo = -TILES_BUFFER, hi = TILES_EXTENT + TILES_BUFFER;
+  double p[4] = { -dx, dx, -dy, dy };
+  double q[4] = { x0 - lo, hi - x0, y0 - lo, hi - y0 };
+  double r;
+  int i;
+  *t0 = 0;
+  *t1 = 1;
+  for(i=0; i<4; i++){
+    if( p[i]==0 ){
+      if( q[i]<0 ) return 0;
+    }else{
+      r = q[i] / p[i];
+      if( p[i]<0 ){
+        if( r>*t1 ) return 0;
+        if( r>*t0 ) *t0 = r;
+      }else{
+        if( r<*t0 ) return 0;
+        if( r<*t1 ) *t1 = r;
+      }
+    }
+  }
+  return 1;
+}
+
+static void tile_line_to(TileLine *l, const double x, const double y) {
+  double dx, dy, t0, t1;
+  if( !l->has_prev ){
+    l->has_prev = 1;
+    l->open = tile_clip(x, y, 0, 0, &t0, &t1);
+    if( l->open ){
+      tile_line_part(l);
+      tile_line_point(l, x, y);
+    }
+  }else{
+    dx = x - l->px;
+    dy = y - l->py;
+    if( tile_clip(l->px, l->py, dx, dy, &t0, &t1) ){
+      if( !l->open ){
+        tile_line_part(l);
+        tile_line_point(l, l->px + t0*dx, l->py + t0*dy);
+      }
+      tile_line_point(l, l->px + t1*dx, l->py + t1*dy);
+      l->open = t1>=1;
+    }
+    else l->open = 0;
+  }
+  l->px = x;
+  l->py = y;
+}
+
+/*
+** Layer of a vector tile
+**
+** The features are encoded when they are added. The values of the
+** attributes are stored once per layer, a hash table finds the index
+** of a value that was already used.
+*/
+typedef struct {
+  const char *name;
+  const char *const *key;     /* Attribute names */
+  int num_keys;
+  int num_features;
+  ProtoBuf features;          /* Encoded features of the layer */
+  ProtoBuf values;            /* Encoded values */
+  size_t *value_pos;          /* Value i: values.data[value_pos[i]] .. values.data[value_pos[i+1]-1] */
+  int num_values, cap_values;
+  int *hash;                  /* Value index + 1, 0: empty */
+  int hash_size;              /* Power of 2 */
+  ProtoBuf tags, geometry, feature, value;  /* Current feature */
+} MvtLayer;
+
+#define MVT_POINT       1
+#define MVT_LINESTRING  2
+
+static void mvt_layer_init(MvtLayer *l, const char *name, const char *const *key, const int num_keys) {
+  memset(l, 0, sizeof(MvtLayer));
+  l->name = name;
+  l->key = key;
+  l->num_keys = num_keys;
+  l->cap_values = 64;
+  l->value_pos = malloc((l->cap_values + 1) * sizeof(size_t));
+  l->hash_size = 128;
+  l->hash = calloc(l->hash_size, sizeof(int));
+  if( !l->value_pos || !l->hash ) abort_msg("Out of memory");
+  l->value_pos[0] = 0;
+}
+
+static void mvt_layer_clear(MvtLayer *l) {
+  l->num_features = 0;
+  l->num_values = 0;
+  protobuf_clear(&l->features);
+  protobuf_clear(&l->values);
+  memset(l->hash, 0, l->hash_size * sizeof(int));
+}
+
+static void mvt_layer_free(MvtLayer *l) {
+  protobuf_free(&l->features);
+  protobuf_free(&l->values);
+  protobuf_free(&l->tags);
+  protobuf_free(&l->geometry);
+  protobuf_free(&l->feature);
+  protobuf_free(&l->value);
+  free(l->value_pos);
+  free(l->hash);
+}
+
+static uint32_t mvt_hash(const unsigned char *data, size_t len) {
+  uint32_t h = 2166136261u;  /* FNV-1a */
+  while( len-- ) h = (h ^ *data++) * 16777619u;
+  return h;
+}
+
+static int *mvt_hash_slot(MvtLayer *l, const unsigned char *data, size_t len) {
+  int i, *slot;
+  size_t pos;
+  for(i=mvt_hash(data, len) & (l->hash_size-1); ; i=(i+1) & (l->hash_size-1)){
+    slot = &l->hash[i];
+    if( *slot==0 ) return slot;
+    pos = l->value_pos[*slot-1];
+    if( l->value_pos[*slot]-pos==len && memcmp(l->values.data+pos, data, len)==0 ) return slot;
+  }
+}
+
+/*
+** Adds the attribute key with the encoded value in l->value to the current feature
+*/
+static void mvt_tag(MvtLayer *l, const int key) {
+  int *slot, i;
+  slot = mvt_hash_slot(l, l->value.data, l->value.size);
+  if( *slot==0 ){
+    if( l->num_values==l->cap_values ){
+      l->cap_values *= 2;
+      l->value_pos = realloc(l->value_pos, (l->cap_values + 1) * sizeof(size_t));
+      if( !l->value_pos ) abort_msg("Out of memory");
+    }
+    protobuf_raw(&l->values, l->value.data, l->value.size);
+    l->value_pos[++l->num_values] = l->values.size;
+    *slot = l->num_values;
+    /* Hash table at most half full */
+    if( 2*l->num_values>=l->hash_size ){
+      l->hash_size *= 2;
+      l->hash = realloc(l->hash, l->hash_size * sizeof(int));
+      if( !l->hash ) abort_msg("Out of memory");
+      memset(l->hash, 0, l->hash_size * sizeof(int));
+      for(i=0; i<l->num_values; i++){
+        *mvt_hash_slot(l, l->values.data + l->value_pos[i], l->value_pos[i+1] - l->value_pos[i]) = i + 1;
+      }
+      slot = NULL;
+    }
+  }
+  protobuf_varint(&l->tags, key);
+  protobuf_varint(&l->tags, slot ? *slot - 1 : l->num_values - 1);
+}
+
+static void mvt_feature_begin(MvtLayer *l) {
+  protobuf_clear(&l->tags);
+  protobuf_clear(&l->geometry);
+}
+
+static void mvt_tag_string(MvtLayer *l, const int key, const char *s) {
+  if( s==NULL || s[0]=='\0' ) return;
+  protobuf_clear(&l->value);
+  protobuf_string(&l->value, 1, s);
+  mvt_tag(l, key);
+}
+
+static void mvt_tag_uint(MvtLayer *l, const int key, const uint64_t v) {
+  protobuf_clear(&l->value);
+  protobuf_uint(&l->value, 5, v);
+  mvt_tag(l, key);
+}
+
+static void mvt_tag_bool(MvtLayer *l, const int key, const int v) {
+  protobuf_clear(&l->value);
+  protobuf_uint(&l->value, 7, v!=0);
+  mvt_tag(l, key);
+}
+
+static void mvt_feature_point(MvtLayer *l, const int32_t x, const int32_t y) {
+  protobuf_varint(&l->geometry, 1 | 1 << 3);  /* MoveTo */
+  protobuf_varint(&l->geometry, protobuf_zigzag(x));
+  protobuf_varint(&l->geometry, protobuf_zigzag(y));
+}
+
+static void mvt_feature_line(MvtLayer *l, const TileLine *line) {
+  size_t p, i, first, last;
+  int32_t cx = 0, cy = 0;
+  for(p=0; p<line->num_parts; p++){
+    first = line->part[p];
+    last = p+1<line->num_parts ? line->part[p+1] : line->num_points;
+    for(i=first; i<last; i++){
+      if( i==first ) protobuf_varint(&l->geometry, 1 | 1 << 3);                        /* MoveTo */
+      if( i==first+1 ) protobuf_varint(&l->geometry, 2 | (uint64_t)(last-first-1) << 3);  /* LineTo */
+      protobuf_varint(&l->geometry, protobuf_zigzag(line->pt[i].x - cx));
+      protobuf_varint(&l->geometry, protobuf_zigzag(line->pt[i].y - cy));
+      cx = line->pt[i].x;
+      cy = line->pt[i].y;
+    }
+  }
+}
+
+/*
+** Adds the current feature to the layer, id 0: no id
+*/
+static void mvt_feature_end(MvtLayer *l, const int64_t id, const int type) {
+  protobuf_clear(&l->feature);
+  if( id>0 ) protobuf_uint(&l->feature, 1, (uint64_t)id);
+  protobuf_bytes(&l->feature, 2, l->tags.data, l->tags.size);
+  protobuf_uint(&l->feature, 3, type);
+  protobuf_bytes(&l->feature, 4, l->geometry.data, l->geometry.size);
+  protobuf_bytes(&l->features, 2, l->feature.data, l->feature.size);
+  l->num_features++;
+}
+
+/*
+** Adds the layer to the tile if it has features
+*/
+static void mvt_layer_write(MvtLayer *l, ProtoBuf *tile) {
+  int i;
+  if( l->num_features==0 ) return;
+  protobuf_clear(&l->feature);
+  protobuf_uint(&l->feature, 15, 2);  /* version */
+  protobuf_string(&l->feature, 1, l->name);
+  protobuf_raw(&l->feature, l->features.data, l->features.size);
+  for(i=0; i<l->num_keys; i++) protobuf_string(&l->feature, 3, l->key[i]);
+  for(i=0; i<l->num_values; i++){
+    protobuf_bytes(&l->feature, 4, l->values.data + l->value_pos[i], l->value_pos[i+1] - l->value_pos[i]);
+  }
+  protobuf_uint(&l->feature, 5, TILES_EXTENT);
+  protobuf_bytes(tile, 3, l->feature.data, l->feature.size);
+}
+
+/*
+** Addresses, sorted by longitude
+*/
+typedef struct {
+  double lon, lat;
+  char *housenumber, *street, *postcode, *city;
+} TileAddr;
+
+static const char *const tiles_highway_keys[] = { "highway", "name", "permit", "foot", "bike", "car" };
+static const char *const tiles_graph_keys[] = { "permit", "dist", "way_id" };
+static const char *const tiles_addr_keys[] = { "housenumber", "street", "postcode", "city" };
+
+static struct {
+  const char *filename;       /* Database */
+  int minzoom;
+  int num_zooms;
+  int x0[TILES_MAX_ZOOM+1], y0[TILES_MAX_ZOOM+1];  /* First tile of each zoom level */
+  int nx[TILES_MAX_ZOOM+1], ny[TILES_MAX_ZOOM+1];  /* Number of tiles */
+  int64_t num_tiles;
+  int64_t next_tile;          /* Next tile that is not yet assigned to a worker */
+  TileAddr *addr;
+  size_t num_addr;
+  sqlite3 *out;               /* MBTiles file */
+  sqlite3_stmt *stmt_insert;
+  int64_t tiles_written, bytes_written;
+  pthread_mutex_t lock;       /* Protects next_tile */
+  pthread_mutex_t write_lock; /* Protects out, stmt_insert and the counters */
+} tiles;
+
+typedef struct {
+  sqlite3 *db;
+  sqlite3_stmt *stmt_edges, *stmt_tags;
+  MvtLayer highways, graph, addresses;
+  TileLine way, edge;
+  GraphPoint *point;          /* Points of the current edge */
+  int cap_points;
+  StrBuf highway, name;
+  ProtoBuf tile, gz;
+} TileWorker;
+
+static char *tiles_strdup(const unsigned char *s) {
+  char *copy;
+  if( s==NULL || s[0]=='\0' ) return NULL;
+  copy = malloc(strlen((const char *)s) + 1);
+  if( !copy ) abort_msg("Out of memory");
+  strcpy(copy, (const char *)s);
+  return copy;
+}
+
+static void tiles_load_addr(sqlite3 *db) {
+  sqlite3_stmt *stmt;
+  size_t cap = 1024;
+  tiles.addr = malloc(cap * sizeof(TileAddr));
+  if( !tiles.addr ) abort_msg("Out of memory");
+  tiles.num_addr = 0;
+  rc = sqlite3_prepare_v2(db,
+    " SELECT h.lon,h.lat,h.housenumber,s.street,s.postcode,s.city"
+    " FROM addr_housenumber AS h"
+    " LEFT JOIN addr_street AS s ON s.street_id=h.street_id"
+    " WHERE h.lon IS NOT NULL AND h.lat IS NOT NULL"
+    " ORDER BY h.lon",
+    -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(db, rc);
+  while( (rc = sqlite3_step(stmt))==SQLITE_ROW ){
+    if( tiles.num_addr==cap ){
+      cap *= 2;
+      tiles.addr = realloc(tiles.addr, cap * sizeof(TileAddr));
+      if( !tiles.addr ) abort_msg("Out of memory");
+    }
+    TileAddr *a = &tiles.addr[tiles.num_addr++];
+    a->lon = sqlite3_column_double(stmt, 0);
+    a->lat = sqlite3_column_double(stmt, 1);
+    a->housenumber = tiles_strdup(sqlite3_column_text(stmt, 2));
+    a->street = tiles_strdup(sqlite3_column_text(stmt, 3));
+    a->postcode = tiles_strdup(sqlite3_column_text(stmt, 4));
+    a->city = tiles_strdup(sqlite3_column_text(stmt, 5));
+  }
+  if( rc!=SQLITE_DONE ) abort_db_error(db, rc);
+  sqlite3_finalize(stmt);
+}
+
+/*
+** Writes the highway feature of a way
+*/
+static void tiles_way_end(TileWorker *w, const int64_t way_id, const int permit) {
+  tile_line_end(&w->way);
+  if( w->way.num_parts==0 ) return;
+  mvt_feature_begin(&w->highways);
+  mvt_tag_string(&w->highways, 0, w->highway.s);
+  mvt_tag_string(&w->highways, 1, w->name.s);
+  mvt_tag_uint(&w->highways, 2, permit);
+  mvt_tag_bool(&w->highways, 3, permit & 1);
+  mvt_tag_bool(&w->highways, 4, permit & 2);
+  mvt_tag_bool(&w->highways, 5, permit & 4);
+  mvt_feature_line(&w->highways, &w->way);
+  mvt_feature_end(&w->highways, way_id, MVT_LINESTRING);
+}
+
+static void tiles_edges(TileWorker *w, const int z, const int x, const int y) {
+  int64_t way_id, prev_way_id = -1, edge_id;
+  int permit, way_permit = 0, show_way = 0, show_edge, pos, size, i, num_points, result;
+  int32_t min_lon, min_lat, max_lon, max_lat;
+  const void *blob;
+  const char *key;
+  GraphPoint pt;
+  sqlite3_stmt *stmt = w->stmt_edges;
+  double buffer = TILES_BUFFER / (double)TILES_EXTENT;
+  /* Tile with the buffer in 1e-7 degrees */
+  int32_t tile_min_lon = (int32_t)floor(tile_lon(x - buffer, z) * 1e7);
+  int32_t tile_max_lon = (int32_t)ceil(tile_lon(x + 1 + buffer, z) * 1e7);
+  int32_t tile_min_lat = (int32_t)floor(tile_lat(y + 1 + buffer, z) * 1e7);
+  int32_t tile_max_lat = (int32_t)ceil(tile_lat(y - buffer, z) * 1e7);
+  /* Ways in the tile */
+  sqlite3_bind_double(stmt, 1, tile_min_lon / 1e7);
+  sqlite3_bind_double(stmt, 2, tile_max_lon / 1e7);
+  sqlite3_bind_double(stmt, 3, tile_min_lat / 1e7);
+  sqlite3_bind_double(stmt, 4, tile_max_lat / 1e7);
+  show_edge = z>=TILES_GRAPH_ZOOM;
+  while( (result = sqlite3_step(stmt))==SQLITE_ROW ){
+    way_id = sqlite3_column_int64(stmt, 0);
+    edge_id = sqlite3_column_int64(stmt, 1);
+    permit = sqlite3_column_int(stmt, 2);
+    if( way_id!=prev_way_id ){
+      if( show_way ) tiles_way_end(w, prev_way_id, way_permit);
+      prev_way_id = way_id;
+      way_permit = permit;
+      tile_line_clear(&w->way);
+      /* Tags of the way */
+      strbuf_clear(&w->highway);
+      strbuf_clear(&w->name);
+      sqlite3_bind_int64(w->stmt_tags, 1, way_id);
+      while( sqlite3_step(w->stmt_tags)==SQLITE_ROW ){
+        key = (const char *)sqlite3_column_text(w->stmt_tags, 0);
+        strbuf_printf(strcmp(key, "name")==0 ? &w->name : &w->highway, "%s",
+                      (const char *)sqlite3_column_text(w->stmt_tags, 1));
+      }
+      sqlite3_reset(w->stmt_tags);
+      show_way = z>=TILES_MINOR_ZOOM;
+      for(i=0; !show_way && tiles_major_highway[i]; i++) show_way = strcmp(w->highway.s, tiles_major_highway[i])==0;
+    }
+    if( !show_way && !show_edge ) continue;
+    tile_line_clear(&w->edge);
+    blob = sqlite3_column_blob(stmt, 4);
+    size = sqlite3_column_bytes(stmt, 4);
+    pt = (GraphPoint){ 0, 0, 0 };
+    pos = 0;
+    num_points = 0;
+    min_lon = min_lat = INT32_MAX;
+    max_lon = max_lat = INT32_MIN;
+    while( geometry_blob_next(blob, size, &pos, &pt) ){
+      if( num_points==w->cap_points ){
+        w->cap_points = w->cap_points ? w->cap_points * 2 : 256;
+        w->point = realloc(w->point, w->cap_points * sizeof(GraphPoint));
+        if( !w->point ) abort_msg("Out of memory");
+      }
+      w->point[num_points++] = pt;
+      if( pt.lon<min_lon ) min_lon = pt.lon;
+      if( pt.lon>max_lon ) max_lon = pt.lon;
+      if( pt.lat<min_lat ) min_lat = pt.lat;
+      if( pt.lat>max_lat ) max_lat = pt.lat;
+    }
+    /* Edges of long ways outside the tile are not projected, the way continues with a new part */
+    if( max_lon<tile_min_lon || min_lon>tile_max_lon || max_lat<tile_min_lat || min_lat>tile_max_lat ){
+      w->way.has_prev = w->way.open = 0;
+      continue;
+    }
+    for(i=0; i<num_points; i++){
+      double px = (tile_x(GRAPH_POINT_LON(w->point[i]), z) - x) * TILES_EXTENT;
+      double py = (tile_y(GRAPH_POINT_LAT(w->point[i]), z) - y) * TILES_EXTENT;
+      /* The first point of the next edge of the way is the last point of this edge */
+      if( show_way ) tile_line_to(&w->way, px, py);
+      if( show_edge ) tile_line_to(&w->edge, px, py);
+    }
+    if( !show_edge ) continue;
+    tile_line_end(&w->edge);
+    if( w->edge.num_parts==0 ) continue;
+    mvt_feature_begin(&w->graph);
+    mvt_tag_uint(&w->graph, 0, permit);
+    mvt_tag_uint(&w->graph, 1, sqlite3_column_int(stmt, 3));
+    mvt_tag_uint(&w->graph, 2, way_id);
+    mvt_feature_line(&w->graph, &w->edge);
+    mvt_feature_end(&w->graph, edge_id, MVT_LINESTRING);
+  }
+  if( result!=SQLITE_DONE ) abort_db_error(w->db, result);
+  if( show_way ) tiles_way_end(w, prev_way_id, way_permit);
+  sqlite3_reset(stmt);
+}
+
+static void tiles_addresses(TileWorker *w, const int z, const int x, const int y) {
+  double min_lon = tile_lon(x, z), max_lon = tile_lon(x + 1, z);
+  double min_lat = tile_lat(y + 1, z), max_lat = tile_lat(y, z);
+  size_t lo = 0, hi = tiles.num_addr, mid;
+  TileAddr *a;
+  /* First address with lon >= min_lon */
+  while( lo<hi ){
+    mid = (lo + hi) / 2;
+    if( tiles.addr[mid].lon<min_lon ) lo = mid + 1;
+    else hi = mid;
+  }
+  for(a=tiles.addr+lo; a<tiles.addr+tiles.num_addr && a->lon<max_lon; a++){
+    if( a->lat<min_lat || a->lat>=max_lat ) continue;
+    mvt_feature_begin(&w->addresses);
+    mvt_tag_string(&w->addresses, 0, a->housenumber);
+    mvt_tag_string(&w->addresses, 1, a->street);
+    mvt_tag_string(&w->addresses, 2, a->postcode);
+    mvt_tag_string(&w->addresses, 3, a->city);
+    mvt_feature_point(&w->addresses, (int32_t)lround((tile_x(a->lon, z) - x) * TILES_EXTENT),
+                                     (int32_t)lround((tile_y(a->lat, z) - y) * TILES_EXTENT));
+    mvt_feature_end(&w->addresses, 0, MVT_POINT);
+  }
+}
+
+/*
+** Compresses the tile with gzip
+*/
+static void tiles_gzip(const ProtoBuf *in, ProtoBuf *out) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if( deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)!=Z_OK )
+    abort_msg("Option tiles: Error initializing zlib");
+  protobuf_clear(out);
+  protobuf_reserve(out, deflateBound(&zs, in->size));
+  zs.next_in = in->data;
+  zs.avail_in = in->size;
+  zs.next_out = out->data;
+  zs.avail_out = out->capacity;
+  if( deflate(&zs, Z_FINISH)!=Z_STREAM_END ) abort_msg("Option tiles: Error compressing tile");
+  out->size = zs.total_out;
+  deflateEnd(&zs);
+}
+
+static void tiles_make(TileWorker *w, const int z, const int x, const int y) {
+  int result;
+  mvt_layer_clear(&w->highways);
+  mvt_layer_clear(&w->graph);
+  mvt_layer_clear(&w->addresses);
+  tiles_edges(w, z, x, y);
+  if( z>=TILES_ADDR_ZOOM ) tiles_addresses(w, z, x, y);
+  protobuf_clear(&w->tile);
+  mvt_layer_write(&w->highways, &w->tile);
+  mvt_layer_write(&w->graph, &w->tile);
+  mvt_layer_write(&w->addresses, &w->tile);
+  if( w->tile.size==0 ) return;  /* Empty tiles are not written */
+  tiles_gzip(&w->tile, &w->gz);
+  pthread_mutex_lock(&tiles.write_lock);
+  /* MBTiles: rows from south to north (TMS) */
+  sqlite3_bind_int(tiles.stmt_insert, 1, z);
+  sqlite3_bind_int(tiles.stmt_insert, 2, x);
+  sqlite3_bind_int(tiles.stmt_insert, 3, (1 << z) - 1 - y);
+  sqlite3_bind_blob(tiles.stmt_insert, 4, w->gz.data, w->gz.size, SQLITE_STATIC);
+  result = sqlite3_step(tiles.stmt_insert);
+  if( result!=SQLITE_DONE ) abort_db_error(tiles.out, result);
+  sqlite3_reset(tiles.stmt_insert);
+  tiles.tiles_written++;
+  tiles.bytes_written += w->gz.size;
+  pthread_mutex_unlock(&tiles.write_lock);
+}
+
+static void *tiles_worker(void *arg) {
+  TileWorker w;
+  int64_t first, last, t, i;
+  int z, result;
+  result = sqlite3_open_v2(tiles.filename, &w.db, SQLITE_OPEN_READONLY, NULL);
+  if( result!=SQLITE_OK ) abort_db_error(w.db, result);
+  /* Neighbouring tiles read the same pages, cache 64 MB */
+  sqlite3_exec(w.db, "PRAGMA cache_size = -65536", NULL, NULL, NULL);
+  if( sqlite3_prepare_v2(w.db,
+        " SELECT way_id,edge_id,permit,dist,geometry FROM graph_edges"
+        " WHERE way_id IN ("
+        "                  SELECT way_id FROM rtree_way"
+        "                  WHERE max_lon>=?1 AND min_lon<=?2"
+        "                    AND max_lat>=?3 AND min_lat<=?4"
+        "                 )"
+        " ORDER BY edge_id",
+        -1, &w.stmt_edges, NULL)!=SQLITE_OK ||
+      sqlite3_prepare_v2(w.db,
+        " SELECT key,value FROM way_tags INDEXED BY way_tags__way_id"
+        " WHERE way_id=?1 AND key IN ('highway','name')",
+        -1, &w.stmt_tags, NULL)!=SQLITE_OK ){
+    fprintf(stderr, "%s\n", sqlite3_errmsg(w.db));
+    abort_msg("Option tiles: Tables missing (options index, rtree and graph)");
+  }
+  mvt_layer_init(&w.highways, "highways", tiles_highway_keys, 6);
+  mvt_layer_init(&w.graph, "graph", tiles_graph_keys, 3);
+  mvt_layer_init(&w.addresses, "addresses", tiles_addr_keys, 4);
+  tile_line_init(&w.way);
+  tile_line_init(&w.edge);
+  w.point = NULL;
+  w.cap_points = 0;
+  strbuf_init(&w.highway);
+  strbuf_init(&w.name);
+  protobuf_init(&w.tile);
+  protobuf_init(&w.gz);
+  while( 1 ){
+    /* Take the next block of tiles */
+    pthread_mutex_lock(&tiles.lock);
+    first = tiles.next_tile;
+    tiles.next_tile += TILES_BLOCK_SIZE;
+    pthread_mutex_unlock(&tiles.lock);
+    if( first>=tiles.num_tiles ) break;
+    last = first + TILES_BLOCK_SIZE;
+    if( last>tiles.num_tiles ) last = tiles.num_tiles;
+    for(t=first; t<last; t++){
+      /* Zoom level and position of tile number t */
+      i = t;
+      for(z=0; i>=(int64_t)tiles.nx[z] * tiles.ny[z]; z++) i -= (int64_t)tiles.nx[z] * tiles.ny[z];
+      tiles_make(&w, tiles.minzoom + z, tiles.x0[z] + (int)(i % tiles.nx[z]), tiles.y0[z] + (int)(i / tiles.nx[z]));
+    }
+  }
+  mvt_layer_free(&w.highways);
+  mvt_layer_free(&w.graph);
+  mvt_layer_free(&w.addresses);
+  tile_line_free(&w.way);
+  tile_line_free(&w.edge);
+  free(w.point);
+  strbuf_free(&w.highway);
+  strbuf_free(&w.name);
+  protobuf_free(&w.tile);
+  protobuf_free(&w.gz);
+  sqlite3_finalize(w.stmt_edges);
+  sqlite3_finalize(w.stmt_tags);
+  sqlite3_close(w.db);
+  return NULL;
+}
+
+static void tiles_metadata(const char *name, const char *value) {
+  sqlite3_stmt *stmt;
+  rc = sqlite3_prepare_v2(tiles.out, "INSERT INTO metadata (name,value) VALUES (?1,?2)", -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(tiles.out, rc);
+  sqlite3_bind_text(stmt, 1, name, -1, NULL);
+  sqlite3_bind_text(stmt, 2, value, -1, NULL);
+  rc = sqlite3_step(stmt);
+  if( rc!=SQLITE_DONE ) abort_db_error(tiles.out, rc);
+  sqlite3_finalize(stmt);
+}
+
+/**
+ * \brief Writes the vector tiles from minzoom to maxzoom into an MBTiles file
+ *
+ * \param threads  Number of worker threads
+ */
+void write_tiles(
+  sqlite3 *db,
+  const int minzoom,
+  const int maxzoom,
+  const char *mbtiles_file,
+  int threads
+){
+  sqlite3_stmt *stmt;
+  pthread_t *thread;
+  bbox b;
+  int z, i;
+  char value[256];
+  StrBuf json;
+  double t0, t1;
+  if( minzoom<0 || maxzoom>TILES_MAX_ZOOM || minzoom>maxzoom ) abort_msg("Option tiles: Invalid zoom levels");
+  if( threads<1 || threads>SERVE_MAX_THREADS ) abort_msg("Option tiles: Invalid number of threads");
+  threads = db_worker_threads(threads);
+  tiles.filename = sqlite3_db_filename(db, "main");
+  if( tiles.filename==NULL || tiles.filename[0]=='\0' ) abort_msg("Option tiles: Database file required");
+  graph_check_geometry(db);
+  t0 = time_now();
+  /* Boundingbox of the ways */
+  rc = sqlite3_prepare_v2(db,
+    "SELECT min(min_lon),min(min_lat),max(max_lon),max(max_lat) FROM rtree_way", -1, &stmt, NULL);
+  if( rc!=SQLITE_OK ) abort_msg("Option tiles: R*Tree indexes missing (option rtree)");
+  if( sqlite3_step(stmt)!=SQLITE_ROW || sqlite3_column_type(stmt, 0)==SQLITE_NULL )
+    abort_msg("Option tiles: No ways in the database");
+  b.min_lon = sqlite3_column_double(stmt, 0);
+  b.min_lat = sqlite3_column_double(stmt, 1);
+  b.max_lon = sqlite3_column_double(stmt, 2);
+  b.max_lat = sqlite3_column_double(stmt, 3);
+  sqlite3_finalize(stmt);
+  /* Tiles of each zoom level */
+  tiles.minzoom = minzoom;
+  tiles.num_zooms = maxzoom - minzoom + 1;
+  tiles.num_tiles = 0;
+  for(i=0; i<tiles.num_zooms; i++){
+    z = minzoom + i;
+    tiles.x0[i] = (int)floor(tile_x(b.min_lon, z));
+    tiles.y0[i] = (int)floor(tile_y(b.max_lat, z));
+    tiles.nx[i] = (int)floor(tile_x(b.max_lon, z));
+    tiles.ny[i] = (int)floor(tile_y(b.min_lat, z));
+    if( tiles.nx[i]>(1 << z) - 1 ) tiles.nx[i] = (1 << z) - 1;
+    if( tiles.ny[i]>(1 << z) - 1 ) tiles.ny[i] = (1 << z) - 1;
+    if( tiles.x0[i]<0 ) tiles.x0[i] = 0;
+    if( tiles.y0[i]<0 ) tiles.y0[i] = 0;
+    tiles.nx[i] -= tiles.x0[i] - 1;
+    tiles.ny[i] -= tiles.y0[i] - 1;
+    tiles.num_tiles += (int64_t)tiles.nx[i] * tiles.ny[i];
+  }
+  tiles.next_tile = 0;
+  tiles.num_addr = 0;
+  tiles.addr = NULL;
+  if( maxzoom>=TILES_ADDR_ZOOM && table_exists(db, "addr_housenumber") ) tiles_load_addr(db);
+  /* MBTiles file */
+  remove(mbtiles_file);
+  rc = sqlite3_open(mbtiles_file, &tiles.out);
+  if( rc!=SQLITE_OK ) abort_db_error(tiles.out, rc);
+  rc = sqlite3_exec(tiles.out,
+    " PRAGMA journal_mode = OFF;"
+    " PRAGMA synchronous = OFF;"
+    " CREATE TABLE metadata (name TEXT, value TEXT);"
+    " CREATE TABLE tiles (zoom_level INTEGER, tile_column INTEGER, tile_row INTEGER, tile_data BLOB);"
+    " BEGIN TRANSACTION;",
+    NULL, NULL, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(tiles.out, rc);
+  rc = sqlite3_prepare_v2(tiles.out,
+    "INSERT INTO tiles (zoom_level,tile_column,tile_row,tile_data) VALUES (?1,?2,?3,?4)",
+    -1, &tiles.stmt_insert, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(tiles.out, rc);
+  tiles.tiles_written = 0;
+  tiles.bytes_written = 0;
+  pthread_mutex_init(&tiles.lock, NULL);
+  pthread_mutex_init(&tiles.write_lock, NULL);
+  /* Tiles in parallel */
+  thread = malloc(threads * sizeof(pthread_t));
+  if( !thread ) abort_msg("Out of memory");
+  for(i=0; i<threads; i++){
+    if( pthread_create(&thread[i], NULL, tiles_worker, NULL)!=0 )
+      abort_msg("Option tiles: Error creating thread");
+  }
+  for(i=0; i<threads; i++) pthread_join(thread[i], NULL);
+  sqlite3_finalize(tiles.stmt_insert);
+  /* Metadata (MBTiles 1.3) */
+  tiles_metadata("name", "pbf2sqlite");
+  tiles_metadata("format", "pbf");
+  tiles_metadata("type", "overlay");
+  tiles_metadata("description", "Highways, routing graph and addresses");
+  snprintf(value, sizeof(value), "%.7f,%.7f,%.7f,%.7f", b.min_lon, b.min_lat, b.max_lon, b.max_lat);
+  tiles_metadata("bounds", value);
+  snprintf(value, sizeof(value), "%.7f,%.7f,%d", (b.min_lon + b.max_lon) / 2, (b.min_lat + b.max_lat) / 2, minzoom);
+  tiles_metadata("center", value);
+  snprintf(value, sizeof(value), "%d", minzoom);
+  tiles_metadata("minzoom", value);
+  snprintf(value, sizeof(value), "%d", maxzoom);
+  tiles_metadata("maxzoom", value);
+  strbuf_init(&json);
+  strbuf_printf(&json, "{\"vector_layers\":["
+    "{\"id\":\"highways\",\"fields\":{\"highway\":\"String\",\"name\":\"String\",\"permit\":\"Number\","
+    "\"foot\":\"Boolean\",\"bike\":\"Boolean\",\"car\":\"Boolean\"},\"minzoom\":%d,\"maxzoom\":%d}",
+    minzoom, maxzoom);
+  if( maxzoom>=TILES_GRAPH_ZOOM ){
+    strbuf_printf(&json, ",{\"id\":\"graph\",\"fields\":{\"permit\":\"Number\",\"dist\":\"Number\","
+      "\"way_id\":\"Number\"},\"minzoom\":%d,\"maxzoom\":%d}",
+      minzoom>TILES_GRAPH_ZOOM ? minzoom : TILES_GRAPH_ZOOM, maxzoom);
+  }
+  if( tiles.num_addr>0 ){
+    strbuf_printf(&json, ",{\"id\":\"addresses\",\"fields\":{\"housenumber\":\"String\",\"street\":\"String\","
+      "\"postcode\":\"String\",\"city\":\"String\"},\"minzoom\":%d,\"maxzoom\":%d}",
+      minzoom>TILES_ADDR_ZOOM ? minzoom : TILES_ADDR_ZOOM, maxzoom);
+  }
+  strbuf_printf(&json, "]}");
+  tiles_metadata("json", json.s);
+  strbuf_free(&json);
+  rc = sqlite3_exec(tiles.out,
+    " COMMIT;"
+    " CREATE UNIQUE INDEX tile_index ON tiles (zoom_level, tile_column, tile_row);",
+    NULL, NULL, NULL);
+  if( rc!=SQLITE_OK ) abort_db_error(tiles.out, rc);
+  rc = sqlite3_close(tiles.out);
+  if( rc!=SQLITE_OK ) abort_db_error(tiles.out, rc);
+  t1 = time_now();
+  fprintf(stderr, "tiles: %" PRId64 " of %" PRId64 " tiles (zoom %d-%d) with %.1f MB in %.3f s with %d threads\n",
+          tiles.tiles_written, tiles.num_tiles, minzoom, maxzoom, tiles.bytes_written / 1e6, t1-t0, threads);
+  /* Cleanup */
+  for(size_t k=0; k<tiles.num_addr; k++){
+    free(tiles.addr[k].housenumber);
+    free(tiles.addr[k].street);
+    free(tiles.addr[k].postcode);
+    free(tiles.addr[k].city);
+  }
+  free(tiles.addr);
+  free(thread);
+  pthread_mutex_destroy(&tiles.lock);
+  pthread_mutex_destroy(&tiles.write_lock);
+}
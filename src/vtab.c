@@ -0,0 +1,659 @@
+/**
+ * \file vtab.c
+ * \brief Table-valued SQL functions for way geometries and spatial queries
+ *
+ * The table-valued functions are eponymous virtual tables, their
+ * arguments are hidden columns. xBestIndex passes the arguments and,
+ * without other constraints and sorting by SQLite, LIMIT and OFFSET of
+ * the query to xFilter:
+ *
+ *   way_geometry(way_id)                  Nodes of a way with their locations
+ *   ways_in_bbox(lon1, lat1, lon2, lat2)  Ways in a boundingbox (rtree_way)
+ *   knn_nodes(lon, lat [, k])             k nearest tagged nodes (rtree_node)
+ *   route(permit, lon1, lat1, lon2, lat2) Shortest route (routing graph)
+ *
+ * The scalar function way_length(way_id) returns the length of a way.
+ */
+
+#define VTAB_KNN_RADIUS      100        /* First radius in meters */
+#define VTAB_KNN_MAX_RADIUS  20000000   /* Larger radius: all nodes of rtree_node */
+
+typedef struct {
+  sqlite3_vtab base;
+  sqlite3 *db;
+  void *aux;           /* Data of the module */
+} Vtab;
+
+typedef struct {
+  int64_t node_id;
+  double lon, lat;
+  double d;            /* Distance in meters */
+} VtabNode;
+
+typedef struct {
+  sqlite3_vtab_cursor base;
+  sqlite3_stmt *stmt;  /* way_geometry, ways_in_bbox: rows of the inner query */
+  int eof;
+  int64_t row;
+  double arg[4];       /* Values of the hidden columns */
+  int num_args;
+  VtabNode *node;      /* knn_nodes: result sorted by distance */
+  int num_nodes, pos;
+} VtabCursor;
+
+static int vtab_connect(sqlite3 *db, void *aux, const char *schema, sqlite3_vtab **pp_vtab) {
+  Vtab *v;
+  int result = sqlite3_declare_vtab(db, schema);
+  if( result!=SQLITE_OK ) return result;
+  v = sqlite3_malloc(sizeof(Vtab));
+  if( !v ) return SQLITE_NOMEM;
+  memset(v, 0, sizeof(Vtab));
+  v->db = db;
+  v->aux = aux;
+  *pp_vtab = &v->base;
+  return SQLITE_OK;
+}
+
+static int vtab_disconnect(sqlite3_vtab *vtab) {
+  sqlite3_free(vtab);
+  return SQLITE_OK;
+}
+
+static int vtab_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **pp_cursor) {
+  VtabCursor *c = sqlite3_malloc(sizeof(VtabCursor));
+  if( !c ) return SQLITE_NOMEM;
+  memset(c, 0, sizeof(VtabCursor));
+  c->eof = 1;
+  *pp_cursor = &c->base;
+  return SQLITE_OK;
+}
+
+static int vtab_close(sqlite3_vtab_cursor *cursor) {
+  VtabCursor *c = (VtabCursor *)cursor;
+  sqlite3_finalize(c->stmt);
+  sqlite3_free(c->node);
+  sqlite3_free(c);
+  return SQLITE_OK;
+}
+
+static int vtab_eof(sqlite3_vtab_cursor *cursor) {
+  return ((VtabCursor *)cursor)->eof;
+}
+
+static int vtab_rowid(sqlite3_vtab_cursor *cursor, sqlite_int64 *rowid) {
+  *rowid = ((VtabCursor *)cursor)->row;
+  return SQLITE_OK;
+}
+
+/*
+** Steps the inner query of way_geometry and ways_in_bbox
+*/
+static int vtab_stmt_next(sqlite3_vtab_cursor *cursor) {
+  VtabCursor *c = (VtabCursor *)cursor;
+  int result = sqlite3_step(c->stmt);
+  c->row++;
+  if( result==SQLITE_ROW ) return SQLITE_OK;
+  c->eof = 1;
+  if( result==SQLITE_DONE ) return SQLITE_OK;
+  cursor->pVtab->zErrMsg = sqlite3_mprintf("%s", sqlite3_errmsg(((Vtab *)cursor->pVtab)->db));
+  return result;
+}
+
+/*
+** Prepares the inner query and binds the arguments,
+** a parameter after the arguments is the number of rows
+*/
+static int vtab_stmt_start(VtabCursor *c, const char *sql, const char *name, int argc, sqlite3_value **argv,
+                           const int64_t rows) {
+  Vtab *v = (Vtab *)c->base.pVtab;
+  int i, result;
+  sqlite3_finalize(c->stmt);
+  c->stmt = NULL;
+  c->eof = 0;
+  c->row = 0;
+  result = sqlite3_prepare_v2(v->db, sql, -1, &c->stmt, NULL);
+  if( result!=SQLITE_OK ){
+    v->base.zErrMsg = sqlite3_mprintf("%s: %s", name, sqlite3_errmsg(v->db));
+    return result;
+  }
+  for(i=0; i<argc; i++) sqlite3_bind_value(c->stmt, i+1, argv[i]);
+  if( sqlite3_bind_parameter_count(c->stmt)>argc ) sqlite3_bind_int64(c->stmt, argc+1, rows);
+  return vtab_stmt_next(&c->base);
+}
+
+/*
+** Uses the equality constraints on the hidden columns first .. first+n-1
+** as arguments 1 .. n, returns the number of arguments found or -1 if
+** an argument is not usable
+*/
+static int vtab_index_args(sqlite3_index_info *info, const int first, const int n) {
+  int i, found = 0, mask = 0;
+  for(i=0; i<info->nConstraint; i++){
+    const struct sqlite3_index_constraint *p = &info->aConstraint[i];
+    if( p->iColumn<first || p->iColumn>=first+n || p->op!=SQLITE_INDEX_CONSTRAINT_EQ ) continue;
+    if( !p->usable ) return -1;
+    if( mask & (1 << (p->iColumn - first)) ) continue;    /* Checked by SQLite */
+    mask |= 1 << (p->iColumn - first);
+    info->aConstraintUsage[i].argvIndex = p->iColumn - first + 1;
+    info->aConstraintUsage[i].omit = 1;
+    found++;
+  }
+  return found;
+}
+
+/*
+** LIMIT and OFFSET of the query as arguments argv_index and argv_index+1
+** (only passed by SQLite 3.38 and later), returns the number of arguments.
+** Not used if SQLite sorts the rows afterwards (order_by_consumed 0),
+** the cursor would cut the rows before sorting. SQLite applies LIMIT and
+** OFFSET to the rows of the cursor again, the cursor returns the first
+** LIMIT+OFFSET rows.
+*/
+static int vtab_index_limit(sqlite3_index_info *info, const int argv_index, const int order_by_consumed) {
+#ifdef SQLITE_INDEX_CONSTRAINT_LIMIT
+  int i, limit = -1, offset = -1;
+  if( info->nOrderBy>0 && !order_by_consumed ) return 0;
+  for(i=0; i<info->nConstraint; i++){
+    if( !info->aConstraint[i].usable ) continue;
+    if( info->aConstraint[i].op==SQLITE_INDEX_CONSTRAINT_LIMIT ) limit = i;
+    if( info->aConstraint[i].op==SQLITE_INDEX_CONSTRAINT_OFFSET ) offset = i;
+  }
+  if( limit<0 ) return 0;
+  info->aConstraintUsage[limit].argvIndex = argv_index;
+  if( offset<0 ) return 1;
+  info->aConstraintUsage[offset].argvIndex = argv_index + 1;
+  return 2;
+#else
+  return 0;
+#endif
+}
+
+/*
+** Number of rows for LIMIT and OFFSET (arguments i and i+1 if n is 2),
+** INT64_MAX without limit
+*/
+static int64_t vtab_limit_rows(sqlite3_value **argv, const int i, const int n) {
+  int64_t limit, offset = 0;
+  if( n<1 ) return INT64_MAX;
+  limit = sqlite3_value_int64(argv[i]);
+  if( limit<0 ) return INT64_MAX;
+  if( n>1 && sqlite3_value_int64(argv[i+1])>0 ) offset = sqlite3_value_int64(argv[i+1]);
+  return offset>INT64_MAX - limit ? INT64_MAX : limit + offset;
+}
+
+/*
+** 1 if the query is ordered by the column ascending only
+*/
+static int vtab_order_by(const sqlite3_index_info *info, const int column) {
+  return info->nOrderBy==1 && info->aOrderBy[0].iColumn==column && !info->aOrderBy[0].desc;
+}
+
+static int vtab_hidden_column(sqlite3_context *ctx, const VtabCursor *c, const int i) {
+  if( i<c->num_args ) sqlite3_result_double(ctx, c->arg[i]);
+  return SQLITE_OK;
+}
+
+/*
+** way_geometry(way_id): node_order, node_id, lon, lat
+*/
+static int way_geometry_connect(sqlite3 *db, void *aux, int argc, const char *const *argv,
+                                sqlite3_vtab **pp_vtab, char **err) {
+  return vtab_connect(db, aux, "CREATE TABLE x(node_order INTEGER, node_id INTEGER, lon REAL, lat REAL,"
+                          " way_id HIDDEN)", pp_vtab);
+}
+
+static int way_geometry_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+  if( vtab_index_args(info, 4, 1)!=1 ) return SQLITE_CONSTRAINT;
+  info->orderByConsumed = vtab_order_by(info, 0);
+  info->estimatedCost = 10;
+  info->estimatedRows = 10;
+  return SQLITE_OK;
+}
+
+static int way_geometry_filter(sqlite3_vtab_cursor *cursor, int idx_num, const char *idx_str,
+                               int argc, sqlite3_value **argv) {
+  VtabCursor *c = (VtabCursor *)cursor;
+  c->num_args = 0;
+  return vtab_stmt_start(c,
+    " SELECT wn.node_order,wn.node_id,n.lon,n.lat,wn.way_id"
+    " FROM way_nodes AS wn"
+    " LEFT JOIN nodes AS n ON n.node_id=wn.node_id"
+    " WHERE wn.way_id=?1"
+    " ORDER BY wn.node_order",
+    "way_geometry", argc, argv, 0);
+}
+
+static int way_geometry_column(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int i) {
+  sqlite3_result_value(ctx, sqlite3_column_value(((VtabCursor *)cursor)->stmt, i));
+  return SQLITE_OK;
+}
+
+/*
+** ways_in_bbox(lon1, lat1, lon2, lat2): way_id, min_lon, min_lat, max_lon, max_lat
+** idx_num: number of arguments for LIMIT and OFFSET
+*/
+static int ways_in_bbox_connect(sqlite3 *db, void *aux, int argc, const char *const *argv,
+                                sqlite3_vtab **pp_vtab, char **err) {
+  return vtab_connect(db, aux, "CREATE TABLE x(way_id INTEGER, min_lon REAL, min_lat REAL, max_lon REAL, max_lat REAL,"
+                          " lon1 HIDDEN, lat1 HIDDEN, lon2 HIDDEN, lat2 HIDDEN)", pp_vtab);
+}
+
+static int ways_in_bbox_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+  if( vtab_index_args(info, 5, 4)!=4 ) return SQLITE_CONSTRAINT;
+  info->idxNum = vtab_index_limit(info, 5, 0);
+  info->estimatedCost = 1000;
+  info->estimatedRows = 1000;
+  return SQLITE_OK;
+}
+
+static int ways_in_bbox_filter(sqlite3_vtab_cursor *cursor, int idx_num, const char *idx_str,
+                               int argc, sqlite3_value **argv) {
+  VtabCursor *c = (VtabCursor *)cursor;
+  int i;
+  for(i=0; i<4; i++) c->arg[i] = sqlite3_value_double(argv[i]);
+  c->num_args = 4;
+  /* The corners in any order */
+  return vtab_stmt_start(c,
+    " SELECT way_id,min_lon,min_lat,max_lon,max_lat FROM rtree_way"
+    " WHERE max_lon>=min(?1,?3) AND min_lon<=max(?1,?3) AND max_lat>=min(?2,?4) AND min_lat<=max(?2,?4)"
+    " LIMIT ?5",
+    "ways_in_bbox", 4, argv, vtab_limit_rows(argv, 4, idx_num));
+}
+
+static int ways_in_bbox_column(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int i) {
+  VtabCursor *c = (VtabCursor *)cursor;
+  if( i>=5 ) return vtab_hidden_column(ctx, c, i-5);
+  sqlite3_result_value(ctx, sqlite3_column_value(c->stmt, i));
+  return SQLITE_OK;
+}
+
+/*
+** knn_nodes(lon, lat, k): node_id, lon, lat, distance
+** idx_num bit 0: k, bits 1-2: number of arguments for LIMIT and OFFSET
+** (the smaller number of rows is used), without k and LIMIT all nodes
+*/
+static int knn_nodes_connect(sqlite3 *db, void *aux, int argc, const char *const *argv,
+                             sqlite3_vtab **pp_vtab, char **err) {
+  return vtab_connect(db, aux, "CREATE TABLE x(node_id INTEGER, lon REAL, lat REAL, distance REAL,"
+                          " ref_lon HIDDEN, ref_lat HIDDEN, k HIDDEN)", pp_vtab);
+}
+
+static int knn_nodes_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+  int i, num_args = vtab_index_args(info, 4, 3);
+  info->idxNum = 0;
+  for(i=0; i<info->nConstraint; i++){
+    if( info->aConstraintUsage[i].argvIndex==3 ) info->idxNum |= 1;
+  }
+  if( num_args!=2 + (info->idxNum & 1) ) return SQLITE_CONSTRAINT;    /* lon and lat required */
+  info->orderByConsumed = vtab_order_by(info, 3);
+  info->idxNum |= vtab_index_limit(info, num_args + 1, info->orderByConsumed) << 1;
+  info->estimatedCost = info->idxNum ? 100 : 1000000;
+  info->estimatedRows = info->idxNum ? 10 : 1000000;
+  return SQLITE_OK;
+}
+
+static int knn_nodes_cmp(const void *a, const void *b) {
+  const VtabNode *na = a, *nb = b;
+  if( na->d!=nb->d ) return na->d<nb->d ? -1 : 1;
+  return na->node_id<nb->node_id ? -1 : na->node_id>nb->node_id;
+}
+
+/*
+** Nodes of rtree_node in a square around the point, with the radius
+** doubled until the k-th node is within the radius
+*/
+static int knn_nodes_filter(sqlite3_vtab_cursor *cursor, int idx_num, const char *idx_str,
+                            int argc, sqlite3_value **argv) {
+  VtabCursor *c = (VtabCursor *)cursor;
+  Vtab *v = (Vtab *)cursor->pVtab;
+  sqlite3_stmt *stmt;
+  double lon, lat, radius, dlat, dlon;
+  int64_t k = INT64_MAX;
+  int cap = 0, result;
+  c->arg[0] = lon = sqlite3_value_double(argv[0]);
+  c->arg[1] = lat = sqlite3_value_double(argv[1]);
+  c->num_args = 2;
+  if( idx_num & 1 ){
+    k = sqlite3_value_int64(argv[2]);
+    c->arg[2] = (double)k;
+    c->num_args = 3;
+  }
+  if( vtab_limit_rows(argv, c->num_args, idx_num >> 1)<k ) k = vtab_limit_rows(argv, c->num_args, idx_num >> 1);
+  c->num_nodes = c->pos = 0;
+  c->eof = 1;
+  c->row = 0;
+  if( k<=0 ) return SQLITE_OK;
+  result = sqlite3_prepare_v2(v->db,
+    " SELECT r.node_id,n.lon,n.lat FROM rtree_node AS r"
+    " JOIN nodes AS n ON n.node_id=r.node_id"
+    " WHERE r.max_lon>=?1 AND r.min_lon<=?2 AND r.max_lat>=?3 AND r.min_lat<=?4",
+    -1, &stmt, NULL);
+  if( result!=SQLITE_OK ){
+    v->base.zErrMsg = sqlite3_mprintf("knn_nodes: R*Tree indexes missing (option rtree)");
+    return result;
+  }
+  for(radius=k<INT64_MAX ? VTAB_KNN_RADIUS : VTAB_KNN_MAX_RADIUS; ; radius*=2){
+    /* Degrees of longitude at the latitude nearest to the pole */
+    dlat = radius / 111320.0;
+    dlon = radius / (111320.0 * cos(radians(fmin(fabs(lat) + dlat, 89.9))));
+    if( radius>=VTAB_KNN_MAX_RADIUS ) dlat = dlon = 360;
+    sqlite3_bind_double(stmt, 1, lon - dlon);
+    sqlite3_bind_double(stmt, 2, lon + dlon);
+    sqlite3_bind_double(stmt, 3, lat - dlat);
+    sqlite3_bind_double(stmt, 4, lat + dlat);
+    c->num_nodes = 0;
+    while( (result = sqlite3_step(stmt))==SQLITE_ROW ){
+      if( c->num_nodes==cap ){
+        VtabNode *node;
+        cap = cap ? 2 * cap : 64;
+        node = sqlite3_realloc64(c->node, cap * sizeof(VtabNode));
+        if( !node ){
+          sqlite3_finalize(stmt);
+          return SQLITE_NOMEM;
+        }
+        c->node = node;
+      }
+      c->node[c->num_nodes].node_id = sqlite3_column_int64(stmt, 0);
+      c->node[c->num_nodes].lon = sqlite3_column_double(stmt, 1);
+      c->node[c->num_nodes].lat = sqlite3_column_double(stmt, 2);
+      c->node[c->num_nodes].d = distance(lon, lat, c->node[c->num_nodes].lon, c->node[c->num_nodes].lat);
+      c->num_nodes++;
+    }
+    sqlite3_reset(stmt);
+    if( result!=SQLITE_DONE ){
+      v->base.zErrMsg = sqlite3_mprintf("knn_nodes: %s", sqlite3_errmsg(v->db));
+      sqlite3_finalize(stmt);
+      return result;
+    }
+    if( c->num_nodes>0 ) qsort(c->node, c->num_nodes, sizeof(VtabNode), knn_nodes_cmp);
+    /* Nodes beyond the radius may be missing */
+    if( radius>=VTAB_KNN_MAX_RADIUS || (c->num_nodes>=k && c->node[k-1].d<=radius) ) break;
+  }
+  sqlite3_finalize(stmt);
+  if( c->num_nodes>k ) c->num_nodes = (int)k;
+  c->eof = c->num_nodes==0;
+  return SQLITE_OK;
+}
+
+static int knn_nodes_next(sqlite3_vtab_cursor *cursor) {
+  VtabCursor *c = (VtabCursor *)cursor;
+  c->row++;
+  if( ++c->pos>=c->num_nodes ) c->eof = 1;
+  return SQLITE_OK;
+}
+
+static int knn_nodes_column(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int i) {
+  VtabCursor *c = (VtabCursor *)cursor;
+  const VtabNode *n = &c->node[c->pos];
+  switch( i ){
+    case 0: sqlite3_result_int64(ctx, n->node_id); break;
+    case 1: sqlite3_result_double(ctx, n->lon); break;
+    case 2: sqlite3_result_double(ctx, n->lat); break;
+    case 3: sqlite3_result_double(ctx, n->d); break;
+    case 6: if( c->num_args==3 ) sqlite3_result_int64(ctx, (int64_t)c->arg[2]); break;
+    default: return vtab_hidden_column(ctx, c, i-4);
+  }
+  return SQLITE_OK;
+}
+
+/*
+** way_length(way_id): length of the way in meters,
+** NULL if the way or a node is missing
+*/
+static void way_length_func(sqlite3_context *context, int argc, sqlite3_value **argv) {
+  sqlite3 *db = sqlite3_context_db_handle(context);
+  sqlite3_stmt *stmt;
+  double lon, lat, last_lon = 0, last_lat = 0, length = 0;
+  int n = 0, missing = 0, result;
+  result = sqlite3_prepare_v2(db,
+    " SELECT n.lon,n.lat FROM way_nodes AS wn"
+    " LEFT JOIN nodes AS n ON n.node_id=wn.node_id"
+    " WHERE wn.way_id=?1"
+    " ORDER BY wn.node_order",
+    -1, &stmt, NULL);
+  if( result!=SQLITE_OK ){
+    sqlite3_result_error(context, sqlite3_errmsg(db), -1);
+    return;
+  }
+  sqlite3_bind_value(stmt, 1, argv[0]);
+  while( (result = sqlite3_step(stmt))==SQLITE_ROW ){
+    if( sqlite3_column_type(stmt, 0)==SQLITE_NULL ) missing = 1;
+    lon = sqlite3_column_double(stmt, 0);
+    lat = sqlite3_column_double(stmt, 1);
+    if( n++>0 ) length += distance(last_lon, last_lat, lon, lat);
+    last_lon = lon;
+    last_lat = lat;
+  }
+  if( result!=SQLITE_DONE ) sqlite3_result_error(context, sqlite3_errmsg(db), -1);
+  else if( n==0 || missing ) sqlite3_result_null(context);
+  else sqlite3_result_double(context, length);
+  sqlite3_finalize(stmt);
+}
+
+/*
+** route(permit, lon1, lat1, lon2, lat2): distance, edges, polyline
+**
+** The routing graph (graph image if available, otherwise the tables)
+** and the landmarks are loaded by the first query and kept until the
+** connection is closed. The graph is loaded again if max(edge_id) of
+** table graph_edges changes. The route is calculated in xFilter, the
+** polyline only if the column is used (idx_num 1).
+*/
+typedef struct {
+  int loaded;
+  RoutingGraph graph;
+  Landmarks lm;
+  DijkstraWorkspace ws;
+  Path path;
+  NodeList ends, points;
+} RouteVtabCache;
+
+typedef struct {
+  sqlite3_vtab_cursor base;
+  int eof;
+  char *permit;        /* Values of the hidden columns */
+  double arg[4];
+  int distance;        /* -1: no route */
+  StrBuf edges;        /* JSON array of the edge IDs */
+  StrBuf polyline;
+} RouteCursor;
+
+static void route_vtab_unload(RouteVtabCache *cache) {
+  if( !cache->loaded ) return;
+  dijkstra_workspace_free(&cache->ws);
+  landmarks_free(&cache->lm);
+  routing_graph_free(&cache->graph);
+  cache->loaded = 0;
+}
+
+static void route_vtab_cache_free(void *p) {
+  RouteVtabCache *cache = p;
+  route_vtab_unload(cache);
+  path_free(&cache->path);
+  nodelist_free(&cache->ends);
+  nodelist_free(&cache->points);
+  free(cache);
+}
+
+static int route_vtab_connect(sqlite3 *db, void *aux, int argc, const char *const *argv,
+                              sqlite3_vtab **pp_vtab, char **err) {
+  return vtab_connect(db, aux, "CREATE TABLE x(distance INTEGER, edges TEXT, polyline TEXT,"
+                               " permit HIDDEN, lon1 HIDDEN, lat1 HIDDEN, lon2 HIDDEN, lat2 HIDDEN)", pp_vtab);
+}
+
+static int route_vtab_best_index(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+  if( vtab_index_args(info, 3, 5)!=5 ) return SQLITE_CONSTRAINT;
+  info->idxNum = (info->colUsed & 4)!=0;
+  info->estimatedCost = 100000;
+  info->estimatedRows = 1;
+  info->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+  return SQLITE_OK;
+}
+
+static int route_vtab_open(sqlite3_vtab *vtab, sqlite3_vtab_cursor **pp_cursor) {
+  RouteCursor *c = sqlite3_malloc(sizeof(RouteCursor));
+  if( !c ) return SQLITE_NOMEM;
+  memset(c, 0, sizeof(RouteCursor));
+  c->eof = 1;
+  strbuf_init(&c->edges);
+  strbuf_init(&c->polyline);
+  *pp_cursor = &c->base;
+  return SQLITE_OK;
+}
+
+static int route_vtab_close(sqlite3_vtab_cursor *cursor) {
+  RouteCursor *c = (RouteCursor *)cursor;
+  sqlite3_free(c->permit);
+  strbuf_free(&c->edges);
+  strbuf_free(&c->polyline);
+  sqlite3_free(c);
+  return SQLITE_OK;
+}
+
+/*
+** Edge IDs of the path in the direction of travel, negative if the edge
+** is traversed from its end to its start (the first and the last edge
+** are travelled only partially)
+*/
+static void route_vtab_edges(const RoutingGraph *graph, const Path *path, StrBuf *sb) {
+  size_t i;
+  const char *sep = "";
+  strbuf_printf(sb, "[");
+  if( path->snapped ){
+    strbuf_printf(sb, "%" PRId64, (path->from_backward ? -1 : 1) * graph->edge[path->from.edge].edge_id);
+    sep = ",";
+  }
+  for(i=0; i<path->size; i++){
+    strbuf_printf(sb, "%s%" PRId64, sep, (path->step[i].backward ? -1 : 1) * graph->edge[path->step[i].edge].edge_id);
+    sep = ",";
+  }
+  if( path->snapped && !path->direct ){
+    strbuf_printf(sb, "%s%" PRId64, sep, (path->to_backward ? -1 : 1) * graph->edge[path->to.edge].edge_id);
+  }
+  strbuf_printf(sb, "]");
+}
+
+static int route_vtab_filter(sqlite3_vtab_cursor *cursor, int idx_num, const char *idx_str,
+                             int argc, sqlite3_value **argv) {
+  RouteCursor *c = (RouteCursor *)cursor;
+  Vtab *v = (Vtab *)cursor->pVtab;
+  RouteVtabCache *cache = v->aux;
+  SnapPoint snap[2];
+  int i, mask_permit;
+  sqlite3_free(c->permit);
+  c->permit = sqlite3_mprintf("%s", sqlite3_value_text(argv[0]));
+  if( !c->permit ) return SQLITE_NOMEM;
+  for(i=0; i<4; i++) c->arg[i] = sqlite3_value_double(argv[i+1]);
+  c->distance = -1;
+  strbuf_clear(&c->edges);
+  strbuf_clear(&c->polyline);
+  c->eof = 0;
+  mask_permit = permit_mask(c->permit);
+  if( mask_permit<=0 ){
+    v->base.zErrMsg = sqlite3_mprintf("route: permit 'foot', 'bike' or 'car' expected");
+    return SQLITE_ERROR;
+  }
+  if( !table_exists(v->db, "graph_edges") ){
+    v->base.zErrMsg = sqlite3_mprintf("route: graph tables missing (option graph)");
+    return SQLITE_ERROR;
+  }
+  /* Graph of the connection, loaded again if the tables have changed */
+  if( cache->loaded && cache->graph.header->max_edge_id!=graph_max_edge_id(v->db) ) route_vtab_unload(cache);
+  if( !cache->loaded ){
+    routing_graph_load(v->db, NULL, 0, &cache->graph);
+    landmarks_load(v->db, &cache->graph, &cache->lm);
+    dijkstra_workspace_init(&cache->ws, &cache->graph);
+    cache->loaded = 1;
+  }
+  landmarks_attach(&cache->ws, &cache->lm, mask_permit);
+  nodelist_clear(&cache->ends);
+  nodelist_add(&cache->ends, c->arg[0], c->arg[1], -1);
+  nodelist_add(&cache->ends, c->arg[2], c->arg[3], -1);
+  if( !snap_points(&cache->graph, mask_permit, &cache->ends, snap) ) return SQLITE_OK;
+  c->distance = snap_route(&cache->ws, &cache->graph, mask_permit, &snap[0], &snap[1], &cache->path);
+  if( c->distance==-1 ) return SQLITE_OK;
+  route_vtab_edges(&cache->graph, &cache->path, &c->edges);
+  if( idx_num & 1 ){
+    nodelist_clear(&cache->points);
+    path_points(&cache->graph, &cache->path, &cache->points);
+    nodelist_polyline(&cache->points, &c->polyline);
+  }
+  return SQLITE_OK;
+}
+
+static int route_vtab_next(sqlite3_vtab_cursor *cursor) {
+  ((RouteCursor *)cursor)->eof = 1;    /* One row per route */
+  return SQLITE_OK;
+}
+
+static int route_vtab_eof(sqlite3_vtab_cursor *cursor) {
+  return ((RouteCursor *)cursor)->eof;
+}
+
+static int route_vtab_column(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx, int i) {
+  RouteCursor *c = (RouteCursor *)cursor;
+  switch( i ){
+    case 0:
+      if( c->distance!=-1 ) sqlite3_result_int(ctx, c->distance);
+      break;
+    case 1:
+      if( c->distance!=-1 ) sqlite3_result_text(ctx, c->edges.s, (int)c->edges.len, SQLITE_TRANSIENT);
+      break;
+    case 2:
+      if( c->distance!=-1 && c->polyline.len>0 ) sqlite3_result_text(ctx, c->polyline.s, (int)c->polyline.len, SQLITE_TRANSIENT);
+      break;
+    case 3:
+      sqlite3_result_text(ctx, c->permit, -1, SQLITE_TRANSIENT);
+      break;
+    default:
+      sqlite3_result_double(ctx, c->arg[i-4]);
+  }
+  return SQLITE_OK;
+}
+
+static int route_vtab_rowid(sqlite3_vtab_cursor *cursor, sqlite_int64 *rowid) {
+  *rowid = 1;
+  return SQLITE_OK;
+}
+
+static sqlite3_module way_geometry_module = {
+  0, NULL, way_geometry_connect, way_geometry_best_index, vtab_disconnect, NULL,
+  vtab_open, vtab_close, way_geometry_filter, vtab_stmt_next, vtab_eof,
+  way_geometry_column, vtab_rowid
+};
+
+static sqlite3_module ways_in_bbox_module = {
+  0, NULL, ways_in_bbox_connect, ways_in_bbox_best_index, vtab_disconnect, NULL,
+  vtab_open, vtab_close, ways_in_bbox_filter, vtab_stmt_next, vtab_eof,
+  ways_in_bbox_column, vtab_rowid
+};
+
+static sqlite3_module knn_nodes_module = {
+  0, NULL, knn_nodes_connect, knn_nodes_best_index, vtab_disconnect, NULL,
+  vtab_open, vtab_close, knn_nodes_filter, knn_nodes_next, vtab_eof,
+  knn_nodes_column, vtab_rowid
+};
+
+static sqlite3_module route_vtab_module = {
+  0, NULL, route_vtab_connect, route_vtab_best_index, vtab_disconnect, NULL,
+  route_vtab_open, route_vtab_close, route_vtab_filter, route_vtab_next, route_vtab_eof,
+  route_vtab_column, route_vtab_rowid
+};
+
+/**
+ * \brief Register the table-valued functions in SQLite
+ */
+void register_vtabs(sqlite3 *db) {
+  RouteVtabCache *cache;
+  sqlite3_create_module(db, "way_geometry", &way_geometry_module, NULL);
+  sqlite3_create_module(db, "ways_in_bbox", &ways_in_bbox_module, NULL);
+  sqlite3_create_module(db, "knn_nodes", &knn_nodes_module, NULL);
+  sqlite3_create_function(db, "way_length", 1, SQLITE_UTF8, NULL, way_length_func, NULL, NULL);
+  /* The routing graph is cached with the module and freed with the connection */
+  cache = calloc(1, sizeof(RouteVtabCache));
+  if( !cache ) abort_msg("Out of memory");
+  path_init(&cache->path);
+  nodelist_init(&cache->ends);
+  nodelist_init(&cache->points);
+  sqlite3_create_module_v2(db, "route", &route_vtab_module, cache, route_vtab_cache_free);
+}
@@ -17,7 +17,7 @@ echo "Test 1: Main options"
 echo "-----------------------------------------------------------------"
 
 echo "Test option 'read'..."
-rm -f $dir/osm_c.db
+rm -f $dir/osm_c.db $dir/osm_c.db.graph $dir/osm_c.db.landmarks
 $dir/pbf2sqlite $dir/osm_c.db read $osm_file
 
 echo "Test option 'index'..."
@@ -32,6 +32,19 @@ $dir/pbf2sqlite $dir/osm_c.db addr
 echo "Test option 'graph'..."
 $dir/pbf2sqlite $dir/osm_c.db graph
 
+echo "Test option 'graph image'..."
+$dir/pbf2sqlite $dir/osm_c.db graph image
+
+echo "Test option 'graph landmarks'..."
+$dir/pbf2sqlite $dir/osm_c.db graph landmarks 4
+
+echo "Test option 'areas'..."
+$dir/pbf2sqlite $dir/osm_c.db areas
+
+echo "Test option 'addr areas'..."
+rm -f $dir/osm_addr.db
+$dir/pbf2sqlite $dir/osm_addr.db read $osm_file index addr areas
+
 echo "read OSM file with Python version..."
 rm -f $dir/osm_py.db
 $dir/../test/pbf2sqlite.py $dir/osm_py.db read $osm_file graph
@@ -62,10 +75,25 @@ xdg-open $dir/vgraph.html
 echo "Test option 'sql'..."
 $dir/pbf2sqlite $dir/osm_c.db sql "SELECT * FROM nodes LIMIT 5"
 $dir/pbf2sqlite $dir/osm_c.db sql "SELECT radians(lat),sin(radians(lat)) FROM nodes LIMIT 5"
+$dir/pbf2sqlite $dir/osm_c.db sql "SELECT component_car,count(*) FROM graph_vertices GROUP BY component_car"
+$dir/pbf2sqlite $dir/osm_c.db sql "SELECT * FROM way_geometry(15805105)"
+$dir/pbf2sqlite $dir/osm_c.db sql "SELECT way_id,way_length(way_id) FROM ways_in_bbox(11.3309,50.9771,11.3326,50.9786) LIMIT 5"
+$dir/pbf2sqlite $dir/osm_c.db sql "SELECT * FROM knn_nodes(11.3317806,50.9777393,3)"
 
 echo "Test option 'sql' (read from stdin)..."
 echo "SELECT * FROM nodes LIMIT 5" | $dir/pbf2sqlite $dir/osm_c.db sql
 
+echo "Test option 'tiles'..."
+$dir/pbf2sqlite $dir/osm_c.db tiles 12 17 $dir/tiles.mbtiles 2
+$dir/pbf2sqlite $dir/tiles.mbtiles sql "SELECT zoom_level,count(*),sum(length(tile_data)) FROM tiles GROUP BY zoom_level"
+
+echo "Test option 'export'..."
+$dir/pbf2sqlite $dir/osm_c.db export geojson 11.3309 50.9771 11.3326 50.9786 highway $dir/export.geojson
+$dir/pbf2sqlite $dir/osm_c.db export fgb 11.3309 50.9771 11.3326 50.9786 $dir/export.fgb
+
+echo "Test option 'extract-pbf'..."
+$dir/pbf2sqlite $dir/osm_c.db extract-pbf 11.3309 50.9771 11.3326 50.9786 $dir/extract.osm.pbf 2
+
 
 echo "-----------------------------------------------------------------"
 echo "Test 3: Routing"
@@ -78,6 +106,38 @@ $dir/pbf2sqlite $dir/osm_c.db route foot \
   11.3310429 50.9785668 \
   $dir/route
 xdg-open $dir/route.html
+$dir/pbf2sqlite $dir/osm_c.db route foot 11.3317806 50.9777393 11.3310429 50.9785668 $dir/route_alt alternatives=2
+$dir/pbf2sqlite $dir/osm_c.db route foot 11.3317806 50.9777393 11.3310429 50.9785668 $dir/route_simple simplify=5
+cat $dir/route_simple.csv
+
+echo "Test SQL function 'route'..."
+$dir/pbf2sqlite $dir/osm_c.db sql "SELECT * FROM route('foot',11.3317806,50.9777393,11.3310429,50.9785668)"
+
+echo "Test option 'route-batch'..."
+printf "id,lon1,lat1,lon2,lat2\n1,11.3317806,50.9777393,11.3310429,50.9785668\n" > $dir/pairs.csv
+$dir/pbf2sqlite $dir/osm_c.db route-batch foot $dir/pairs.csv $dir/pairs_result.csv 2 polyline
+cat $dir/pairs_result.csv
+
+echo "Test option 'route-bench'..."
+$dir/pbf2sqlite $dir/osm_c.db route-bench foot $dir/pairs.csv
+
+echo "Test option 'matrix'..."
+printf "id,lon,lat\nA,11.3317806,50.9777393\nB,11.3314828,50.9778879\n" > $dir/sources.csv
+printf "id,lon,lat\nX,11.3310429,50.9785668\nY,11.3317806,50.9777393\n" > $dir/targets.csv
+$dir/pbf2sqlite $dir/osm_c.db matrix foot $dir/sources.csv $dir/targets.csv $dir/matrix.csv 2
+cat $dir/matrix.csv
+
+echo "Test option 'isochrone'..."
+$dir/pbf2sqlite $dir/osm_c.db isochrone foot 11.3317806 50.9777393 150 $dir/isochrone
+xdg-open $dir/isochrone.html
+
+echo "Test option 'nearest'..."
+$dir/pbf2sqlite $dir/osm_c.db nearest foot 11.3317806 50.9777393 amenity=bench 3
+
+echo "Test option 'serve'..."
+echo '{"id":1,"permit":"foot","points":[[11.3317806,50.9777393],[11.3310429,50.9785668]]}' | \
+  $dir/pbf2sqlite $dir/osm_c.db serve 2
+$dir/pbf2sqlite $dir/osm_c.db sql "SELECT mask_permit,from_edge,to_edge,distance FROM route_cache"
 
 # Both coordinates outside the range of weimar.osm -> display error message
 #$dir/pbf2sqlite $dir/osm_c.db route foot 11.574 48.137 11.578 48.137 $dir/route2